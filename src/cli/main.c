@@ -42,6 +42,7 @@
 #include "control/conf.h"
 #include "develop/imageop.h"
 
+#include <glib/gstdio.h>
 #include <inttypes.h>
 #include <libintl.h>
 #include <sys/time.h>
@@ -63,6 +64,8 @@
 static void usage(const char *progname)
 {
   fprintf(stderr, "usage: %s [<input file or dir>] [<xmp file>] <output destination> [options] [--core <darktable options>]\n", progname);
+  fprintf(stderr, "       %s --batch <job file or -> [--threads <N>] [options] [--core <darktable options>]\n", progname);
+  fprintf(stderr, "       %s --autotune [--core <darktable options>]\n", progname);
   fprintf(stderr, "\n");
   fprintf(stderr, "options:\n");
   fprintf(stderr, "   --width <max width> default: 0 = full resolution\n");
@@ -81,6 +84,16 @@ static void usage(const char *progname)
   fprintf(stderr, "   --icc-file <file> specify icc filename, default to NONE\n");
   fprintf(stderr, "   --icc-intent <intent> specify icc intent, default to LAST\n");
   fprintf(stderr, "                     use --help icc-intent for list of supported intents\n");
+  fprintf(stderr, "   --batch <file> read export jobs from file, or stdin if '-', one JSON object per line:\n");
+  fprintf(stderr, "                  {\"input\": <file>, \"xmp\": <file>, \"output\": <file or dir>,\n");
+  fprintf(stderr, "                   \"width\": <max width>, \"height\": <max height>, \"format\": <extension>}\n");
+  fprintf(stderr, "                  only input and output are mandatory, other options apply to all jobs.\n");
+  fprintf(stderr, "                  the result of each job is printed on stdout as a JSON line.\n");
+  fprintf(stderr, "   --threads <N>  number of images exported in parallel in batch mode,\n");
+  fprintf(stderr, "                  default: number of CPU cores / 4\n");
+  fprintf(stderr, "                  jobs on the same input file run one after the other\n");
+  fprintf(stderr, "   --autotune     benchmark the CPU kernels of the modules on this machine and\n");
+  fprintf(stderr, "                  store their fastest settings in anselrc\n");
   fprintf(stderr, "   --verbose\n");
   fprintf(stderr, "   --help,-h [option]\n");
   fprintf(stderr, "   --version\n");
@@ -173,6 +186,448 @@ static dt_iop_color_intent_t get_icc_intent(const char* option)
 }
 #undef ICC_INTENT_FROM_STR
 
+// largest output size allowed by the command line, the storage and the format
+static void _set_max_size(dt_imageio_module_storage_t *storage, dt_imageio_module_data_t *sdata,
+                          dt_imageio_module_format_t *format, dt_imageio_module_data_t *fdata, const int width,
+                          const int height)
+{
+  uint32_t w, h, fw, fh, sw, sh;
+  fw = fh = sw = sh = 0;
+  storage->dimension(storage, sdata, &sw, &sh);
+  format->dimension(format, fdata, &fw, &fh);
+
+  if(sw == 0 || fw == 0)
+    w = sw > fw ? sw : fw;
+  else
+    w = sw < fw ? sw : fw;
+
+  if(sh == 0 || fh == 0)
+    h = sh > fh ? sh : fh;
+  else
+    h = sh < fh ? sh : fh;
+
+  fdata->max_width = width;
+  fdata->max_height = height;
+  fdata->max_width = (w != 0 && fdata->max_width > w) ? w : fdata->max_width;
+  fdata->max_height = (h != 0 && fdata->max_height > h) ? h : fdata->max_height;
+}
+
+/*
+ * Batch mode: export jobs are read from a file, one JSON object per line, and processed by worker
+ * threads inside one process. Modules, color profiles, OpenCL kernels and caches are initialized
+ * once and shared by all jobs.
+ */
+
+typedef struct _batch_t
+{
+  FILE *jobs;
+
+  // reading jobs and importing images are serialized, exports run in parallel
+  dt_pthread_mutex_t read_lock;
+  // one JSON line at a time on stdout
+  dt_pthread_mutex_t print_lock;
+  GString *line;
+  int line_number;
+
+  // inputs of the jobs being run, under read_lock. An input is imported once and keeps its image id,
+  // so jobs on the same input, each with their own xmp, run one after the other.
+  GHashTable *busy_inputs;
+  pthread_cond_t busy_cond;
+
+  // OpenMP threads of each worker
+  int threads_per_worker;
+
+  // options of the command line, applying to all jobs
+  int width;
+  int height;
+  const char *style;
+  const char *output_ext;
+  gboolean export_masks;
+  dt_colorspaces_color_profile_type_t icc_type;
+  const gchar *icc_filename;
+  dt_iop_color_intent_t icc_intent;
+
+  // summary
+  int exported;
+  int failed;
+} _batch_t;
+
+typedef struct _batch_job_t
+{
+  int number;
+  gchar *input;
+  gchar *xmp;
+  gchar *output;
+  gchar *format;
+  int width;
+  int height;
+} _batch_job_t;
+
+static void _batch_job_clear(_batch_job_t *job)
+{
+  g_free(job->input);
+  g_free(job->xmp);
+  g_free(job->output);
+  g_free(job->format);
+  memset(job, 0, sizeof(_batch_job_t));
+}
+
+// read the next non-empty line, without its end of line. FALSE at the end of the file.
+static gboolean _batch_read_line(_batch_t *b)
+{
+  char chunk[1024];
+  do
+  {
+    g_string_truncate(b->line, 0);
+    while(fgets(chunk, sizeof(chunk), b->jobs))
+    {
+      g_string_append(b->line, chunk);
+      if(b->line->len && b->line->str[b->line->len - 1] == '\n') break;
+    }
+    if(b->line->len == 0) return FALSE;
+    b->line_number++;
+    g_strstrip(b->line->str);
+  } while(b->line->str[0] == '\0' || b->line->str[0] == '#');
+  return TRUE;
+}
+
+static const gchar *_json_string(JsonObject *object, const char *member)
+{
+  JsonNode *node = json_object_get_member(object, member);
+  return (node && JSON_NODE_HOLDS_VALUE(node) && json_node_get_value_type(node) == G_TYPE_STRING)
+             ? json_node_get_string(node)
+             : NULL;
+}
+
+static int _json_int(JsonObject *object, const char *member, const int fallback)
+{
+  JsonNode *node = json_object_get_member(object, member);
+  return (node && JSON_NODE_HOLDS_VALUE(node)) ? MAX((int)json_node_get_int(node), 0) : fallback;
+}
+
+static gboolean _batch_parse_job(_batch_t *b, _batch_job_t *job, gchar **error)
+{
+  JsonParser *parser = json_parser_new();
+  GError *err = NULL;
+  gboolean ok = json_parser_load_from_data(parser, b->line->str, -1, &err);
+  JsonNode *root = ok ? json_parser_get_root(parser) : NULL;
+
+  if(!ok)
+    *error = g_strdup_printf("invalid JSON: %s", err->message);
+  else if(!root || !JSON_NODE_HOLDS_OBJECT(root))
+  {
+    *error = g_strdup("a job has to be a JSON object");
+    ok = FALSE;
+  }
+  else
+  {
+    JsonObject *object = json_node_get_object(root);
+    job->input = g_strdup(_json_string(object, "input"));
+    job->xmp = g_strdup(_json_string(object, "xmp"));
+    job->output = g_strdup(_json_string(object, "output"));
+    job->format = g_strdup(_json_string(object, "format"));
+    job->width = _json_int(object, "width", b->width);
+    job->height = _json_int(object, "height", b->height);
+    if(!job->input || !job->output)
+    {
+      *error = g_strdup("`input' and `output' are mandatory");
+      ok = FALSE;
+    }
+  }
+
+  if(err) g_error_free(err);
+  g_object_unref(parser);
+  return ok;
+}
+
+// import the input of the job, and attach its xmp, or reset its history when it has none.
+// returns the image id, or 0
+static int32_t _batch_import(const _batch_job_t *job, gchar **error)
+{
+  if(!g_file_test(job->input, G_FILE_TEST_IS_REGULAR))
+  {
+    *error = g_strdup_printf("input file `%s' doesn't exist", job->input);
+    return 0;
+  }
+
+  dt_film_t film;
+  gchar *directory = g_path_get_dirname(job->input);
+  const int filmid = dt_film_new(&film, directory);
+  const int32_t imgid = dt_image_import(filmid, job->input, TRUE);
+  g_free(directory);
+  if(!imgid)
+  {
+    *error = g_strdup_printf("can't open file `%s'", job->input);
+    return 0;
+  }
+
+  if(job->xmp)
+  {
+    dt_image_t *image = dt_image_cache_get(darktable.image_cache, imgid, 'w');
+    const int res = dt_exif_xmp_read(image, job->xmp, 1);
+    // don't write new xmp:
+    dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+    if(res)
+    {
+      *error = g_strdup_printf("can't open xmp file `%s'", job->xmp);
+      return 0;
+    }
+  }
+  else
+  {
+    // an earlier job on the same input already imported it and attached its own xmp:
+    // go back to what a fresh import gives, the default history or the sidecar of the input.
+    dt_history_delete_on_image_ext(imgid, FALSE);
+    gchar *sidecar = g_strconcat(job->input, ".xmp", NULL);
+    if(g_file_test(sidecar, G_FILE_TEST_IS_REGULAR))
+    {
+      dt_image_t *image = dt_image_cache_get(darktable.image_cache, imgid, 'w');
+      (void)dt_exif_xmp_read(image, sidecar, 0);
+      dt_image_cache_write_release(darktable.image_cache, image, DT_IMAGE_CACHE_RELAXED);
+    }
+    g_free(sidecar);
+  }
+
+  return imgid;
+}
+
+// split the output destination of the job into a filename pattern for the disk storage and a format name
+static gboolean _batch_output(const _batch_t *b, const _batch_job_t *job, gchar **pattern, gchar **format_name,
+                              gchar **error)
+{
+  gchar *ext = g_strdup(job->format ? job->format : b->output_ext);
+  if(ext && ext[0] == '.') memmove(ext, ext + 1, strlen(ext));
+
+  if(g_file_test(job->output, G_FILE_TEST_IS_DIR) || g_str_has_suffix(job->output, G_DIR_SEPARATOR_S)
+     || g_str_has_suffix(job->output, "/"))
+  {
+    gchar *dir = g_strdup(job->output);
+    const size_t len = strlen(dir);
+    if(len > 1 && (dir[len - 1] == '/' || dir[len - 1] == G_DIR_SEPARATOR)) dir[len - 1] = '\0';
+    *pattern = g_strconcat(dir, G_DIR_SEPARATOR_S "$(FILE_NAME)", NULL);
+    g_free(dir);
+    if(!ext) ext = g_strdup("jpg");
+  }
+  else
+  {
+    *pattern = g_strdup(job->output);
+    char *dot = strrchr(*pattern, '.');
+    if(dot && strchr(dot, G_DIR_SEPARATOR)) dot = NULL;
+    if(ext)
+    {
+      // remove redundant file ext
+      if(dot && !strcmp(ext, dot + 1)) *dot = '\0';
+    }
+    else if(dot && strlen(dot) > 1 && strlen(dot) <= DT_MAX_OUTPUT_EXT_LENGTH)
+    {
+      ext = g_strdup(dot + 1);
+      *dot = '\0';
+    }
+    else
+    {
+      *error = g_strdup_printf("no valid file extension in output `%s'", job->output);
+      g_free(*pattern);
+      *pattern = NULL;
+      return FALSE;
+    }
+  }
+
+  if(!strcmp(ext, "jpg"))
+    *format_name = g_strdup("jpeg");
+  else if(!strcmp(ext, "tif"))
+    *format_name = g_strdup("tiff");
+  else
+    *format_name = g_strdup(ext);
+  g_free(ext);
+  return TRUE;
+}
+
+static gboolean _batch_export(const _batch_t *b, const _batch_job_t *job, const int32_t imgid, gchar **error)
+{
+  gchar *pattern = NULL, *format_name = NULL;
+  if(!_batch_output(b, job, &pattern, &format_name, error)) return FALSE;
+
+  gboolean ok = FALSE;
+  dt_imageio_module_storage_t *storage = dt_imageio_get_storage_by_name("disk");
+  dt_imageio_module_format_t *format = dt_imageio_get_format_by_name(format_name);
+  dt_imageio_module_data_t *sdata = storage ? storage->get_params(storage) : NULL;
+  dt_imageio_module_data_t *fdata = format ? format->get_params(format) : NULL;
+
+  if(!storage || !sdata)
+    *error = g_strdup("cannot use the disk storage module");
+  else if(!format)
+    *error = g_strdup_printf("unknown extension `.%s'", format_name);
+  else if(!fdata)
+    *error = g_strdup_printf("failed to get parameters from the %s format module", format_name);
+  else
+  {
+    // see main() about this one
+    g_strlcpy((char *)sdata, pattern, DT_MAX_PATH_FOR_PARAMS);
+
+    _set_max_size(storage, sdata, format, fdata, job->width, job->height);
+    fdata->style[0] = '\0';
+    if(b->style)
+    {
+      g_strlcpy((char *)fdata->style, b->style, DT_MAX_STYLE_NAME_LENGTH);
+      fdata->style[127] = '\0';
+    }
+
+    dt_export_metadata_t metadata;
+    metadata.flags = dt_lib_export_metadata_default_flags();
+    metadata.list = NULL;
+    ok = !storage->store(storage, sdata, imgid, format, fdata, 1, 1, TRUE, b->export_masks, b->icc_type,
+                         b->icc_filename, b->icc_intent, &metadata);
+    if(!ok) *error = g_strdup("export failed");
+  }
+
+  if(fdata) format->free_params(format, fdata);
+  if(sdata) storage->free_params(storage, sdata);
+  g_free(pattern);
+  g_free(format_name);
+  return ok;
+}
+
+static void _batch_print(_batch_t *b, const _batch_job_t *job, const gboolean ok, const gchar *error,
+                         const double seconds)
+{
+  JsonBuilder *builder = json_builder_new();
+  json_builder_begin_object(builder);
+  json_builder_set_member_name(builder, "job");
+  json_builder_add_int_value(builder, job->number);
+  if(job->input)
+  {
+    json_builder_set_member_name(builder, "input");
+    json_builder_add_string_value(builder, job->input);
+  }
+  if(job->output)
+  {
+    json_builder_set_member_name(builder, "output");
+    json_builder_add_string_value(builder, job->output);
+  }
+  json_builder_set_member_name(builder, "status");
+  json_builder_add_string_value(builder, ok ? "ok" : "error");
+  if(error)
+  {
+    json_builder_set_member_name(builder, "error");
+    json_builder_add_string_value(builder, error);
+  }
+  json_builder_set_member_name(builder, "seconds");
+  json_builder_add_double_value(builder, seconds);
+  json_builder_end_object(builder);
+
+  JsonGenerator *generator = json_generator_new();
+  JsonNode *root = json_builder_get_root(builder);
+  json_generator_set_root(generator, root);
+  gchar *text = json_generator_to_data(generator, NULL);
+
+  dt_pthread_mutex_lock(&b->print_lock);
+  if(ok)
+    b->exported++;
+  else
+    b->failed++;
+  printf("%s\n", text);
+  fflush(stdout);
+  dt_pthread_mutex_unlock(&b->print_lock);
+
+  g_free(text);
+  json_node_free(root);
+  g_object_unref(generator);
+  g_object_unref(builder);
+}
+
+static void *_batch_worker(void *data)
+{
+  _batch_t *b = (_batch_t *)data;
+#ifdef _OPENMP // need to do this in every thread
+  // darktable.num_openmp_threads is left alone, the per-thread buffers of the pipeline are sized from it
+  omp_set_num_threads(b->threads_per_worker);
+#endif
+  dt_pthread_setname("cli batch");
+
+  while(TRUE)
+  {
+    _batch_job_t job = { 0 };
+    gchar *error = NULL;
+
+    dt_pthread_mutex_lock(&b->read_lock);
+    if(!_batch_read_line(b))
+    {
+      dt_pthread_mutex_unlock(&b->read_lock);
+      break;
+    }
+    job.number = b->line_number;
+    const gboolean parsed = _batch_parse_job(b, &job, &error);
+    if(parsed)
+    {
+      // wait for the other jobs on the same input to be done with its image id
+      while(g_hash_table_contains(b->busy_inputs, job.input))
+        dt_pthread_cond_wait(&b->busy_cond, &b->read_lock);
+      g_hash_table_add(b->busy_inputs, job.input);
+    }
+    const double start = dt_get_wtime();
+    const int32_t imgid = parsed ? _batch_import(&job, &error) : 0;
+    dt_pthread_mutex_unlock(&b->read_lock);
+
+    const gboolean ok = imgid && _batch_export(b, &job, imgid, &error);
+    _batch_print(b, &job, ok, error, dt_get_wtime() - start);
+
+    if(parsed)
+    {
+      dt_pthread_mutex_lock(&b->read_lock);
+      g_hash_table_remove(b->busy_inputs, job.input);
+      pthread_cond_broadcast(&b->busy_cond);
+      dt_pthread_mutex_unlock(&b->read_lock);
+    }
+
+    g_free(error);
+    _batch_job_clear(&job);
+  }
+  return NULL;
+}
+
+// returns the number of failed jobs
+static int _batch_run(_batch_t *b, const int threads)
+{
+  dt_pthread_mutex_init(&b->read_lock, NULL);
+  dt_pthread_mutex_init(&b->print_lock, NULL);
+  b->line = g_string_new(NULL);
+  b->busy_inputs = g_hash_table_new(g_str_hash, g_str_equal);
+  pthread_cond_init(&b->busy_cond, NULL);
+
+  // the CPU cores are shared between workers for the OpenMP sections of the pipeline
+  const int workers = MAX(threads, 1);
+  b->threads_per_worker = MAX(1, darktable.num_openmp_threads / workers);
+  fprintf(stderr, _("batch mode: using %d worker threads, %d threads each\n"), workers,
+          b->threads_per_worker);
+
+  const double start = dt_get_wtime();
+
+  pthread_t *thread = malloc(sizeof(pthread_t) * workers);
+  int started = 0;
+  for(int k = 0; k < workers; k++)
+    if(!dt_pthread_create(&thread[started], _batch_worker, b)) started++;
+
+  // the main thread does the job alone, with all the cores, if no thread could be started
+  if(!started)
+  {
+    b->threads_per_worker = darktable.num_openmp_threads;
+    _batch_worker(b);
+  }
+  for(int k = 0; k < started; k++) pthread_join(thread[k], NULL);
+  free(thread);
+
+  const double elapsed = dt_get_wtime() - start;
+  fprintf(stderr, _("%d exported, %d failed in %.1f s (%.2f images/s)\n"), b->exported, b->failed, elapsed,
+          elapsed > 0.0 ? b->exported / elapsed : 0.0);
+
+  g_string_free(b->line, TRUE);
+  g_hash_table_destroy(b->busy_inputs);
+  pthread_cond_destroy(&b->busy_cond);
+  dt_pthread_mutex_destroy(&b->read_lock);
+  dt_pthread_mutex_destroy(&b->print_lock);
+  return b->failed;
+}
+
 int main(int argc, char *arg[])
 {
 #ifdef __APPLE__
@@ -197,6 +652,9 @@ int main(int argc, char *arg[])
   int width = 0, height = 0, bpp = 0;
   gboolean verbose = FALSE, custom_presets = TRUE, export_masks = FALSE,
            output_to_dir = FALSE;
+  const char *batch_filename = NULL;
+  gboolean autotune = FALSE;
+  int threads = MAX(1, g_get_num_processors() / 4);
 
   GList* inputs = NULL;
 
@@ -341,6 +799,20 @@ int main(int argc, char *arg[])
           exit(1);
         }
       }
+      else if(!strcmp(arg[k], "--batch") && argc > k + 1)
+      {
+        k++;
+        batch_filename = arg[k];
+      }
+      else if(!strcmp(arg[k], "--threads") && argc > k + 1)
+      {
+        k++;
+        threads = MAX(atoi(arg[k]), 1);
+      }
+      else if(!strcmp(arg[k], "--autotune"))
+      {
+        autotune = TRUE;
+      }
       else if(!strcmp(arg[k], "-v") || !strcmp(arg[k], "--verbose"))
       {
         verbose = TRUE;
@@ -380,6 +852,74 @@ int main(int argc, char *arg[])
   for(; k < argc; k++) m_arg[m_argc++] = arg[k];
   m_arg[m_argc] = NULL;
 
+  if(autotune)
+  {
+    if(dt_init(m_argc, m_arg, FALSE, FALSE, NULL))
+    {
+      free(m_arg);
+      exit(1);
+    }
+
+    fprintf(stderr, _("benchmarking the modules, this can take a minute...\n"));
+    const double start = dt_get_wtime();
+    dt_iop_autotune();
+    fprintf(stderr, _("done in %.1f s\n"), dt_get_wtime() - start);
+
+    // saves anselrc
+    dt_cleanup();
+    free(m_arg);
+    exit(0);
+  }
+
+  if(batch_filename)
+  {
+    if(inputs || file_counter)
+    {
+      fprintf(stderr, _("error: inputs and outputs are given by the job file in batch mode\n"));
+      usage(arg[0]);
+      free(m_arg);
+      g_free(output_filename);
+      g_free(output_ext);
+      g_list_free_full(inputs, g_free);
+      exit(1);
+    }
+
+    _batch_t batch = { .width = width,
+                       .height = height,
+                       .style = style,
+                       .output_ext = output_ext,
+                       .export_masks = export_masks,
+                       .icc_type = icc_type,
+                       .icc_filename = icc_filename,
+                       .icc_intent = icc_intent };
+
+    batch.jobs = strcmp(batch_filename, "-") ? g_fopen(batch_filename, "r") : stdin;
+    if(!batch.jobs)
+    {
+      fprintf(stderr, _("error: can't open job file %s\n"), batch_filename);
+      free(m_arg);
+      g_free(output_ext);
+      exit(1);
+    }
+
+    // init dt without gui and without data.db:
+    if(dt_init(m_argc, m_arg, FALSE, custom_presets, NULL))
+    {
+      free(m_arg);
+      g_free(output_ext);
+      exit(1);
+    }
+
+    const int failed = _batch_run(&batch, threads);
+
+    if(batch.jobs != stdin) fclose(batch.jobs);
+    g_free(output_ext);
+    g_free(icc_filename);
+    dt_cleanup();
+    free(m_arg);
+    exit(failed ? 1 : 0);
+  }
+
   if( (inputs && file_counter < 1) || (!inputs && file_counter < 2) || file_counter > 3)
   {
     usage(arg[0]);
@@ -662,25 +1202,7 @@ int main(int argc, char *arg[])
     exit(1);
   }
 
-  uint32_t w, h, fw, fh, sw, sh;
-  fw = fh = sw = sh = 0;
-  storage->dimension(storage, sdata, &sw, &sh);
-  format->dimension(format, fdata, &fw, &fh);
-
-  if(sw == 0 || fw == 0)
-    w = sw > fw ? sw : fw;
-  else
-    w = sw < fw ? sw : fw;
-
-  if(sh == 0 || fh == 0)
-    h = sh > fh ? sh : fh;
-  else
-    h = sh < fh ? sh : fh;
-
-  fdata->max_width = width;
-  fdata->max_height = height;
-  fdata->max_width = (w != 0 && fdata->max_width > w) ? w : fdata->max_width;
-  fdata->max_height = (h != 0 && fdata->max_height > h) ? h : fdata->max_height;
+  _set_max_size(storage, sdata, format, fdata, width, height);
   fdata->style[0] = '\0';
 
   if(style)
@@ -18,8 +18,10 @@
 
 #include "common/bilateral.h"
 #include "common/darktable.h" // dt_print, dt_alloc_align, dt_free_align
+#include "common/imagebuf.h"  // dt_iop_image_channel_hash
 #include "common/math.h"      // for CLAMPS, roundf
-#include <glib.h>             // for MIN, MAX
+#include <glib.h>             // for MIN, MAX, GMutex
+#include <stdint.h>           // for uint32_t, uint64_t
 #include <stdlib.h>           // for size_t, free, malloc, NULL
 #include <string.h>           // for memset
 #include <stdio.h>            // fprintf
@@ -30,6 +32,29 @@
 #define DT_COMMON_BILATERAL_MAX_RES_S 3000
 #define DT_COMMON_BILATERAL_MAX_RES_R 50
 
+// pixels of a row processed at once by the SIMD loops of the splat
+#define DT_BILATERAL_CHUNK 256
+
+// Cache of blurred grids, shared by all the modules building a grid of the same input with the same sigmas,
+// and by the successive runs of a module whose input didn't change (e.g. while dragging a detail slider).
+// Grids larger than DT_BILATERAL_CACHE_MAX_BYTES are not cached, to not hold export-sized grids in memory,
+// and the cached grids don't hold more than DT_BILATERAL_CACHE_TOTAL_BYTES together. The cache is flushed
+// when a pipe is cleaned up.
+#define DT_BILATERAL_CACHE_SLOTS 4
+#define DT_BILATERAL_CACHE_MAX_BYTES ((size_t)64 << 20)
+#define DT_BILATERAL_CACHE_TOTAL_BYTES ((size_t)128 << 20)
+
+typedef struct dt_bilateral_cache_slot_t
+{
+  dt_bilateral_t *grid;
+  size_t bytes;
+  uint64_t last_use;
+} dt_bilateral_cache_slot_t;
+
+static dt_bilateral_cache_slot_t _cache[DT_BILATERAL_CACHE_SLOTS] = { { NULL, 0, 0 } };
+static uint64_t _cache_clock = 0;
+static GMutex _cache_lock;
+
 void dt_bilateral_grid_size(dt_bilateral_t *b, const int width, const int height, const float L_range,
                             float sigma_s, const float sigma_r)
 {
@@ -110,32 +135,6 @@ size_t dt_bilateral_singlebuffer_size2(const int width,
 }
 #endif /* !HAVE_OPENCL */
 
-static size_t image_to_grid(const dt_bilateral_t *const b, const int i, const int j, const float L,
-                            float *xf, float *yf, float *zf)
-{
-  float x = CLAMPS(i / b->sigma_s, 0, b->size_x - 1);
-  float y = CLAMPS(j / b->sigma_s, 0, b->size_y - 1);
-  float z = CLAMPS(L / b->sigma_r, 0, b->size_z - 1);
-  const int xi = MIN((int)x, b->size_x - 2);
-  const int yi = MIN((int)y, b->size_y - 2);
-  const int zi = MIN((int)z, b->size_z - 2);
-  *xf = x - xi;
-  *yf = y - yi;
-  *zf = z - zi;
-  return ((xi + yi * b->size_x) * b->size_z) + zi;
-}
-
-static size_t image_to_relgrid(const dt_bilateral_t *const b, const int i, const float L, float *xf, float *zf)
-{
-  float x = CLAMPS(i / b->sigma_s, 0, b->size_x - 1);
-  float z = CLAMPS(L / b->sigma_r, 0, b->size_z - 1);
-  const int xi = MIN((int)x, b->size_x - 2);
-  const int zi = MIN((int)z, b->size_z - 2);
-  *xf = x - xi;
-  *zf = z - zi;
-  return (xi * b->size_z) + zi;
-}
-
 dt_bilateral_t *dt_bilateral_init(const int width,     // width of input image
                                   const int height,    // height of input image
                                   const float sigma_s, // spatial sigma (blur pixel coords)
@@ -149,6 +148,8 @@ dt_bilateral_t *dt_bilateral_init(const int width,     // width of input image
   b->numslices = darktable.num_openmp_threads;
   b->sliceheight = (height + b->numslices - 1) / b->numslices;
   b->slicerows = (b->size_y + b->numslices - 1) / b->numslices + 2;
+  b->hash = 0;
+  b->refs = 0;
   b->buf = dt_calloc_align_float(b->size_x * b->size_z * b->numslices * b->slicerows);
   if (!b->buf)
   {
@@ -161,75 +162,106 @@ dt_bilateral_t *dt_bilateral_init(const int width,     // width of input image
   return b;
 }
 
-#ifdef _OPENMP
-#pragma omp declare simd aligned(in:64)
-#endif
+// add the weights accumulated over a run of pixels of the cell `cell` to the two grid rows around the image
+// row. acc holds the weights of the corners (x, z), (x, z + 1), (x + 1, z), (x + 1, z + 1).
+static inline void _splat_cell(float *const grid, const int cell, const int ox, const int oy,
+                               const float acc[4], const float wy0, const float wy1)
+{
+  float *const g = grid + cell;
+  g[0] += acc[0] * wy0;
+  g[1] += acc[1] * wy0;
+  g[ox] += acc[2] * wy0;
+  g[ox + 1] += acc[3] * wy0;
+  g[oy] += acc[0] * wy1;
+  g[oy + 1] += acc[1] * wy1;
+  g[oy + ox] += acc[2] * wy1;
+  g[oy + ox + 1] += acc[3] * wy1;
+}
+
+__DT_CLONE_TARGETS__
 void dt_bilateral_splat(const dt_bilateral_t *b, const float *const in)
 {
   const int ox = b->size_z;
   const int oy = b->size_x * b->size_z;
-  const int oz = 1;
-  const float sigma_s = b->sigma_s * b->sigma_s;
+  const int size_x = b->size_x;
+  const int size_y = b->size_y;
+  const int size_z = b->size_z;
+  const int width = b->width;
+  const int height = b->height;
+  const int sliceheight = b->sliceheight;
+  const int slicerows = b->slicerows;
+  const float sigma_s = b->sigma_s;
+  const float sigma_r = b->sigma_r;
+  // the contributions are normalized by the area of a grid cell
+  const float norm = 100.0f / (sigma_s * sigma_s);
   float *const buf = b->buf;
 
   if (!buf) return;
   // splat into downsampled grid
   const int nthreads = darktable.num_openmp_threads;
-  const size_t offsets[8] =
-  {
-    0,
-    ox,
-    oy,
-    ox + oy,
-    oz,
-    oz + ox,
-    oz + oy,
-    oz + oy + ox
-  };
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(in, oy, oz, ox, sigma_s, buf, offsets) \
+  dt_omp_firstprivate(in, ox, oy, size_x, size_y, size_z, width, height, sliceheight, slicerows, sigma_s, sigma_r, \
+                      norm, buf) \
   shared(b)
 #endif
   for(int slice = 0; slice < b->numslices; slice++)
   {
-    const int firstrow = slice * b->sliceheight;
-    const int lastrow = MIN((slice+1)*b->sliceheight,b->height);
+    const int firstrow = slice * sliceheight;
+    const int lastrow = MIN((slice+1)*sliceheight,height);
     // compute the first row of the final grid which this slice splats, and subtract that from the first
     // row the current thread should use to get an offset
-    const int slice_offset = slice * b->slicerows - (int)(firstrow / b->sigma_s);
+    const int slice_offset = slice * slicerows - (int)(firstrow / sigma_s);
     // now iterate over the rows of the current horizontal slice
     for(int j = firstrow; j < lastrow; j++)
     {
-      float y = CLAMPS(j / b->sigma_s, 0, b->size_y - 1);
-      const int yi = MIN((int)y, b->size_y - 2);
+      const float y = CLAMPS(j / sigma_s, 0, size_y - 1);
+      const int yi = MIN((int)y, size_y - 2);
       const float yf = y - yi;
-      const size_t base = (size_t)(yi + slice_offset) * oy;
-      for(int i = 0; i < b->width; i++)
+      const float wy0 = (1.0f - yf) * norm;
+      const float wy1 = yf * norm;
+      float *const grid = buf + (size_t)(yi + slice_offset) * oy;
+      const float *const restrict in_row = in + (size_t)4 * j * width;
+
+      int cell = -1;
+      float acc[4] = { 0.0f };
+      for(int i0 = 0; i0 < width; i0 += DT_BILATERAL_CHUNK)
       {
-        size_t index = 4 * (j * b->width + i);
-        float xf, zf;
-        const float L = in[index];
-        // nearest neighbour splatting:
-        const size_t grid_index = base + image_to_relgrid(b, i, L, &xf, &zf);
-        // sum up payload here
-        const dt_aligned_pixel_t contrib =
+        const int n = MIN(DT_BILATERAL_CHUNK, width - i0);
+        int DT_ALIGNED_ARRAY cells[DT_BILATERAL_CHUNK];
+        float DT_ALIGNED_ARRAY wx[DT_BILATERAL_CHUNK];
+        float DT_ALIGNED_ARRAY wz[DT_BILATERAL_CHUNK];
+
+        // grid cell and position in the cell of each pixel, in SIMD
+        for(int k = 0; k < n; k++)
         {
-          (1.0f - xf) * (1.0f - yf) * 100.0f / sigma_s,	// precompute the contributions along the first two dimensions
-          xf * (1.0f - yf) * 100.0f / sigma_s,
-          (1.0f - xf) * yf * 100.0f / sigma_s,
-          xf * yf * 100.0f / sigma_s
-        };
-#ifdef _OPENMP
-#pragma omp simd aligned(buf:64)
-#endif
-        for(int k = 0; k < 4; k++)
+          const float x = CLAMPS((i0 + k) / sigma_s, 0, size_x - 1);
+          const float z = CLAMPS(in_row[4 * (i0 + k)] / sigma_r, 0, size_z - 1);
+          const int xi = MIN((int)x, size_x - 2);
+          const int zi = MIN((int)z, size_z - 2);
+          wx[k] = x - xi;
+          wz[k] = z - zi;
+          cells[k] = xi * ox + zi;
+        }
+
+        // neighbouring pixels mostly fall into the same cell: sum their weights in registers and add them to
+        // the grid once per run of pixels, instead of 8 read-modify-writes per pixel
+        for(int k = 0; k < n; k++)
         {
-          buf[grid_index + offsets[k]] += (contrib[k] * (1.0f - zf));
-          buf[grid_index + offsets[k+4]] += (contrib[k] * zf);
+          if(cells[k] != cell)
+          {
+            if(cell >= 0) _splat_cell(grid, cell, ox, oy, acc, wy0, wy1);
+            cell = cells[k];
+            for(int c = 0; c < 4; c++) acc[c] = 0.0f;
+          }
+          acc[0] += (1.0f - wx[k]) * (1.0f - wz[k]);
+          acc[1] += (1.0f - wx[k]) * wz[k];
+          acc[2] += wx[k] * (1.0f - wz[k]);
+          acc[3] += wx[k] * wz[k];
         }
       }
+      if(cell >= 0) _splat_cell(grid, cell, ox, oy, acc, wy0, wy1);
     }
   }
 
@@ -359,16 +391,30 @@ void dt_bilateral_blur(const dt_bilateral_t *b)
 }
 
 
-#ifdef _OPENMP
-#pragma omp declare simd aligned(out, in :64)
-#endif
+// trilinear lookup of the grid at the position (xf, yf, zf) in the cell `cell` of the grid row `grid`. The
+// cells are indexed as int from the row, so that the lookups compile to gathers.
+static inline float _slice_cell(const float *const grid, const int cell, const int ox, const int oy,
+                                const float xf, const float yf, const float zf)
+{
+  const float v0 = (1.0f - xf) * ((1.0f - zf) * grid[cell] + zf * grid[cell + 1])
+                   + xf * ((1.0f - zf) * grid[cell + ox] + zf * grid[cell + ox + 1]);
+  const float v1 = (1.0f - xf) * ((1.0f - zf) * grid[cell + oy] + zf * grid[cell + oy + 1])
+                   + xf * ((1.0f - zf) * grid[cell + oy + ox] + zf * grid[cell + oy + ox + 1]);
+  return (1.0f - yf) * v0 + yf * v1;
+}
+
+__DT_CLONE_TARGETS__
 void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, float *out, const float detail)
 {
   // detail: 0 is leave as is, -1 is bilateral filtered, +1 is contrast boost
   const float norm = -detail * b->sigma_r * 0.04f;
   const int ox = b->size_z;
   const int oy = b->size_x * b->size_z;
-  const int oz = 1;
+  const int size_x = b->size_x;
+  const int size_y = b->size_y;
+  const int size_z = b->size_z;
+  const float sigma_s = b->sigma_s;
+  const float sigma_r = b->sigma_r;
   float *const buf = b->buf;
   const int width = b->width;
   const int height = b->height;
@@ -376,39 +422,37 @@ void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, fl
   if (!buf) return;
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(b, in, norm, ox, oy, oz, height, width, buf) \
-    shared(out) collapse(2)
+  dt_omp_firstprivate(in, norm, ox, oy, size_x, size_y, size_z, sigma_s, sigma_r, height, width, buf) \
+  shared(out) schedule(static)
 #endif
   for(int j = 0; j < height; j++)
   {
+    const float *const in_row = in + (size_t)4 * j * width;
+    float *const out_row = out + (size_t)4 * j * width;
+    // copy color and mask, the luminance gets overwritten below
+    if(in != out) memcpy(out_row, in_row, sizeof(float) * 4 * width);
+
+    const float y = CLAMPS(j / sigma_s, 0, size_y - 1);
+    const int yi = MIN((int)y, size_y - 2);
+    const float yf = y - yi;
+    const float *const grid = buf + (size_t)yi * oy;
+    // trilinear lookup, in SIMD along the row. out may be in, but each pixel only reads its own luminance.
+#ifdef _OPENMP
+#pragma omp simd
+#endif
     for(int i = 0; i < width; i++)
     {
-      size_t index = 4 * (j * width + i);
-      float xf, yf, zf;
-      const float L = in[index];
-      // trilinear lookup:
-      const size_t gi = image_to_grid(b, i, j, L, &xf, &yf, &zf);
-      const float Lout = fmaxf( 0.0f, L
-                         + norm * (buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf)
-                                   + buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
-                                   + buf[gi + oy] * (1.0f - xf) * (yf) * (1.0f - zf)
-                                   + buf[gi + ox + oy] * (xf) * (yf) * (1.0f - zf)
-                                   + buf[gi + oz] * (1.0f - xf) * (1.0f - yf) * (zf)
-                                   + buf[gi + ox + oz] * (xf) * (1.0f - yf) * (zf)
-                                   + buf[gi + oy + oz] * (1.0f - xf) * (yf) * (zf)
-                                   + buf[gi + ox + oy + oz] * (xf) * (yf) * (zf)));
-      out[index] = Lout;
-      // and copy color and mask
-      out[index + 1] = in[index + 1];
-      out[index + 2] = in[index + 2];
-      out[index + 3] = in[index + 3];
+      const float L = in_row[4 * i];
+      const float x = CLAMPS(i / sigma_s, 0, size_x - 1);
+      const float z = CLAMPS(L / sigma_r, 0, size_z - 1);
+      const int xi = MIN((int)x, size_x - 2);
+      const int zi = MIN((int)z, size_z - 2);
+      out_row[4 * i] = MAX(0.0f, L + norm * _slice_cell(grid, xi * ox + zi, ox, oy, x - xi, yf, z - zi));
     }
   }
 }
 
-#ifdef _OPENMP
-#pragma omp declare simd aligned(out, in :64)
-#endif
+__DT_CLONE_TARGETS__
 void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *const in, float *out,
                                   const float detail)
 {
@@ -416,7 +460,11 @@ void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *co
   const float norm = -detail * b->sigma_r * 0.04f;
   const int ox = b->size_z;
   const int oy = b->size_x * b->size_z;
-  const int oz = 1;
+  const int size_x = b->size_x;
+  const int size_y = b->size_y;
+  const int size_z = b->size_z;
+  const float sigma_s = b->sigma_s;
+  const float sigma_r = b->sigma_r;
   float *const buf = b->buf;
   const int width = b->width;
   const int height = b->height;
@@ -424,40 +472,156 @@ void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *co
   if (!buf) return;
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(b, in, norm, oy, oz, ox, buf, width, height) \
-  shared(out) collapse(2)
+  dt_omp_firstprivate(in, norm, ox, oy, size_x, size_y, size_z, sigma_s, sigma_r, height, width, buf) \
+  shared(out) schedule(static)
 #endif
   for(int j = 0; j < height; j++)
   {
+    const float *const in_row = in + (size_t)4 * j * width;
+    float *const out_row = out + (size_t)4 * j * width;
+    const float y = CLAMPS(j / sigma_s, 0, size_y - 1);
+    const int yi = MIN((int)y, size_y - 2);
+    const float yf = y - yi;
+    const float *const grid = buf + (size_t)yi * oy;
+    // trilinear lookup, in SIMD along the row. out may be in, but each pixel only reads its own luminance.
+#ifdef _OPENMP
+#pragma omp simd
+#endif
     for(int i = 0; i < width; i++)
     {
-      size_t index = 4 * (j * width + i);
-      float xf, yf, zf;
-      const float L = in[index];
-      // trilinear lookup:
-      const size_t gi = image_to_grid(b, i, j, L, &xf, &yf, &zf);
-      const float Lout = norm * (buf[gi] * (1.0f - xf) * (1.0f - yf) * (1.0f - zf)
-                                 + buf[gi + ox] * (xf) * (1.0f - yf) * (1.0f - zf)
-                                 + buf[gi + oy] * (1.0f - xf) * (yf) * (1.0f - zf)
-                                 + buf[gi + ox + oy] * (xf) * (yf) * (1.0f - zf)
-                                 + buf[gi + oz] * (1.0f - xf) * (1.0f - yf) * (zf)
-                                 + buf[gi + ox + oz] * (xf) * (1.0f - yf) * (zf)
-                                 + buf[gi + oy + oz] * (1.0f - xf) * (yf) * (zf)
-                                 + buf[gi + ox + oy + oz] * (xf) * (yf) * (zf));
-      out[index] = MAX(0.0f, out[index] + Lout);
+      const float x = CLAMPS(i / sigma_s, 0, size_x - 1);
+      const float z = CLAMPS(in_row[4 * i] / sigma_r, 0, size_z - 1);
+      const int xi = MIN((int)x, size_x - 2);
+      const int zi = MIN((int)z, size_z - 2);
+      out_row[4 * i]
+          = MAX(0.0f, out_row[4 * i] + norm * _slice_cell(grid, xi * ox + zi, ox, oy, x - xi, yf, z - zi));
     }
   }
 }
 
-void dt_bilateral_free(dt_bilateral_t *b)
+static void _bilateral_destroy(dt_bilateral_t *b)
 {
-  if(!b) return;
   dt_free_align(b->buf);
   free(b);
 }
 
+void dt_bilateral_free(dt_bilateral_t *b)
+{
+  if(!b) return;
+  if(b->refs > 0)
+  {
+    // shared grid: only freed once released by the cache and by all its users
+    g_mutex_lock(&_cache_lock);
+    const gboolean last = --b->refs == 0;
+    g_mutex_unlock(&_cache_lock);
+    if(!last) return;
+  }
+  _bilateral_destroy(b);
+}
+
+dt_bilateral_t *dt_bilateral_shared(const float *const in, const int width, const int height,
+                                    const float sigma_s, const float sigma_r)
+{
+  dt_bilateral_t size;
+  dt_bilateral_grid_size(&size, width, height, 100.0f, sigma_s, sigma_r);
+  // the grid only depends on the luminance channel
+  uint64_t hash = dt_iop_image_channel_hash(in, width, height, 4, 0);
+  hash = dt_hash(hash, (const char *)&width, sizeof(int));
+  hash = dt_hash(hash, (const char *)&height, sizeof(int));
+  hash = dt_hash(hash, (const char *)&size.sigma_s, sizeof(float));
+  hash = dt_hash(hash, (const char *)&size.sigma_r, sizeof(float));
+
+  g_mutex_lock(&_cache_lock);
+  for(int k = 0; k < DT_BILATERAL_CACHE_SLOTS; k++)
+  {
+    dt_bilateral_t *const cached = _cache[k].grid;
+    if(cached && cached->hash == hash)
+    {
+      cached->refs++;
+      _cache[k].last_use = ++_cache_clock;
+      g_mutex_unlock(&_cache_lock);
+      dt_print(DT_DEBUG_DEV, "[bilateral] reusing cached grid [%ld %ld %ld]\n", cached->size_x, cached->size_y,
+               cached->size_z);
+      return cached;
+    }
+  }
+  g_mutex_unlock(&_cache_lock);
+
+  dt_bilateral_t *b = dt_bilateral_init(width, height, sigma_s, sigma_r);
+  if(!b) return NULL;
+  dt_bilateral_splat(b, in);
+  dt_bilateral_blur(b);
+  b->hash = hash;
+  b->refs = 1;
+
+  const size_t bytes = sizeof(float) * b->size_x * b->size_z * b->numslices * b->slicerows;
+  if(bytes > DT_BILATERAL_CACHE_MAX_BYTES) return b;
+
+  g_mutex_lock(&_cache_lock);
+  // another thread may have cached the same grid meanwhile, then ours stays private. Else evict the least
+  // recently used grids until there is a free slot and room for ours. Evicted grids get freed once their
+  // current users release them.
+  gboolean cached = FALSE;
+  for(int k = 0; k < DT_BILATERAL_CACHE_SLOTS; k++)
+    if(_cache[k].grid && _cache[k].grid->hash == hash) cached = TRUE;
+
+  dt_bilateral_t *evicted[DT_BILATERAL_CACHE_SLOTS] = { NULL };
+  int num_evicted = 0;
+  while(!cached)
+  {
+    int free_slot = -1;
+    int lru = -1;
+    size_t used = 0;
+    for(int k = 0; k < DT_BILATERAL_CACHE_SLOTS; k++)
+    {
+      if(!_cache[k].grid)
+      {
+        if(free_slot < 0) free_slot = k;
+        continue;
+      }
+      used += _cache[k].bytes;
+      if(lru < 0 || _cache[k].last_use < _cache[lru].last_use) lru = k;
+    }
+
+    if(free_slot >= 0 && used + bytes <= DT_BILATERAL_CACHE_TOTAL_BYTES)
+    {
+      _cache[free_slot].grid = b;
+      _cache[free_slot].bytes = bytes;
+      _cache[free_slot].last_use = ++_cache_clock;
+      b->refs++;
+      break;
+    }
+
+    if(--_cache[lru].grid->refs == 0) evicted[num_evicted++] = _cache[lru].grid;
+    _cache[lru].grid = NULL;
+    _cache[lru].bytes = 0;
+  }
+  g_mutex_unlock(&_cache_lock);
+
+  for(int k = 0; k < num_evicted; k++) _bilateral_destroy(evicted[k]);
+  return b;
+}
+
+void dt_bilateral_cache_cleanup(void)
+{
+  g_mutex_lock(&_cache_lock);
+  for(int k = 0; k < DT_BILATERAL_CACHE_SLOTS; k++)
+  {
+    dt_bilateral_t *const grid = _cache[k].grid;
+    _cache[k].grid = NULL;
+    _cache[k].bytes = 0;
+    // still in use somewhere: freed by its last user
+    if(grid && --grid->refs == 0) _bilateral_destroy(grid);
+  }
+  g_mutex_unlock(&_cache_lock);
+}
+
 #undef DT_COMMON_BILATERAL_MAX_RES_S
 #undef DT_COMMON_BILATERAL_MAX_RES_R
+#undef DT_BILATERAL_CHUNK
+#undef DT_BILATERAL_CACHE_SLOTS
+#undef DT_BILATERAL_CACHE_MAX_BYTES
+#undef DT_BILATERAL_CACHE_TOTAL_BYTES
 
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
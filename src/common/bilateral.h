@@ -19,6 +19,7 @@
 #pragma once
 
 #include <stddef.h> // for size_t
+#include <stdint.h> // for uint64_t
 
 typedef struct dt_bilateral_t
 {
@@ -26,6 +27,8 @@ typedef struct dt_bilateral_t
   int width, height;
   int numslices, sliceheight, slicerows; //height--in input image, rows--in grid
   float sigma_s, sigma_r;
+  uint64_t hash; // content of the input and sigmas, for shared grids
+  int refs;      // users of a shared grid, cache included. 0 for the grids owned by their caller
   float *buf __attribute__((aligned(64)));
 } __attribute__((packed)) dt_bilateral_t;
 
@@ -66,8 +69,22 @@ void dt_bilateral_slice(const dt_bilateral_t *const b, const float *const in, fl
 void dt_bilateral_slice_to_output(const dt_bilateral_t *const b, const float *const in, float *out,
                                   const float detail);
 
+/** splatted and blurred grid of `in`, shared with the other callers asking for the grid of the same input
+ * content with the same size and sigmas, and kept in a small cache between calls. The luminance of `in` is
+ * hashed to find a cached grid, else one is built and cached. The grid is read-only: only slice it, and
+ * release it with dt_bilateral_free(). Returns NULL if out of memory. */
+dt_bilateral_t *dt_bilateral_shared(const float *const in, // input image, 4 channels, luminance first
+                                    const int width,       // width of input image
+                                    const int height,      // height of input image
+                                    const float sigma_s,   // spatial sigma (blur pixel coords)
+                                    const float sigma_r);  // range sigma (blur luma values)
+
 void dt_bilateral_free(dt_bilateral_t *b);
 
+/** free the grids cached by dt_bilateral_shared(), on pipe cleanup and at shutdown. Grids still in use
+ * are freed by their last user. */
+void dt_bilateral_cache_cleanup(void);
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
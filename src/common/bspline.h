@@ -2,6 +2,7 @@
 
 #include "common/darktable.h"
 #include "common/dwt.h"
+#include "common/half.h"
 #include "develop/openmp_maths.h"
 #include "math.h"
 
@@ -196,6 +197,36 @@ inline static void decompose_2D_Bspline(const float *const restrict in,
   }
 }
 
+// Same as decompose_2D_Bspline(), with the HF component stored as half floats (see common/half.h)
+inline static void decompose_2D_Bspline_half(const float *const restrict in,
+                                             dt_half_t *const restrict HF,
+                                             float *const restrict LF,
+                                             const size_t width, const size_t height, const int mult,
+                                             float *const tempbuf, size_t padded_size)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+    dt_omp_firstprivate(width, height, mult, padded_size) \
+    dt_omp_sharedconst(in, HF, LF, tempbuf)  \
+    schedule(static)
+#endif
+  for(size_t row = 0; row < height; row++)
+  {
+    float *restrict DT_ALIGNED_ARRAY const temp = dt_get_perthread(tempbuf, padded_size);
+    const size_t i = dwt_interleave_rows(row, height, mult);
+    _bspline_vertical_pass(in, temp, i, width, height, mult, TRUE);
+    for(size_t j = 0; j < width; j++)
+    {
+      const size_t index = 4U * (i * width + j);
+      _bspline_horizontal(temp, LF + index, j, width, mult, TRUE);
+      dt_aligned_pixel_t detail;
+      for_four_channels(c)
+        detail[c] = in[index + c] - LF[index + c];
+      dt_store_half_4(HF + index, detail);
+    }
+  }
+}
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
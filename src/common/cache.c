@@ -152,7 +152,8 @@ dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char m
 // if found, the data void* is returned. if not, it is set to be
 // the given *data and a new hash table entry is created, which can be
 // found using the given key later on.
-dt_cache_entry_t *dt_cache_get_with_caller(dt_cache_t *cache, const uint32_t key, char mode, const char *file, int line)
+static dt_cache_entry_t *_cache_get(dt_cache_t *cache, const uint32_t key, char mode, const char *file, int line,
+                                    const gboolean wait)
 {
   gpointer orig_key, value;
   gboolean res;
@@ -171,6 +172,7 @@ restart:
     { // need to give up mutex so other threads have a chance to get in between and
       // free the lock we're trying to acquire:
       dt_pthread_mutex_unlock(&cache->lock);
+      if(!wait) return NULL;
       g_usleep(5);
       goto restart;
     }
@@ -257,6 +259,17 @@ restart:
   return entry;
 }
 
+dt_cache_entry_t *dt_cache_get_with_caller(dt_cache_t *cache, const uint32_t key, char mode, const char *file, int line)
+{
+  return _cache_get(cache, key, mode, file, line, TRUE);
+}
+
+dt_cache_entry_t *dt_cache_tryget_with_caller(dt_cache_t *cache, const uint32_t key, char mode, const char *file,
+                                              int line)
+{
+  return _cache_get(cache, key, mode, file, line, FALSE);
+}
+
 int dt_cache_remove(dt_cache_t *cache, const uint32_t key)
 {
   gpointer orig_key, value;
@@ -77,7 +77,11 @@ static inline void dt_cache_set_cleanup_callback(dt_cache_t *cache, dt_cache_cle
 // returns a slot in the cache for this key (newly allocated if need be), locked according to mode (r, w)
 #define dt_cache_get(A, B, C)  dt_cache_get_with_caller(A, B, C, __FILE__, __LINE__)
 dt_cache_entry_t *dt_cache_get_with_caller(dt_cache_t *cache, const uint32_t key, char mode, const char *file, int line);
-// same but returns 0 if not allocated yet (both will block and wait for entry rw locks to be released)
+// same but returns 0 instead of waiting if the entry is already there and locked by someone else
+#define dt_cache_tryget(A, B, C)  dt_cache_tryget_with_caller(A, B, C, __FILE__, __LINE__)
+dt_cache_entry_t *dt_cache_tryget_with_caller(dt_cache_t *cache, const uint32_t key, char mode, const char *file,
+                                              int line);
+// like dt_cache_get, but returns 0 if not allocated yet (both will block and wait for entry rw locks to be released)
 dt_cache_entry_t *dt_cache_testget(dt_cache_t *cache, const uint32_t key, char mode);
 // release a lock on a cache entry. the cache knows which one you mean (r or w).
 #define dt_cache_release(A, B) dt_cache_release_with_caller(A, B, __FILE__, __LINE__)
@@ -0,0 +1,292 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/clahe.h"
+#include "common/darktable.h"
+#include "common/math.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// luminances are quantized to BINS + 1 bins. Histograms are padded to a multiple of 16 bins for the SIMD
+// loops; the padding bins stay 0.
+#define BINS 256
+#define HIST_SIZE 272
+
+// tiled method: smallest spacing between nodes, which bounds the memory used by their mappings
+#define TILE_MIN_STEP 16
+
+static inline uint16_t _quantize(const float l)
+{
+  // rounded in double, as the original code did
+  return (uint16_t)CLAMPS((double)(CLIP(l) * (float)BINS) + 0.5, 0.0, (double)BINS);
+}
+
+// clip the histogram of a neighbourhood of n pixels to slope times the mean bin count, and spread the
+// clipped counts over all bins, until no count exceeds the limit anymore.
+static inline void _clip_histogram(const int *const restrict hist, int *const restrict clipped, const int n,
+                                   const float slope)
+{
+  const int limit = (int)(slope * n / BINS + 0.5f);
+  memcpy(clipped, hist, sizeof(int) * HIST_SIZE);
+
+  int excess = 0;
+  int previous;
+  do
+  {
+    previous = excess;
+    excess = 0;
+    for(int b = 0; b <= BINS; b++)
+    {
+      excess += MAX(clipped[b] - limit, 0);
+      clipped[b] = MIN(clipped[b], limit);
+    }
+
+    const int d = excess / (float)(BINS + 1);
+    const int m = excess % (BINS + 1);
+    for(int b = 0; b <= BINS; b++) clipped[b] += d;
+
+    if(m != 0)
+    {
+      // one more count every s bins, as a test on each bin so that the loop vectorizes. b / s is exact:
+      // the fractional part of (b + 0.5) / s stays at least 0.5 / s away from the integers.
+      const int s = BINS / (float)m;
+      const float inv_s = 1.0f / s;
+      for(int b = 0; b <= BINS; b++) clipped[b] += (int)((b + 0.5f) * inv_s) * s == b;
+    }
+  } while(excess != previous);
+}
+
+// first non-empty bin, BINS if there is none below
+static inline int _first_bin(const int *const restrict clipped)
+{
+  for(int b = 0; b < BINS; b++)
+    if(clipped[b] != 0) return b;
+  return BINS;
+}
+
+// normalized rank of the bin v in the clipped histogram
+static inline float _rank(const int *const restrict clipped, const int v)
+{
+  const int cdf_min = clipped[_first_bin(clipped)];
+  int cdf = 0;
+  int total = 0;
+#ifdef _OPENMP
+#pragma omp simd reduction(+ : cdf, total)
+#endif
+  for(int b = 0; b <= BINS; b++)
+  {
+    cdf += b <= v ? clipped[b] : 0;
+    total += clipped[b];
+  }
+  return (cdf - cdf_min) / (float)(total - cdf_min);
+}
+
+// hist += add - remove
+static inline void _update_histogram(int *const restrict hist, const uint16_t *const restrict add,
+                                     const uint16_t *const restrict remove)
+{
+#ifdef _OPENMP
+#pragma omp simd aligned(hist, add, remove : 32)
+#endif
+  for(int b = 0; b < HIST_SIZE; b++) hist[b] += (int)add[b] - (int)remove[b];
+}
+
+__DT_CLONE_TARGETS__
+static int _clahe_sliding(const uint16_t *const restrict bins, float *const restrict out, const int width,
+                          const int height, const int radius, const float slope)
+{
+  // the image is split in one strip of rows per thread. Each thread keeps the histograms of the columns
+  // of the neighbourhood rows of its current row.
+  size_t padded_size;
+  uint16_t *const restrict columns_buf = dt_alloc_perthread((size_t)HIST_SIZE * width, sizeof(uint16_t),
+                                                            &padded_size);
+  if(!columns_buf) return 1;
+
+  const int strips = MAX(MIN(darktable.num_openmp_threads, height), 1);
+  const int strip_height = (height + strips - 1) / strips;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(bins, out, width, height, radius, slope, columns_buf, padded_size, strips, strip_height) \
+  schedule(static)
+#endif
+  for(int s = 0; s < strips; s++)
+  {
+    const int y0 = s * strip_height;
+    const int y1 = MIN(y0 + strip_height, height);
+    uint16_t *const restrict columns = dt_get_perthread(columns_buf, padded_size);
+    int DT_ALIGNED_ARRAY hist[HIST_SIZE];
+    int DT_ALIGNED_ARRAY clipped[HIST_SIZE];
+    uint16_t DT_ALIGNED_ARRAY empty[HIST_SIZE] = { 0 };
+
+    memset(columns, 0, sizeof(uint16_t) * HIST_SIZE * width);
+    for(int yi = MAX(0, y0 - radius); yi < MIN(height, y0 + radius + 1); yi++)
+      for(int x = 0; x < width; x++)
+        columns[(size_t)x * HIST_SIZE + bins[(size_t)yi * width + x]]++;
+
+    for(int j = y0; j < y1; j++)
+    {
+      if(j > y0)
+      {
+        // move the column histograms down by one row
+        const int leaving = j - radius - 1;
+        const int entering = j + radius;
+        if(leaving >= 0)
+          for(int x = 0; x < width; x++)
+            columns[(size_t)x * HIST_SIZE + bins[(size_t)leaving * width + x]]--;
+        if(entering < height)
+          for(int x = 0; x < width; x++)
+            columns[(size_t)x * HIST_SIZE + bins[(size_t)entering * width + x]]++;
+      }
+
+      const int h = MIN(height, j + radius + 1) - MAX(0, j - radius);
+
+      // neighbourhood of the first pixel of the row
+      memset(hist, 0, sizeof(int) * HIST_SIZE);
+      for(int x = 0; x < MIN(width, radius + 1); x++)
+        _update_histogram(hist, columns + (size_t)x * HIST_SIZE, empty);
+
+      for(int i = 0; i < width; i++)
+      {
+        if(i > 0)
+        {
+          const int add = i + radius;
+          const int remove = i - radius - 1;
+          _update_histogram(hist, add < width ? columns + (size_t)add * HIST_SIZE : empty,
+                            remove >= 0 ? columns + (size_t)remove * HIST_SIZE : empty);
+        }
+
+        const int w = MIN(width, i + radius + 1) - MAX(0, i - radius);
+        _clip_histogram(hist, clipped, h * w, slope);
+        out[(size_t)j * width + i] = _rank(clipped, bins[(size_t)j * width + i]);
+      }
+    }
+  }
+
+  dt_free_align(columns_buf);
+  return 0;
+}
+
+__DT_CLONE_TARGETS__
+static int _clahe_tiled(const uint16_t *const restrict bins, float *const restrict out, const int width,
+                        const int height, const int radius, const float slope)
+{
+  // nodes every `step` pixels, the last ones on the last row and column of the image
+  const int step = MAX(radius, TILE_MIN_STEP);
+  const int nodes_x = (width - 1 + step - 1) / step + 1;
+  const int nodes_y = (height - 1 + step - 1) / step + 1;
+  float *const restrict maps = dt_alloc_align_float((size_t)nodes_x * nodes_y * HIST_SIZE);
+  if(!maps) return 1;
+
+  // mapping of every bin through the clipped histogram of the neighbourhood of each node
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(bins, maps, width, height, radius, slope, step, nodes_x, nodes_y) \
+  schedule(dynamic) collapse(2)
+#endif
+  for(int ny = 0; ny < nodes_y; ny++)
+    for(int nx = 0; nx < nodes_x; nx++)
+    {
+      const int xc = MIN(nx * step, width - 1);
+      const int yc = MIN(ny * step, height - 1);
+      const int x0 = MAX(0, xc - radius), x1 = MIN(width, xc + radius + 1);
+      const int y0 = MAX(0, yc - radius), y1 = MIN(height, yc + radius + 1);
+
+      int DT_ALIGNED_ARRAY hist[HIST_SIZE] = { 0 };
+      int DT_ALIGNED_ARRAY clipped[HIST_SIZE];
+      for(int y = y0; y < y1; y++)
+        for(int x = x0; x < x1; x++) hist[bins[(size_t)y * width + x]]++;
+      _clip_histogram(hist, clipped, (x1 - x0) * (y1 - y0), slope);
+
+      const int cdf_min = clipped[_first_bin(clipped)];
+      int total = 0;
+      for(int b = 0; b <= BINS; b++) total += clipped[b];
+
+      float *const restrict map = maps + ((size_t)ny * nodes_x + nx) * HIST_SIZE;
+      int cdf = 0;
+      for(int b = 0; b <= BINS; b++)
+      {
+        cdf += clipped[b];
+        map[b] = (cdf - cdf_min) / (float)(total - cdf_min);
+      }
+    }
+
+  // bilinear interpolation between the mappings of the 4 nodes around each pixel
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(bins, out, maps, width, height, step, nodes_x, nodes_y) \
+  schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+  {
+    const int ny0 = MIN(j / step, nodes_y - 1);
+    const int ny1 = MIN(ny0 + 1, nodes_y - 1);
+    const int yc0 = MIN(ny0 * step, height - 1);
+    const int yc1 = MIN(ny1 * step, height - 1);
+    const float ty = yc1 > yc0 ? (float)(j - yc0) / (float)(yc1 - yc0) : 0.0f;
+    const float *const restrict row0 = maps + (size_t)ny0 * nodes_x * HIST_SIZE;
+    const float *const restrict row1 = maps + (size_t)ny1 * nodes_x * HIST_SIZE;
+
+    for(int i = 0; i < width; i++)
+    {
+      const int nx0 = MIN(i / step, nodes_x - 1);
+      const int nx1 = MIN(nx0 + 1, nodes_x - 1);
+      const int xc0 = MIN(nx0 * step, width - 1);
+      const int xc1 = MIN(nx1 * step, width - 1);
+      const float tx = xc1 > xc0 ? (float)(i - xc0) / (float)(xc1 - xc0) : 0.0f;
+      const int v = bins[(size_t)j * width + i];
+
+      const float top = row0[(size_t)nx0 * HIST_SIZE + v] * (1.0f - tx) + row0[(size_t)nx1 * HIST_SIZE + v] * tx;
+      const float bottom = row1[(size_t)nx0 * HIST_SIZE + v] * (1.0f - tx) + row1[(size_t)nx1 * HIST_SIZE + v] * tx;
+      out[(size_t)j * width + i] = top * (1.0f - ty) + bottom * ty;
+    }
+  }
+
+  dt_free_align(maps);
+  return 0;
+}
+
+int dt_clahe(const float *const in, float *const out, const int width, const int height, const int radius,
+             const float slope, const dt_clahe_method_t method)
+{
+  uint16_t *const restrict bins = dt_alloc_align(sizeof(uint16_t) * width * height);
+  if(!bins) return 1;
+
+#ifdef _OPENMP
+#pragma omp parallel for simd default(none) \
+  dt_omp_firstprivate(in, bins, width, height) \
+  schedule(static)
+#endif
+  for(size_t k = 0; k < (size_t)width * height; k++) bins[k] = _quantize(in[k]);
+
+  const int err = method == DT_CLAHE_TILED ? _clahe_tiled(bins, out, width, height, MAX(radius, 0), slope)
+                                           : _clahe_sliding(bins, out, width, height, MAX(radius, 0), slope);
+  dt_free_align(bins);
+  return err;
+}
+
+#undef TILE_MIN_STEP
+#undef HIST_SIZE
+#undef BINS
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
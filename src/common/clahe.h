@@ -0,0 +1,51 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+/**
+ * Contrast-limited adaptive histogram equalization (CLAHE) of a luminance map, as used by iop/clahe.c.
+ *
+ * Luminances in [0;1] are quantized to 257 bins. The histogram of the square neighbourhood of each pixel,
+ * cropped to the image, is clipped to `slope` times its mean bin count, the clipped counts are spread over
+ * all bins, and the pixel is mapped to its normalized rank in the clipped histogram.
+ *
+ * Both methods have a cost per pixel that doesn't depend on the radius:
+ *  - DT_CLAHE_SLIDING gives the result of the exact neighbourhood of each pixel. Each thread keeps the
+ *    histograms of the columns of its neighbourhood rows, updated by one pixel per column when moving down,
+ *    and the histogram of the neighbourhood is updated by adding and removing a column histogram, in SIMD.
+ *  - DT_CLAHE_TILED only equalizes the neighbourhoods of nodes spaced by `radius` pixels, and interpolates
+ *    bilinearly between the mappings of the 4 nodes around each pixel, as in the original CLAHE paper.
+ */
+
+typedef enum dt_clahe_method_t
+{
+  DT_CLAHE_SLIDING = 0,
+  DT_CLAHE_TILED = 1
+} dt_clahe_method_t;
+
+/** equalize the `width` x `height` luminance map `in` into `out`, over neighbourhoods of `radius` pixels
+ * around each pixel. Returns 0 on success, 1 if out of memory. */
+int dt_clahe(const float *const in, float *const out, const int width, const int height, const int radius,
+             const float slope, const dt_clahe_method_t method);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
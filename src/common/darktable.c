@@ -33,15 +33,18 @@
 #include "common/darktable.h"
 #include "common/datetime.h"
 #include "common/exif.h"
+#include "common/presets.h"
 #include "common/pwstorage/pwstorage.h"
 #include "common/selection.h"
 #include "common/system_signal_handling.h"
 #include "bauhaus/bauhaus.h"
 
+#include "common/bilateral.h"
 #include "common/cpuid.h"
 #include "common/file_location.h"
 #include "common/film.h"
 #include "common/grealpath.h"
+#include "common/guided_filter.h"
 #include "common/image.h"
 #include "common/image_cache.h"
 #include "common/imageio_module.h"
@@ -61,6 +64,7 @@
 #include "control/signal.h"
 #include "develop/blend.h"
 #include "develop/imageop.h"
+#include "develop/lut_bake.h"
 
 #include "gui/gtk.h"
 #include "gui/guides.h"
@@ -387,9 +391,18 @@ static inline size_t _get_total_memory()
 #endif
 }
 
+// time spent in one step of dt_init(), since the previous one
+static void _print_init_step(const char *step, double *since)
+{
+  const double now = dt_get_wtime();
+  dt_print(DT_DEBUG_PERF, "[init] %s took %.3f s\n", step, now - *since);
+  *since = now;
+}
+
 int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load_data, lua_State *L)
 {
   double start_wtime = dt_get_wtime();
+  double step_wtime = start_wtime;
 
 #ifndef _WIN32
   if(getuid() == 0 || geteuid() == 0)
@@ -441,7 +454,6 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   dt_pthread_mutex_init(&(darktable.plugin_threadsafe), NULL);
   dt_pthread_mutex_init(&(darktable.capabilities_threadsafe), NULL);
   dt_pthread_mutex_init(&(darktable.exiv2_threadsafe), NULL);
-  dt_pthread_mutex_init(&(darktable.readFile_mutex), NULL);
   dt_pthread_mutex_init(&(darktable.pipeline_threadsafe), NULL);
   dt_pthread_rwlock_init(&(darktable.database_threadsafe), NULL);
 
@@ -978,6 +990,8 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   // initialize datetime data
   dt_datetime_init();
 
+  _print_init_step("configuration and color profiles", &step_wtime);
+
   // initialize the database
   darktable.db = dt_database_init(dbfilename_from_command, load_data, init_gui);
   if(darktable.db == NULL)
@@ -1103,6 +1117,8 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   // TODO : Make a single call to unified GUI API initializing everything graphical at once.
   // The current tangled mess is a nightmare to maintain.
 
+  _print_init_step("database and control", &step_wtime);
+
   if(init_gui)
   {
     if(dt_gui_gtk_init(darktable.gui))
@@ -1117,6 +1133,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 
   darktable.view_manager = (dt_view_manager_t *)calloc(1, sizeof(dt_view_manager_t));
   dt_view_manager_init(darktable.view_manager);
+  _print_init_step("gui and views", &step_wtime);
 
   // check whether we were able to load darkroom view. if we failed, we'll crash everywhere later on.
   if(!darktable.develop)
@@ -1136,11 +1153,13 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 
   darktable.mipmap_cache = (dt_mipmap_cache_t *)calloc(1, sizeof(dt_mipmap_cache_t));
   dt_mipmap_cache_init(darktable.mipmap_cache);
+  _print_init_step("image and mipmap caches", &step_wtime);
 
   darktable.opencl = (dt_opencl_t *)calloc(1, sizeof(dt_opencl_t));
   #ifdef HAVE_OPENCL
     dt_opencl_init(darktable.opencl, exclude_opencl, print_statistics);
   #endif
+  _print_init_step("opencl", &step_wtime);
 
   darktable.imageio = (dt_imageio_t *)calloc(1, sizeof(dt_imageio_t));
   dt_imageio_init(darktable.imageio);
@@ -1149,6 +1168,9 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
   darktable.iop_order_list = dt_ioppr_get_iop_order_list(0, FALSE);
   // load iop order rules
   darktable.iop_order_rules = dt_ioppr_get_iop_order_rules();
+  // process-wide cache of baked colour LUTs for exports
+  dt_dev_lut_bake_init();
+
   // load the darkroom mode plugins once:
   dt_iop_load_modules_so();
   // check if all modules have a iop order assigned
@@ -1160,6 +1182,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 
   // set up memory.darktable_iop_names table
   dt_iop_set_darktable_iop_table();
+  _print_init_step("processing modules", &step_wtime);
 
   // set up the list of exiv2 metadata
   dt_exif_set_exiv2_taglist();
@@ -1183,6 +1206,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
 
     // initialize undo struct
     darktable.undo = dt_undo_init();
+    _print_init_step("utility modules and view guis", &step_wtime);
   }
 
   if(darktable.unmuted & DT_DEBUG_MEMORY)
@@ -1233,7 +1257,7 @@ int dt_init(int argc, char *argv[], const gboolean init_gui, const gboolean load
     //gtk_window_add_accel_group(GTK_WINDOW(dt_ui_main_window(darktable.gui->ui)), darktable.gui->accels->global_accels);
   }
 
-  dt_print(DT_DEBUG_CONTROL, "[init] startup took %f seconds\n", dt_get_wtime() - start_wtime);
+  dt_print(DT_DEBUG_CONTROL | DT_DEBUG_PERF, "[init] startup took %f seconds\n", dt_get_wtime() - start_wtime);
 
   return 0;
 }
@@ -1310,6 +1334,9 @@ void dt_cleanup()
   dt_points_cleanup(darktable.points);
   free(darktable.points);
   dt_iop_unload_modules_so();
+  dt_dev_lut_bake_cleanup();
+  dt_gf_scratch_cleanup();
+  dt_bilateral_cache_cleanup();
   g_list_free_full(darktable.iop_order_list, free);
   darktable.iop_order_list = NULL;
   g_list_free_full(darktable.iop_order_rules, free);
@@ -1325,6 +1352,7 @@ void dt_cleanup()
 #endif
 
   dt_guides_cleanup(darktable.guides);
+  dt_presets_index_cleanup();
 
   if(perform_maintenance)
   {
@@ -1371,7 +1399,6 @@ void dt_cleanup()
   dt_pthread_mutex_destroy(&(darktable.plugin_threadsafe));
   dt_pthread_mutex_destroy(&(darktable.capabilities_threadsafe));
   dt_pthread_mutex_destroy(&(darktable.exiv2_threadsafe));
-  dt_pthread_mutex_destroy(&(darktable.readFile_mutex));
   dt_pthread_mutex_destroy(&(darktable.pipeline_threadsafe));
   dt_pthread_rwlock_destroy(&(darktable.database_threadsafe));
 
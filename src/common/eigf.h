@@ -74,7 +74,7 @@ static inline void eigf_variance_analysis(const float *const restrict guide, //
 {
   // We also use gaussian blurs instead of the square blurs of the guided filter
   const size_t Ndim = width * height;
-  float *const restrict in = dt_alloc_sse_ps(Ndim * 4);
+  float *const restrict in = dt_gf_scratch_alloc(Ndim * 4);
 
   float ming = 10000000.0f;
   float maxg = 0.0f;
@@ -129,7 +129,7 @@ dt_omp_firstprivate(out, Ndim) \
     out[4 * k + 3] -= out[4 * k] * out[4 * k + 2];
   }
 
-  dt_free_align(in);
+  dt_gf_scratch_free(in);
 }
 
 // same function as above, but specialized for the case where guide == mask
@@ -141,7 +141,7 @@ static inline void eigf_variance_analysis_no_mask(const float *const restrict gu
 {
   // We also use gaussian blurs instead of the square blurs of the guided filter
   const size_t Ndim = width * height;
-  float *const restrict in = dt_alloc_sse_ps(Ndim * 2);
+  float *const restrict in = dt_gf_scratch_alloc(Ndim * 2);
 
   float ming = 10000000.0f;
   float maxg = 0.0f;
@@ -184,7 +184,7 @@ dt_omp_firstprivate(out, Ndim) \
     out[2 * k + 1] -= avg * avg;
   }
 
-  dt_free_align(in);
+  dt_gf_scratch_free(in);
 }
 
 void eigf_blending(float *const restrict image, const float *const restrict mask,
@@ -256,14 +256,16 @@ void eigf_blending_no_mask(float *const restrict image,
 }
 
 __DT_CLONE_TARGETS__
-static inline void fast_eigf_surface_blur(float *const restrict image,
-                                      const size_t width, const size_t height,
-                                      const float sigma, float feathering, const int iterations,
-                                      const dt_iop_guided_filter_blending_t filter, const float scale,
-                                      const float quantization, const float quantize_min, const float quantize_max)
+static inline gboolean fast_eigf_surface_blur(float *const restrict image,
+                                              const size_t width, const size_t height,
+                                              const float sigma, float feathering, const int iterations,
+                                              const dt_iop_guided_filter_blending_t filter, const float scale,
+                                              const float quantization, const float quantize_min,
+                                              const float quantize_max, dt_atomic_int *const cancel)
 {
   // Works in-place on a grey image
   // mostly similar with fast_surface_blur from fast_guided_filter.h
+  gboolean success = FALSE;
 
   // A down-scaling of 4 seems empirically safe and consistent no matter the image zoom level
   // see reference paper above for proof.
@@ -276,12 +278,12 @@ static inline void fast_eigf_surface_blur(float *const restrict image,
   const size_t num_elem_ds = ds_width * ds_height;
   const size_t num_elem = width * height;
 
-  float *const restrict mask = dt_alloc_sse_ps(dt_round_size_sse(num_elem));
-  float *const restrict ds_image = dt_alloc_sse_ps(dt_round_size_sse(num_elem_ds));
-  float *const restrict ds_mask = dt_alloc_sse_ps(dt_round_size_sse(num_elem_ds));
+  float *const restrict mask = dt_gf_scratch_alloc(dt_round_size_sse(num_elem));
+  float *const restrict ds_image = dt_gf_scratch_alloc(dt_round_size_sse(num_elem_ds));
+  float *const restrict ds_mask = dt_gf_scratch_alloc(dt_round_size_sse(num_elem_ds));
   // average - variance arrays: store the guide and mask averages and variances
-  float *const restrict ds_av = dt_alloc_sse_ps(dt_round_size_sse(num_elem_ds * 4));
-  float *const restrict av = dt_alloc_sse_ps(dt_round_size_sse(num_elem * 4));
+  float *const restrict ds_av = dt_gf_scratch_alloc(dt_round_size_sse(num_elem_ds * 4));
+  float *const restrict av = dt_gf_scratch_alloc(dt_round_size_sse(num_elem * 4));
 
   if(!ds_image || !ds_mask || !ds_av || !av)
   {
@@ -292,6 +294,8 @@ static inline void fast_eigf_surface_blur(float *const restrict image,
   // Iterations of filter models the diffusion, sort of
   for(int i = 0; i < iterations; i++)
   {
+    if(cancel && dt_atomic_get_int(cancel)) goto clean;
+
     // blend linear for all intermediate images
     dt_iop_guided_filter_blending_t blend = DT_GF_BLENDING_LINEAR;
     // use filter for last iteration
@@ -322,12 +326,15 @@ static inline void fast_eigf_surface_blur(float *const restrict image,
     }
   }
 
+  success = TRUE;
+
 clean:
-  if(av) dt_free_align(av);
-  if(ds_av) dt_free_align(ds_av);
-  if(ds_mask) dt_free_align(ds_mask);
-  if(ds_image) dt_free_align(ds_image);
-  if(mask) dt_free_align(mask);
+  dt_gf_scratch_free(av);
+  dt_gf_scratch_free(ds_av);
+  dt_gf_scratch_free(ds_mask);
+  dt_gf_scratch_free(ds_image);
+  dt_gf_scratch_free(mask);
+  return success;
 }
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
@@ -25,8 +25,10 @@
 #include <string.h>
 #include <time.h>
 
+#include "common/atomic.h"
 #include "common/box_filters.h"
 #include "common/darktable.h"
+#include "common/guided_filter.h"
 #include "common/imagebuf.h"
 #include "control/control.h"
 
@@ -173,7 +175,7 @@ static inline void variance_analyse(const float *const restrict guide, // I
   /*
   * input is array of struct : { { guide , mask, guide * guide, guide * mask } }
   */
-  float *const restrict input = dt_alloc_align_float(Ndimch);
+  float *const restrict input = dt_gf_scratch_alloc(Ndimch);
 
   // Pre-multiply guide and mask and pack all inputs into an array of 4x1 SIMD struct
 #ifdef _OPENMP
@@ -208,7 +210,7 @@ static inline void variance_analyse(const float *const restrict guide, // I
     ab[2*idx+1] = b;
   }
 
-  if(input != NULL) dt_free_align(input);
+  dt_gf_scratch_free(input);
 }
 
 
@@ -287,14 +289,18 @@ schedule(simd:static) aligned(image, out:64)
 }
 
 
+// `cancel` is an optional flag (typically the pixelpipe kill-switch) polled between iterations.
+// Returns FALSE if the filter was interrupted or failed, leaving `image` unfinished.
 __DT_CLONE_TARGETS__
-static inline void fast_surface_blur(float *const restrict image,
-                                      const size_t width, const size_t height,
-                                      const int radius, float feathering, const int iterations,
-                                      const dt_iop_guided_filter_blending_t filter, const float scale,
-                                      const float quantization, const float quantize_min, const float quantize_max)
+static inline gboolean fast_surface_blur(float *const restrict image,
+                                         const size_t width, const size_t height,
+                                         const int radius, float feathering, const int iterations,
+                                         const dt_iop_guided_filter_blending_t filter, const float scale,
+                                         const float quantization, const float quantize_min, const float quantize_max,
+                                         dt_atomic_int *const cancel)
 {
   // Works in-place on a grey image
+  gboolean success = FALSE;
 
   // A down-scaling of 4 seems empirically safe and consistent no matter the image zoom level
   // see reference paper above for proof.
@@ -307,10 +313,10 @@ static inline void fast_surface_blur(float *const restrict image,
   const size_t num_elem_ds = ds_width * ds_height;
   const size_t num_elem = width * height;
 
-  float *const restrict ds_image = dt_alloc_sse_ps(dt_round_size_sse(num_elem_ds));
-  float *const restrict ds_mask = dt_alloc_sse_ps(dt_round_size_sse(num_elem_ds));
-  float *const restrict ds_ab = dt_alloc_sse_ps(dt_round_size_sse(num_elem_ds * 2));
-  float *const restrict ab = dt_alloc_sse_ps(dt_round_size_sse(num_elem * 2));
+  float *const restrict ds_image = dt_gf_scratch_alloc(dt_round_size_sse(num_elem_ds));
+  float *const restrict ds_mask = dt_gf_scratch_alloc(dt_round_size_sse(num_elem_ds));
+  float *const restrict ds_ab = dt_gf_scratch_alloc(dt_round_size_sse(num_elem_ds * 2));
+  float *const restrict ab = dt_gf_scratch_alloc(dt_round_size_sse(num_elem * 2));
 
   if(!ds_image || !ds_mask || !ds_ab || !ab)
   {
@@ -324,6 +330,8 @@ static inline void fast_surface_blur(float *const restrict image,
   // Iterations of filter models the diffusion, sort of
   for(int i = 0; i < iterations; ++i)
   {
+    if(cancel && dt_atomic_get_int(cancel)) goto clean;
+
     // (Re)build the mask from the quantized image to help guiding
     quantize(ds_image, ds_mask, ds_width * ds_height, quantization, quantize_min, quantize_max);
 
@@ -350,11 +358,14 @@ static inline void fast_surface_blur(float *const restrict image,
   else if(filter == DT_GF_BLENDING_GEOMEAN)
     apply_linear_blending_w_geomean(image, ab, num_elem);
 
+  success = TRUE;
+
 clean:
-  if(ab) dt_free_align(ab);
-  if(ds_ab) dt_free_align(ds_ab);
-  if(ds_mask) dt_free_align(ds_mask);
-  if(ds_image) dt_free_align(ds_image);
+  dt_gf_scratch_free(ab);
+  dt_gf_scratch_free(ds_ab);
+  dt_gf_scratch_free(ds_mask);
+  dt_gf_scratch_free(ds_image);
+  return success;
 }
 
 // clang-format off
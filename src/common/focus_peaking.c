@@ -63,7 +63,7 @@ void dt_focuspeaking(cairo_t *cr,
     }
 
   // Prefilter noise
-  fast_eigf_surface_blur(luma, buf_width, buf_height, 12, 0.00005f, 4, DT_GF_BLENDING_LINEAR, 1, 0.0f, exp2f(-8.0f), 1.0f);
+  fast_eigf_surface_blur(luma, buf_width, buf_height, 12, 0.00005f, 4, DT_GF_BLENDING_LINEAR, 1, 0.0f, exp2f(-8.0f), 1.0f, NULL);
 
   // Compute the laplacian of a gaussian
   float mass = 0.f;
@@ -186,7 +186,7 @@ schedule(static) collapse(2)
   dt_box_mean(luma, buf_height, buf_width, 1, 3, 1);
 
   // Postfilter to connect isolated dots and draw lines
-  fast_eigf_surface_blur(luma, buf_width, buf_height, 12, 0.000005f, 1, DT_GF_BLENDING_LINEAR, 1, 0.0f, exp2f(-8.0f), 1.0f);
+  fast_eigf_surface_blur(luma, buf_width, buf_height, 12, 0.000005f, 1, DT_GF_BLENDING_LINEAR, 1, 0.0f, exp2f(-8.0f), 1.0f, NULL);
 
   // Compute the laplacian mean over the picture
   float TV_sum = 0.0f;
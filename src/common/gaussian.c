@@ -19,15 +19,19 @@
 
 #include <assert.h>
 #include <math.h>
-#if defined(__SSE__)
-#include <xmmintrin.h>
-#endif
 #include "common/gaussian.h"
 #include "common/math.h"
 #include "common/opencl.h"
 
 #define BLOCKSIZE (1 << 6)
 
+// Number of floats filtered together by the recursive kernel. The vertical pass walks panels of
+// two cache lines down the image, which keeps the hardware prefetcher busy on large strides; the
+// horizontal pass gathers one cache line per column step (16 single-channel rows or 4 RGBA rows)
+// into a transposed tile small enough to stay in L2.
+#define IIR_PANEL_LANES 32
+#define IIR_TILE_LANES 16
+
 static void compute_gauss_params(const float sigma, dt_gaussian_order_t order, float *a0, float *a1,
                                  float *a2, float *a3, float *b1, float *b2, float *coefp, float *coefn)
 {
@@ -128,6 +132,7 @@ dt_gaussian_t *dt_gaussian_init(const int width,    // width of input image
   g->sigma = sigma;
   g->order = order;
   g->buf = NULL;
+  g->tiles = NULL;
   g->max = (float *)calloc(channels, sizeof(float));
   g->min = (float *)calloc(channels, sizeof(float));
 
@@ -142,10 +147,15 @@ dt_gaussian_t *dt_gaussian_init(const int width,    // width of input image
   g->buf = dt_alloc_align_float((size_t)channels * width * height);
   if(!g->buf) goto error;
 
+  // two tiles of IIR_TILE_LANES floats per column and per thread, see dt_gaussian_blur()
+  g->tiles = dt_alloc_perthread_float((size_t)2 * IIR_TILE_LANES * width, &g->tiles_padded);
+  if(!g->tiles) goto error;
+
   return g;
 
 error:
   dt_free_align(g->buf);
+  dt_free_align(g->tiles);
   free(g->max);
   free(g->min);
   free(g);
@@ -153,351 +163,214 @@ error:
 }
 
 
-void dt_gaussian_blur(dt_gaussian_t *g, const float *const in, float *const out)
+typedef struct dt_gaussian_coefs_t
 {
-
-  const int width = g->width;
-  const int height = g->height;
-  const int ch = MIN(4, g->channels); // just to appease zealous compiler warnings about stack usage
-
   float a0, a1, a2, a3, b1, b2, coefp, coefn;
+} dt_gaussian_coefs_t;
+
+// Run the forward and backward recursions over n steps of a block of `lanes` independent signals.
+// Step j of lane l reads src[j * src_stride + l] and writes dst[j * dst_stride + l], so the
+// same kernel filters contiguous columns in place (vertical pass) or rows gathered into a
+// transposed tile (horizontal pass). Every step touches one contiguous vector, which the
+// compiler vectorizes across lanes instead of walking a single column with a large stride.
+static inline void _iir_block(const float *const restrict src, const size_t src_stride,
+                              float *const restrict dst, const size_t dst_stride,
+                              const size_t n, const int lanes,
+                              const float *const restrict lmin, const float *const restrict lmax,
+                              const dt_gaussian_coefs_t *const c)
+{
+  const float a0 = c->a0, a1 = c->a1, a2 = c->a2, a3 = c->a3;
+  const float b1 = c->b1, b2 = c->b2, coefp = c->coefp, coefn = c->coefn;
 
-  compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
-
-  float *temp = g->buf;
+  float DT_ALIGNED_ARRAY xp[IIR_PANEL_LANES];
+  float DT_ALIGNED_ARRAY yp[IIR_PANEL_LANES];
+  float DT_ALIGNED_ARRAY yb[IIR_PANEL_LANES];
 
-  float *Labmax = g->max;
-  float *Labmin = g->min;
+  // forward filter
+  for(int l = 0; l < lanes; l++)
+  {
+    xp[l] = CLAMPF(src[l], lmin[l], lmax[l]);
+    yb[l] = xp[l] * coefp;
+    yp[l] = yb[l];
+  }
 
-// vertical blur column by column
+  for(size_t j = 0; j < n; j++)
+  {
+    const float *const restrict s = src + j * src_stride;
+    float *const restrict d = dst + j * dst_stride;
 #ifdef _OPENMP
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(in, width, height, ch) \
-  shared(temp, Labmin, Labmax, a0, a1, a2, a3, b1, b2, coefp, coefn) \
-  schedule(static)
+#pragma omp simd aligned(xp, yp, yb, lmin, lmax : 64)
 #endif
-  for(int i = 0; i < width; i++)
-  {
-    dt_aligned_pixel_t xp = {0.0f};
-    dt_aligned_pixel_t yb = {0.0f};
-    dt_aligned_pixel_t yp = {0.0f};
-
-    // forward filter
-    for(int k = 0; k < ch; k++)
-    {
-      xp[k] = CLAMPF(in[(size_t)i * ch + k], Labmin[k], Labmax[k]);
-      yb[k] = xp[k] * coefp;
-      yp[k] = yb[k];
-    }
-
-    dt_aligned_pixel_t xc = {0.0f};
-    dt_aligned_pixel_t yc = {0.0f};
-    dt_aligned_pixel_t xn = {0.0f};
-    dt_aligned_pixel_t xa = {0.0f};
-    dt_aligned_pixel_t yn = {0.0f};
-    dt_aligned_pixel_t ya = {0.0f};
-    for(int j = 0; j < height; j++)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      for(int k = 0; k < ch; k++)
-      {
-        xc[k] = CLAMPF(in[offset + k], Labmin[k], Labmax[k]);
-        yc[k] = (a0 * xc[k]) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
-
-        temp[offset + k] = yc[k];
-
-        xp[k] = xc[k];
-        yb[k] = yp[k];
-        yp[k] = yc[k];
-      }
-    }
-
-    // backward filter
-    for(int k = 0; k < ch; k++)
+    for(int l = 0; l < lanes; l++)
     {
-      xn[k] = CLAMPF(in[((size_t)(height - 1) * width + i) * ch + k], Labmin[k], Labmax[k]);
-      xa[k] = xn[k];
-      yn[k] = xn[k] * coefn;
-      ya[k] = yn[k];
+      const float xc = CLAMPF(s[l], lmin[l], lmax[l]);
+      const float yc = (a0 * xc) + (a1 * xp[l]) - (b1 * yp[l]) - (b2 * yb[l]);
+      d[l] = yc;
+      xp[l] = xc;
+      yb[l] = yp[l];
+      yp[l] = yc;
     }
+  }
 
-    for(int j = height - 1; j > -1; j--)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      for(int k = 0; k < ch; k++)
-      {
-        xc[k] = CLAMPF(in[offset + k], Labmin[k], Labmax[k]);
-
-        yc[k] = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
-
-        xa[k] = xn[k];
-        xn[k] = xc[k];
-        ya[k] = yn[k];
-        yn[k] = yc[k];
+  // backward filter, reusing the forward state arrays as xn, yn, ya
+  float DT_ALIGNED_ARRAY xa[IIR_PANEL_LANES];
+  float *const restrict xn = xp;
+  float *const restrict yn = yp;
+  float *const restrict ya = yb;
+  const float *const restrict last = src + (n - 1) * src_stride;
 
-        temp[offset + k] += yc[k];
-      }
-    }
+  for(int l = 0; l < lanes; l++)
+  {
+    xn[l] = CLAMPF(last[l], lmin[l], lmax[l]);
+    xa[l] = xn[l];
+    yn[l] = xn[l] * coefn;
+    ya[l] = yn[l];
   }
 
-// horizontal blur line by line
+  for(size_t j = n; j > 0; j--)
+  {
+    const float *const restrict s = src + (j - 1) * src_stride;
+    float *const restrict d = dst + (j - 1) * dst_stride;
 #ifdef _OPENMP
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(out, ch, width, height) \
-  shared(temp, Labmin, Labmax, a0, a1, a2, a3, b1, b2, coefp, coefn) \
-  schedule(static)
+#pragma omp simd aligned(xn, xa, yn, ya, lmin, lmax : 64)
 #endif
-  for(int j = 0; j < height; j++)
-  {
-    dt_aligned_pixel_t xp = {0.0f};
-    dt_aligned_pixel_t yb = {0.0f};
-    dt_aligned_pixel_t yp = {0.0f};
-
-    // forward filter
-    for(int k = 0; k < ch; k++)
-    {
-      xp[k] = CLAMPF(temp[(size_t)j * width * ch + k], Labmin[k], Labmax[k]);
-      yb[k] = xp[k] * coefp;
-      yp[k] = yb[k];
-    }
-
-    dt_aligned_pixel_t xc = {0.0f};
-    dt_aligned_pixel_t yc = {0.0f};
-    dt_aligned_pixel_t xn = {0.0f};
-    dt_aligned_pixel_t xa = {0.0f};
-    dt_aligned_pixel_t yn = {0.0f};
-    dt_aligned_pixel_t ya = {0.0f};
-
-    for(int i = 0; i < width; i++)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      for(int k = 0; k < ch; k++)
-      {
-        xc[k] = CLAMPF(temp[offset + k], Labmin[k], Labmax[k]);
-        yc[k] = (a0 * xc[k]) + (a1 * xp[k]) - (b1 * yp[k]) - (b2 * yb[k]);
-
-        out[offset + k] = yc[k];
-
-        xp[k] = xc[k];
-        yb[k] = yp[k];
-        yp[k] = yc[k];
-      }
-    }
-
-    // backward filter
-    for(int k = 0; k < ch; k++)
+    for(int l = 0; l < lanes; l++)
     {
-      xn[k] = CLAMPF(temp[((size_t)(j + 1) * width - 1) * ch + k], Labmin[k], Labmax[k]);
-      xa[k] = xn[k];
-      yn[k] = xn[k] * coefn;
-      ya[k] = yn[k];
-    }
-
-    for(int i = width - 1; i > -1; i--)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      for(int k = 0; k < ch; k++)
-      {
-        xc[k] = CLAMPF(temp[offset + k], Labmin[k], Labmax[k]);
-
-        yc[k] = (a2 * xn[k]) + (a3 * xa[k]) - (b1 * yn[k]) - (b2 * ya[k]);
-
-        xa[k] = xn[k];
-        xn[k] = xc[k];
-        ya[k] = yn[k];
-        yn[k] = yc[k];
-
-        out[offset + k] += yc[k];
-      }
+      const float xc = CLAMPF(s[l], lmin[l], lmax[l]);
+      const float yc = (a2 * xn[l]) + (a3 * xa[l]) - (b1 * yn[l]) - (b2 * ya[l]);
+      xa[l] = xn[l];
+      xn[l] = xc;
+      ya[l] = yn[l];
+      yn[l] = yc;
+      d[l] += yc;
     }
   }
 }
 
-
-
-#if defined(__SSE__)
-static void dt_gaussian_blur_4c_sse(dt_gaussian_t *g, const float *const in, float *const out)
+// Dispatch a block to the kernel with a compile-time lane count for full blocks, so the inner
+// loops get fully unrolled into vector instructions, and a runtime count for the image border.
+static inline void _iir_dispatch(const float *const restrict src, const size_t src_stride,
+                                 float *const restrict dst, const size_t dst_stride,
+                                 const size_t n, const int lanes,
+                                 const float *const restrict lmin, const float *const restrict lmax,
+                                 const dt_gaussian_coefs_t *const c)
 {
+  if(lanes == IIR_PANEL_LANES)
+    _iir_block(src, src_stride, dst, dst_stride, n, IIR_PANEL_LANES, lmin, lmax, c);
+  else if(lanes == IIR_TILE_LANES)
+    _iir_block(src, src_stride, dst, dst_stride, n, IIR_TILE_LANES, lmin, lmax, c);
+  else
+    _iir_block(src, src_stride, dst, dst_stride, n, lanes, lmin, lmax, c);
+}
 
+__DT_CLONE_TARGETS__
+void dt_gaussian_blur(dt_gaussian_t *g, const float *const in, float *const out)
+{
   const int width = g->width;
   const int height = g->height;
-  const int ch = 4;
-
-  assert(g->channels == 4);
-
-  float a0, a1, a2, a3, b1, b2, coefp, coefn;
-
-  compute_gauss_params(g->sigma, g->order, &a0, &a1, &a2, &a3, &b1, &b2, &coefp, &coefn);
+  const int ch = MIN(4, g->channels); // just to appease zealous compiler warnings about stack usage
 
-  const __m128 Labmax = _mm_set_ps(g->max[3], g->max[2], g->max[1], g->max[0]);
-  const __m128 Labmin = _mm_set_ps(g->min[3], g->min[2], g->min[1], g->min[0]);
+  dt_gaussian_coefs_t c;
+  compute_gauss_params(g->sigma, g->order, &c.a0, &c.a1, &c.a2, &c.a3, &c.b1, &c.b2, &c.coefp, &c.coefn);
 
-  float *temp = g->buf;
+  float *const temp = g->buf;
+  const float *const Labmax = g->max;
+  const float *const Labmin = g->min;
 
+  const size_t row_floats = (size_t)width * ch;
+  const size_t col_blocks = (row_floats + IIR_PANEL_LANES - 1) / IIR_PANEL_LANES;
 
-// vertical blur column by column
+  // vertical blur, IIR_PANEL_LANES contiguous floats of each row at a time: the recursion walks
+  // down the panel two cache lines per row instead of striding down one column at a time.
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(in, Labmin, Labmax, width, height, ch) \
-  shared(temp, a0, a1, a2, a3, b1, b2, coefp, coefn) \
+  dt_omp_firstprivate(in, temp, Labmin, Labmax, height, ch, row_floats, col_blocks) \
+  shared(c) \
   schedule(static)
 #endif
-  for(int i = 0; i < width; i++)
+  for(size_t b = 0; b < col_blocks; b++)
   {
-    __m128 xp = _mm_setzero_ps();
-    __m128 yb = _mm_setzero_ps();
-    __m128 yp = _mm_setzero_ps();
-    __m128 xc = _mm_setzero_ps();
-    __m128 yc = _mm_setzero_ps();
-    __m128 xn = _mm_setzero_ps();
-    __m128 xa = _mm_setzero_ps();
-    __m128 yn = _mm_setzero_ps();
-    __m128 ya = _mm_setzero_ps();
-
-    // forward filter
-    xp = MMCLAMPPS(_mm_load_ps(in + i * ch), Labmin, Labmax);
-    yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
-    yp = yb;
-
-
-    for(int j = 0; j < height; j++)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(in + offset), Labmin, Labmax);
-
-
-      yc = _mm_add_ps(
-          _mm_mul_ps(xc, _mm_set_ps1(a0)),
-          _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
-                     _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
-
-      _mm_store_ps(temp + offset, yc);
+    const size_t x0 = b * IIR_PANEL_LANES;
+    const int lanes = MIN(IIR_PANEL_LANES, (int)(row_floats - x0));
 
-      xp = xc;
-      yb = yp;
-      yp = yc;
-    }
-
-    // backward filter
-    xn = MMCLAMPPS(_mm_load_ps(in + ((size_t)(height - 1) * width + i) * ch), Labmin, Labmax);
-    xa = xn;
-    yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
-    ya = yn;
-
-    for(int j = height - 1; j > -1; j--)
+    float DT_ALIGNED_ARRAY lmin[IIR_PANEL_LANES];
+    float DT_ALIGNED_ARRAY lmax[IIR_PANEL_LANES];
+    for(int l = 0; l < IIR_PANEL_LANES; l++)
     {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(in + offset), Labmin, Labmax);
-
-      yc = _mm_add_ps(
-          _mm_mul_ps(xn, _mm_set_ps1(a2)),
-          _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
-                     _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
+      lmin[l] = Labmin[(x0 + l) % ch];
+      lmax[l] = Labmax[(x0 + l) % ch];
+    }
 
+    _iir_dispatch(in + x0, row_floats, temp + x0, row_floats, height, lanes, lmin, lmax, &c);
+  }
 
-      xa = xn;
-      xn = xc;
-      ya = yn;
-      yn = yc;
+  // horizontal blur: gather as many whole rows as fit in IIR_TILE_LANES into a transposed tile, so
+  // each step of the recursion reads the same column of all these rows from one cache line.
+  const int rows_per_tile = IIR_TILE_LANES / ch;
+  const int row_tiles = (height + rows_per_tile - 1) / rows_per_tile;
 
-      _mm_store_ps(temp + offset, _mm_add_ps(_mm_load_ps(temp + offset), yc));
-    }
-  }
+  float *const tiles = g->tiles;
+  const size_t padded_size = g->tiles_padded;
 
-// horizontal blur line by line
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(out, Labmin, Labmax, width, height, ch) \
-  shared(temp, a0, a1, a2, a3, b1, b2, coefp, coefn) \
+  dt_omp_firstprivate(out, temp, tiles, padded_size, Labmin, Labmax, width, height, ch, row_floats, \
+                      rows_per_tile, row_tiles) \
+  shared(c) \
   schedule(static)
 #endif
-  for(size_t j = 0; j < height; j++)
+  for(int t = 0; t < row_tiles; t++)
   {
-    __m128 xp = _mm_setzero_ps();
-    __m128 yb = _mm_setzero_ps();
-    __m128 yp = _mm_setzero_ps();
-    __m128 xc = _mm_setzero_ps();
-    __m128 yc = _mm_setzero_ps();
-    __m128 xn = _mm_setzero_ps();
-    __m128 xa = _mm_setzero_ps();
-    __m128 yn = _mm_setzero_ps();
-    __m128 ya = _mm_setzero_ps();
-
-    // forward filter
-    xp = MMCLAMPPS(_mm_load_ps(temp + j * width * ch), Labmin, Labmax);
-    yb = _mm_mul_ps(_mm_set_ps1(coefp), xp);
-    yp = yb;
-
-
-    for(int i = 0; i < width; i++)
-    {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(temp + offset), Labmin, Labmax);
-
-      yc = _mm_add_ps(
-          _mm_mul_ps(xc, _mm_set_ps1(a0)),
-          _mm_sub_ps(_mm_mul_ps(xp, _mm_set_ps1(a1)),
-                     _mm_add_ps(_mm_mul_ps(yp, _mm_set_ps1(b1)), _mm_mul_ps(yb, _mm_set_ps1(b2)))));
+    float *const restrict tile_in = dt_get_perthread(tiles, padded_size);
+    float *const restrict tile_out = tile_in + (size_t)IIR_TILE_LANES * width;
 
-      _mm_store_ps(out + offset, yc);
+    const int j0 = t * rows_per_tile;
+    const int rows = MIN(rows_per_tile, height - j0);
+    const int lanes = rows * ch;
 
-      xp = xc;
-      yb = yp;
-      yp = yc;
+    float DT_ALIGNED_ARRAY lmin[IIR_TILE_LANES] = { 0.0f };
+    float DT_ALIGNED_ARRAY lmax[IIR_TILE_LANES] = { 0.0f };
+    for(int l = 0; l < lanes; l++)
+    {
+      lmin[l] = Labmin[l % ch];
+      lmax[l] = Labmax[l % ch];
     }
 
-    // backward filter
-    xn = MMCLAMPPS(_mm_load_ps(temp + ((size_t)(j + 1) * width - 1) * ch), Labmin, Labmax);
-    xa = xn;
-    yn = _mm_mul_ps(_mm_set_ps1(coefn), xn);
-    ya = yn;
-
-
-    for(int i = width - 1; i > -1; i--)
+    // transpose rows j0 .. j0 + rows into the tile
+    for(int r = 0; r < rows; r++)
     {
-      size_t offset = ((size_t)j * width + i) * ch;
-
-      xc = MMCLAMPPS(_mm_load_ps(temp + offset), Labmin, Labmax);
-
-      yc = _mm_add_ps(
-          _mm_mul_ps(xn, _mm_set_ps1(a2)),
-          _mm_sub_ps(_mm_mul_ps(xa, _mm_set_ps1(a3)),
-                     _mm_add_ps(_mm_mul_ps(yn, _mm_set_ps1(b1)), _mm_mul_ps(ya, _mm_set_ps1(b2)))));
-
+      const float *const restrict row = temp + (size_t)(j0 + r) * row_floats;
+      for(int i = 0; i < width; i++)
+        for(int k = 0; k < ch; k++)
+          tile_in[(size_t)i * IIR_TILE_LANES + r * ch + k] = row[(size_t)i * ch + k];
+    }
 
-      xa = xn;
-      xn = xc;
-      ya = yn;
-      yn = yc;
+    _iir_dispatch(tile_in, IIR_TILE_LANES, tile_out, IIR_TILE_LANES, width, lanes, lmin, lmax, &c);
 
-      _mm_store_ps(out + offset, _mm_add_ps(_mm_load_ps(out + offset), yc));
+    // transpose back into the output rows
+    for(int r = 0; r < rows; r++)
+    {
+      float *const restrict row = out + (size_t)(j0 + r) * row_floats;
+      for(int i = 0; i < width; i++)
+        for(int k = 0; k < ch; k++)
+          row[(size_t)i * ch + k] = tile_out[(size_t)i * IIR_TILE_LANES + r * ch + k];
     }
   }
 }
-#endif
 
 void dt_gaussian_blur_4c(dt_gaussian_t *g, const float *const in, float *const out)
 {
-  if(darktable.codepath.OPENMP_SIMD) return dt_gaussian_blur(g, in, out);
-#if defined(__SSE__)
-  else if(darktable.codepath.SSE2)
-    return dt_gaussian_blur_4c_sse(g, in, out);
-#endif
-  else
-    dt_unreachable_codepath();
+  // the blocked kernel above vectorizes across 4 pixels at once, which supersedes the former
+  // one-pixel-per-step SSE path
+  assert(g->channels == 4);
+  dt_gaussian_blur(g, in, out);
 }
 
 void dt_gaussian_free(dt_gaussian_t *g)
 {
   if(!g) return;
   dt_free_align(g->buf);
+  dt_free_align(g->tiles);
   free(g->min);
   free(g->max);
   free(g);
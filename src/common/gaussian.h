@@ -38,6 +38,8 @@ typedef struct dt_gaussian_t
   float *max;
   float *min;
   float *buf;
+  float *tiles;       // per-thread transposition tiles for the horizontal pass
+  size_t tiles_padded;
 } dt_gaussian_t;
 
 dt_gaussian_t *dt_gaussian_init(const int width, const int height, const int channels, const float *max,
@@ -32,6 +32,7 @@
 #include "common/guided_filter.h"
 #include "common/math.h"
 #include "common/opencl.h"
+#include "control/control.h"
 #include <assert.h>
 #include <float.h>
 #include <stdlib.h>
@@ -70,16 +71,127 @@ typedef struct color_image
   int width, height, stride;
 } color_image;
 
+// Pool of scratch buffers, shared by all guided filter variants.
+// The filters run once per tile, iteration or blend mask, and freshly allocated buffers
+// of several MB have to be page-faulted in each time. Recycling them is much cheaper.
+// Buffers larger than GF_SCRATCH_MAX_BYTES are not pooled, to not hold full-resolution
+// temporaries in memory, and the pool never holds more than GF_SCRATCH_TOTAL_BYTES.
+// The pool is emptied when a pipe is cleaned up.
+#define GF_SCRATCH_SLOTS 8
+#define GF_SCRATCH_MAX_BYTES ((size_t)64 << 20)
+#define GF_SCRATCH_TOTAL_BYTES ((size_t)128 << 20)
+
+typedef struct gf_scratch_slot
+{
+  float *buf;
+  size_t size; // in floats
+  gboolean used;
+} gf_scratch_slot;
+
+static gf_scratch_slot _scratch[GF_SCRATCH_SLOTS] = { { NULL, 0, FALSE } };
+static size_t _scratch_total = 0; // in floats
+static GMutex _scratch_lock;
+
+static void _scratch_release_slot(gf_scratch_slot *slot)
+{
+  dt_free_align(slot->buf);
+  _scratch_total -= slot->size;
+  slot->buf = NULL;
+  slot->size = 0;
+}
+
+float *dt_gf_scratch_alloc(const size_t nfloats)
+{
+  if(nfloats * sizeof(float) > GF_SCRATCH_MAX_BYTES) return dt_alloc_align_float(nfloats);
+
+  float *buf = NULL;
+  g_mutex_lock(&_scratch_lock);
+
+  // best fit among the free slots already large enough, else recycle any free slot
+  int best = -1;
+  int any = -1;
+  for(int k = 0; k < GF_SCRATCH_SLOTS; k++)
+  {
+    if(_scratch[k].used) continue;
+    if(_scratch[k].buf && _scratch[k].size >= nfloats && (best < 0 || _scratch[k].size < _scratch[best].size))
+      best = k;
+    if(any < 0 || _scratch[k].buf == NULL) any = k;
+  }
+
+  if(best < 0 && any >= 0)
+  {
+    _scratch_release_slot(&_scratch[any]);
+
+    // make room by dropping the other free buffers, else don't pool this one
+    const size_t max_total = GF_SCRATCH_TOTAL_BYTES / sizeof(float);
+    for(int k = 0; k < GF_SCRATCH_SLOTS && _scratch_total + nfloats > max_total; k++)
+      if(!_scratch[k].used && _scratch[k].buf) _scratch_release_slot(&_scratch[k]);
+
+    if(_scratch_total + nfloats <= max_total)
+    {
+      _scratch[any].buf = dt_alloc_align_float(nfloats);
+      if(_scratch[any].buf)
+      {
+        _scratch[any].size = nfloats;
+        _scratch_total += nfloats;
+        best = any;
+      }
+    }
+  }
+
+  if(best >= 0)
+  {
+    _scratch[best].used = TRUE;
+    buf = _scratch[best].buf;
+  }
+
+  g_mutex_unlock(&_scratch_lock);
+
+  // all slots busy, or the pool is full: fall back to a plain allocation
+  return buf ? buf : dt_alloc_align_float(nfloats);
+}
+
+void dt_gf_scratch_free(float *const buf)
+{
+  if(!buf) return;
+
+  g_mutex_lock(&_scratch_lock);
+  for(int k = 0; k < GF_SCRATCH_SLOTS; k++)
+  {
+    if(_scratch[k].buf == buf)
+    {
+      _scratch[k].used = FALSE;
+      g_mutex_unlock(&_scratch_lock);
+      return;
+    }
+  }
+  g_mutex_unlock(&_scratch_lock);
+
+  // not pooled
+  dt_free_align(buf);
+}
+
+void dt_gf_scratch_cleanup(void)
+{
+  g_mutex_lock(&_scratch_lock);
+  for(int k = 0; k < GF_SCRATCH_SLOTS; k++)
+  {
+    if(_scratch[k].used) continue; // still in use by another pipe, released on its own cleanup
+    _scratch_release_slot(&_scratch[k]);
+  }
+  g_mutex_unlock(&_scratch_lock);
+}
+
 // allocate space for n-component image of size width x height
 static inline color_image new_color_image(int width, int height, int ch)
 {
-  return (color_image){ dt_alloc_align_float((size_t)width * height * ch), width, height, ch };
+  return (color_image){ dt_gf_scratch_alloc((size_t)width * height * ch), width, height, ch };
 }
 
 // free space for n-component image
 static inline void free_color_image(color_image *img_p)
 {
-  dt_free_align(img_p->data);
+  dt_gf_scratch_free(img_p->data);
   img_p->data = NULL;
 }
 
@@ -98,11 +210,13 @@ static inline float *get_color_pixel(color_image img, size_t i)
 //    6 variance (R-R, R-G, R-B, G-G, G-B, B-B)
 // for computational efficiency, we'll pack them into a four-channel image and a 9-channel image
 // image instead of running 13 separate box filters: guide+input, R/G/B/R-R/R-G/R-B/G-G/G-B/B-B.
-static void guided_filter_tiling(color_image imgg, gray_image img, gray_image img_out, tile target, const int w,
-                                 const float eps, const float guide_weight, const float min, const float max)
+//
+// this computes the box-averaged coefficients a_r, a_g, a_b and b of the local linear models
+// output = a . guide + b over the source tile. The result is a source-sized 4-channel image,
+// to be released with free_color_image(). Its data is NULL if we ran out of memory.
+static color_image guided_filter_coefficients(color_image imgg, gray_image img, const tile source, const int w,
+                                              const float eps, const float guide_weight)
 {
-  const tile source = { max_i(target.left - 2 * w, 0), min_i(target.right + 2 * w, imgg.width),
-                        max_i(target.lower - 2 * w, 0), min_i(target.upper + 2 * w, imgg.height) };
   const int width = source.right - source.left;
   const int height = source.upper - source.lower;
   size_t size = (size_t)width * (size_t)height;
@@ -123,6 +237,12 @@ static void guided_filter_tiling(color_image imgg, gray_image img, gray_image im
 #define VAR_GB 7
   color_image mean = new_color_image(width, height, 4);
   color_image variance = new_color_image(width, height, 9);
+  if(!mean.data || !variance.data)
+  {
+    free_color_image(&variance);
+    free_color_image(&mean);
+    return mean;
+  }
   const size_t img_dimen = mean.width;
   size_t img_bak_sz;
   float *img_bak = dt_alloc_perthread_float(9*img_dimen, &img_bak_sz);
@@ -230,6 +350,22 @@ static void guided_filter_tiling(color_image imgg, gray_image img, gray_image im
   free_color_image(&variance);
 
   dt_box_mean(a_b.data, a_b.height, a_b.width, a_b.stride|BOXFILTER_KAHAN_SUM, w, 1);
+  return a_b;
+}
+
+static void guided_filter_tiling(color_image imgg, gray_image img, gray_image img_out, tile target, const int w,
+                                 const float eps, const float guide_weight, const float min, const float max)
+{
+  const tile source = { max_i(target.left - 2 * w, 0), min_i(target.right + 2 * w, imgg.width),
+                        max_i(target.lower - 2 * w, 0), min_i(target.upper + 2 * w, imgg.height) };
+  const int width = source.right - source.left;
+
+  color_image a_b = guided_filter_coefficients(imgg, img, source, w, eps, guide_weight);
+  if(!a_b.data)
+  {
+    dt_control_log(_("guided filter failed to allocate memory, check your RAM settings"));
+    return;
+  }
 
 #ifdef _OPENMP
 #pragma omp parallel for schedule(static) default(none) \
@@ -252,7 +388,7 @@ static void guided_filter_tiling(color_image imgg, gray_image img, gray_image im
       img_out.data[i_imgg + (size_t)j_imgg * imgg.width] = CLAMP(res, min, max);
     }
   }
-  free_color_image(&mean);
+  free_color_image(&a_b);
 }
 
 static int compute_tile_height(const int height, const int w)
@@ -332,6 +468,152 @@ void guided_filter(const float *const guide, const float *const in, float *const
   }
 }
 
+// average the guide and the input over blocks of factor x factor pixels.
+// Partial blocks on the right and bottom borders are averaged over their actual size.
+static void downsample_guide_and_input(color_image imgg, gray_image img, color_image ds_guide, gray_image ds_in,
+                                       const int factor)
+{
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) \
+  dt_omp_firstprivate(factor) shared(imgg, img, ds_guide, ds_in)
+#endif
+  for(int j = 0; j < ds_in.height; j++)
+  {
+    const int y_end = min_i((j + 1) * factor, img.height);
+    for(int i = 0; i < ds_in.width; i++)
+    {
+      const int x_end = min_i((i + 1) * factor, img.width);
+      dt_aligned_pixel_t acc = { 0.f, 0.f, 0.f, 0.f };
+      float acc_in = 0.f;
+      for(int y = j * factor; y < y_end; y++)
+        for(int x = i * factor; x < x_end; x++)
+        {
+          const size_t k = (size_t)y * img.width + x;
+          const float *const pixel = get_color_pixel(imgg, k);
+          for(int c = 0; c < 3; c++) acc[c] += pixel[c];
+          acc_in += img.data[k];
+        }
+      const float norm = 1.f / (float)((y_end - j * factor) * (x_end - i * factor));
+      const size_t k = (size_t)j * ds_in.width + i;
+      float *const out = get_color_pixel(ds_guide, k);
+      for(int c = 0; c < 3; c++) out[c] = acc[c] * norm;
+      out[3] = 0.f;
+      ds_in.data[k] = acc_in * norm;
+    }
+  }
+}
+
+void guided_filter_subsampled(const float *const guide, const float *const in, float *const out, const int width,
+                              const int height, const int ch, const int w, const float sqrt_eps,
+                              const float guide_weight, const float min, const float max, const int subsample)
+{
+  assert(ch >= 3);
+  assert(w >= 1);
+
+  const int ds_width = (width + subsample - 1) / MAX(subsample, 1);
+  const int ds_height = (height + subsample - 1) / MAX(subsample, 1);
+  const int ds_w = (int)roundf((float)w / (float)MAX(subsample, 1));
+
+  // nothing to gain, or not enough resolution left to fit the linear models
+  if(subsample < 2 || ds_w < 1 || ds_width < 4 * ds_w || ds_height < 4 * ds_w)
+  {
+    guided_filter(guide, in, out, width, height, ch, w, sqrt_eps, guide_weight, min, max);
+    return;
+  }
+
+  color_image img_guide = (color_image){ (float *)guide, width, height, ch };
+  gray_image img_in = (gray_image){ (float *)in, width, height };
+
+  color_image ds_guide = new_color_image(ds_width, ds_height, 4);
+  gray_image ds_in = (gray_image){ dt_gf_scratch_alloc((size_t)ds_width * ds_height), ds_width, ds_height };
+  color_image ds_ab = new_color_image(ds_width, ds_height, 4);
+
+  if(!ds_guide.data || !ds_in.data || !ds_ab.data)
+  {
+    dt_control_log(_("guided filter failed to allocate memory, check your RAM settings"));
+    goto error;
+  }
+
+  // 1. downsample, then fit the local linear models at low resolution, tile by tile
+  downsample_guide_and_input(img_guide, img_in, ds_guide, ds_in, subsample);
+
+  {
+    const int tile_width = compute_tile_width(ds_width, ds_w);
+    const int tile_height = compute_tile_height(ds_height, ds_w);
+    const float eps = sqrt_eps * sqrt_eps;
+
+    for(int j = 0; j < ds_height; j += tile_height)
+      for(int i = 0; i < ds_width; i += tile_width)
+      {
+        const tile target = { i, min_i(i + tile_width, ds_width), j, min_i(j + tile_height, ds_height) };
+        const tile source = { max_i(target.left - 2 * ds_w, 0), min_i(target.right + 2 * ds_w, ds_width),
+                              max_i(target.lower - 2 * ds_w, 0), min_i(target.upper + 2 * ds_w, ds_height) };
+        color_image a_b = guided_filter_coefficients(ds_guide, ds_in, source, ds_w, eps, guide_weight);
+        if(!a_b.data)
+        {
+          dt_control_log(_("guided filter failed to allocate memory, check your RAM settings"));
+          goto error;
+        }
+
+        const int source_width = source.right - source.left;
+        for(int y = target.lower; y < target.upper; y++)
+          memcpy(get_color_pixel(ds_ab, (size_t)y * ds_width + target.left),
+                 get_color_pixel(a_b, (size_t)(y - source.lower) * source_width + target.left - source.left),
+                 sizeof(float) * 4 * (target.right - target.left));
+
+        free_color_image(&a_b);
+      }
+  }
+
+  // 2. upsample the coefficients bilinearly and apply them to the full-resolution guide.
+  // Since the coefficients are box averages over the window, they are smooth at the scale of the
+  // subsampling and the interpolation error is small (see "Fast Guided Filter", He & Sun, 2015).
+  {
+    const float inv_factor = 1.f / (float)subsample;
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) default(none) \
+  dt_omp_firstprivate(width, height, ds_width, ds_height, inv_factor, guide_weight, min, max, out) \
+  shared(img_guide, ds_ab)
+#endif
+    for(int y = 0; y < height; y++)
+    {
+      const float v = CLAMP(((float)y + 0.5f) * inv_factor - 0.5f, 0.f, (float)(ds_height - 1));
+      const int v0 = MIN((int)v, ds_height - 2);
+      const int v1 = MIN(v0 + 1, ds_height - 1);
+      const float fv = v - (float)v0;
+      const float *const row0 = get_color_pixel(ds_ab, (size_t)v0 * ds_width);
+      const float *const row1 = get_color_pixel(ds_ab, (size_t)v1 * ds_width);
+
+      for(int x = 0; x < width; x++)
+      {
+        const float u = CLAMP(((float)x + 0.5f) * inv_factor - 0.5f, 0.f, (float)(ds_width - 1));
+        const int u0 = MIN((int)u, ds_width - 2);
+        const int u1 = MIN(u0 + 1, ds_width - 1);
+        const float fu = u - (float)u0;
+
+        dt_aligned_pixel_t ab;
+        for_four_channels(c)
+        {
+          const float top = row0[4 * u0 + c] + fu * (row0[4 * u1 + c] - row0[4 * u0 + c]);
+          const float bottom = row1[4 * u0 + c] + fu * (row1[4 * u1 + c] - row1[4 * u0 + c]);
+          ab[c] = top + fv * (bottom - top);
+        }
+
+        const size_t k = (size_t)y * width + x;
+        const float *const pixel = get_color_pixel(img_guide, k);
+        const float res = guide_weight * (ab[A_RED] * pixel[0] + ab[A_GREEN] * pixel[1] + ab[A_BLUE] * pixel[2])
+                          + ab[B];
+        out[k] = CLAMP(res, min, max);
+      }
+    }
+  }
+
+error:
+  free_color_image(&ds_ab);
+  dt_gf_scratch_free(ds_in.data);
+  free_color_image(&ds_guide);
+}
+
 #ifdef HAVE_OPENCL
 
 dt_guided_filter_cl_global_t *dt_guided_filter_init_cl_global()
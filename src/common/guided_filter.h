@@ -83,6 +83,19 @@ static inline int max_i(int a, int b)
 void guided_filter(const float *guide, const float *in, float *out, int width, int height, int ch, int w,
                    float sqrt_eps, float guide_weight, float min, float max);
 
+// fast variant of guided_filter(): the local linear models are fitted on the guide and input downsampled
+// by `subsample` (radius w / subsample), then upsampled and applied at full resolution.
+// Falls back to guided_filter() if subsample < 2 or if the image gets too small for the radius.
+void guided_filter_subsampled(const float *guide, const float *in, float *out, int width, int height, int ch,
+                              int w, float sqrt_eps, float guide_weight, float min, float max, int subsample);
+
+// pool of aligned scratch buffers shared by the guided filters, to avoid allocating and page-faulting
+// fresh temporaries on each call. Thread-safe. Buffers must be released with dt_gf_scratch_free().
+float *dt_gf_scratch_alloc(const size_t nfloats);
+void dt_gf_scratch_free(float *const buf);
+// release the pooled buffers that are not in use, on pipe cleanup and at shutdown
+void dt_gf_scratch_cleanup(void);
+
 #ifdef HAVE_OPENCL
 
 typedef struct dt_guided_filter_cl_global_t
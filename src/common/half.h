@@ -0,0 +1,121 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+/**
+ * IEEE 754 half-precision storage for large intermediate buffers.
+ *
+ * Only the storage is 16 bits: values are converted to float32 on load and all the maths stay in float32.
+ * Half floats keep 11 significant bits (relative error up to 2^-11 ≈ 4.9e-4) and saturate to infinity
+ * above 65504, so they suit band-pass signals like wavelet details, not unbounded scene-referred RGB.
+ *
+ * Conversions round to nearest even. They use the F16C instructions when the build targets them
+ * (e.g. -march=native on x86 since Ivy Bridge), and an equivalent scalar code otherwise.
+ */
+
+#include <stdint.h>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+typedef uint16_t dt_half_t;
+
+static inline float dt_half_to_float(const dt_half_t h)
+{
+  const uint32_t sign = ((uint32_t)h & 0x8000u) << 16;
+  const uint32_t exponent = ((uint32_t)h >> 10) & 0x1fu;
+  const uint32_t mantissa = (uint32_t)h & 0x3ffu;
+
+  union { float f; uint32_t u; } v;
+
+  if(exponent == 0x1fu)
+    v.u = sign | 0x7f800000u | (mantissa << 13); // inf and NaN
+  else if(exponent != 0)
+    v.u = sign | ((exponent + 112u) << 23) | (mantissa << 13);
+  else
+  {
+    // zero and subnormals: mantissa * 2^-24, exact in float32
+    const float f = (float)mantissa * 5.9604644775390625e-8f;
+    return sign ? -f : f;
+  }
+  return v.f;
+}
+
+static inline dt_half_t dt_float_to_half(const float f)
+{
+  union { float f; uint32_t u; } v = { .f = f };
+  const uint32_t sign = (v.u >> 16) & 0x8000u;
+  const uint32_t abs = v.u & 0x7fffffffu;
+
+  // NaN stays a quiet NaN, inf and anything from 65520 rounds to inf
+  if(abs > 0x7f800000u) return sign | 0x7e00u | ((abs >> 13) & 0x3ffu);
+  if(abs >= 0x477ff000u) return sign | 0x7c00u;
+
+  // below 2^-25: rounds to zero
+  if(abs < 0x33000000u) return sign;
+
+  uint32_t h, rest, halfway;
+  if(abs < 0x38800000u)
+  {
+    // subnormal half: the implicit bit of the float becomes explicit
+    const uint32_t shift = 126u - (abs >> 23);
+    const uint32_t mantissa = (abs & 0x7fffffu) | 0x800000u;
+    h = mantissa >> shift;
+    rest = mantissa & ((1u << shift) - 1u);
+    halfway = 1u << (shift - 1u);
+  }
+  else
+  {
+    // normal half: rebias the exponent from 127 to 15, and drop 13 bits of mantissa
+    h = (abs - 0x38000000u) >> 13;
+    rest = abs & 0x1fffu;
+    halfway = 0x1000u;
+  }
+
+  // round to nearest even. A carry out of the mantissa correctly bumps the exponent.
+  if(rest > halfway || (rest == halfway && (h & 1u))) h++;
+  return (dt_half_t)(sign | h);
+}
+
+/** store the 4 channels of a pixel as half floats */
+static inline void dt_store_half_4(dt_half_t *const out, const float *const in)
+{
+#if defined(__F16C__)
+  _mm_storel_epi64((__m128i *)out, _mm_cvtps_ph(_mm_loadu_ps(in), _MM_FROUND_TO_NEAREST_INT));
+#else
+  for(int c = 0; c < 4; c++) out[c] = dt_float_to_half(in[c]);
+#endif
+}
+
+/** load the 4 half-float channels of a pixel */
+static inline void dt_load_half_4(float *const out, const dt_half_t *const in)
+{
+#if defined(__F16C__)
+  _mm_storeu_ps(out, _mm_cvtph_ps(_mm_loadl_epi64((const __m128i *)in)));
+#else
+  for(int c = 0; c < 4; c++) out[c] = dt_half_to_float(in[c]);
+#endif
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -35,8 +35,11 @@
  * corrected, I1 is the reference pattern. Then we solve DeltaI=0
  * (Laplace) with I2 Dirichlet conditions at the borders of the
  * mask. The solver is a red/black checker Gauss-Seidel with over-relaxation.
- * It could benefit from a multi-grid evaluation of an initial solution
- * before the main iteration loop.
+ * Its initial solution is computed by a full multigrid pass: the problem is
+ * restricted to a pyramid of half-size grids, solved on the coarsest one, then
+ * interpolated and refined level by level. SOR removes high frequencies of the
+ * error fast and low frequencies very slowly, so starting from the coarse
+ * solution leaves it only a few iterations to converge on large stamps.
  *
  * I reduced the convergence criteria to 0.1% (0.001) as we are
  * dealing here with RGB integer components, more is overkill.
@@ -314,10 +317,11 @@ static void collect_runs(const int start, const float *const restrict mask, cons
   }
 }
 
-// Solve the laplace equation for pixels and store the result in-place.
-static void _heal_laplace_loop(float *const restrict red_pixels, float *const restrict black_pixels,
+// Solve the laplace equation for pixels and store the result in-place. Returns the number of iterations.
+static int _heal_laplace_loop(float *const restrict red_pixels, float *const restrict black_pixels,
                                const size_t width, const size_t height,
-                               const float *const restrict mask, const int max_iter)
+                               const float *const restrict mask, const int max_iter,
+                               const gboolean from_multigrid)
 {
   // we start by converting the opacity mask into runs of nonzero positions, handling the 'red' and 'black'
   // checkerboarded pixels separately
@@ -326,6 +330,7 @@ static void _heal_laplace_loop(float *const restrict red_pixels, float *const re
   // arrangement will yield fewer runs.  For any mask a user would have the patience to draw, there will only be
   // a handful of runs in each row of pixels.
   // Note that using `unsigned` instead of size_t, the stamp is limited to ~8 gigapixels (the main image can be larger)
+  int iter = 0;
   const size_t subwidth = (width+1)/2;  // round up to be able to handle odd widths
   unsigned *const restrict red_runs = dt_alloc_align(sizeof(unsigned) * subwidth * (height + 2));
   unsigned *const restrict black_runs = dt_alloc_align(sizeof(unsigned) * subwidth * (height + 2));
@@ -356,13 +361,15 @@ static void _heal_laplace_loop(float *const restrict red_pixels, float *const re
    * round brushes, at least. I don't know whether aspect ratio
    * affects it.)
    */
-  const float w = ((2.0f - 1.0f / (0.1575f * sqrtf(nmask) + 0.8f)) * .25f);
+  // the multigrid solution leaves only short wavelengths in the error, which a lower over-relaxation damps
+  // faster: use the factor of a stamp of half the size
+  const float w = ((2.0f - 1.0f / (0.1575f * sqrtf(from_multigrid ? nmask / 4 : nmask) + 0.8f)) * .25f);
 
   const float epsilon = (0.1 / 255);
   const float err_exit = epsilon * epsilon * w * w;
 
   /* Gauss-Seidel with successive over-relaxation */
-  for(int iter = 0; iter < max_iter; iter++)
+  for(; iter < max_iter; iter++)
   {
     // process red/black cells separately
     float err = _heal_laplace_iteration(black_pixels, red_pixels, height, subwidth, black_runs, num_black, 1, w);
@@ -374,22 +381,304 @@ static void _heal_laplace_loop(float *const restrict red_pixels, float *const re
 cleanup:
   if(red_runs) dt_free_align(red_runs);
   if(black_runs) dt_free_align(black_runs);
+  return iter;
 }
 
 
-/* Original Algorithm Design:
- *
- * T. Georgiev, "Photoshop Healing Brush: a Tool for Seamless Cloning
- * http://www.tgeorgiev.net/Photoshop_Healing.pdf
- */
-void dt_heal(const float *const src_buffer, float *dest_buffer, const float *const mask_buffer, const int width,
-             const int height, const int ch, const int max_iter)
+// one level of the multigrid pyramid, with interleaved 4-channel pixels
+typedef struct _heal_level_t
+{
+  float *pixels;  // the solution where mask is set, the Dirichlet boundary values elsewhere
+  uint8_t *mask;  // 1 where the Laplace equation is solved
+  size_t width, height;
+  size_t nmask;
+} _heal_level_t;
+
+// don't bother with a pyramid for stamps that plain SOR solves in a few hundred iterations
+#define HEAL_MULTIGRID_MIN_MASK 4096
+// stop halving when the grid gets that small
+#define HEAL_MULTIGRID_MIN_SIZE 16
+#define HEAL_MULTIGRID_MAX_LEVELS 12
+
+static void _heal_level_free(_heal_level_t *level)
+{
+  if(level->pixels) dt_free_align(level->pixels);
+  if(level->mask) dt_free_align(level->mask);
+  level->pixels = NULL;
+  level->mask = NULL;
+}
+
+static gboolean _heal_level_alloc(_heal_level_t *level, const size_t width, const size_t height)
+{
+  level->width = width;
+  level->height = height;
+  level->nmask = 0;
+  level->pixels = dt_alloc_align_float((size_t)4 * width * height);
+  level->mask = dt_alloc_align(sizeof(uint8_t) * width * height);
+  if(level->pixels && level->mask) return TRUE;
+  _heal_level_free(level);
+  return FALSE;
+}
+
+// build the first coarse level straight from the images: a coarse pixel is solved if its 2x2 fine pixels all
+// are, otherwise it is a boundary pixel holding the average of the fine boundary pixels
+static void _heal_restrict_first(const float *const restrict dest, const float *const restrict src,
+                                 const float *const restrict mask, const size_t width, const size_t height,
+                                 _heal_level_t *const coarse)
+{
+  size_t nmask = 0;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(dest, src, mask, width, height, coarse) \
+  schedule(static) reduction(+ : nmask)
+#endif
+  for(size_t cy = 0; cy < coarse->height; cy++)
+    for(size_t cx = 0; cx < coarse->width; cx++)
+    {
+      dt_aligned_pixel_t inside = { 0.0f }, outside = { 0.0f };
+      int n_in = 0, n_out = 0;
+      for(size_t y = 2 * cy; y < MIN(2 * cy + 2, height); y++)
+        for(size_t x = 2 * cx; x < MIN(2 * cx + 2, width); x++)
+        {
+          const size_t k = y * width + x;
+          if(mask[k] != 0.f)
+          {
+            for_each_channel(c) inside[c] += dest[4 * k + c] - src[4 * k + c];
+            n_in++;
+          }
+          else
+          {
+            for_each_channel(c) outside[c] += dest[4 * k + c] - src[4 * k + c];
+            n_out++;
+          }
+        }
+      const size_t k = cy * coarse->width + cx;
+      coarse->mask[k] = (n_out == 0);
+      nmask += (n_out == 0);
+      const float norm = 1.0f / (n_out ? n_out : n_in);
+      for_each_channel(c) coarse->pixels[4 * k + c] = (n_out ? outside[c] : inside[c]) * norm;
+    }
+  coarse->nmask = nmask;
+}
+
+// same as above, from one level of the pyramid to the next
+static void _heal_restrict(const _heal_level_t *const fine, _heal_level_t *const coarse)
+{
+  size_t nmask = 0;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(fine, coarse) \
+  schedule(static) reduction(+ : nmask)
+#endif
+  for(size_t cy = 0; cy < coarse->height; cy++)
+    for(size_t cx = 0; cx < coarse->width; cx++)
+    {
+      dt_aligned_pixel_t inside = { 0.0f }, outside = { 0.0f };
+      int n_in = 0, n_out = 0;
+      for(size_t y = 2 * cy; y < MIN(2 * cy + 2, fine->height); y++)
+        for(size_t x = 2 * cx; x < MIN(2 * cx + 2, fine->width); x++)
+        {
+          const size_t k = y * fine->width + x;
+          if(fine->mask[k])
+          {
+            for_each_channel(c) inside[c] += fine->pixels[4 * k + c];
+            n_in++;
+          }
+          else
+          {
+            for_each_channel(c) outside[c] += fine->pixels[4 * k + c];
+            n_out++;
+          }
+        }
+      const size_t k = cy * coarse->width + cx;
+      coarse->mask[k] = (n_out == 0);
+      nmask += (n_out == 0);
+      const float norm = 1.0f / (n_out ? n_out : n_in);
+      for_each_channel(c) coarse->pixels[4 * k + c] = (n_out ? outside[c] : inside[c]) * norm;
+    }
+  coarse->nmask = nmask;
+}
+
+// bilinear interpolation of the coarse solution at the center of fine pixel (x, y)
+static inline void _heal_interpolate(const _heal_level_t *const coarse, const size_t x, const size_t y,
+                                     dt_aligned_pixel_t out)
+{
+  // fine pixel centers sit at 1/4 and 3/4 between coarse pixel centers
+  const float fx = CLAMP((x - 0.5f) * 0.5f, 0.0f, coarse->width - 1.0f);
+  const float fy = CLAMP((y - 0.5f) * 0.5f, 0.0f, coarse->height - 1.0f);
+  const size_t x0 = (size_t)fx, y0 = (size_t)fy;
+  const size_t x1 = MIN(x0 + 1, coarse->width - 1), y1 = MIN(y0 + 1, coarse->height - 1);
+  const float wx = fx - x0, wy = fy - y0;
+  const float *const p00 = coarse->pixels + 4 * (y0 * coarse->width + x0);
+  const float *const p01 = coarse->pixels + 4 * (y0 * coarse->width + x1);
+  const float *const p10 = coarse->pixels + 4 * (y1 * coarse->width + x0);
+  const float *const p11 = coarse->pixels + 4 * (y1 * coarse->width + x1);
+  for_each_channel(c)
+    out[c] = (1.0f - wy) * ((1.0f - wx) * p00[c] + wx * p01[c]) + wy * ((1.0f - wx) * p10[c] + wx * p11[c]);
+}
+
+// set the solved pixels of fine from the solution of coarse
+static void _heal_prolongate(const _heal_level_t *const coarse, _heal_level_t *const fine)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(fine, coarse) \
+  schedule(static)
+#endif
+  for(size_t y = 0; y < fine->height; y++)
+    for(size_t x = 0; x < fine->width; x++)
+    {
+      const size_t k = y * fine->width + x;
+      if(fine->mask[k]) _heal_interpolate(coarse, x, y, fine->pixels + 4 * k);
+    }
+}
+
+// same as above, to the full-resolution images, where the solution is stored as dest = src + solution
+static void _heal_prolongate_last(const _heal_level_t *const coarse, const float *const restrict src,
+                                  float *const restrict dest, const float *const restrict mask,
+                                  const size_t width, const size_t height)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(coarse, src, dest, mask, width, height) \
+  schedule(static)
+#endif
+  for(size_t y = 0; y < height; y++)
+    for(size_t x = 0; x < width; x++)
+    {
+      const size_t k = y * width + x;
+      if(mask[k] == 0.f) continue;
+      dt_aligned_pixel_t value;
+      _heal_interpolate(coarse, x, y, value);
+      for_each_channel(c) dest[4 * k + c] = src[4 * k + c] + value[c];
+    }
+}
+
+// red/black Gauss-Seidel with over-relaxation on one level. Returns the number of iterations.
+// The coarse levels only give the starting point of the full-resolution solver, so their tolerance
+// scales with the size of the stamp past 1024 pixels: the sum of squared updates of large stamps
+// doesn't go below their rounding noise, and they would run max_iter.
+static int _heal_level_solve(_heal_level_t *const level, const int max_iter)
+{
+  const size_t width = level->width;
+  const size_t height = level->height;
+  float *const restrict pixels = level->pixels;
+  const uint8_t *const restrict mask = level->mask;
+
+  const float w = 2.0f - 1.0f / (0.1575f * sqrtf(level->nmask) + 0.8f);
+  const float epsilon = (0.1 / 255);
+  const float err_exit = epsilon * epsilon * w * w / 16.0f * MAX(1.0f, level->nmask / 1024.0f);
+
+  int iter;
+  for(iter = 0; iter < max_iter; iter++)
+  {
+    float err = 0.0f;
+    for(size_t color = 0; color < 2; color++)
+    {
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(pixels, mask, width, height, color, w) \
+  schedule(static) reduction(+ : err)
+#endif
+      for(size_t y = 0; y < height; y++)
+        for(size_t x = (y + color) & 1; x < width; x += 2)
+        {
+          const size_t k = y * width + x;
+          if(!mask[k]) continue;
+          // Neumann condition on the edges of the stamp, like the full-resolution solver
+          dt_aligned_pixel_t sum = { 0.0f };
+          float n = 0.0f;
+          if(x > 0)
+          {
+            for_each_channel(c) sum[c] += pixels[4 * (k - 1) + c];
+            n += 1.0f;
+          }
+          if(x + 1 < width)
+          {
+            for_each_channel(c) sum[c] += pixels[4 * (k + 1) + c];
+            n += 1.0f;
+          }
+          if(y > 0)
+          {
+            for_each_channel(c) sum[c] += pixels[4 * (k - width) + c];
+            n += 1.0f;
+          }
+          if(y + 1 < height)
+          {
+            for_each_channel(c) sum[c] += pixels[4 * (k + width) + c];
+            n += 1.0f;
+          }
+          for(int c = 0; c < 3; c++)
+          {
+            const float diff = w * (sum[c] / n - pixels[4 * k + c]);
+            pixels[4 * k + c] += diff;
+            err += diff * diff;
+          }
+        }
+    }
+    if(err < err_exit) break;
+  }
+  return iter;
+}
+
+// full multigrid initial solution: replace the masked pixels of dest by src + an approximate solution of the
+// Laplace equation, interpolated from a pyramid of coarser grids. Returns FALSE if the stamp is too small to
+// benefit from it, or on allocation failure, leaving dest untouched.
+static gboolean _heal_multigrid(const float *const src, float *const dest, const float *const mask,
+                                const size_t width, const size_t height, const size_t nmask, const int max_iter)
+{
+  if(nmask < HEAL_MULTIGRID_MIN_MASK) return FALSE;
+
+  _heal_level_t levels[HEAL_MULTIGRID_MAX_LEVELS] = { { 0 } };
+  int num_levels = 0;
+  gboolean success = FALSE;
+
+  // restrict down to the coarsest grid that still holds a sensible part of the stamp
+  size_t w = (width + 1) / 2, h = (height + 1) / 2;
+  if(!_heal_level_alloc(&levels[0], w, h)) goto cleanup;
+  _heal_restrict_first(dest, src, mask, width, height, &levels[0]);
+  num_levels = 1;
+
+  while(num_levels < HEAL_MULTIGRID_MAX_LEVELS)
+  {
+    const _heal_level_t *const fine = &levels[num_levels - 1];
+    w = (fine->width + 1) / 2;
+    h = (fine->height + 1) / 2;
+    if(w < HEAL_MULTIGRID_MIN_SIZE || h < HEAL_MULTIGRID_MIN_SIZE || fine->nmask < 64) break;
+    if(!_heal_level_alloc(&levels[num_levels], w, h)) goto cleanup;
+    _heal_restrict(fine, &levels[num_levels]);
+    num_levels++;
+  }
+
+  // solve the coarsest level, then refine the interpolated solution on each finer level
+  int iterations = _heal_level_solve(&levels[num_levels - 1], max_iter);
+  for(int l = num_levels - 2; l >= 0; l--)
+  {
+    _heal_prolongate(&levels[l + 1], &levels[l]);
+    iterations += _heal_level_solve(&levels[l], max_iter);
+  }
+
+  _heal_prolongate_last(&levels[0], src, dest, mask, width, height);
+  dt_print(DT_DEBUG_PERF, "[heal] multigrid initial solution on %d levels took %d iterations\n", num_levels,
+           iterations);
+  success = TRUE;
+
+cleanup:
+  for(int l = 0; l < HEAL_MULTIGRID_MAX_LEVELS; l++) _heal_level_free(&levels[l]);
+  if(!success) fprintf(stderr, "dt_heal: error allocating memory for the multigrid solver, using plain SOR\n");
+  return success;
+}
+
+int dt_heal_ext(const float *const src_buffer, float *dest_buffer, const float *const mask_buffer,
+                const int width, const int height, const int ch, const int max_iter, const gboolean multigrid)
 {
   if(ch != 4)
   {
     fprintf(stderr,"dt_heal: full-color image required\n");
-    return;
+    return 0;
   }
+  const double start = dt_get_wtime();
+  int iterations = 0;
   const size_t subwidth = 4 * ((width+1)/2);  // round up to be able to handle odd widths
   float *const restrict red_buffer = dt_alloc_align_float(subwidth * (height + 2));
   float *const restrict black_buffer = dt_alloc_align_float(subwidth * (height + 2));
@@ -399,17 +688,47 @@ void dt_heal(const float *const src_buffer, float *dest_buffer, const float *con
     goto cleanup;
   }
 
+  /* start from the multigrid solution rather than from the image difference, if the stamp is large */
+  gboolean from_multigrid = FALSE;
+  if(multigrid)
+  {
+    size_t nmask = 0;
+    const size_t npixels = (size_t)width * height;
+#ifdef _OPENMP
+#pragma omp parallel for simd default(none) dt_omp_firstprivate(mask_buffer, npixels) \
+  schedule(static) reduction(+ : nmask)
+#endif
+    for(size_t k = 0; k < npixels; k++) nmask += (mask_buffer[k] != 0.f);
+
+    from_multigrid = _heal_multigrid(src_buffer, dest_buffer, mask_buffer, width, height, nmask, max_iter);
+  }
+
   /* subtract pattern from image and store the result split by 'red' and 'black' positions  */
   _heal_sub(dest_buffer, src_buffer, red_buffer, black_buffer, width, height);
 
-  _heal_laplace_loop(red_buffer, black_buffer, width, height, mask_buffer, max_iter);
+  iterations = _heal_laplace_loop(red_buffer, black_buffer, width, height, mask_buffer, max_iter, from_multigrid);
 
   /* add solution to original image and store in dest */
   _heal_add(red_buffer, black_buffer, src_buffer, dest_buffer, width, height);
 
+  dt_print(DT_DEBUG_PERF, "[heal] %dx%d stamp healed in %d iterations, %.3f s\n", width, height, iterations,
+           dt_get_wtime() - start);
+
 cleanup:
   if(red_buffer) dt_free_align(red_buffer);
   if(black_buffer) dt_free_align(black_buffer);
+  return iterations;
+}
+
+/* Original Algorithm Design:
+ *
+ * T. Georgiev, "Photoshop Healing Brush: a Tool for Seamless Cloning
+ * http://www.tgeorgiev.net/Photoshop_Healing.pdf
+ */
+void dt_heal(const float *const src_buffer, float *dest_buffer, const float *const mask_buffer, const int width,
+             const int height, const int ch, const int max_iter)
+{
+  dt_heal_ext(src_buffer, dest_buffer, mask_buffer, width, height, ch, max_iter, TRUE);
 }
 
 #ifdef HAVE_OPENCL
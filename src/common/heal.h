@@ -25,6 +25,11 @@
 void dt_heal(const float *const src_buffer, float *dest_buffer, const float *const mask_buffer, const int width,
              const int height, const int ch, const int max_iter);
 
+/* same as dt_heal(), with the multigrid initial solution optional.
+ * returns the number of iterations of the full-resolution solver */
+int dt_heal_ext(const float *const src_buffer, float *dest_buffer, const float *const mask_buffer,
+                const int width, const int height, const int ch, const int max_iter, const gboolean multigrid);
+
 #ifdef HAVE_OPENCL
 
 typedef struct dt_heal_cl_global_t
@@ -107,6 +107,7 @@ void dt_history_delete_on_image_ext(int32_t imgid, gboolean undo)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  dt_mipmap_cache_history_changed(imgid);
 
   _remove_preset_flag(imgid);
 
@@ -123,8 +124,8 @@ void dt_history_delete_on_image_ext(int32_t imgid, gboolean undo)
   // update history hash
   dt_history_hash_write_from_history(imgid, DT_HISTORY_HASH_CURRENT);
 
-  // signal that the mipmap need to be updated
-  dt_thumbtable_refresh_thumbnail(darktable.gui->ui->thumbtable_lighttable, imgid, TRUE);
+  // signal that the mipmap need to be updated. ansel-cli has no thumbnails.
+  if(darktable.gui) dt_thumbtable_refresh_thumbnail(darktable.gui->ui->thumbtable_lighttable, imgid, TRUE);
 
   if(undo)
   {
@@ -797,6 +798,7 @@ void dt_history_hash_write_from_history(const int32_t imgid, const dt_history_ha
       g_free(fields);
       g_free(values);
       g_free(conflict);
+      dt_mipmap_cache_history_changed(imgid);
     }
     g_free(hash);
   }
@@ -820,6 +822,7 @@ void dt_history_hash_write(const int32_t imgid, dt_history_hash_values_t *hash)
     DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 4, hash->current, hash->current_len, SQLITE_TRANSIENT);
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
+    dt_mipmap_cache_history_changed(imgid);
     g_free(hash->basic);
     g_free(hash->auto_apply);
     g_free(hash->current);
@@ -17,6 +17,7 @@
 */
 
 #include <stdarg.h>
+#include <string.h>
 #include "common/imagebuf.h"
 
 static size_t parallel_imgop_minimum = 500000;
@@ -430,6 +431,53 @@ void dt_iop_image_linear_blend(float *const restrict buf, const float lambda, co
     buf[k] = lambda*buf[k] + lambda_1*other[k];
 }
 
+static inline uint64_t _mix(uint64_t h)
+{
+  // splitmix64 finalizer
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+  return h ^ (h >> 31);
+}
+
+// FNV-1a on 16 interleaved lanes, so that it runs in SIMD, and the rows combined by a xor reduction
+__DT_CLONE_TARGETS__
+uint64_t dt_iop_image_channel_hash(const float *const buf, const size_t width, const size_t height,
+                                   const size_t ch, const size_t c)
+{
+  uint64_t hash = 0;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(buf, width, height, ch, c) \
+  schedule(static) reduction(^ : hash)
+#endif
+  for(size_t j = 0; j < height; j++)
+  {
+    const float *const restrict row = buf + ch * j * width + c;
+    uint32_t DT_ALIGNED_ARRAY lanes[16];
+    for(int k = 0; k < 16; k++) lanes[k] = 2166136261u + k;
+
+    size_t i = 0;
+    for(; i + 16 <= width; i += 16)
+      for(int k = 0; k < 16; k++)
+      {
+        uint32_t bits;
+        memcpy(&bits, row + ch * (i + k), sizeof(uint32_t));
+        lanes[k] = (lanes[k] ^ bits) * 16777619u;
+      }
+    for(; i < width; i++)
+    {
+      uint32_t bits;
+      memcpy(&bits, row + ch * i, sizeof(uint32_t));
+      lanes[i & 15] = (lanes[i & 15] ^ bits) * 16777619u;
+    }
+
+    uint64_t h = (uint64_t)j;
+    for(int k = 0; k < 16; k++) h = (h ^ lanes[k]) * 1099511628211ull;
+    hash ^= _mix(h);
+  }
+  return hash;
+}
+
 // perform timings to determine the optimal threshold for switching to parallel operations, as well as the
 // maximal number of threads before saturating the memory bus
 void dt_iop_image_copy_benchmark()
@@ -134,6 +134,11 @@ void dt_iop_image_div_const(float *const buf, const float div_value, const size_
 void dt_iop_image_linear_blend(float *const __restrict__ buf, const float lambda, const float *const __restrict__ other_buf,
                                const size_t width, const size_t height, const size_t ch);
 
+// 64-bit content hash of channel c of an image with ch channels per pixel, to recognize an input that was
+// already processed. Computed on the bits of the floats, over rows in parallel.
+uint64_t dt_iop_image_channel_hash(const float *const buf, const size_t width, const size_t height,
+                                   const size_t ch, const size_t c);
+
 // perform timings to determine the optimal threshold for switching to parallel operations, as well as the
 // maximal number of threads before saturating the memory bus
 void dt_iop_image_copy_benchmark();
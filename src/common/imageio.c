@@ -909,6 +909,23 @@ void _export_disable_finalscale(dt_dev_pixelpipe_t *pipe)
 }
 
 
+// Bypass the costly neighbourhood filters (denoising, sharpening, retouching...)
+// that make no visible difference once the image is shrunk to a thumbnail.
+static void _thumbnail_disable_draft_modules(dt_dev_pixelpipe_t *pipe)
+{
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *node = (dt_dev_pixelpipe_iop_t *)(nodes->data);
+    if(node->enabled && (node->module->flags() & IOP_FLAGS_SKIP_IN_DRAFT))
+    {
+      node->enabled = 0;
+      dt_print(DT_DEBUG_IMAGEIO, "[dt_imageio_export_with_flags] draft thumbnail: skipping %s\n",
+               node->module->op);
+    }
+  }
+}
+
+
 void _swap_byteorder_uint8_to_uint8(uint8_t *outbuf, const size_t processed_width, const size_t processed_height)
 {
   uint8_t *const buf8 = outbuf;
@@ -1121,6 +1138,13 @@ int dt_imageio_export_with_flags(const int32_t imgid, const char *filename,
   // Useful for partial exports, for technical purposes (HDR merge)
   _filter_pipeline(filter, &pipe);
 
+  // Draft thumbnails trade neighbourhood filters and full demosaicing for speed
+  if(thumbnail_export && dt_conf_is_equal("lighttable/thumbnail_quality", "speed"))
+  {
+    pipe.draft = TRUE;
+    _thumbnail_disable_draft_modules(&pipe);
+  }
+
   // Get theoritical final size of image, taking distortions and croppings into account, considering full-size original input
   // Needs to be done after optional filtering, in case we filter out distortion modules
   dt_dev_pixelpipe_get_roi_out(&pipe, &dev, pipe.iwidth, pipe.iheight, &pipe.processed_width,
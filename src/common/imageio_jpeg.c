@@ -25,6 +25,7 @@
 #include "common/exif.h"
 #include "common/imageio.h"
 #include "common/imageio_jpeg.h"
+#include "common/imageio_jpeg_write.h"
 #include "develop/imageop.h"         // for IOP_CS_RGB
 #include <setjmp.h>
 
@@ -492,10 +493,31 @@ static boolean read_icc_profile(j_decompress_ptr dinfo, JOCTET **icc_data_ptr, u
 #undef MAX_SEQ_NO
 
 
+static void _setup_compressor(j_compress_ptr cinfo, const void *data)
+{
+  const int quality = *(const int *)data;
+  jpeg_set_quality(cinfo, quality, TRUE);
+  if(quality > 90) cinfo->comp_info[0].v_samp_factor = 1;
+  if(quality > 92) cinfo->comp_info[0].h_samp_factor = 1;
+}
+
 int dt_imageio_jpeg_write_with_icc_profile(const char *filename, const uint8_t *in, const int width,
                                            const int height, const int quality, const void *exif, int exif_len,
                                            int32_t imgid)
 {
+  // thumbnails of the disk cache use the standard Huffman tables and no smoothing anyway, so the
+  // parallel encoder gives them the same pixels and size: no need to ask
+  if(imgid <= 0)
+  {
+    FILE *f = g_fopen(filename, "wb");
+    if(!f) return 1;
+    const int res
+        = dt_imageio_jpeg_write_parallel(f, in, width, height, _setup_compressor, &quality, NULL, 0, exif, exif_len);
+    fclose(f);
+    if(res >= 0) return res;
+    // else: image too small to be split, nothing written yet
+  }
+
   struct dt_imageio_jpeg_error_mgr jerr;
   dt_imageio_jpeg_t jpg;
 
@@ -516,9 +538,7 @@ int dt_imageio_jpeg_write_with_icc_profile(const char *filename, const uint8_t *
   jpg.cinfo.input_components = 3;
   jpg.cinfo.in_color_space = JCS_RGB;
   jpeg_set_defaults(&(jpg.cinfo));
-  jpeg_set_quality(&(jpg.cinfo), quality, TRUE);
-  if(quality > 90) jpg.cinfo.comp_info[0].v_samp_factor = 1;
-  if(quality > 92) jpg.cinfo.comp_info[0].h_samp_factor = 1;
+  _setup_compressor(&(jpg.cinfo), &quality);
   jpeg_start_compress(&(jpg.cinfo), TRUE);
 
   if(imgid > 0)
@@ -0,0 +1,340 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/imageio_jpeg_write.h"
+#include "common/darktable.h"
+
+#include <setjmp.h>
+#include <string.h>
+
+/*
+ * A baseline JPEG resets its DC predictions at each restart marker, and the entropy-coded segment before
+ * a marker is padded to a whole byte, exactly like the end of a scan. So bands of whole MCU rows can be
+ * encoded as independent JPEG files, and their scans concatenated with RSTn markers in between, behind the
+ * header of the first band with the full image height and a DRI segment holding the band size in MCUs.
+ * This only holds if all bands share their quantization and Huffman tables, hence the standard tables.
+ */
+
+// bands are at least that many MCU rows, so the headers we throw away stay negligible
+#define JPEG_MIN_BAND_MCU_ROWS 4
+// bands per thread, for load balancing
+#define JPEG_BANDS_PER_THREAD 4
+
+#define JPEG_MARKER_SOF0 0xC0
+#define JPEG_MARKER_SOF1 0xC1
+#define JPEG_MARKER_RST0 0xD0
+#define JPEG_MARKER_EOI 0xD9
+#define JPEG_MARKER_SOS 0xDA
+#define JPEG_MARKER_DRI 0xDD
+
+#define ICC_MARKER (JPEG_APP0 + 2) /* JPEG marker code for ICC */
+#define ICC_OVERHEAD_LEN 14        /* size of non-profile data in APP2 */
+#define MAX_BYTES_IN_MARKER 65533  /* maximum data len of a JPEG marker */
+#define MAX_DATA_BYTES_IN_MARKER (MAX_BYTES_IN_MARKER - ICC_OVERHEAD_LEN)
+
+typedef struct dt_imageio_jpeg_write_error_mgr_t
+{
+  struct jpeg_error_mgr pub;
+  jmp_buf setjmp_buffer;
+} dt_imageio_jpeg_write_error_mgr_t;
+
+// in-memory destination for one band, growing as needed
+typedef struct dt_imageio_jpeg_band_t
+{
+  struct jpeg_destination_mgr dest; // must be first
+  JOCTET *buf;
+  size_t alloc;
+  size_t size;
+} dt_imageio_jpeg_band_t;
+
+static void _error_exit(j_common_ptr cinfo)
+{
+  dt_imageio_jpeg_write_error_mgr_t *err = (dt_imageio_jpeg_write_error_mgr_t *)cinfo->err;
+  (*cinfo->err->output_message)(cinfo);
+  longjmp(err->setjmp_buffer, 1);
+}
+
+static void _band_init_destination(j_compress_ptr cinfo)
+{
+  dt_imageio_jpeg_band_t *band = (dt_imageio_jpeg_band_t *)cinfo->dest;
+  band->dest.next_output_byte = band->buf;
+  band->dest.free_in_buffer = band->alloc;
+}
+
+static boolean _band_empty_output_buffer(j_compress_ptr cinfo)
+{
+  // libjpeg only calls us when the whole buffer is full
+  dt_imageio_jpeg_band_t *band = (dt_imageio_jpeg_band_t *)cinfo->dest;
+  const size_t used = band->alloc;
+  band->alloc *= 2;
+  band->buf = g_realloc(band->buf, band->alloc);
+  band->dest.next_output_byte = band->buf + used;
+  band->dest.free_in_buffer = band->alloc - used;
+  return TRUE;
+}
+
+static void _band_term_destination(j_compress_ptr cinfo)
+{
+  dt_imageio_jpeg_band_t *band = (dt_imageio_jpeg_band_t *)cinfo->dest;
+  band->size = band->alloc - band->dest.free_in_buffer;
+}
+
+/*
+ * Same as write_icc_profile() in common/imageio_jpeg.c: split the profile over as many APP2 markers as
+ * needed. It must be called after jpeg_start_compress() and before the first jpeg_write_scanlines().
+ */
+static void _write_icc_profile(j_compress_ptr cinfo, const JOCTET *icc_data_ptr, unsigned int icc_data_len)
+{
+  static const JOCTET icc_id[12] = { 0x49, 0x43, 0x43, 0x5F, 0x50, 0x52, 0x4F, 0x46, 0x49, 0x4C, 0x45, 0x0 };
+  int cur_marker = 1; /* per spec, counting starts at 1 */
+  const unsigned int num_markers = (icc_data_len + MAX_DATA_BYTES_IN_MARKER - 1) / MAX_DATA_BYTES_IN_MARKER;
+
+  while(icc_data_len > 0)
+  {
+    const unsigned int length = MIN(icc_data_len, MAX_DATA_BYTES_IN_MARKER);
+    icc_data_len -= length;
+    jpeg_write_m_header(cinfo, ICC_MARKER, length + ICC_OVERHEAD_LEN);
+    for(int k = 0; k < 12; k++) jpeg_write_m_byte(cinfo, icc_id[k]);
+    jpeg_write_m_byte(cinfo, cur_marker);
+    jpeg_write_m_byte(cinfo, (int)num_markers);
+    for(unsigned int k = 0; k < length; k++) jpeg_write_m_byte(cinfo, icc_data_ptr[k]);
+    icc_data_ptr += length;
+    cur_marker++;
+  }
+}
+
+static void _init_compressor(j_compress_ptr cinfo, const int width, const int height,
+                             dt_imageio_jpeg_setup_t setup, const void *data)
+{
+  cinfo->image_width = width;
+  cinfo->image_height = height;
+  cinfo->input_components = 3;
+  cinfo->in_color_space = JCS_RGB;
+  jpeg_set_defaults(cinfo);
+  setup(cinfo, data);
+  // see the top of the file
+  cinfo->optimize_coding = FALSE;
+  cinfo->restart_interval = 0;
+  cinfo->restart_in_rows = 0;
+}
+
+// encode rows [y0, y0 + rows) as a standalone JPEG in band->buf. returns 1 on error.
+static int _encode_band(dt_imageio_jpeg_band_t *band, const uint8_t *in, const int width, const int y0,
+                        const int rows, dt_imageio_jpeg_setup_t setup, const void *data, const uint8_t *icc,
+                        const unsigned int icc_len, const void *exif, const int exif_len)
+{
+  struct jpeg_compress_struct cinfo;
+  dt_imageio_jpeg_write_error_mgr_t jerr;
+  uint8_t *const row = dt_alloc_align(sizeof(uint8_t) * 3 * width);
+  if(!row) return 1;
+
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = _error_exit;
+  if(setjmp(jerr.setjmp_buffer))
+  {
+    jpeg_destroy_compress(&cinfo);
+    dt_free_align(row);
+    return 1;
+  }
+  jpeg_create_compress(&cinfo);
+
+  // a compression ratio of 1:4 is a reasonable first guess for the buffer size
+  band->alloc = MAX((size_t)width * rows * 3 / 4, 4096);
+  band->buf = g_malloc(band->alloc);
+  band->dest.init_destination = _band_init_destination;
+  band->dest.empty_output_buffer = _band_empty_output_buffer;
+  band->dest.term_destination = _band_term_destination;
+  cinfo.dest = &band->dest;
+
+  _init_compressor(&cinfo, width, rows, setup, data);
+  jpeg_start_compress(&cinfo, TRUE);
+
+  // only the header of the first band is kept
+  if(y0 == 0)
+  {
+    if(icc && icc_len > 0) _write_icc_profile(&cinfo, icc, icc_len);
+    if(exif && exif_len > 0 && exif_len < 65534) jpeg_write_marker(&cinfo, JPEG_APP0 + 1, exif, exif_len);
+  }
+
+  while(cinfo.next_scanline < cinfo.image_height)
+  {
+    const uint8_t *buf = in + ((size_t)y0 + cinfo.next_scanline) * width * 4;
+    for(int i = 0; i < width; i++)
+      for(int k = 0; k < 3; k++) row[3 * i + k] = buf[4 * i + k];
+    JSAMPROW tmp[1] = { row };
+    jpeg_write_scanlines(&cinfo, tmp, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  dt_free_align(row);
+  return 0;
+}
+
+// find the SOS segment of an encoded band, and patch the image height in its SOF segment if height > 0.
+// returns the offset of the SOS marker and sets *scan to the offset of the entropy-coded data, or -1.
+static int64_t _find_scan(uint8_t *buf, const size_t size, const int height, size_t *scan)
+{
+  size_t pos = 2; // SOI
+  while(pos + 4 <= size)
+  {
+    if(buf[pos] != 0xFF) return -1;
+    const uint8_t marker = buf[pos + 1];
+    const size_t length = ((size_t)buf[pos + 2] << 8) | buf[pos + 3];
+    if(pos + 2 + length > size) return -1;
+
+    if((marker == JPEG_MARKER_SOF0 || marker == JPEG_MARKER_SOF1) && height > 0)
+    {
+      // length, precision, then the number of lines
+      buf[pos + 5] = (height >> 8) & 0xFF;
+      buf[pos + 6] = height & 0xFF;
+    }
+    else if(marker == JPEG_MARKER_SOS)
+    {
+      *scan = pos + 2 + length;
+      return pos;
+    }
+    pos += 2 + length;
+  }
+  return -1;
+}
+
+int dt_imageio_jpeg_write_parallel(FILE *f, const uint8_t *in, const int width, const int height,
+                                   dt_imageio_jpeg_setup_t setup, const void *data, const uint8_t *icc,
+                                   const unsigned int icc_len, const void *exif, const int exif_len)
+{
+  if(darktable.num_openmp_threads < 2) return -1;
+
+  // MCU size, from the subsampling the caller asks for
+  int max_h = 1, max_v = 1;
+  {
+    struct jpeg_compress_struct cinfo;
+    dt_imageio_jpeg_write_error_mgr_t jerr;
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = _error_exit;
+    if(setjmp(jerr.setjmp_buffer))
+    {
+      jpeg_destroy_compress(&cinfo);
+      return -1;
+    }
+    jpeg_create_compress(&cinfo);
+    _init_compressor(&cinfo, width, height, setup, data);
+    if(cinfo.progressive_mode || cinfo.arith_code || cinfo.num_scans > 1)
+    {
+      jpeg_destroy_compress(&cinfo);
+      return -1;
+    }
+    for(int c = 0; c < cinfo.num_components; c++)
+    {
+      max_h = MAX(max_h, cinfo.comp_info[c].h_samp_factor);
+      max_v = MAX(max_v, cinfo.comp_info[c].v_samp_factor);
+    }
+    jpeg_destroy_compress(&cinfo);
+  }
+  const int mcu_rows = (height + 8 * max_v - 1) / (8 * max_v);
+  const int mcus_per_row = (width + 8 * max_h - 1) / (8 * max_h);
+
+  // the restart interval, in MCUs, is stored on 16 bits
+  const int max_band_mcu_rows = 65535 / mcus_per_row;
+  const int target = (mcu_rows + JPEG_BANDS_PER_THREAD * darktable.num_openmp_threads - 1)
+                     / (JPEG_BANDS_PER_THREAD * darktable.num_openmp_threads);
+  const int band_mcu_rows = MIN(MAX(target, JPEG_MIN_BAND_MCU_ROWS), max_band_mcu_rows);
+  const int band_rows = band_mcu_rows * 8 * max_v;
+  const int nbands = (height + band_rows - 1) / band_rows;
+  if(nbands < 2 || band_mcu_rows < 1) return -1;
+
+  const double start = dt_get_wtime();
+
+  dt_imageio_jpeg_band_t *bands = calloc(nbands, sizeof(dt_imageio_jpeg_band_t));
+  if(!bands) return -1;
+  int err = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) schedule(dynamic) \
+    dt_omp_firstprivate(bands, nbands, band_rows, in, width, height, setup, data, icc, icc_len, exif, exif_len) \
+    reduction(|: err)
+#endif
+  for(int b = 0; b < nbands; b++)
+  {
+    const int y0 = b * band_rows;
+    err |= _encode_band(&bands[b], in, width, y0, MIN(band_rows, height - y0), setup, data, icc, icc_len,
+                        exif, exif_len);
+  }
+
+  const double encoded = dt_get_wtime();
+
+  // stitch: header of the first band up to its SOS, DRI, then every scan separated by RSTn, then EOI
+  size_t written = 0;
+  for(int b = 0; b < nbands && !err; b++)
+  {
+    dt_imageio_jpeg_band_t *band = &bands[b];
+    size_t scan = 0;
+    const int64_t sos = _find_scan(band->buf, band->size, (b == 0) ? height : 0, &scan);
+    if(sos < 0 || band->size < scan + 2 || band->buf[band->size - 2] != 0xFF
+       || band->buf[band->size - 1] != JPEG_MARKER_EOI)
+    {
+      err = 1;
+      break;
+    }
+    const size_t scan_len = band->size - 2 - scan;
+
+    if(b == 0)
+    {
+      const uint16_t interval = band_mcu_rows * mcus_per_row;
+      const uint8_t dri[6] = { 0xFF, JPEG_MARKER_DRI, 0x00, 0x04, interval >> 8, interval & 0xFF };
+      err |= (fwrite(band->buf, 1, sos, f) != (size_t)sos);
+      err |= (fwrite(dri, 1, sizeof(dri), f) != sizeof(dri));
+      err |= (fwrite(band->buf + sos, 1, scan - sos, f) != scan - sos);
+      written += scan + sizeof(dri);
+    }
+    else
+    {
+      const uint8_t rst[2] = { 0xFF, JPEG_MARKER_RST0 + ((b - 1) & 7) };
+      err |= (fwrite(rst, 1, sizeof(rst), f) != sizeof(rst));
+      written += sizeof(rst);
+    }
+    err |= (fwrite(band->buf + scan, 1, scan_len, f) != scan_len);
+    written += scan_len;
+  }
+  if(!err)
+  {
+    const uint8_t eoi[2] = { 0xFF, JPEG_MARKER_EOI };
+    err |= (fwrite(eoi, 1, sizeof(eoi), f) != sizeof(eoi));
+    written += sizeof(eoi);
+  }
+
+  for(int b = 0; b < nbands; b++) g_free(bands[b].buf);
+  free(bands);
+
+  dt_print(DT_DEBUG_PERF, "[jpeg] %ix%i encoded in %i bands in %.3f s, written in %.3f s, %zu bytes\n", width,
+           height, nbands, encoded - start, dt_get_wtime() - encoded, written);
+
+  return err ? 1 : 0;
+}
+
+#undef JPEG_MIN_BAND_MCU_ROWS
+#undef JPEG_BANDS_PER_THREAD
+#undef ICC_MARKER
+#undef ICC_OVERHEAD_LEN
+#undef MAX_BYTES_IN_MARKER
+#undef MAX_DATA_BYTES_IN_MARKER
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
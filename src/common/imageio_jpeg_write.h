@@ -0,0 +1,57 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+// this fixes a rather annoying, long time bug in libjpeg :(
+#undef HAVE_STDLIB_H
+#undef HAVE_STDDEF_H
+#include <jpeglib.h>
+#undef HAVE_STDLIB_H
+#undef HAVE_STDDEF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** sets quality, subsampling, DCT method, etc. on a compressor, after jpeg_set_defaults(). */
+typedef void (*dt_imageio_jpeg_setup_t)(j_compress_ptr cinfo, const void *data);
+
+/** write a 4-channel, 8 bits buffer as a baseline JPEG to f. Bands of MCU rows are encoded in parallel
+ * and joined with restart markers. `setup` is applied to every band encoder, `icc` and `exif` (may be NULL)
+ * are written once in the header. The standard Huffman tables are always used, whatever `setup` asks, so
+ * the file is larger than with optimize_coding. If `setup` asks for smoothing, each band is smoothed on its
+ * own. Otherwise, the pixels are the same as the single-threaded encoder's with the standard tables.
+ * returns 0 on success, 1 on error, -1 if the image is not worth splitting: then nothing has been written
+ * and the caller should use the single-threaded encoder. */
+int dt_imageio_jpeg_write_parallel(FILE *f, const uint8_t *in, const int width, const int height,
+                                   dt_imageio_jpeg_setup_t setup, const void *data, const uint8_t *icc,
+                                   const unsigned int icc_len, const void *exif, const int exif_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
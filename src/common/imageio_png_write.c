@@ -0,0 +1,253 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/imageio_png_write.h"
+#include "common/darktable.h"
+
+#include <png.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+// uncompressed size of the blocks deflated independently
+#define PNG_BLOCK_BYTES (256 << 10)
+// deflate window, which primes the dictionary of each block with the end of the previous one
+#define PNG_WINDOW_BYTES (32 << 10)
+
+// RGB samples of row y, big-endian for 16 bits
+static void _png_pack_row(const void *ivoid, const int y, const int width, const int bpp, uint8_t *out)
+{
+  if(bpp > 8)
+  {
+    const uint16_t *in = (const uint16_t *)ivoid + (size_t)4 * y * width;
+    for(int x = 0; x < width; x++, in += 4)
+      for(int c = 0; c < 3; c++)
+      {
+        *out++ = in[c] >> 8;
+        *out++ = in[c] & 0xff;
+      }
+  }
+  else
+  {
+    const uint8_t *in = (const uint8_t *)ivoid + (size_t)4 * y * width;
+    for(int x = 0; x < width; x++, in += 4)
+      for(int c = 0; c < 3; c++) *out++ = in[c];
+  }
+}
+
+static inline uint8_t _paeth(const int a, const int b, const int c)
+{
+  const int p = a + b - c;
+  const int pa = abs(p - a);
+  const int pb = abs(p - b);
+  const int pc = abs(p - c);
+  if(pa <= pb && pa <= pc) return a;
+  if(pb <= pc) return b;
+  return c;
+}
+
+// Filter one row with the 5 PNG filters and keep the one with the smallest sum of absolute
+// signed bytes, like libpng does. `cand` holds 5 filtered rows of 1 + rowbytes.
+static void _png_filter_row(const uint8_t *const row, const uint8_t *const prev, const size_t rowbytes,
+                            const int pixel_bytes, uint8_t *const cand, uint8_t *const out)
+{
+  uint64_t best_sum = UINT64_MAX;
+  int best = 0;
+
+  for(int f = 0; f < 5; f++)
+  {
+    uint8_t *const dst = cand + f * (rowbytes + 1);
+    dst[0] = f;
+    uint64_t sum = 0;
+    for(size_t i = 0; i < rowbytes; i++)
+    {
+      const int a = (i >= (size_t)pixel_bytes) ? row[i - pixel_bytes] : 0;
+      const int b = prev[i];
+      const int c = (i >= (size_t)pixel_bytes) ? prev[i - pixel_bytes] : 0;
+      uint8_t v = row[i];
+      switch(f)
+      {
+        case 1: v -= a; break;
+        case 2: v -= b; break;
+        case 3: v -= (a + b) >> 1; break;
+        case 4: v -= _paeth(a, b, c); break;
+        default: break;
+      }
+      dst[i + 1] = v;
+      sum += abs((int8_t)v);
+    }
+    if(sum < best_sum)
+    {
+      best_sum = sum;
+      best = f;
+    }
+  }
+
+  memcpy(out, cand + best * (rowbytes + 1), rowbytes + 1);
+}
+
+int dt_imageio_png_write_parallel(png_structp png_ptr, const void *ivoid, const int width, const int height,
+                                  const int bpp, const int level)
+{
+  const int pixel_bytes = 3 * bpp / 8;
+  const size_t rowbytes = (size_t)width * pixel_bytes;
+  const size_t line = rowbytes + 1; // filter type byte + samples
+  const int rows_per_block = CLAMP((int)(PNG_BLOCK_BYTES / line), 1, height);
+  const int nblocks = (height + rows_per_block - 1) / rows_per_block;
+  const size_t block_size = line * rows_per_block;
+
+  // Blocks are filtered, then deflated, in parallel by batches, and written in order.
+  // Each block is a raw deflate stream ended by a sync flush, so their concatenation
+  // forms a single valid stream, wrapped in the usual zlib header and Adler-32 trailer.
+  const int batch = MAX(1, 2 * darktable.num_openmp_threads);
+  const size_t bound = deflateBound(NULL, block_size) + 16;
+  const size_t scratch_size = 2 * rowbytes + 5 * line;
+
+  uint8_t *const filtered = dt_alloc_align(PNG_WINDOW_BYTES + block_size * batch);
+  uint8_t *const scratch = dt_alloc_align(scratch_size * batch);
+  uint8_t *const compressed = dt_alloc_align(bound * batch);
+  size_t *const lengths = calloc(batch, sizeof(size_t));
+  uLong *const adlers = calloc(batch, sizeof(uLong));
+
+  if(!filtered || !scratch || !compressed || !lengths || !adlers)
+  {
+    dt_free_align(filtered);
+    dt_free_align(scratch);
+    dt_free_align(compressed);
+    free(lengths);
+    free(adlers);
+    return -1;
+  }
+
+  // zlib header: deflate with 32 KiB window, and the level hint
+  const int level_hint = (level < 2) ? 0 : (level < 6) ? 1 : (level == 6) ? 2 : 3;
+  uint8_t header[2] = { 0x78, level_hint << 6 };
+  header[1] += 31 - ((header[0] << 8) + header[1]) % 31;
+  png_write_chunk(png_ptr, (png_const_bytep) "IDAT", header, sizeof(header));
+
+  uLong adler = adler32(0L, Z_NULL, 0);
+  size_t window = 0; // bytes of dictionary available before the current batch
+  uint8_t *const data = filtered + PNG_WINDOW_BYTES;
+  int err = 0;
+
+  for(int b0 = 0; b0 < nblocks && !err; b0 += batch)
+  {
+    const int count = MIN(batch, nblocks - b0);
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+    dt_omp_firstprivate(count, b0, rows_per_block, height, width, bpp, pixel_bytes, rowbytes, line, block_size, \
+                        scratch_size, scratch, data, ivoid) \
+    schedule(static)
+#endif
+    for(int b = 0; b < count; b++)
+    {
+      uint8_t *const row = scratch + b * scratch_size;
+      uint8_t *const prev = row + rowbytes;
+      uint8_t *const cand = prev + rowbytes;
+
+      const int y0 = (b0 + b) * rows_per_block;
+      const int rows = MIN(rows_per_block, height - y0);
+
+      if(y0 > 0)
+        _png_pack_row(ivoid, y0 - 1, width, bpp, prev);
+      else
+        memset(prev, 0, rowbytes);
+
+      for(int r = 0; r < rows; r++)
+      {
+        _png_pack_row(ivoid, y0 + r, width, bpp, row);
+        _png_filter_row(row, prev, rowbytes, pixel_bytes, cand, data + b * block_size + r * line);
+        memcpy(prev, row, rowbytes);
+      }
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+    dt_omp_firstprivate(count, b0, nblocks, rows_per_block, height, line, block_size, bound, level, window, \
+                        data, compressed, lengths, adlers) \
+    schedule(static)
+#endif
+    for(int b = 0; b < count; b++)
+    {
+      const int y0 = (b0 + b) * rows_per_block;
+      const size_t len = (size_t)MIN(rows_per_block, height - y0) * line;
+      const uint8_t *const in = data + b * block_size;
+      const gboolean last = (b0 + b == nblocks - 1);
+      lengths[b] = 0;
+
+      z_stream zs = { 0 };
+      if(deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) continue;
+
+      // earlier blocks of this batch are complete, and the window kept from the previous batch
+      // directly precedes the first one
+      const size_t dict = MIN((size_t)PNG_WINDOW_BYTES, b * block_size + window);
+      if(dict) deflateSetDictionary(&zs, in - dict, dict);
+
+      zs.next_in = (Bytef *)in;
+      zs.avail_in = len;
+      zs.next_out = compressed + b * bound;
+      zs.avail_out = bound;
+      const int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+      if((last && ret == Z_STREAM_END) || (!last && ret == Z_OK && zs.avail_in == 0))
+        lengths[b] = bound - zs.avail_out;
+      deflateEnd(&zs);
+
+      adlers[b] = adler32(adler32(0L, Z_NULL, 0), in, len);
+    }
+
+    for(int b = 0; b < count && !err; b++)
+    {
+      const int y0 = (b0 + b) * rows_per_block;
+      const size_t len = (size_t)MIN(rows_per_block, height - y0) * line;
+      err = (lengths[b] == 0);
+      if(!err)
+      {
+        png_write_chunk(png_ptr, (png_const_bytep) "IDAT", compressed + b * bound, lengths[b]);
+        adler = adler32_combine(adler, adlers[b], len);
+      }
+    }
+
+    // keep the end of this batch as dictionary for the next one
+    const size_t batch_bytes = (size_t)(count - 1) * block_size
+                               + (size_t)MIN(rows_per_block, height - (b0 + count - 1) * rows_per_block) * line;
+    const size_t keep = MIN((size_t)PNG_WINDOW_BYTES, batch_bytes + window);
+    memmove(data - keep, data + batch_bytes - keep, keep);
+    window = keep;
+  }
+
+  if(!err)
+  {
+    const uint8_t trailer[4] = { adler >> 24, (adler >> 16) & 0xff, (adler >> 8) & 0xff, adler & 0xff };
+    png_write_chunk(png_ptr, (png_const_bytep) "IDAT", trailer, sizeof(trailer));
+    png_write_chunk(png_ptr, (png_const_bytep) "IEND", NULL, 0);
+  }
+
+  dt_free_align(filtered);
+  dt_free_align(scratch);
+  dt_free_align(compressed);
+  free(lengths);
+  free(adlers);
+  return err;
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
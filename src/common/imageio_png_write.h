@@ -0,0 +1,35 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <png.h>
+
+// Write the pixels of a 4-channel, 8 or 16 bits export buffer as RGB: rows are filtered and
+// deflated in parallel into one standard zlib stream, written as IDAT chunks followed by IEND.
+// Call after png_write_info(), instead of png_write_image() and png_write_end().
+// Returns 0 on success, -1 if nothing could be written (the caller may fall back to libpng),
+// 1 on a failure after writing started.
+int dt_imageio_png_write_parallel(png_structp png_ptr, const void *ivoid, const int width, const int height,
+                                  const int bpp, const int level);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -30,10 +30,12 @@
 #define TYPE_USHORT16 RawImageType::UINT16
 
 #include <memory>
+#include <optional>
 
 #define __STDC_LIMIT_MACROS
 
 #include "glib.h"
+#include <gio/gio.h>
 
 #include "common/colorspaces.h"
 #include "common/darktable.h"
@@ -136,6 +138,26 @@ static gboolean _ignore_image(const gchar *filename)
   return FALSE;
 }
 
+// A mapped file whose pages can't be read anymore (truncated meanwhile, network share gone) raises
+// SIGBUS in the decoder instead of an error, so only map files that live on a local filesystem.
+static gboolean _can_map_file(const char *filename)
+{
+  GFile *file = g_file_new_for_path(filename);
+  GFileInfo *info = g_file_query_filesystem_info(file, G_FILE_ATTRIBUTE_FILESYSTEM_REMOTE, NULL, NULL);
+  const gboolean local = info && !g_file_info_get_attribute_boolean(info, G_FILE_ATTRIBUTE_FILESYSTEM_REMOTE);
+  if(info) g_object_unref(info);
+  g_object_unref(file);
+  return local;
+}
+
+static void _print_timings(const dt_image_t *img, const gboolean mapped, const double start,
+                           const double read, const double decoded, const double copied)
+{
+  // with a mapped file, reading happens through page faults during decoding
+  dt_print(DT_DEBUG_PERF, "[rawspeed] %s: %s %.3f s, decode %.3f s, copy %.3f s\n", img->filename,
+           mapped ? "map" : "read", read - start, decoded - read, copied - decoded);
+}
+
 dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filename,
                                              dt_mipmap_buffer_t *mbuf)
 {
@@ -151,11 +173,34 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
   {
     dt_rawspeed_load_meta();
 
-    dt_pthread_mutex_lock(&darktable.readFile_mutex);
-    auto [storage, storageBuf] = f.readFile();
-    dt_pthread_mutex_unlock(&darktable.readFile_mutex);
+    const double t_start = dt_get_wtime();
+
+    // Map the file instead of reading it into a heap copy: the decoder faults in the pages it
+    // needs, and concurrent loads (thumbnails, exports) no longer wait on each other.
+    // Fall back to FileReader if the file is remote or can't be mapped.
+    // Neither path needs a global lock: the mapping is private to this call, and FileReader::readFile()
+    // opens, reads and closes its own FILE handle into a buffer it allocates, without shared state.
+    std::unique_ptr<GMappedFile, decltype(&g_mapped_file_unref)> mapped(
+        _can_map_file(filename) ? g_mapped_file_new(filename, FALSE, NULL) : NULL, &g_mapped_file_unref);
+    decltype(f.readFile().first) storage;
+    std::optional<Buffer> storageBuf;
+    if(mapped && g_mapped_file_get_length(mapped.get()) > 0)
+    {
+      storageBuf.emplace(reinterpret_cast<const uint8_t *>(g_mapped_file_get_contents(mapped.get())),
+                         (Buffer::size_type)g_mapped_file_get_length(mapped.get()));
+    }
+    else
+    {
+      mapped.reset();
+      auto [fileStorage, fileBuf] = f.readFile();
+      storage = std::move(fileStorage);
+      storageBuf.emplace(fileBuf);
+    }
+
+    const gboolean is_mapped = (mapped != nullptr);
+    const double t_read = dt_get_wtime();
 
-    RawParser t(storageBuf);
+    RawParser t(*storageBuf);
     std::unique_ptr<RawDecoder> d = t.getDecoder(meta);
 
     if(!d.get()) return DT_IMAGEIO_FILE_CORRUPTED;
@@ -166,6 +211,8 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
     d->decodeMetaData(meta);
     RawImage r = d->mRaw;
 
+    const double t_decoded = dt_get_wtime();
+
     const auto errors = r->getErrors();
     for(const auto &error : errors)
       fprintf(stderr, "[rawspeed] (%s) %s\n", img->filename, error.c_str());
@@ -254,6 +301,8 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
     /* free auto pointers on spot */
     d.reset();
     storage.reset();
+    storageBuf.reset();
+    mapped.reset();
 
     // Grab the WB
     for(int i = 0; i < 4; i++)
@@ -314,6 +363,7 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
     if(!r->isCFA)
     {
       const dt_imageio_retval_t ret = dt_imageio_open_rawspeed_sraw(img, r, mbuf);
+      if(mbuf) _print_timings(img, is_mapped, t_start, t_read, t_decoded, dt_get_wtime());
       return ret;
     }
 
@@ -386,24 +436,16 @@ dt_imageio_retval_t dt_imageio_open_rawspeed(dt_image_t *img, const char *filena
 
     /*
      * since we do not want to crop black borders at this stage,
-     * and we do not want to rotate image, we can just use memcpy,
-     * as it is faster than dt_imageio_flip_buffers, but only if
-     * buffer sizes are equal,
-     * (from Klaus: r->pitch may differ from DT pitch (line to line spacing))
-     * else fallback to generic dt_imageio_flip_buffers()
+     * and we do not want to rotate image, this is a plain copy.
+     * dt_imageio_flip_buffers() copies rows in parallel and handles
+     * r->pitch differing from DT pitch (line to line spacing).
+     * rawspeed owns its output buffer, so it can't decode straight into ours.
      */
-    const size_t bufSize_mipmap = (size_t)img->width * img->height * r->getBpp();
-    const size_t bufSize_rawspeed = (size_t)r->pitch * dimUncropped.y;
-    if(bufSize_mipmap == bufSize_rawspeed)
-    {
-      memcpy(buf, (char *)(&(r->getByteDataAsUncroppedArray2DRef()(0, 0))), bufSize_mipmap);
-    }
-    else
-    {
-      dt_imageio_flip_buffers((char *)buf, (char *)(&(r->getByteDataAsUncroppedArray2DRef()(0, 0))), r->getBpp(),
-                              dimUncropped.x, dimUncropped.y, dimUncropped.x, dimUncropped.y, r->pitch,
-                              ORIENTATION_NONE);
-    }
+    dt_imageio_flip_buffers((char *)buf, (char *)(&(r->getByteDataAsUncroppedArray2DRef()(0, 0))), r->getBpp(),
+                            dimUncropped.x, dimUncropped.y, dimUncropped.x, dimUncropped.y, r->pitch,
+                            ORIENTATION_NONE);
+
+    _print_timings(img, is_mapped, t_start, t_read, t_decoded, dt_get_wtime());
 
     //  Check if the camera is missing samples
     const Camera *cam = meta->getCamera(r->metadata.make.c_str(),
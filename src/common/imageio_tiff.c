@@ -29,6 +29,7 @@
 #include <stdio.h>
 #include <strings.h>
 #include <tiffio.h>
+#include <zlib.h>
 
 #define LAB_CONVERSION_PROFILE DT_COLORSPACE_LIN_REC2020
 
@@ -533,6 +534,114 @@ int dt_imageio_tiff_read_profile(const char *filename, uint8_t **out)
   return profile_len;
 }
 
+
+// uncompressed size of the strips we write: small enough to give every thread some work on
+// medium images, large enough for deflate to find its matches
+#define TIFF_STRIP_BYTES (256 << 10)
+
+// Apply the TIFF predictor to one packed row, as libtiff would before compressing it.
+// `scratch` must hold one row.
+static void _tiff_predict_row(uint8_t *const row, uint8_t *const scratch, const int width, const int layers,
+                              const int bpp, const uint16_t predictor)
+{
+  const size_t n = (size_t)width * layers;
+
+  if(predictor == PREDICTOR_HORIZONTAL && bpp == 8)
+  {
+    for(size_t i = n - 1; i >= (size_t)layers; i--) row[i] -= row[i - layers];
+  }
+  else if(predictor == PREDICTOR_HORIZONTAL && bpp == 16)
+  {
+    uint16_t *const row16 = (uint16_t *)row;
+    for(size_t i = n - 1; i >= (size_t)layers; i--) row16[i] -= row16[i - layers];
+  }
+  else if(predictor == PREDICTOR_FLOATINGPOINT)
+  {
+    // split the samples into byte planes, most significant first, then difference the bytes
+    const size_t bps = bpp / 8;
+    const size_t cc = n * bps;
+    memcpy(scratch, row, cc);
+    for(size_t k = 0; k < n; k++)
+      for(size_t b = 0; b < bps; b++)
+        row[(bps - b - 1) * n + k] = scratch[bps * k + b];
+    for(size_t i = cc - 1; i >= (size_t)layers; i--) row[i] -= row[i - layers];
+  }
+}
+
+int dt_imageio_tiff_write_strips(TIFF *tif, const int width, const int height, const int layers,
+                                 const int bpp, const int level, dt_imageio_tiff_pack_row_t pack_row,
+                                 const void *data)
+{
+  const size_t rowsize = (size_t)width * layers * bpp / 8;
+  const int rows_per_strip = CLAMP((int)(TIFF_STRIP_BYTES / rowsize), 1, height);
+  const int nstrips = (height + rows_per_strip - 1) / rows_per_strip;
+  const size_t strip_size = rowsize * rows_per_strip;
+  TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, (uint32_t)rows_per_strip);
+
+  uint16_t compression = COMPRESSION_NONE;
+  uint16_t predictor = PREDICTOR_NONE;
+  TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression);
+  // the predictor tag only exists once a codec that supports it is configured
+  if(compression == COMPRESSION_ADOBE_DEFLATE) TIFFGetFieldDefaulted(tif, TIFFTAG_PREDICTOR, &predictor);
+
+  // We deflate the strips ourselves and hand them to libtiff as raw strips, which is only
+  // valid if our samples are already in the little-endian order of the file.
+  // Otherwise, libtiff encodes them one at a time.
+  const gboolean raw = (compression == COMPRESSION_ADOBE_DEFLATE) && (G_BYTE_ORDER == G_LITTLE_ENDIAN);
+
+  const int batch = MAX(1, 2 * darktable.num_openmp_threads);
+  const size_t bound = compressBound(strip_size);
+  uint8_t *const packed = dt_alloc_align((strip_size + rowsize) * batch);
+  uint8_t *const compressed = raw ? dt_alloc_align(bound * batch) : NULL;
+  uLongf *const lengths = calloc(batch, sizeof(uLongf));
+
+  int err = (!packed || (raw && !compressed) || !lengths);
+
+  for(int s0 = 0; s0 < nstrips && !err; s0 += batch)
+  {
+    const int count = MIN(batch, nstrips - s0);
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+    dt_omp_firstprivate(count, s0, rows_per_strip, height, rowsize, strip_size, bound, raw, width, layers, bpp, \
+                        level, predictor, packed, compressed, lengths, pack_row, data) \
+    schedule(dynamic, 1)
+#endif
+    for(int b = 0; b < count; b++)
+    {
+      const int y0 = (s0 + b) * rows_per_strip;
+      const int rows = MIN(rows_per_strip, height - y0);
+      uint8_t *const strip = packed + b * (strip_size + rowsize);
+      uint8_t *const scratch = strip + strip_size;
+
+      for(int r = 0; r < rows; r++)
+      {
+        pack_row(data, y0 + r, strip + r * rowsize);
+        if(raw) _tiff_predict_row(strip + r * rowsize, scratch, width, layers, bpp, predictor);
+      }
+
+      lengths[b] = bound;
+      if(raw && compress2(compressed + b * bound, &lengths[b], strip, rows * rowsize, level) != Z_OK)
+        lengths[b] = 0;
+    }
+
+    for(int b = 0; b < count && !err; b++)
+    {
+      const int y0 = (s0 + b) * rows_per_strip;
+      const int rows = MIN(rows_per_strip, height - y0);
+      if(raw)
+        err = (lengths[b] == 0 || TIFFWriteRawStrip(tif, s0 + b, compressed + b * bound, lengths[b]) < 0);
+      else
+        err = (TIFFWriteEncodedStrip(tif, s0 + b, packed + b * (strip_size + rowsize), rows * rowsize) < 0);
+    }
+  }
+
+  dt_free_align(packed);
+  dt_free_align(compressed);
+  free(lengths);
+  return err;
+}
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -21,10 +21,22 @@
 #include "common/image.h"
 #include "common/mipmap_cache.h"
 
+#include <tiffio.h>
+
 dt_imageio_retval_t dt_imageio_open_tiff(dt_image_t *img, const char *filename, dt_mipmap_buffer_t *buf);
 
 int dt_imageio_tiff_read_profile(const char *filename, uint8_t **out);
 
+// Fill `out` with row `y` of the image, in the file sample layout
+typedef void (*dt_imageio_tiff_pack_row_t)(const void *data, const int y, uint8_t *out);
+
+// Write the current directory of `tif` as strips of contiguous rows. The compression and predictor
+// tags must already be set. Adobe deflate strips are packed, predicted and compressed in parallel,
+// then written in order. Returns 0 on success.
+int dt_imageio_tiff_write_strips(TIFF *tif, const int width, const int height, const int layers,
+                                 const int bpp, const int level, dt_imageio_tiff_pack_row_t pack_row,
+                                 const void *data);
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
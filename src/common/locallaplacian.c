@@ -18,6 +18,7 @@
 
 #include "common/darktable.h"
 #include "common/locallaplacian.h"
+#include "common/imagebuf.h"
 #include "common/math.h"
 
 #include <string.h>
@@ -31,8 +32,12 @@
 
 // the maximum number of levels for the gaussian pyramid
 #define max_levels 30
-// the number of segments for the piecewise linear interpolation
+// the number of brightness levels, interpolated linearly
 #define num_gamma 6
+// the number of brightness levels in fast mode, interpolated cubically
+#define num_gamma_fast 4
+// largest input pyramid kept in a local_laplacian_cache_t
+#define max_cache_bytes ((size_t)128 << 20)
 
 //#define DEBUG_DUMP
 
@@ -60,48 +65,35 @@ static void dump_PFM(const char *filename, const float* out, const uint32_t w, c
 #define debug_dump_PFM(f,b,w,h)
 #endif
 
-// needs a boundary of 1 or 2px around i,j or else it will crash.
-// (translates to a 1px boundary around the corresponding pixel in the coarse buffer)
-// more precisely, 1<=i<wd-1 for even wd and
-//                 1<=i<wd-2 for odd wd (j likewise with ht)
-static inline float ll_expand_gaussian(
+// row j of the expansion of the coarse level to the fine level of size wd x ht. The pixels of the one or
+// two px boundary are copied from their inner neighbours. The 5-tap kernel is separable: [1 6 1]/8 around
+// even fine coordinates, [4 4]/8 around odd ones, so the rows of the coarse level are blended first into
+// tmp (one coarse row wide), which then gets expanded horizontally.
+static inline void ll_expand_row(
     const float *const coarse,
-    const int i,
+    float *const restrict row,
+    float *const restrict tmp,
     const int j,
     const int wd,
     const int ht)
 {
-  assert(i > 0);
-  assert(i < wd-1);
-  assert(j > 0);
-  assert(j < ht-1);
-  assert(j/2 + 1 < (ht-1)/2+1);
-  assert(i/2 + 1 < (wd-1)/2+1);
   const int cw = (wd-1)/2+1;
-  const int ind = (j/2)*cw+i/2;
-  // case 0:     case 1:     case 2:     case 3:
-  //  x . x . x   x . x . x   x . x . x   x . x . x
-  //  . . . . .   . . . . .   . .[.]. .   .[.]. . .
-  //  x .[x]. x   x[.]x . x   x . x . x   x . x . x
-  //  . . . . .   . . . . .   . . . . .   . . . . .
-  //  x . x . x   x . x . x   x . x . x   x . x . x
-  switch((i&1) + 2*(j&1))
+  const int last = ((wd-1)&~1)-1; // last column off the boundary, odd
+  const int jj = CLAMPS(j, 1, ((ht-1)&~1)-1);
+  const float *const restrict c = coarse + (size_t)(jj/2)*cw;
+  if(jj & 1)
+    for(int i=0;i<cw;i++) tmp[i] = 0.5f * (c[i] + c[i+cw]);
+  else
+    for(int i=0;i<cw;i++) tmp[i] = 0.125f * (c[i-cw] + 6.0f*c[i] + c[i+cw]);
+
+  row[1] = 0.5f * (tmp[0] + tmp[1]);
+  for(int m=1;2*m+1<=last;m++)
   {
-    case 0: // both are even, 3x3 stencil
-      return 4./256. * (
-          6.0f*(coarse[ind-cw] + coarse[ind-1] + 6.0f*coarse[ind] + coarse[ind+1] + coarse[ind+cw])
-          + coarse[ind-cw-1] + coarse[ind-cw+1] + coarse[ind+cw-1] + coarse[ind+cw+1]);
-    case 1: // i is odd, 2x3 stencil
-      return 4./256. * (
-          24.0*(coarse[ind] + coarse[ind+1]) +
-          4.0*(coarse[ind-cw] + coarse[ind-cw+1] + coarse[ind+cw] + coarse[ind+cw+1]));
-    case 2: // j is odd, 3x2 stencil
-      return 4./256. * (
-          24.0*(coarse[ind] + coarse[ind+cw]) +
-          4.0*(coarse[ind-1] + coarse[ind+1] + coarse[ind+cw-1] + coarse[ind+cw+1]));
-    default: // case 3: // both are odd, 2x2 stencil
-      return .25f * (coarse[ind] + coarse[ind+1] + coarse[ind+cw] + coarse[ind+cw+1]);
+    row[2*m]   = 0.125f * (tmp[m-1] + 6.0f*tmp[m] + tmp[m+1]);
+    row[2*m+1] = 0.5f * (tmp[m] + tmp[m+1]);
   }
+  row[0] = row[1];
+  for(int i=last+1;i<wd;i++) row[i] = row[last];
 }
 
 // helper to fill in one pixel boundary by copying it
@@ -116,20 +108,6 @@ static inline void ll_fill_boundary1(
   memcpy(input+wd*(ht-1), input+wd*(ht-2), sizeof(float)*wd);
 }
 
-// helper to fill in two pixels boundary by copying it
-static inline void ll_fill_boundary2(
-    float *const input,
-    const int wd,
-    const int ht)
-{
-  for(int j=1;j<ht-1;j++) input[j*wd] = input[j*wd+1];
-  if(wd & 1) for(int j=1;j<ht-1;j++) input[j*wd+wd-1] = input[j*wd+wd-2];
-  else       for(int j=1;j<ht-1;j++) input[j*wd+wd-1] = input[j*wd+wd-2] = input[j*wd+wd-3];
-  memcpy(input, input+wd, sizeof(float)*wd);
-  if(!(ht & 1)) memcpy(input+wd*(ht-2), input+wd*(ht-3), sizeof(float)*wd);
-  memcpy(input+wd*(ht-1), input+wd*(ht-2), sizeof(float)*wd);
-}
-
 static void pad_by_replication(
     float *buf,			// the buffer to be padded
     const uint32_t w,		// width of a line
@@ -148,24 +126,6 @@ static void pad_by_replication(
   }
 }
 
-static inline void gauss_expand(
-    const float *const input, // coarse input
-    float *const fine,        // upsampled, blurry output
-    const int wd,             // fine res
-    const int ht)
-{
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(fine, input, wd, ht) \
-  schedule(static) \
-  collapse(2)
-#endif
-  for(int j=1;j<((ht-1)&~1);j++)  // even ht: two px boundary. odd ht: one px.
-    for(int i=1;i<((wd-1)&~1);i++)
-      fine[j*wd+i] = ll_expand_gaussian(input, i, j, wd, ht);
-  ll_fill_boundary2(fine, wd, ht);
-}
-
 #if defined(__SSE2__)
 static inline __m128 convolve14641_vert(const float *in, const int wd)
 {
@@ -383,17 +343,46 @@ static inline float *ll_pad_input(
 }
 
 
-static inline float ll_laplacian(
-    const float *const coarse,   // coarse res gaussian
-    const float *const fine,     // fine res gaussian
-    const int i,                 // fine index
-    const int j,
-    const int wd,                // fine width
-    const int ht)                // fine height
+// Catmull-Rom cubic kernel
+static inline float ll_cubic(const float t)
+{
+  const float a = fabsf(t);
+  return a < 1.0f ? (1.5f*a - 2.5f)*a*a + 1.0f
+       : a < 2.0f ? ((-0.5f*a + 2.5f)*a - 4.0f)*a + 2.0f
+       : 0.0f;
+}
+
+// weights of the laplacian of the brightness level k at t = (v - gamma[k]) * levels, for the brightness v
+// clamped to [gamma[0], gamma[levels-1]]: linear interpolation between the two nearest levels, or
+// Catmull-Rom through the four nearest ones. There, the missing levels beyond the ends are extrapolated
+// linearly from the last two, which adds e times the kernel at t+d to the weight of the levels next to the
+// ends: 2 at t+1 and 2 at t-1 for the first and last levels, -1 at t+2 and -1 at t-2 for the second ones.
+static inline float ll_weight_linear(const float t)
+{
+  return MAX(0.0f, 1.0f - fabsf(t));
+}
+
+static inline float ll_weight_cubic(const float t, const float e, const float d)
+{
+  return ll_cubic(t) + e * ll_cubic(t + d);
+}
+
+// expf() to about one ulp for x <= 0, without branches nor calls so that the curve vectorizes: the build
+// doesn't let gcc use the vector versions of libm. Cephes: x = n ln2 + r, |r| <= ln2/2, and a polynomial
+// for exp(r), scaled by 2^n through the exponent bits.
+static inline float ll_expf(const float x)
 {
-  const float c = ll_expand_gaussian(coarse,
-      CLAMPS(i, 1, ((wd-1)&~1)-1), CLAMPS(j, 1, ((ht-1)&~1)-1), wd, ht);
-  return fine[j*wd+i] - c;
+  const float xc = MAX(x, -87.0f);
+  const int n = (int)(xc * 1.44269504f - 0.5f); // rounded, xc is negative
+  const float r = xc - n * 0.693359375f + n * 2.12194440e-4f;
+  float p = 1.9875691500e-4f;
+  p = p * r + 1.3981999507e-3f;
+  p = p * r + 8.3334519073e-3f;
+  p = p * r + 4.1665795894e-2f;
+  p = p * r + 1.6666665459e-1f;
+  p = p * r + 5.0000001201e-1f;
+  union { float f; uint32_t i; } scale = { .i = (uint32_t)(n + 127) << 23 };
+  return (p * r * r + r + 1.0f) * scale.f;
 }
 
 static inline float curve_scalar(
@@ -424,112 +413,11 @@ static inline float curve_scalar(
     val = g - sigma * 2.0f*mt*t + t2*(- sigma - sigma*highlights);
   }
   // midtone local contrast
-  val += clarity * c * expf(-c*c/(2.0*sigma*sigma/3.0f));
+  val += clarity * c * ll_expf(-c*c/(2.0f*sigma*sigma/3.0f));
   return val;
 }
 
-#if defined(__SSE2__)
-static inline __m128 curve_vec4(
-    const __m128 x,
-    const __m128 g,
-    const __m128 sigma,
-    const __m128 shadows,
-    const __m128 highlights,
-    const __m128 clarity)
-{
-  // TODO: pull these non-data dependent constants out of the loop to see
-  // whether the compiler fail to do so
-  const __m128 const0 = _mm_set_ps1(0x3f800000u);
-  const __m128 const1 = _mm_set_ps1((float)0x402DF854u); // for e^x
-  const __m128 sign_mask = _mm_set1_ps(-0.f); // -0.f = 1 << 31
-  const __m128 one = _mm_set1_ps(1.0f);
-  const __m128 two = _mm_set1_ps(2.0f);
-  const __m128 twothirds = _mm_set1_ps(2.0f/3.0f);
-  const __m128 twosig = _mm_mul_ps(two, sigma);
-  const __m128 sigma2 = _mm_mul_ps(sigma, sigma);
-  const __m128 s22 = _mm_mul_ps(twothirds, sigma2);
-
-  const __m128 c = _mm_sub_ps(x, g);
-  const __m128 select = _mm_cmplt_ps(c, _mm_setzero_ps());
-  // select shadows or highlights as multiplier for linear part, based on c < 0
-  const __m128 shadhi = _mm_or_ps(_mm_andnot_ps(select, shadows), _mm_and_ps(select, highlights));
-  // flip sign bit of sigma based on c < 0 (c < 0 ? - sigma : sigma)
-  const __m128 ssigma = _mm_xor_ps(sigma, _mm_and_ps(select, sign_mask));
-  // this contains the linear parts valid for c > 2*sigma or c < - 2*sigma
-  const __m128 vlin = _mm_add_ps(g, _mm_add_ps(ssigma, _mm_mul_ps(shadhi, _mm_sub_ps(c, ssigma))));
-
-  const __m128 t = _mm_min_ps(one, _mm_max_ps(_mm_setzero_ps(),
-        _mm_div_ps(c, _mm_mul_ps(two, ssigma))));
-  const __m128 t2 = _mm_mul_ps(t, t);
-  const __m128 mt = _mm_sub_ps(one, t);
-
-  // midtone value fading over to linear part, without local contrast:
-  const __m128 vmid = _mm_add_ps(g,
-      _mm_add_ps(_mm_mul_ps(_mm_mul_ps(ssigma, two), _mm_mul_ps(mt, t)),
-        _mm_mul_ps(t2, _mm_add_ps(ssigma, _mm_mul_ps(ssigma, shadhi)))));
-
-  // c > 2*sigma?
-  const __m128 linselect = _mm_cmpgt_ps(_mm_andnot_ps(sign_mask, c), twosig);
-  const __m128 val = _mm_or_ps(_mm_and_ps(linselect, vlin), _mm_andnot_ps(linselect, vmid));
-
-  // midtone local contrast
-  // dt_fast_expf in sse:
-  const __m128 arg = _mm_xor_ps(sign_mask, _mm_div_ps(_mm_mul_ps(c, c), s22));
-  const __m128 k0 = _mm_add_ps(const0, _mm_mul_ps(arg, _mm_sub_ps(const1, const0)));
-  const __m128 k = _mm_max_ps(k0, _mm_setzero_ps());
-  const __m128i ki = _mm_cvtps_epi32(k);
-  const __m128 gauss = _mm_load_ps((float*)&ki);
-  const __m128 vcon = _mm_mul_ps(clarity, _mm_mul_ps(c, gauss));
-  return _mm_add_ps(val, vcon);
-}
-
-// sse (4-wide)
-void apply_curve_sse2(
-    float *const out,
-    const float *const in,
-    const uint32_t w,
-    const uint32_t h,
-    const uint32_t padding,
-    const float g,
-    const float sigma,
-    const float shadows,
-    const float highlights,
-    const float clarity)
-{
-  // TODO: do all this in avx2 8-wide (should be straight forward):
-#ifdef _OPENMP
-#pragma omp parallel for default(none) \
-  dt_omp_firstprivate(clarity, g, h, highlights, in, out, padding, shadows, sigma, w) \
-  schedule(static)
-#endif
-  for(uint32_t j=padding;j<h-padding;j++)
-  {
-    const float *in2  = in  + j*w + padding;
-    float *out2 = out + j*w + padding;
-    // find 4-byte aligned block in the middle:
-    const float *const beg = (float *)((size_t)(out2+3)&(size_t)0x10ul);
-    const float *const end = (float *)((size_t)(out2+w-padding)&(size_t)0x10ul);
-    const float *const fin = out2+w-padding;
-    const __m128 g4 = _mm_set1_ps(g);
-    const __m128 sig4 = _mm_set1_ps(sigma);
-    const __m128 shd4 = _mm_set1_ps(shadows);
-    const __m128 hil4 = _mm_set1_ps(highlights);
-    const __m128 clr4 = _mm_set1_ps(clarity);
-    for(;out2<beg;out2++,in2++)
-      *out2 = curve_scalar(*in2, g, sigma, shadows, highlights, clarity);
-    for(;out2<end;out2+=4,in2+=4)
-      _mm_stream_ps(out2, curve_vec4(_mm_load_ps(in2), g4, sig4, shd4, hil4, clr4));
-    for(;out2<fin;out2++,in2++)
-      *out2 = curve_scalar(*in2, g, sigma, shadows, highlights, clarity);
-    out2 = out + j*w;
-    for(int i=0;i<padding;i++)   out2[i] = out2[padding];
-    for(int i=w-padding;i<w;i++) out2[i] = out2[w-padding-1];
-  }
-  pad_by_replication(out, w, h, padding);
-}
-#endif
-
-// scalar version
+// vectorized by the compiler, also on the sse2 path
 void apply_curve(
     float *const out,
     const float *const in,
@@ -569,8 +457,10 @@ void local_laplacian_internal(
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
     const float clarity,        // user param: increase clarity/local contrast
+    const int fast,             // fewer brightness levels, interpolated cubically
     const int use_sse2,         // flag whether to use SSE version
-    local_laplacian_boundary_t *b)
+    local_laplacian_boundary_t *b,
+    local_laplacian_cache_t *cache)
 {
   if(wd <= 1 || ht <= 1) return;
 
@@ -580,59 +470,75 @@ void local_laplacian_internal(
   if(b && b->mode == 2) // higher number here makes it less prone to aliasing and slower.
     last_level = num_levels > 4 ? 4 : num_levels-1;
   const int max_supp = 1<<last_level;
-  int w, h;
+  const int w = 2*max_supp + wd, h = 2*max_supp + ht;
+
+  // the gaussian pyramid of the padded input only depends on the input when it is padded by replication
+  if(b && b->mode != 0) cache = NULL;
+  size_t pyramid_size = 0;
+  for(int l=0;l<=last_level;l++) pyramid_size += sizeof(float) * dl(w,l) * dl(h,l);
+  if(pyramid_size > max_cache_bytes) cache = NULL;
+  uint64_t hash = 0;
+  if(cache)
+  {
+    hash = dt_iop_image_channel_hash(input, wd, ht, 4, 0);
+    hash = dt_hash(hash, (const char *)&wd, sizeof(int));
+    hash = dt_hash(hash, (const char *)&ht, sizeof(int));
+    hash = dt_hash(hash, (const char *)&use_sse2, sizeof(int));
+  }
+  const int cached = cache && cache->hash == hash && cache->num_levels == last_level+1;
+
   float *padded[max_levels] = {0};
-  if(b && b->mode == 2)
-    padded[0] = ll_pad_input(input, wd, ht, max_supp, &w, &h, b);
+  if(cached)
+  {
+    for(int l=0;l<=last_level;l++) padded[l] = cache->pyramid[l];
+  }
   else
-    padded[0] = ll_pad_input(input, wd, ht, max_supp, &w, &h, 0);
-
-  // allocate pyramid pointers for padded input
-  for(int l=1;l<=last_level;l++)
-    padded[l] = dt_alloc_align_float((size_t)dl(w,l) * dl(h,l));
+  {
+    int w2, h2;
+    padded[0] = ll_pad_input(input, wd, ht, max_supp, &w2, &h2, b);
 
-  // allocate pyramid pointers for output
-  float *output[max_levels] = {0};
-  for(int l=0;l<=last_level;l++)
-    output[l] = dt_alloc_align_float((size_t)dl(w,l) * dl(h,l));
+    // allocate pyramid pointers for padded input
+    for(int l=1;l<=last_level;l++)
+      padded[l] = dt_alloc_align_float((size_t)dl(w,l) * dl(h,l));
 
-  // create gauss pyramid of padded input, write coarse directly to output
+    // create gauss pyramid of padded input
 #if defined(__SSE2__)
-  if(use_sse2)
-  {
-    for(int l=1;l<last_level;l++)
-      gauss_reduce_sse2(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1));
-    gauss_reduce_sse2(padded[last_level-1], output[last_level], dl(w,last_level-1), dl(h,last_level-1));
-  }
-  else
+    if(use_sse2)
+    {
+      for(int l=1;l<=last_level;l++)
+        gauss_reduce_sse2(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1));
+    }
+    else
 #endif
-  {
-    for(int l=1;l<last_level;l++)
-      gauss_reduce(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1));
-    gauss_reduce(padded[last_level-1], output[last_level], dl(w,last_level-1), dl(h,last_level-1));
+    {
+      for(int l=1;l<=last_level;l++)
+        gauss_reduce(padded[l-1], padded[l], dl(w,l-1), dl(h,l-1));
+    }
   }
 
+  // allocate pyramid pointers for output, starting from the coarse input
+  float *output[max_levels] = {0};
+  for(int l=0;l<=last_level;l++)
+    output[l] = dt_alloc_align_float((size_t)dl(w,l) * dl(h,l));
+  memcpy(output[last_level], padded[last_level], sizeof(float) * dl(w,last_level) * dl(h,last_level));
+
   // evenly sample brightness [0,1]:
+  const int levels = fast ? num_gamma_fast : num_gamma;
   float gamma[num_gamma] = {0.0f};
-  for(int k=0;k<num_gamma;k++) gamma[k] = (k+.5f)/(float)num_gamma;
-  // for(int k=0;k<num_gamma;k++) gamma[k] = k/(num_gamma-1.0f);
+  for(int k=0;k<levels;k++) gamma[k] = (k+.5f)/(float)levels;
+  // for(int k=0;k<levels;k++) gamma[k] = k/(levels-1.0f);
 
   // allocate memory for intermediate laplacian pyramids
   float *buf[num_gamma][max_levels] = {{0}};
-  for(int k=0;k<num_gamma;k++) for(int l=0;l<=last_level;l++)
+  for(int k=0;k<levels;k++) for(int l=0;l<=last_level;l++)
     buf[k][l] = dt_alloc_align_float((size_t)dl(w,l)*dl(h,l));
 
   // the paper says remapping only level 3 not 0 does the trick, too
   // (but i really like the additional octave of sharpness we get,
   // willing to pay the cost).
-  for(int k=0;k<num_gamma;k++)
+  for(int k=0;k<levels;k++)
   { // process images
-#if defined(__SSE2__)
-    if(use_sse2)
-      apply_curve_sse2(buf[k][0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);
-    else // brackets in next line needed for silly gcc warning:
-#endif
-    {apply_curve(buf[k][0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);}
+    apply_curve(buf[k][0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);
 
     // create gaussian pyramids
     for(int l=1;l<=last_level;l++)
@@ -702,30 +608,83 @@ void local_laplacian_internal(
     debug_dump_PFM("/tmp/newcoarse.pfm", output[last_level], pw, ph);
   }
 
+  // extrapolation of the brightness levels next to the ends, see ll_weight_cubic()
+  float ends[num_gamma][2] = {{0.0f}};
+  ends[0][0] = 2.0f;         ends[0][1] = 1.0f;
+  ends[1][0] = -1.0f;        ends[1][1] = 2.0f;
+  ends[levels-2][0] = -1.0f; ends[levels-2][1] = -2.0f;
+  ends[levels-1][0] = 2.0f;  ends[levels-1][1] = -1.0f;
+  const int cubic = fast;
+  const float radius = cubic ? 2.0f : 1.0f; // support of the interpolation, in brightness levels
+
+  // per-thread rows: the expanded coarse level, followed by the vertically blended coarse rows
+  size_t padded_row;
+  float *const rows = dt_alloc_perthread(w + w/2 + 2, sizeof(float), &padded_row);
+
   // assemble output pyramid coarse to fine
   for(int l=last_level-1;l >= 0; l--)
   {
     const int pw = dl(w,l), ph = dl(h,l);
+    const float *const coarse = output[l+1];
+    float *const fine = output[l];
+    const float *const grey = padded[l];
 
-    gauss_expand(output[l+1], output[l], pw, ph);
-    // go through all coefficients in the upsampled gauss buffer:
+    // go through all coefficients in the upsampled gauss buffer, one row at a time. Each row is the
+    // expanded coarse output plus the laplacians of the brightness levels near the input grey levels.
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-    dt_omp_firstprivate(ph, pw) \
-    shared(w,h,buf,output,l,gamma,padded) \
-    schedule(static) \
-    collapse(2)
+    dt_omp_firstprivate(pw, ph, l, levels, cubic, radius, coarse, fine, grey, rows, padded_row, ends, gamma) \
+    shared(buf) \
+    schedule(static)
 #endif
-    for(int j=0;j<ph;j++) for(int i=0;i<pw;i++)
+    for(int j=0;j<ph;j++)
     {
-      const float v = padded[l][j*pw+i];
-      int hi = 1;
-      for(;hi<num_gamma-1 && gamma[hi] <= v;hi++);
-      int lo = hi-1;
-      const float a = CLAMPS((v - gamma[lo])/(gamma[hi]-gamma[lo]), 0.0f, 1.0f);
-      const float l0 = ll_laplacian(buf[lo][l+1], buf[lo][l], i, j, pw, ph);
-      const float l1 = ll_laplacian(buf[hi][l+1], buf[hi][l], i, j, pw, ph);
-      output[l][j*pw+i] += l0 * (1.0f-a) + l1 * a;
+      float *const restrict expanded = dt_get_perthread(rows, padded_row);
+      float *const restrict tmp = expanded + pw;
+      float *const restrict out_row = fine + (size_t)j*pw;
+      const float *const restrict grey_row = grey + (size_t)j*pw;
+
+      ll_expand_row(coarse, out_row, tmp, j, pw, ph);
+
+      float vmin = 1.0f, vmax = 0.0f;
+#ifdef _OPENMP
+#pragma omp simd reduction(min : vmin) reduction(max : vmax)
+#endif
+      for(int i=0;i<pw;i++)
+      {
+        vmin = MIN(vmin, grey_row[i]);
+        vmax = MAX(vmax, grey_row[i]);
+      }
+      vmin = CLAMPS(vmin, gamma[0], gamma[levels-1]);
+      vmax = CLAMPS(vmax, gamma[0], gamma[levels-1]);
+
+      for(int k=0;k<levels;k++)
+      {
+        // skip the brightness levels that no pixel of the row interpolates
+        if((vmin - gamma[k]) * levels >= radius || (gamma[k] - vmax) * levels >= radius) continue;
+
+        ll_expand_row(buf[k][l+1], expanded, tmp, j, pw, ph);
+        const float *const restrict gauss_row = buf[k][l] + (size_t)j*pw;
+        const float g = gamma[k];
+        const float lo = gamma[0], hi = gamma[levels-1];
+        if(cubic)
+        {
+          const float e = ends[k][0], d = ends[k][1];
+          for(int i=0;i<pw;i++)
+          {
+            const float t = (CLAMPS(grey_row[i], lo, hi) - g) * levels;
+            out_row[i] += ll_weight_cubic(t, e, d) * (gauss_row[i] - expanded[i]);
+          }
+        }
+        else
+        {
+          for(int i=0;i<pw;i++)
+          {
+            const float t = (CLAMPS(grey_row[i], lo, hi) - g) * levels;
+            out_row[i] += ll_weight_linear(t) * (gauss_row[i] - expanded[i]);
+          }
+        }
+      }
       // we could do this to save on memory (no need for finest buf[][]).
       // unfortunately it results in a quite noticeable loss of sharpness, i think
       // the extra level is worth it.
@@ -733,10 +692,11 @@ void local_laplacian_internal(
       //   output[l][j*pw+i] += ll_laplacian(padded[l+1], padded[l], i, j, pw, ph);
     }
   }
+  dt_free_align(rows);
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(ht, input, max_supp, out, wd) \
-  shared(w,output,buf) \
+  dt_omp_firstprivate(ht, input, max_supp, out, w, wd) \
+  shared(output) \
   schedule(static) \
   collapse(2)
 #endif
@@ -756,10 +716,17 @@ void local_laplacian_internal(
     b->num_levels = num_levels;
     for(int l=0;l<num_levels;l++) b->output[l] = output[l];
   }
-  // free all buffers except the ones passed out for preview rendering
+  if(cache && !cached)
+  { // keep the input pyramid for the next run
+    local_laplacian_cache_free(cache);
+    cache->hash = hash;
+    cache->num_levels = last_level+1;
+    for(int l=0;l<=last_level;l++) cache->pyramid[l] = padded[l];
+  }
+  // free all buffers except the ones passed out for preview rendering or kept in the cache
   for(int l=0;l<max_levels;l++)
   {
-    if(!b || b->mode != 1 || l)   dt_free_align(padded[l]);
+    if(!cache && (!b || b->mode != 1 || l)) dt_free_align(padded[l]);
     if(!b || b->mode != 1)        dt_free_align(output[l]);
     for(int k=0; k<num_gamma;k++) dt_free_align(buf[k][l]);
   }
@@ -19,6 +19,8 @@
 
 #include "develop/imageop.h"
 
+#include <stdint.h>
+
 // struct bundling all the auxiliary buffers
 // required to fill the boundary of a full res pipeline
 // with the coarse but complete roi preview pipeline
@@ -37,6 +39,23 @@ typedef struct local_laplacian_boundary_t
 }
 local_laplacian_boundary_t;
 
+// gaussian pyramid of the grey levels of the padded input of a previous run. It only depends on the input,
+// so it is kept while the parameters change and only the remapped pyramids are computed again.
+typedef struct local_laplacian_cache_t
+{
+  uint64_t hash;           // hash of the input grey levels and size, 0 if empty
+  int num_levels;          // number of levels in the pyramid
+  float *pyramid[30];      // padded input and its gaussian pyramid (allocated via dt_alloc_align)
+}
+local_laplacian_cache_t;
+
+void local_laplacian_cache_free(
+    local_laplacian_cache_t *c)
+{
+  for(int l=0;l<c->num_levels;l++) dt_free_align(c->pyramid[l]);
+  memset(c, 0, sizeof(*c));
+}
+
 void local_laplacian_boundary_free(
     local_laplacian_boundary_t *b)
 {
@@ -54,9 +73,12 @@ void local_laplacian_internal(
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
     const float clarity,        // user param: increase clarity/local contrast
+    const int fast,             // fewer brightness levels, interpolated cubically
     const int use_sse2,         // switch on sse optimised version, if available
     // the following is just needed for clipped roi with boundary conditions from coarse buffer (can be 0)
-    local_laplacian_boundary_t *b);
+    local_laplacian_boundary_t *b,
+    // input pyramid kept across calls on the same input, only used without boundary (can be 0)
+    local_laplacian_cache_t *cache);
 
 void local_laplacian(
     const float *const input,   // input buffer in some Labx or yuvx format
@@ -67,9 +89,11 @@ void local_laplacian(
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
     const float clarity,        // user param: increase clarity/local contrast
-    local_laplacian_boundary_t *b) // can be 0
+    const int fast,             // fewer brightness levels, interpolated cubically
+    local_laplacian_boundary_t *b, // can be 0
+    local_laplacian_cache_t *cache) // can be 0
 {
-  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, 0, b);
+  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, fast, 0, b, cache);
 }
 
 size_t local_laplacian_memory_use(const int width,      // width of input image
@@ -90,9 +114,11 @@ void local_laplacian_sse2(
     const float shadows,        // user param: lift shadows
     const float highlights,     // user param: compress highlights
     const float clarity,        // user param: increase clarity/local contrast
-    local_laplacian_boundary_t *b) // can be 0
+    const int fast,             // fewer brightness levels, interpolated cubically
+    local_laplacian_boundary_t *b, // can be 0
+    local_laplacian_cache_t *cache) // can be 0
 {
-  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, 1, b);
+  local_laplacian_internal(input, out, wd, ht, sigma, shadows, highlights, clarity, fast, 1, b, cache);
 }
 #endif
 // clang-format off
@@ -22,13 +22,16 @@
 #include "common/exif.h"
 #include "common/file_location.h"
 #include "common/grealpath.h"
+#include "common/history.h"
 #include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/imageio_jpeg.h"
 #include "common/imageio_module.h"
 #include "control/conf.h"
 #include "control/jobs.h"
+#include "control/signal.h"
 #include "develop/imageop_math.h"
+#include "develop/pixelpipe_hb.h"
 
 #include <assert.h>
 #include <errno.h>
@@ -61,7 +64,9 @@ typedef enum dt_mipmap_buffer_dsc_flags
 {
   DT_MIPMAP_BUFFER_DSC_FLAG_NONE = 0,
   DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE = 1 << 0,
-  DT_MIPMAP_BUFFER_DSC_FLAG_INVALIDATE = 1 << 1
+  DT_MIPMAP_BUFFER_DSC_FLAG_INVALIDATE = 1 << 1,
+  // rendered by a draft thumbnail pipe, see lighttable/thumbnail_quality
+  DT_MIPMAP_BUFFER_DSC_FLAG_DRAFT = 1 << 2
 } dt_mipmap_buffer_dsc_flags;
 
 // the embedded Exif data to tag thumbnails as sRGB or AdobeRGB
@@ -88,6 +93,8 @@ struct dt_mipmap_buffer_dsc
   size_t size;
   dt_mipmap_buffer_dsc_flags flags;
   dt_colorspaces_color_profile_type_t color_space;
+  // history digest the thumbnail was rendered from, its key in the pack files. 0 if unknown.
+  uint64_t history_hash;
 
 #if __has_feature(address_sanitizer) || defined(__SANITIZE_ADDRESS__)
   // do not touch!
@@ -185,11 +192,81 @@ exit:
   return r;
 }
 
+// digests of the current history of the images, read once from the database and then kept here,
+// so looking thumbnails up in the pack files doesn't query the database each time.
+static GHashTable *_history_hashes = NULL;
+static uint32_t _history_hashes_generation = 0;
+static dt_pthread_mutex_t _history_hashes_lock;
+
+// digest of the current history of the image, to tell stale thumbnails apart in the pack files
+static uint64_t _history_hash(const int32_t imgid)
+{
+  dt_pthread_mutex_lock(&_history_hashes_lock);
+  const uint64_t *known = g_hash_table_lookup(_history_hashes, GINT_TO_POINTER(imgid));
+  const uint64_t cached = known ? *known : 0;
+  const uint32_t generation = _history_hashes_generation;
+  dt_pthread_mutex_unlock(&_history_hashes_lock);
+  if(known) return cached;
+
+  dt_history_hash_values_t hash;
+  dt_history_hash_read(imgid, &hash);
+  // FNV-1a
+  uint64_t digest = 14695981039346656037ULL;
+  for(int k = 0; k < hash.current_len; k++) digest = (digest ^ hash.current[k]) * 1099511628211ULL;
+  free(hash.basic);
+  free(hash.auto_apply);
+  free(hash.current);
+
+  // don't keep what we read if the history was changed meanwhile
+  dt_pthread_mutex_lock(&_history_hashes_lock);
+  if(generation == _history_hashes_generation)
+  {
+    uint64_t *value = g_new(uint64_t, 1);
+    *value = digest;
+    g_hash_table_insert(_history_hashes, GINT_TO_POINTER(imgid), value);
+  }
+  dt_pthread_mutex_unlock(&_history_hashes_lock);
+  return digest;
+}
+
+void dt_mipmap_cache_history_changed(const int32_t imgid)
+{
+  if(!_history_hashes) return;
+  dt_pthread_mutex_lock(&_history_hashes_lock);
+  g_hash_table_remove(_history_hashes, GINT_TO_POINTER(imgid));
+  _history_hashes_generation++;
+  dt_pthread_mutex_unlock(&_history_hashes_lock);
+}
+
+// draft thumbnails are stored in the pack files under their own key, so they are never served as
+// full quality ones
+static inline uint64_t _pack_key(const uint64_t history_hash, const gboolean draft)
+{
+  return draft ? history_hash ^ 0x9e3779b97f4a7c15ULL : history_hash;
+}
+
+static gboolean _disk_has_room(const char *filename)
+{
+  struct statvfs vfsbuf;
+  if(statvfs(filename, &vfsbuf))
+  {
+    fprintf(stderr, "Aborting image write since couldn't determine free space available to write %s\n", filename);
+    return FALSE;
+  }
+  const int64_t free_mb = ((vfsbuf.f_frsize * vfsbuf.f_bavail) >> 20);
+  if(free_mb < 100)
+  {
+    fprintf(stderr, "Aborting image write as only %" PRId64 " MB free to write %s\n", free_mb, filename);
+    return FALSE;
+  }
+  return TRUE;
+}
+
 static void _init_f(dt_mipmap_buffer_t *mipmap_buf, float *buf, uint32_t *width, uint32_t *height, float *iscale,
                     const int32_t imgid);
 static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *iscale,
-                    dt_colorspaces_color_profile_type_t *color_space, const int32_t imgid,
-                    const dt_mipmap_size_t size);
+                    dt_colorspaces_color_profile_type_t *color_space, gboolean *draft,
+                    const uint64_t history_hash, const int32_t imgid, const dt_mipmap_size_t size);
 
 
 /**
@@ -297,6 +374,7 @@ void dt_mipmap_cache_update_buffer_addresses(dt_cache_entry_t *entry, struct dt_
   (*dsc)->iscale = 1.0f;
   (*dsc)->color_space = DT_COLORSPACE_NONE;
   (*dsc)->flags = DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
+  (*dsc)->history_hash = 0;
   (*dsc)->size = _get_entry_size(buffer_size);
 }
 
@@ -363,6 +441,65 @@ void *dt_mipmap_cache_alloc(dt_mipmap_buffer_t *buf, const dt_image_t *img)
   return _get_buffer_from_dsc(dsc);
 }
 
+static void _read_from_pack(dt_mipmap_cache_t *cache, struct dt_mipmap_buffer_dsc *dsc, const int32_t imgid,
+                            const dt_mipmap_size_t mip)
+{
+  uint32_t width = 0, height = 0;
+  int32_t color_space = DT_COLORSPACE_DISPLAY;
+  const uint64_t hash = _history_hash(imgid);
+  const size_t out_size = (size_t)cache->max_width[mip] * cache->max_height[mip] * 4;
+  int res = dt_mipmap_pack_read(cache->pack[mip], imgid, _pack_key(hash, FALSE), _get_buffer_from_dsc(dsc),
+                                out_size, &width, &height, &color_space);
+  // full quality thumbnails are always fine, drafts only as long as drafts are requested
+  gboolean draft = FALSE;
+  if(res == 1 && cache->draft_thumbnails)
+  {
+    res = dt_mipmap_pack_read(cache->pack[mip], imgid, _pack_key(hash, TRUE), _get_buffer_from_dsc(dsc),
+                              out_size, &width, &height, &color_space);
+    draft = TRUE;
+  }
+  if(res == 2)
+  {
+    fprintf(stderr, "[mipmap_cache] corrupted thumbnail for image %" PRIu32 " in the pack of mip %d, dropping it\n",
+            imgid, mip);
+    dt_mipmap_pack_remove(cache->pack[mip], imgid);
+  }
+  if(res) return;
+
+  // Same tolerance as for JPEG files: 2 px error on the dimensions for rounding errors,
+  // unless the original file is anyway smaller than the requested mip
+  const dt_image_t *cimg = dt_image_cache_get(darktable.image_cache, imgid, 'r');
+  const gboolean bad_width = (uint32_t)cimg->width > width && width < cache->max_width[mip] - 2;
+  const gboolean bad_height = (uint32_t)cimg->height > height && height < cache->max_height[mip] - 2;
+  dt_image_cache_read_release(darktable.image_cache, cimg);
+  if(bad_width && bad_height) return;
+
+  dt_print(DT_DEBUG_CACHE, "[mipmap_cache] grab mip %d for image %" PRIu32 " (%ix%i) from disk pack\n", mip,
+           imgid, width, height);
+
+  dsc->width = width;
+  dsc->height = height;
+  dsc->iscale = 1.0f;
+  dsc->color_space = color_space;
+  dsc->flags = draft ? DT_MIPMAP_BUFFER_DSC_FLAG_DRAFT : 0;
+  dsc->history_hash = hash;
+}
+
+static void _write_to_pack(dt_mipmap_cache_t *cache, struct dt_mipmap_buffer_dsc *dsc, const int32_t imgid,
+                           const dt_mipmap_size_t mip)
+{
+  // Don't rewrite thumbnails that are already there and up-to-date
+  const uint64_t history_hash = dsc->history_hash ? dsc->history_hash : _history_hash(imgid);
+  const uint64_t hash = _pack_key(history_hash, dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_DRAFT);
+  if(dt_mipmap_pack_contains(cache->pack[mip], imgid, hash)) return;
+  char dirname[PATH_MAX] = { 0 };
+  snprintf(dirname, sizeof(dirname), "%s.d", cache->cachedir);
+  if(!_disk_has_room(dirname)) return;
+
+  dt_mipmap_pack_write(cache->pack[mip], imgid, hash, _get_buffer_from_dsc(dsc), dsc->width, dsc->height,
+                       dsc->color_space, cache->pack_codec);
+}
+
 // callback for the cache backend to initialize payload pointers
 // It's actually not dynamic at all, fixed size only.
 void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
@@ -391,7 +528,11 @@ void dt_mipmap_cache_allocate_dynamic(void *data, dt_cache_entry_t *entry)
 
   if(!dsc) return;
 
-  if(cache->cachedir[0] && dt_conf_get_bool("cache_disk_backend") && mip < DT_MIPMAP_F)
+  if(mip < DT_MIPMAP_F && cache->pack[mip] && dt_conf_get_bool("cache_disk_backend"))
+  {
+    _read_from_pack(cache, dsc, imgid, mip);
+  }
+  else if(cache->cachedir[0] && dt_conf_get_bool("cache_disk_backend") && mip < DT_MIPMAP_F)
   {
     // try and load from disk, if successful set flag
     char filename[PATH_MAX] = {0};
@@ -509,6 +650,7 @@ static void dt_mipmap_cache_unlink_ondisk_thumbnail(void *data, int32_t imgid, d
     snprintf(filename, sizeof(filename), "%s.d/%d/%"PRIu32".jpg", cache->cachedir, (int)mip, imgid);
     g_unlink(filename);
   }
+  if(mip < DT_MIPMAP_F && cache->pack[mip]) dt_mipmap_pack_remove(cache->pack[mip], imgid);
 }
 
 void dt_mipmap_cache_deallocate_dynamic(void *data, dt_cache_entry_t *entry)
@@ -525,9 +667,14 @@ void dt_mipmap_cache_deallocate_dynamic(void *data, dt_cache_entry_t *entry)
       {
         dt_mipmap_cache_unlink_ondisk_thumbnail(data, get_imgid(entry->key), mip);
       }
-      else if(cache->cachedir[0] && (dt_conf_get_bool("cache_disk_backend") && mip < DT_MIPMAP_F))
+      else if(cache->pack[mip] && dt_conf_get_bool("cache_disk_backend"))
+      {
+        _write_to_pack(cache, dsc, get_imgid(entry->key), mip);
+      }
+      else if(cache->cachedir[0] && (dt_conf_get_bool("cache_disk_backend") && mip < DT_MIPMAP_F)
+              && !(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_DRAFT))
       {
-        // serialize to disk
+        // serialize to disk, except drafts that could not be told apart from full quality thumbnails
         char filename[PATH_MAX] = {0};
         snprintf(filename, sizeof(filename), "%s.d/%d", cache->cachedir, mip);
         const int mkd = g_mkdir_with_parents(filename, 0750);
@@ -540,21 +687,7 @@ void dt_mipmap_cache_deallocate_dynamic(void *data, dt_cache_entry_t *entry)
           if (!g_file_test(filename, G_FILE_TEST_EXISTS) && (f = g_fopen(filename, "wb")))
           {
             // first check the disk isn't full
-            struct statvfs vfsbuf;
-            if (!statvfs(filename, &vfsbuf))
-            {
-              const int64_t free_mb = ((vfsbuf.f_frsize * vfsbuf.f_bavail) >> 20);
-              if (free_mb < 100)
-              {
-                fprintf(stderr, "Aborting image write as only %" PRId64 " MB free to write %s\n", free_mb, filename);
-                goto write_error;
-              }
-            }
-            else
-            {
-              fprintf(stderr, "Aborting image write since couldn't determine free space available to write %s\n", filename);
-              goto write_error;
-            }
+            if(!_disk_has_room(filename)) goto write_error;
 
             const int cache_quality = dt_conf_get_int("database_cache_quality");
             const uint8_t *exif = NULL;
@@ -590,6 +723,38 @@ static uint32_t nearest_power_of_two(const uint32_t value)
   return rc;
 }
 
+static int _collect_draft(const uint32_t key, const void *data, void *user_data)
+{
+  const struct dt_mipmap_buffer_dsc *dsc = (const struct dt_mipmap_buffer_dsc *)data;
+  if(dsc && (dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_DRAFT))
+  {
+    GList **keys = (GList **)user_data;
+    *keys = g_list_prepend(*keys, GUINT_TO_POINTER(key));
+  }
+  return 0;
+}
+
+// When going back from draft to full quality thumbnails, drop the drafts we hold in memory and on disk,
+// so they are rendered again.
+static void _preferences_changed(gpointer instance, gpointer user_data)
+{
+  dt_mipmap_cache_t *cache = (dt_mipmap_cache_t *)user_data;
+  const gboolean draft = dt_conf_is_equal("lighttable/thumbnail_quality", "speed");
+  const gboolean flush = cache->draft_thumbnails && !draft;
+  cache->draft_thumbnails = draft;
+  if(!flush) return;
+
+  GList *keys = NULL;
+  dt_cache_for_all(&cache->mip_thumbs.cache, _collect_draft, &keys);
+  for(GList *k = keys; k; k = g_list_next(k))
+  {
+    const uint32_t key = GPOINTER_TO_UINT(k->data);
+    dt_mipmap_cache_remove_at_size(cache, get_imgid(key), get_size(key));
+  }
+  dt_print(DT_DEBUG_CACHE, "[mipmap_cache] dropped %u draft thumbnails\n", g_list_length(keys));
+  g_list_free(keys);
+}
+
 void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
 {
   dt_mipmap_cache_get_filename(cache->cachedir, sizeof(cache->cachedir));
@@ -637,6 +802,31 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   cache->mip_full.stats_fetches = 0;
   cache->mip_full.stats_standin = 0;
 
+  // pack files for the disk cache
+  cache->pack_codec = dt_conf_is_equal("cache_disk_format", "compressed pack") ? DT_MIPMAP_PACK_DEFLATE
+                                                                                : DT_MIPMAP_PACK_RAW;
+  for(int k = 0; k < DT_MIPMAP_F; k++) cache->pack[k] = NULL;
+  if(cache->cachedir[0] && !dt_conf_is_equal("cache_disk_format", "jpeg"))
+  {
+    char filename[PATH_MAX] = { 0 };
+    snprintf(filename, sizeof(filename), "%s.d", cache->cachedir);
+    if(!g_mkdir_with_parents(filename, 0750))
+    {
+      for(int k = 0; k < DT_MIPMAP_F; k++)
+      {
+        snprintf(filename, sizeof(filename), "%s.d/%d.pack", cache->cachedir, k);
+        cache->pack[k] = dt_mipmap_pack_open(filename);
+      }
+    }
+  }
+
+  dt_pthread_mutex_init(&_history_hashes_lock, NULL);
+  _history_hashes = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+
+  cache->draft_thumbnails = dt_conf_is_equal("lighttable/thumbnail_quality", "speed");
+  DT_DEBUG_CONTROL_SIGNAL_CONNECT(darktable.signals, DT_SIGNAL_PREFERENCES_CHANGE, G_CALLBACK(_preferences_changed),
+                                  cache);
+
   dt_cache_init(&cache->mip_thumbs.cache, 0, dt_get_mipmap_mem());
   dt_cache_set_allocate_callback(&cache->mip_thumbs.cache, dt_mipmap_cache_allocate_dynamic, cache);
   dt_cache_set_cleanup_callback(&cache->mip_thumbs.cache, dt_mipmap_cache_deallocate_dynamic, cache);
@@ -661,9 +851,21 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
 
 void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache)
 {
+  DT_DEBUG_CONTROL_SIGNAL_DISCONNECT(darktable.signals, G_CALLBACK(_preferences_changed), cache);
+
   dt_cache_cleanup(&cache->mip_thumbs.cache);
   dt_cache_cleanup(&cache->mip_full.cache);
   dt_cache_cleanup(&cache->mip_f.cache);
+
+  // after the caches, which write their thumbnails on cleanup
+  for(int k = 0; k < DT_MIPMAP_F; k++)
+  {
+    dt_mipmap_pack_close(cache->pack[k]);
+    cache->pack[k] = NULL;
+  }
+  g_hash_table_destroy(_history_hashes);
+  _history_hashes = NULL;
+  dt_pthread_mutex_destroy(&_history_hashes_lock);
 }
 
 void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
@@ -870,7 +1072,15 @@ static void _generate_blocking(dt_cache_entry_t *entry, dt_mipmap_buffer_t *buf,
     dt_print(DT_DEBUG_CACHE,
              "[mipmap_cache] compute mip %d uint8 for image %i (%ix%i) from original file \n", mip,
              imgid, dsc->width, dsc->height);
-    _init_8((uint8_t *)_get_buffer_from_dsc(dsc), &dsc->width, &dsc->height, &dsc->iscale, &dsc->color_space, imgid, mip);
+    // the history the thumbnail is rendered from, to store it under the right key
+    dsc->history_hash = _history_hash(imgid);
+    gboolean draft = FALSE;
+    _init_8((uint8_t *)_get_buffer_from_dsc(dsc), &dsc->width, &dsc->height, &dsc->iscale, &dsc->color_space,
+            &draft, dsc->history_hash, imgid, mip);
+    if(draft)
+      dsc->flags |= DT_MIPMAP_BUFFER_DSC_FLAG_DRAFT;
+    else
+      dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_DRAFT;
   }
   dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
   _paint_skulls(buf, dsc, mip);
@@ -1140,6 +1350,7 @@ typedef struct _dummy_data_t
 {
   dt_imageio_module_data_t head;
   uint8_t *buf;
+  gboolean draft;
 } _dummy_data_t;
 
 static int _levels(dt_imageio_module_data_t *data)
@@ -1159,6 +1370,7 @@ static int _write_image(dt_imageio_module_data_t *data, const char *filename, co
 {
   _dummy_data_t *d = (_dummy_data_t *)data;
   memcpy(d->buf, in, sizeof(uint32_t) * data->width * data->height);
+  d->draft = pipe && pipe->draft;
   return 0;
 }
 
@@ -1208,9 +1420,44 @@ static int _find_sidecar_jpg(const char *filename, const char *ext, char *sideca
   return 0;
 }
 
+// Populate the smaller levels of the cache from a freshly rendered one, so they don't need to run
+// the pipeline or decode a JPEG again when they are requested. Levels that are already in cache, or
+// locked by another thread, are left alone.
+static void _derive_smaller_mips(const uint8_t *buf, const uint32_t width, const uint32_t height,
+                                 const dt_colorspaces_color_profile_type_t color_space, const gboolean draft,
+                                 const uint64_t history_hash, const int32_t imgid, const dt_mipmap_size_t size)
+{
+  if(width <= 8 || height <= 8) return;
+
+  dt_mipmap_cache_t *cache = darktable.mipmap_cache;
+  for(int k = (int)size - 1; k >= DT_MIPMAP_0; k--)
+  {
+    // never wait for an entry here: we are holding the write lock of a larger level,
+    // that its owner may be waiting for.
+    dt_cache_t *c = &_get_cache(cache, k)->cache;
+    dt_cache_entry_t *entry = dt_cache_tryget(c, get_key(imgid, k), 'w');
+    if(!entry) continue;
+
+    ASAN_UNPOISON_MEMORY_REGION(entry->data, entry->data_size);
+    struct dt_mipmap_buffer_dsc *dsc = _get_dsc_from_entry(entry);
+    if(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE)
+    {
+      dt_iop_downsample_8(buf, width, height, _get_buffer_from_dsc(dsc), cache->max_width[k], cache->max_height[k],
+                          &dsc->width, &dsc->height);
+      dsc->iscale = 1.0f;
+      dsc->color_space = color_space;
+      dsc->flags &= ~(DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE | DT_MIPMAP_BUFFER_DSC_FLAG_DRAFT);
+      if(draft) dsc->flags |= DT_MIPMAP_BUFFER_DSC_FLAG_DRAFT;
+      dsc->history_hash = history_hash;
+      dt_print(DT_DEBUG_CACHE, "[mipmap_cache] derived mip %d for image %d from level %d\n", k, imgid, size);
+    }
+    dt_cache_release(c, entry);
+  }
+}
+
 static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *iscale,
-                    dt_colorspaces_color_profile_type_t *color_space, const int32_t imgid,
-                    const dt_mipmap_size_t size)
+                    dt_colorspaces_color_profile_type_t *color_space, gboolean *draft,
+                    const uint64_t history_hash, const int32_t imgid, const dt_mipmap_size_t size)
 {
   if(size >= DT_MIPMAP_F || *width < 16 || *height < 16) return;
 
@@ -1244,8 +1491,9 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
 
       dt_print(DT_DEBUG_CACHE, "[mipmap_cache] generate mip %d for image %d from level %d\n", size, imgid, k);
       *color_space = tmp.color_space;
+      *draft = (_get_dsc_from_entry(tmp.cache_entry)->flags & DT_MIPMAP_BUFFER_DSC_FLAG_DRAFT) != 0;
       // downsample
-      dt_iop_flip_and_zoom_8(tmp.buf, tmp.width, tmp.height, buf, wd, ht, ORIENTATION_NONE, width, height);
+      dt_iop_downsample_8(tmp.buf, tmp.width, tmp.height, buf, wd, ht, width, height);
 
       dt_mipmap_cache_release(darktable.mipmap_cache, &tmp);
       res = 0;
@@ -1253,6 +1501,9 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
     }
   }
 
+  // if we had a larger level, smaller ones are already there or can be downsampled from it as well
+  const gboolean from_larger_mip = !res;
+
   const dt_image_orientation_t orientation = dt_image_get_orientation(imgid);
 
   // Get the file extension
@@ -1322,6 +1573,7 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
     dat.head.max_width = wd;
     dat.head.max_height = ht;
     dat.buf = buf;
+    dat.draft = FALSE;
     // export with flags: ignore exif (don't load from disk), don't swap byte order, don't do hq processing,
     // no upscaling and signal we want thumbnail export
     res = dt_imageio_export_with_flags(imgid, "unused", &format, (dt_imageio_module_data_t *)&dat, TRUE, FALSE, FALSE,
@@ -1335,6 +1587,7 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
       *height = dat.head.height;
       *iscale = 1.0f;
       *color_space = DT_COLORSPACE_ADOBERGB;
+      *draft = dat.draft;
     }
   }
 
@@ -1346,6 +1599,10 @@ static void _init_8(uint8_t *buf, uint32_t *width, uint32_t *height, float *isca
     *iscale = 0.0f;
     *color_space = DT_COLORSPACE_NONE;
   }
+  else if(!from_larger_mip)
+  {
+    _derive_smaller_mips(buf, *width, *height, *color_space, *draft, history_hash, imgid, size);
+  }
 }
 
 void dt_mipmap_cache_copy_thumbnails(const dt_mipmap_cache_t *cache, const uint32_t dst_imgid, const uint32_t src_imgid)
@@ -1354,6 +1611,22 @@ void dt_mipmap_cache_copy_thumbnails(const dt_mipmap_cache_t *cache, const uint3
   {
     for(dt_mipmap_size_t mip = DT_MIPMAP_0; mip < DT_MIPMAP_F; mip++)
     {
+      if(cache->pack[mip])
+      {
+        const size_t size = (size_t)cache->max_width[mip] * cache->max_height[mip] * 4;
+        uint8_t *buf = dt_alloc_align(size);
+        uint32_t width, height;
+        int32_t color_space;
+        const uint64_t src_hash = _history_hash(src_imgid);
+        const gboolean draft = !dt_mipmap_pack_contains(cache->pack[mip], src_imgid, _pack_key(src_hash, FALSE))
+                               && dt_mipmap_pack_contains(cache->pack[mip], src_imgid, _pack_key(src_hash, TRUE));
+        if(buf && !dt_mipmap_pack_read(cache->pack[mip], src_imgid, 0, buf, size, &width, &height, &color_space))
+          dt_mipmap_pack_write(cache->pack[mip], dst_imgid, _pack_key(_history_hash(dst_imgid), draft), buf, width,
+                               height, color_space, cache->pack_codec);
+        dt_free_align(buf);
+        continue;
+      }
+
       // try and load from disk, if successful set flag
       char srcpath[PATH_MAX] = {0};
       char dstpath[PATH_MAX] = {0};
@@ -1371,6 +1644,28 @@ void dt_mipmap_cache_copy_thumbnails(const dt_mipmap_cache_t *cache, const uint3
   }
 }
 
+gboolean dt_mipmap_cache_has_disk_thumbnail(const dt_mipmap_cache_t *cache, const int32_t imgid,
+                                            const dt_mipmap_size_t mip)
+{
+  if(mip >= DT_MIPMAP_F || !cache->cachedir[0]) return FALSE;
+  if(cache->pack[mip])
+  {
+    const uint64_t hash = _history_hash(imgid);
+    return dt_mipmap_pack_contains(cache->pack[mip], imgid, _pack_key(hash, FALSE))
+           || (cache->draft_thumbnails && dt_mipmap_pack_contains(cache->pack[mip], imgid, _pack_key(hash, TRUE)));
+  }
+
+  char filename[PATH_MAX] = { 0 };
+  snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", cache->cachedir, (int)mip, imgid);
+  return dt_util_test_image_file(filename);
+}
+
+void dt_mipmap_cache_compact_disk(dt_mipmap_cache_t *cache)
+{
+  for(int k = 0; k < DT_MIPMAP_F; k++)
+    if(cache->pack[k] && dt_mipmap_pack_get_garbage(cache->pack[k]) > 0) dt_mipmap_pack_compact(cache->pack[k]);
+}
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -21,6 +21,7 @@
 #include "common/cache.h"
 #include "common/colorspaces.h"
 #include "common/image.h"
+#include "common/mipmap_pack.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -103,6 +104,11 @@ typedef struct dt_mipmap_cache_t
   dt_mipmap_cache_one_t mip_f;
   dt_mipmap_cache_one_t mip_full;
   char cachedir[PATH_MAX]; // cached sha1sum filename for faster access
+  // on-disk thumbnails as pack files instead of JPEG files, one per mip level, NULL if not enabled
+  dt_mipmap_pack_t *pack[DT_MIPMAP_F];
+  dt_mipmap_pack_codec_t pack_codec;
+  // thumbnails rendered by a draft pipe are shown and kept, per lighttable/thumbnail_quality
+  gboolean draft_thumbnails;
 } dt_mipmap_cache_t;
 
 // dynamic memory allocation interface for imageio backend: a write locked
@@ -166,6 +172,16 @@ dt_mipmap_size_t dt_mipmap_cache_get_matching_size(
 // only copies over the jpg backend on disk, doesn't directly affect the in-memory cache.
 void dt_mipmap_cache_copy_thumbnails(const dt_mipmap_cache_t *cache, const uint32_t dst_imgid, const uint32_t src_imgid);
 
+// TRUE if the disk cache holds an up-to-date thumbnail of this size for the image
+gboolean dt_mipmap_cache_has_disk_thumbnail(const dt_mipmap_cache_t *cache, const int32_t imgid,
+                                            const dt_mipmap_size_t mip);
+
+// reclaim the space of replaced and removed thumbnails in the disk cache pack files
+void dt_mipmap_cache_compact_disk(dt_mipmap_cache_t *cache);
+
+// forget the history digest kept for the image, to be called when its history hash is written
+void dt_mipmap_cache_history_changed(const int32_t imgid);
+
 
 // Wrapper to send a delayed DT_SIGNAL_DEVELOP_MIPMAP_UPDATED from g_idle_add
 // data is GINT_TO_POINTER(imgid)
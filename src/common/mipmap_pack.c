@@ -0,0 +1,448 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "common/mipmap_pack.h"
+#include "common/darktable.h"
+
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <zlib.h>
+
+/*
+ * File layout, in host byte order since the cache never leaves the machine:
+ *
+ *   file header, padded to PACK_ALIGN bytes
+ *   record header, padded to PACK_ALIGN bytes | payload, padded to PACK_ALIGN bytes
+ *   record header ...
+ *
+ * so every payload starts on a cache line of the mapping. A record with the TOMBSTONE codec removes the
+ * thumbnail of its image. The last record of an image wins. A record that goes beyond the end of the file,
+ * left by a crash in the middle of an append, ends the valid part of the file.
+ */
+
+#define PACK_MAGIC "ANSELMIP"
+#define PACK_VERSION 1
+#define PACK_ENDIANNESS 0x01020304u
+#define PACK_ALIGN 64
+#define PACK_RECORD_MAGIC 0x4345524Du // "MREC"
+#define PACK_TOMBSTONE 0xFFFFFFFFu
+
+// compact on open when replaced and removed records take more than half the file, and at least that much
+#define PACK_GARBAGE_MIN_BYTES (16 << 20)
+
+typedef struct dt_mipmap_pack_file_header_t
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t endianness;
+} dt_mipmap_pack_file_header_t;
+
+typedef struct dt_mipmap_pack_record_t
+{
+  uint32_t magic;
+  int32_t imgid;
+  uint64_t hash;
+  uint32_t width;
+  uint32_t height;
+  int32_t color_space;
+  uint32_t codec;
+  uint64_t size;     // payload bytes, without padding
+  uint32_t checksum; // adler32 of the payload
+  uint32_t reserved;
+} dt_mipmap_pack_record_t;
+
+typedef struct dt_mipmap_pack_entry_t
+{
+  uint64_t offset; // of the record header
+  dt_mipmap_pack_record_t record;
+} dt_mipmap_pack_entry_t;
+
+struct dt_mipmap_pack_t
+{
+  gchar *filename;
+  FILE *f;           // append-only, NULL after a write error
+  GMappedFile *map;  // may cover less than the file, remapped on demand
+  GHashTable *index; // imgid -> dt_mipmap_pack_entry_t
+  uint64_t end;      // end of the last record
+  uint64_t live;     // bytes of the indexed records
+  GMutex lock;
+};
+
+static inline uint64_t _padded(const uint64_t size)
+{
+  return (size + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+}
+
+static inline uint64_t _record_span(const dt_mipmap_pack_record_t *record)
+{
+  return PACK_ALIGN + _padded(record->size);
+}
+
+static void _index_insert(dt_mipmap_pack_t *pack, const uint64_t offset, const dt_mipmap_pack_record_t *record)
+{
+  const dt_mipmap_pack_entry_t *old = g_hash_table_lookup(pack->index, GINT_TO_POINTER(record->imgid));
+  if(old) pack->live -= _record_span(&old->record);
+
+  if(record->codec == PACK_TOMBSTONE)
+  {
+    g_hash_table_remove(pack->index, GINT_TO_POINTER(record->imgid));
+    return;
+  }
+
+  dt_mipmap_pack_entry_t *entry = g_malloc(sizeof(dt_mipmap_pack_entry_t));
+  entry->offset = offset;
+  entry->record = *record;
+  g_hash_table_insert(pack->index, GINT_TO_POINTER(record->imgid), entry);
+  pack->live += _record_span(record);
+}
+
+// make sure the mapping covers the file up to `end`. call with the lock held.
+static gboolean _map(dt_mipmap_pack_t *pack, const uint64_t end)
+{
+  if(pack->map && g_mapped_file_get_length(pack->map) >= end) return TRUE;
+  if(pack->map) g_mapped_file_unref(pack->map);
+  pack->map = g_mapped_file_new(pack->filename, FALSE, NULL);
+  return pack->map && g_mapped_file_get_length(pack->map) >= end;
+}
+
+static gboolean _write_padded(FILE *f, const void *data, const size_t size)
+{
+  static const uint8_t zeros[PACK_ALIGN] = { 0 };
+  const size_t padding = _padded(size) - size;
+  return fwrite(data, 1, size, f) == size && fwrite(zeros, 1, padding, f) == padding;
+}
+
+static FILE *_create(const char *filename)
+{
+  FILE *f = g_fopen(filename, "wb");
+  if(!f) return NULL;
+  dt_mipmap_pack_file_header_t header = { .version = PACK_VERSION, .endianness = PACK_ENDIANNESS };
+  memcpy(header.magic, PACK_MAGIC, sizeof(header.magic));
+  if(!_write_padded(f, &header, sizeof(header)) || fflush(f))
+  {
+    fclose(f);
+    return NULL;
+  }
+  return f;
+}
+
+// index all records of the file. returns the size of the file.
+static uint64_t _scan(dt_mipmap_pack_t *pack)
+{
+  pack->end = PACK_ALIGN;
+  if(!_map(pack, 0)) return 0;
+
+  const uint64_t size = g_mapped_file_get_length(pack->map);
+  const uint8_t *data = (const uint8_t *)g_mapped_file_get_contents(pack->map);
+  if(size < PACK_ALIGN) return size;
+
+  const dt_mipmap_pack_file_header_t *header = (const dt_mipmap_pack_file_header_t *)data;
+  if(memcmp(header->magic, PACK_MAGIC, sizeof(header->magic)) || header->version != PACK_VERSION
+     || header->endianness != PACK_ENDIANNESS)
+  {
+    pack->end = 0;
+    return size;
+  }
+
+  uint64_t pos = PACK_ALIGN;
+  while(pos + PACK_ALIGN <= size)
+  {
+    dt_mipmap_pack_record_t record;
+    memcpy(&record, data + pos, sizeof(record));
+    if(record.magic != PACK_RECORD_MAGIC || record.size > size || pos + _record_span(&record) > size) break;
+    _index_insert(pack, pos, &record);
+    pos += _record_span(&record);
+  }
+  pack->end = pos;
+  return size;
+}
+
+dt_mipmap_pack_t *dt_mipmap_pack_open(const char *filename)
+{
+  dt_mipmap_pack_t *pack = g_malloc0(sizeof(dt_mipmap_pack_t));
+  pack->filename = g_strdup(filename);
+  pack->index = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+  g_mutex_init(&pack->lock);
+
+  const double start = dt_get_wtime();
+  const uint64_t size = g_file_test(filename, G_FILE_TEST_EXISTS) ? _scan(pack) : 0;
+
+  gboolean ok = TRUE;
+  if(pack->end == 0 || size < PACK_ALIGN)
+  {
+    // missing, too short or of another version: start afresh
+    if(pack->map) g_mapped_file_unref(pack->map);
+    pack->map = NULL;
+    g_hash_table_remove_all(pack->index);
+    pack->live = 0;
+    pack->end = PACK_ALIGN;
+    FILE *f = _create(filename);
+    ok = (f != NULL);
+    if(f) fclose(f);
+  }
+  else if(pack->end < size)
+  {
+    // drop the remains of an interrupted append, we can't append after them
+    ok = !dt_mipmap_pack_compact(pack);
+  }
+  else if(dt_mipmap_pack_get_garbage(pack) > MAX(pack->live, PACK_GARBAGE_MIN_BYTES))
+  {
+    dt_mipmap_pack_compact(pack);
+  }
+
+  if(ok && !pack->f) pack->f = g_fopen(filename, "ab");
+  if(!ok || !pack->f)
+  {
+    fprintf(stderr, "[mipmap_pack] can't open `%s' for writing\n", filename);
+    dt_mipmap_pack_close(pack);
+    return NULL;
+  }
+
+  dt_print(DT_DEBUG_CACHE | DT_DEBUG_PERF, "[mipmap_pack] indexed %u thumbnails in `%s' in %.3f s\n",
+           g_hash_table_size(pack->index), filename, dt_get_wtime() - start);
+  return pack;
+}
+
+void dt_mipmap_pack_close(dt_mipmap_pack_t *pack)
+{
+  if(!pack) return;
+  if(pack->f) fclose(pack->f);
+  if(pack->map) g_mapped_file_unref(pack->map);
+  g_hash_table_destroy(pack->index);
+  g_mutex_clear(&pack->lock);
+  g_free(pack->filename);
+  g_free(pack);
+}
+
+gboolean dt_mipmap_pack_contains(dt_mipmap_pack_t *pack, const int32_t imgid, const uint64_t hash)
+{
+  g_mutex_lock(&pack->lock);
+  const dt_mipmap_pack_entry_t *entry = g_hash_table_lookup(pack->index, GINT_TO_POINTER(imgid));
+  const gboolean found = entry && (hash == 0 || entry->record.hash == hash);
+  g_mutex_unlock(&pack->lock);
+  return found;
+}
+
+int dt_mipmap_pack_read(dt_mipmap_pack_t *pack, const int32_t imgid, const uint64_t hash, uint8_t *out,
+                        const size_t out_size, uint32_t *width, uint32_t *height, int32_t *color_space)
+{
+  g_mutex_lock(&pack->lock);
+  const dt_mipmap_pack_entry_t *entry = g_hash_table_lookup(pack->index, GINT_TO_POINTER(imgid));
+  if(!entry || (hash != 0 && entry->record.hash != hash))
+  {
+    g_mutex_unlock(&pack->lock);
+    return 1;
+  }
+  const dt_mipmap_pack_record_t record = entry->record;
+  const uint64_t offset = entry->offset;
+  GMappedFile *map = _map(pack, offset + _record_span(&record)) ? g_mapped_file_ref(pack->map) : NULL;
+  g_mutex_unlock(&pack->lock);
+
+  // a compaction may replace the file meanwhile, our reference keeps the mapping we looked up alive
+  if(!map) return 2;
+
+  const uint8_t *payload = (const uint8_t *)g_mapped_file_get_contents(map) + offset + PACK_ALIGN;
+  const size_t bytes = (size_t)record.width * record.height * 4;
+  int err = (bytes > out_size || adler32(adler32(0L, Z_NULL, 0), payload, record.size) != record.checksum);
+
+  if(!err && record.codec == DT_MIPMAP_PACK_RAW)
+  {
+    err = (record.size != bytes);
+    if(!err) memcpy(out, payload, bytes);
+  }
+  else if(!err && record.codec == DT_MIPMAP_PACK_DEFLATE)
+  {
+    uLongf length = bytes;
+    err = (uncompress(out, &length, payload, record.size) != Z_OK || length != bytes);
+  }
+  else
+    err = 1;
+
+  g_mapped_file_unref(map);
+  if(err) return 2;
+
+  *width = record.width;
+  *height = record.height;
+  *color_space = record.color_space;
+  return 0;
+}
+
+// append a record. call with the lock held.
+static int _append(dt_mipmap_pack_t *pack, const dt_mipmap_pack_record_t *record, const uint8_t *payload)
+{
+  if(!pack->f) return 1;
+
+  if(!_write_padded(pack->f, record, sizeof(dt_mipmap_pack_record_t))
+     || (record->size && !_write_padded(pack->f, payload, record->size)) || fflush(pack->f))
+  {
+    // the file now ends with a truncated record: stop appending after it, the next open will drop it
+    fprintf(stderr, "[mipmap_pack] failed to write to `%s', disabling writes\n", pack->filename);
+    fclose(pack->f);
+    pack->f = NULL;
+    return 1;
+  }
+
+  _index_insert(pack, pack->end, record);
+  pack->end += _record_span(record);
+  return 0;
+}
+
+int dt_mipmap_pack_write(dt_mipmap_pack_t *pack, const int32_t imgid, const uint64_t hash, const uint8_t *in,
+                         const uint32_t width, const uint32_t height, const int32_t color_space,
+                         const dt_mipmap_pack_codec_t codec)
+{
+  const size_t bytes = (size_t)width * height * 4;
+  dt_mipmap_pack_record_t record = { .magic = PACK_RECORD_MAGIC,
+                                     .imgid = imgid,
+                                     .hash = hash,
+                                     .width = width,
+                                     .height = height,
+                                     .color_space = color_space,
+                                     .codec = DT_MIPMAP_PACK_RAW,
+                                     .size = bytes };
+  const uint8_t *payload = in;
+  uint8_t *compressed = NULL;
+
+  // compress outside of the lock, and keep the raw pixels if that doesn't save anything
+  if(codec == DT_MIPMAP_PACK_DEFLATE)
+  {
+    uLongf length = compressBound(bytes);
+    compressed = g_try_malloc(length);
+    if(compressed && compress2(compressed, &length, in, bytes, Z_BEST_SPEED) == Z_OK && length < bytes)
+    {
+      record.codec = DT_MIPMAP_PACK_DEFLATE;
+      record.size = length;
+      payload = compressed;
+    }
+  }
+  record.checksum = adler32(adler32(0L, Z_NULL, 0), payload, record.size);
+
+  g_mutex_lock(&pack->lock);
+  const int err = _append(pack, &record, payload);
+  g_mutex_unlock(&pack->lock);
+
+  g_free(compressed);
+  return err;
+}
+
+void dt_mipmap_pack_remove(dt_mipmap_pack_t *pack, const int32_t imgid)
+{
+  g_mutex_lock(&pack->lock);
+  if(g_hash_table_contains(pack->index, GINT_TO_POINTER(imgid)))
+  {
+    const dt_mipmap_pack_record_t record = { .magic = PACK_RECORD_MAGIC, .imgid = imgid, .codec = PACK_TOMBSTONE };
+    _append(pack, &record, NULL);
+  }
+  g_mutex_unlock(&pack->lock);
+}
+
+size_t dt_mipmap_pack_get_garbage(dt_mipmap_pack_t *pack)
+{
+  g_mutex_lock(&pack->lock);
+  const size_t garbage = pack->end - PACK_ALIGN - pack->live;
+  g_mutex_unlock(&pack->lock);
+  return garbage;
+}
+
+static gint _sort_by_offset(gconstpointer a, gconstpointer b)
+{
+  const uint64_t oa = (*(const dt_mipmap_pack_entry_t **)a)->offset;
+  const uint64_t ob = (*(const dt_mipmap_pack_entry_t **)b)->offset;
+  return (oa > ob) - (oa < ob);
+}
+
+int dt_mipmap_pack_compact(dt_mipmap_pack_t *pack)
+{
+  g_mutex_lock(&pack->lock);
+  const double start = dt_get_wtime();
+  const uint64_t old_end = pack->end;
+
+  gchar *tmpname = g_strdup_printf("%s.tmp", pack->filename);
+  FILE *out = _create(tmpname);
+  int err = !out || !_map(pack, pack->end);
+
+  // copy the live records in file order, so reading them back stays sequential
+  GPtrArray *entries = g_ptr_array_new();
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, pack->index);
+  while(g_hash_table_iter_next(&iter, NULL, &value)) g_ptr_array_add(entries, value);
+  g_ptr_array_sort(entries, _sort_by_offset);
+
+  uint64_t pos = PACK_ALIGN;
+  const uint8_t *data = err ? NULL : (const uint8_t *)g_mapped_file_get_contents(pack->map);
+  for(guint k = 0; k < entries->len && !err; k++)
+  {
+    const dt_mipmap_pack_entry_t *entry = g_ptr_array_index(entries, k);
+    const uint64_t span = _record_span(&entry->record);
+    err = (fwrite(data + entry->offset, 1, span, out) != span);
+    pos += span;
+  }
+  if(out) err |= (fclose(out) != 0);
+
+  if(!err)
+  {
+    // close everything pointing to the old file before replacing it, Windows won't rename over it otherwise
+    if(pack->f) fclose(pack->f);
+    g_mapped_file_unref(pack->map);
+    pack->map = NULL;
+    g_unlink(pack->filename);
+    err = g_rename(tmpname, pack->filename);
+    pack->f = err ? NULL : g_fopen(pack->filename, "ab");
+  }
+
+  if(!err)
+  {
+    pos = PACK_ALIGN;
+    for(guint k = 0; k < entries->len; k++)
+    {
+      dt_mipmap_pack_entry_t *entry = g_ptr_array_index(entries, k);
+      entry->offset = pos;
+      pos += _record_span(&entry->record);
+    }
+    pack->end = pos;
+  }
+  else
+  {
+    g_unlink(tmpname);
+    fprintf(stderr, "[mipmap_pack] failed to compact `%s'\n", pack->filename);
+  }
+
+  dt_print(DT_DEBUG_CACHE | DT_DEBUG_PERF, "[mipmap_pack] compacted `%s' from %" PRIu64 " to %" PRIu64
+           " bytes in %.3f s\n", pack->filename, old_end, pack->end, dt_get_wtime() - start);
+
+  g_ptr_array_free(entries, TRUE);
+  g_free(tmpname);
+  g_mutex_unlock(&pack->lock);
+  return err;
+}
+
+#undef PACK_MAGIC
+#undef PACK_VERSION
+#undef PACK_ENDIANNESS
+#undef PACK_ALIGN
+#undef PACK_RECORD_MAGIC
+#undef PACK_TOMBSTONE
+#undef PACK_GARBAGE_MIN_BYTES
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
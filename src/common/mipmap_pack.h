@@ -0,0 +1,85 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Pack files for the on-disk thumbnail cache: one append-only file per mip level, holding 8 bits RGBA
+ * thumbnails of any number of images. Records are looked up in memory by image id, and carry the hash
+ * of the history they were rendered from. The file is memory-mapped for reading, so uncompressed
+ * thumbnails are copied straight to the cache buffer without any decoding.
+ *
+ * Replacing or removing a thumbnail only appends a record, the space taken by the older one is
+ * reclaimed by dt_mipmap_pack_compact().
+ *
+ * All functions are thread-safe.
+ */
+
+typedef enum dt_mipmap_pack_codec_t
+{
+  DT_MIPMAP_PACK_RAW = 0,     // plain RGBA
+  DT_MIPMAP_PACK_DEFLATE = 1, // RGBA, zlib at its fastest setting
+} dt_mipmap_pack_codec_t;
+
+typedef struct dt_mipmap_pack_t dt_mipmap_pack_t;
+
+/** open or create the pack file, and index its records. returns NULL if the file can't be opened. */
+dt_mipmap_pack_t *dt_mipmap_pack_open(const char *filename);
+void dt_mipmap_pack_close(dt_mipmap_pack_t *pack);
+
+/** TRUE if the pack holds a thumbnail for imgid, rendered from a history of this hash.
+ * hash = 0 matches any history. */
+gboolean dt_mipmap_pack_contains(dt_mipmap_pack_t *pack, const int32_t imgid, const uint64_t hash);
+
+/** copy the thumbnail of imgid to out, which can hold out_size bytes.
+ * returns 0 on success, 1 if there is no such thumbnail, or not for this hash (0 matches any),
+ * 2 if the record is corrupted: the caller should remove it. */
+int dt_mipmap_pack_read(dt_mipmap_pack_t *pack, const int32_t imgid, const uint64_t hash, uint8_t *out,
+                        const size_t out_size, uint32_t *width, uint32_t *height, int32_t *color_space);
+
+/** append the thumbnail of imgid, replacing any previous one. returns 0 on success. */
+int dt_mipmap_pack_write(dt_mipmap_pack_t *pack, const int32_t imgid, const uint64_t hash, const uint8_t *in,
+                         const uint32_t width, const uint32_t height, const int32_t color_space,
+                         const dt_mipmap_pack_codec_t codec);
+
+/** forget the thumbnail of imgid. */
+void dt_mipmap_pack_remove(dt_mipmap_pack_t *pack, const int32_t imgid);
+
+/** bytes in the file that belong to replaced or removed records. */
+size_t dt_mipmap_pack_get_garbage(dt_mipmap_pack_t *pack);
+
+/** rewrite the pack file with only its live records. returns 0 on success. */
+int dt_mipmap_pack_compact(dt_mipmap_pack_t *pack);
+
+#ifdef __cplusplus
+}
+#endif
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
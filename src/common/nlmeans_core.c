@@ -427,6 +427,7 @@ void nlmeans_denoise(const float *const inbuf, float *const outbuf,
   {
     for (int chunk_left = 0; chunk_left < roi_out->width; chunk_left += chk_width)
     {
+      if(dt_dev_pixelpipe_is_cancelled(params->pipe)) continue;
       // locate our scratch space within the big buffer allocated above
       // we'll offset by chunk_left so that we don't have to subtract on every access
       float *const restrict tmpbuf = dt_get_perthread(scratch_buf, padded_scratch_size);
@@ -651,6 +652,7 @@ void nlmeans_denoise_sse2(const float *const inbuf, float *const outbuf,
   {
     for (int chunk_left = 0; chunk_left < roi_out->width; chunk_left += chk_width)
     {
+      if(dt_dev_pixelpipe_is_cancelled(params->pipe)) continue;
       // locate our scratch space within the big buffer allocated above
       // we'll offset by chunk_left so that we don't have to subtract on every access
       float *const restrict tmpbuf = dt_get_perthread(scratch_buf, padded_scratch_size);
@@ -828,6 +830,335 @@ void nlmeans_denoise_sse2(const float *const inbuf, float *const outbuf,
 }
 #endif /* __SSE2__ */
 
+// Banded backend.
+//
+// For a group of NLM_LANES patches at once, the channel-normed squared differences between each pixel and
+// its displaced counterpart are summed into an integral image, from which the distortion of any patch is
+// read with 4 lookups, whatever its radius. Values of all the patches of the group are interleaved, so
+// that the differences, the integral, the lookups and the weights of the group are computed in SIMD
+// lanes: 8 floats fill an AVX2 register.
+//
+// Each thread processes a band of NLM_BAND_HEIGHT rows and NLM_BAND_WIDTH columns at a time. The RGB
+// channels of the band, extended by the patch radius and the largest shift between patches, are first
+// copied to planes, so that patches shifted by consecutive columns are read with plain vector loads
+// instead of gathers. The integral restarts for each band, which bounds the rounding errors, and only its
+// last 2*radius+2 rows are kept, in a ring that stays in cache.
+#define NLM_LANES 8
+#define NLM_BAND_HEIGHT 32
+#define NLM_BAND_WIDTH 128
+
+// a group of patches, one per lane. Padding lanes have 'active' unset. In a contiguous group, all patches
+// are on the same row and on consecutive columns.
+typedef struct nlmeans_lanes_t
+{
+  int rows[NLM_LANES];
+  int cols[NLM_LANES];
+  float active[NLM_LANES];
+  int contiguous;
+} nlmeans_lanes_t;
+
+// pack the patches in groups of NLM_LANES, making groups contiguous where the patches allow it.
+// returns the number of groups.
+static int define_lanes(const patch_t *const patches, const int num_patches, nlmeans_lanes_t *const lanes)
+{
+  int n = 0;
+  int p = 0;
+  while(p < num_patches)
+  {
+    // the longest run of consecutive columns on the same row, if any
+    int run = 1;
+    while(run < NLM_LANES && p + run < num_patches && patches[p + run].rows == patches[p].rows
+          && patches[p + run].cols == patches[p].cols + run)
+      run++;
+    // short runs are not worth the empty lanes
+    const int contiguous = run >= NLM_LANES / 2;
+    const int count = contiguous ? run : MIN(NLM_LANES, num_patches - p);
+    nlmeans_lanes_t *const group = lanes + n++;
+    group->contiguous = contiguous;
+    for(int k = 0; k < NLM_LANES; k++)
+    {
+      // padding lanes continue the run in a contiguous group, or repeat the first patch
+      group->rows[k] = k < count ? patches[p + k].rows : patches[p].rows;
+      group->cols[k] = k < count ? patches[p + k].cols : patches[p].cols + (contiguous ? k : 0);
+      group->active[k] = k < count ? 1.0f : 0.0f;
+    }
+    p += count;
+  }
+  return n;
+}
+
+// the RGB planes of a band, with its origin in the image and its row stride
+typedef struct nlmeans_planes_t
+{
+  float *plane[3];
+  int x0, y0;
+  int stride;
+} nlmeans_planes_t;
+
+// process one group of patches over a band. 'contiguous' is a constant in each of the two calls, so the
+// compiler generates vector loads for contiguous groups and gathers for the others.
+static inline void nlmeans_band_group(float *const outbuf, const int width, const int height,
+                                      const nlmeans_lanes_t *const group, const int contiguous,
+                                      const nlmeans_planes_t *const planes,
+                                      const int top, const int bot, const int left, const int right,
+                                      float *const restrict ring, const dt_nlmeans_param_t *const params)
+{
+  const int radius = params->patch_radius;
+  const float sharpness = params->sharpness;
+  const float center_weight = params->center_weight;
+  // the weight is gh(max(0, (distortion + center pixel difference * center_norm) * dissimilarity_scale - bias)),
+  // which covers the computations of both the denoise(non-local) and the denoiseprofiled iops
+  const gboolean profiled = center_weight >= 0.0f;
+  const float center_norm = profiled ? compute_center_pixel_norm(center_weight, radius) : 0.0f;
+  const float dissimilarity_scale = profiled ? sharpness / (1.0f + center_weight) : sharpness;
+  const float bias = profiled ? 2.0f : 0.0f;
+  const float norm0 = params->norm[0];
+  const float norm1 = params->norm[1];
+  const float norm2 = params->norm[2];
+  const float *const restrict R = planes->plane[0];
+  const float *const restrict G = planes->plane[1];
+  const float *const restrict B = planes->plane[2];
+
+  // displacement of each lane in the planes
+  int shift[NLM_LANES];
+  for(int k = 0; k < NLM_LANES; k++) shift[k] = group->rows[k] * planes->stride + group->cols[k];
+
+  // column i of the ring holds the integral up to x = left - radius - 1 + i, column 0 is always 0
+  const int ncols = right - left + 2 * radius + 1;
+  const int nrows = 2 * radius + 2;
+  const size_t row_size = (size_t)ncols * NLM_LANES;
+#define RING_ROW(y) (ring + (size_t)(((y) - top + nrows) % nrows) * row_size)
+#define LANE_INDEX(base, k) (contiguous ? (base) + shift[0] + (k) : (base) + shift[k])
+
+  // the row above the first one of the band is 0
+  memset(RING_ROW(top - radius - 1), 0, sizeof(float) * row_size);
+
+  for(int y = top - radius; y < bot + radius; y++)
+  {
+    const float *const restrict prev = RING_ROW(y - 1);
+    float *const restrict cur = RING_ROW(y);
+
+    if(y < 0 || y >= height)
+    {
+      // rows outside of the image don't contribute
+      memcpy(cur, prev, sizeof(float) * row_size);
+    }
+    else
+    {
+      // lanes whose displaced row is inside the image
+      float row_valid[NLM_LANES];
+      for(int k = 0; k < NLM_LANES; k++)
+        row_valid[k] = (y + group->rows[k] >= 0 && y + group->rows[k] < height) ? group->active[k] : 0.0f;
+
+      float run[NLM_LANES] = { 0.0f };
+      for(int k = 0; k < NLM_LANES; k++) cur[k] = 0.0f;
+      for(int i = 1; i < ncols; i++)
+      {
+        const int x = left - radius - 1 + i;
+        if(x >= 0 && x < width)
+        {
+          const int base = (y - planes->y0) * planes->stride + x - planes->x0;
+          const float r = R[base];
+          const float g = G[base];
+          const float b = B[base];
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+          for(int k = 0; k < NLM_LANES; k++)
+          {
+            const int j = LANE_INDEX(base, k);
+            const float valid = row_valid[k] * (float)((x + group->cols[k] >= 0) & (x + group->cols[k] < width));
+            const float d0 = r - R[j];
+            const float d1 = g - G[j];
+            const float d2 = b - B[j];
+            run[k] += (d0 * d0 * norm0 + d1 * d1 * norm1 + d2 * d2 * norm2) * valid;
+          }
+        }
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+        for(int k = 0; k < NLM_LANES; k++)
+          cur[i * NLM_LANES + k] = prev[i * NLM_LANES + k] + run[k];
+      }
+    }
+
+    // once the integral reaches the bottom of the patches centered on a row, that row can be denoised
+    const int row = y - radius;
+    if(row < top) continue;
+
+    const float *const restrict above = RING_ROW(row - radius - 1);
+    float *const out = outbuf + (size_t)4 * width * row;
+
+    float row_valid[NLM_LANES];
+    for(int k = 0; k < NLM_LANES; k++)
+      row_valid[k] = (row + group->rows[k] >= 0 && row + group->rows[k] < height) ? group->active[k] : 0.0f;
+
+    for(int col = left; col < right; col++)
+    {
+      const int lo = (col - left) * NLM_LANES;                  // column x = col - radius - 1
+      const int hi = (col - left + 2 * radius + 1) * NLM_LANES; // column x = col + radius
+      const int base = (row - planes->y0) * planes->stride + col - planes->x0;
+      const float r = R[base];
+      const float g = G[base];
+      const float b = B[base];
+
+      float sum0 = 0.0f, sum1 = 0.0f, sum2 = 0.0f, sumw = 0.0f;
+#ifdef _OPENMP
+#pragma omp simd reduction(+ : sum0, sum1, sum2, sumw)
+#endif
+      for(int k = 0; k < NLM_LANES; k++)
+      {
+        const int j = LANE_INDEX(base, k);
+        const float valid = row_valid[k] * (float)((col + group->cols[k] >= 0) & (col + group->cols[k] < width));
+        const float distortion = cur[hi + k] - cur[lo + k] - above[hi + k] + above[lo + k];
+        const float v0 = R[j];
+        const float v1 = G[j];
+        const float v2 = B[j];
+        const float center = (r - v0) * (r - v0) + (g - v1) * (g - v1) + (b - v2) * (b - v2);
+        // MAX rather than fmaxf, which is a libm call when NaNs are not ruled out
+        const float wt = gh(MAX(0.0f, (distortion + center * center_norm) * dissimilarity_scale - bias)) * valid;
+        sum0 += v0 * wt;
+        sum1 += v1 * wt;
+        sum2 += v2 * wt;
+        sumw += wt;
+      }
+      out[4 * col + 0] += sum0;
+      out[4 * col + 1] += sum1;
+      out[4 * col + 2] += sum2;
+      out[4 * col + 3] += sumw;
+    }
+  }
+#undef LANE_INDEX
+#undef RING_ROW
+}
+
+// copy the RGB channels of the band, extended by 'margin' pixels, to planes. Pixels outside of the image
+// are set to 0, they are never weighted.
+static void nlmeans_band_planes(const float *const inbuf, const int width, const int height, const size_t stride,
+                                const int top, const int bot, const int left, const int margin,
+                                nlmeans_planes_t *const planes)
+{
+  planes->x0 = left - margin;
+  planes->y0 = top - margin;
+  const int rows = bot - top + 2 * margin;
+  for(int i = 0; i < rows; i++)
+  {
+    const int y = planes->y0 + i;
+    for(int j = 0; j < planes->stride; j++)
+    {
+      const int x = planes->x0 + j;
+      const size_t index = (size_t)i * planes->stride + j;
+      const int inside = y >= 0 && y < height && x >= 0 && x < width;
+      const float *const px = inbuf + (inside ? y * stride + 4 * x : 0);
+      for(int c = 0; c < 3; c++) planes->plane[c][index] = inside ? px[c] : 0.0f;
+    }
+  }
+}
+
+__DT_CLONE_TARGETS__
+void nlmeans_denoise_banded(const float *const inbuf, float *const outbuf,
+                            const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
+                            const dt_nlmeans_param_t *const params)
+{
+  // define the factors for applying blending between the original image and the denoised version
+  // if running in RGB space, 'luma' should equal 'chroma'
+  const dt_aligned_pixel_t weight = { params->luma, params->chroma, params->chroma, 1.0f };
+  const dt_aligned_pixel_t invert = { 1.0f - params->luma, 1.0f - params->chroma, 1.0f - params->chroma, 0.0f };
+  const bool skip_blend = (params->luma == 1.0 && params->chroma == 1.0);
+
+  // define the patches to be compared when denoising a pixel, and pack them in groups of NLM_LANES
+  const size_t stride = 4 * roi_in->width;
+  int num_patches;
+  int max_shift;
+  struct patch_t *patches = define_patches(params, stride, &num_patches, &max_shift);
+  nlmeans_lanes_t *lanes = patches ? dt_alloc_align(sizeof(nlmeans_lanes_t) * num_patches) : NULL;
+  const int num_groups = lanes ? define_lanes(patches, num_patches, lanes) : 0;
+  dt_free_align(patches);
+
+  // per thread: the ring of integral rows, and the planes of the band. Padding lanes of contiguous groups
+  // read up to NLM_LANES columns further.
+  const int radius = params->patch_radius;
+  const int margin = radius + max_shift + 1;
+  const int plane_stride = (NLM_BAND_WIDTH + 2 * margin + NLM_LANES + 15) & ~15;
+  const size_t plane_size = (size_t)plane_stride * (NLM_BAND_HEIGHT + 2 * margin);
+  const size_t ring_size = (size_t)(2 * radius + 2) * (NLM_BAND_WIDTH + 2 * radius + 1) * NLM_LANES;
+  size_t padded_scratch_size;
+  float *const scratch_buf = dt_alloc_perthread_float(ring_size + 3 * plane_size, &padded_scratch_size);
+  if(!lanes || !scratch_buf)
+  {
+    // not enough memory: fall back on the sliding window
+    dt_free_align(scratch_buf);
+    dt_free_align(lanes);
+    nlmeans_denoise(inbuf, outbuf, roi_in, roi_out, params);
+    return;
+  }
+
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) num_threads(darktable.num_openmp_threads) \
+      dt_omp_firstprivate(lanes, num_groups, scratch_buf, padded_scratch_size, ring_size, plane_size, \
+                          plane_stride, margin, width, height) \
+      dt_omp_sharedconst(params, outbuf, inbuf, stride, skip_blend, weight, invert) \
+      schedule(dynamic) \
+      collapse(2)
+#endif
+  for(int top = 0; top < height; top += NLM_BAND_HEIGHT)
+  {
+    for(int left = 0; left < width; left += NLM_BAND_WIDTH)
+    {
+      if(dt_dev_pixelpipe_is_cancelled(params->pipe)) continue;
+      float *const restrict ring = dt_get_perthread(scratch_buf, padded_scratch_size);
+      const int bot = MIN(top + NLM_BAND_HEIGHT, height);
+      const int right = MIN(left + NLM_BAND_WIDTH, width);
+
+      nlmeans_planes_t planes = { .plane = { ring + ring_size, ring + ring_size + plane_size,
+                                             ring + ring_size + 2 * plane_size },
+                                  .stride = plane_stride };
+      nlmeans_band_planes(inbuf, width, height, stride, top, bot, left, margin, &planes);
+
+      // we incrementally sum results (especially weights in col[3]), so clear the output buffer to zeros
+      for(int i = top; i < bot; i++)
+        memset(outbuf + 4 * ((size_t)i * width + left), '\0', sizeof(float) * 4 * (right - left));
+
+      for(int g = 0; g < num_groups; g++)
+      {
+        if(lanes[g].contiguous)
+          nlmeans_band_group(outbuf, width, height, lanes + g, TRUE, &planes, top, bot, left, right, ring, params);
+        else
+          nlmeans_band_group(outbuf, width, height, lanes + g, FALSE, &planes, top, bot, left, right, ring, params);
+      }
+
+      // normalize, and apply chroma/luma blending if needed
+      for(int row = top; row < bot; row++)
+      {
+        const float *const in = inbuf + row * stride;
+        float *const out = outbuf + (size_t)4 * width * row;
+        for(int col = left; col < right; col++)
+        {
+          if(skip_blend)
+          {
+            for_each_channel(c, aligned(out:16))
+              out[4 * col + c] /= out[4 * col + 3];
+          }
+          else
+          {
+            for_each_channel(c, aligned(in, out, weight, invert:16))
+              out[4 * col + c] = (in[4 * col + c] * invert[c]) + (out[4 * col + c] / out[4 * col + 3] * weight[c]);
+          }
+        }
+      }
+    }
+  }
+
+  dt_free_align(lanes);
+  dt_free_align(scratch_buf);
+}
+
+#undef NLM_BAND_WIDTH
+#undef NLM_BAND_HEIGHT
+#undef NLM_LANES
+
 /**************************************************************/
 /**************************************************************/
 /*      Everything from here to end of file is WIP!!          */
@@ -998,6 +1329,8 @@ int nlmeans_denoise_cl(const dt_nlmeans_param_t *const params, const int devid,
 
     // indirectly give gpu some air to breathe (and to do display related stuff)
     dt_iop_nap(dt_opencl_micro_nap(devid));
+
+    if(dt_dev_pixelpipe_is_cancelled(params->pipe)) break;
   }
 
 error:
@@ -1093,6 +1426,8 @@ int nlmeans_denoiseprofile_cl(const dt_nlmeans_param_t *const params, const int
 
     // indirectly give gpu some air to breathe (and to do display related stuff)
     dt_iop_nap(dt_opencl_micro_nap(devid));
+
+    if(dt_dev_pixelpipe_is_cancelled(params->pipe)) break;
   }
 
 error:
@@ -38,6 +38,7 @@ struct dt_nlmeans_param_t
   int kernel_horiz;	// CL: horizontal sum (runs for each patch)
   int kernel_vert;	// CL: vertical sum (runs for each patch)
   int kernel_accu;	// CL: add to output pixel (runs for each patch)
+  struct dt_dev_pixelpipe_t *pipe; // pipe polled for cancellation between chunks/patches, may be NULL
 };
 typedef struct dt_nlmeans_param_t dt_nlmeans_param_t;
 
@@ -49,6 +50,13 @@ void nlmeans_denoise_sse2(const float *const inbuf, float *const outbuf,
                           const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
                           const dt_nlmeans_param_t *const params);
 
+/** same results as nlmeans_denoise, computing groups of 8 patches at once in SIMD lanes from an integral
+ * image of each band of the image. Falls back on nlmeans_denoise if out of memory.
+ * Used by the iops when the `nlmeans_banded` config key is set. */
+void nlmeans_denoise_banded(const float *const inbuf, float *const outbuf,
+                            const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
+                            const dt_nlmeans_param_t *const params);
+
 #ifdef HAVE_OPENCL
 int nlmeans_denoise_cl(const dt_nlmeans_param_t *const params, const int devid,
                        cl_mem dev_in, cl_mem dev_out, const dt_iop_roi_t *const roi_in);
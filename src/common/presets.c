@@ -21,8 +21,10 @@
 #include "common/debug.h"
 #include "common/exif.h"
 #include "common/file_location.h"
+#include "common/image.h"
 #include "develop/blend.h"
 #include "develop/imageop.h"
+#include "gui/presets.h"
 #include "libs/lib.h"
 
 #include <libxml/encoding.h>
@@ -31,8 +33,10 @@
 #include <libxml/xpath.h>
 #include <libxml/xpathInternals.h>
 
+#include <float.h>
 #include <glib.h>
 #include <inttypes.h>
+#include <math.h>
 #include <sqlite3.h>
 
 static char *dt_preset_encode(sqlite3_stmt *stmt, int row)
@@ -317,6 +321,398 @@ gboolean dt_presets_module_can_autoapply(const gchar *operation)
   }
   return TRUE;
 }
+
+/* ---------------------------------------------------------------------------------------------------- */
+/* presets index                                                                                        */
+/* ---------------------------------------------------------------------------------------------------- */
+
+typedef enum dt_preset_pattern_kind_t
+{
+  DT_PRESET_PATTERN_NONE = 0, // NULL in the table: LIKE NULL never matches
+  DT_PRESET_PATTERN_ANY,      // '%'
+  DT_PRESET_PATTERN_EXACT,    // no wildcard
+  DT_PRESET_PATTERN_PREFIX,   // 'abc%'
+  DT_PRESET_PATTERN_LIKE,     // anything else
+} dt_preset_pattern_kind_t;
+
+// a LIKE pattern, compiled to the cheapest test that gives the same result as SQLite
+typedef struct dt_preset_pattern_t
+{
+  dt_preset_pattern_kind_t kind;
+  gchar *pattern;
+  size_t prefix_len; // bytes before the '%' of PREFIX
+  glong length;      // LENGTH() of the pattern in SQL, -1 for NULL
+} dt_preset_pattern_t;
+
+struct dt_presets_index_t
+{
+  gint ref;
+  GPtrArray *presets;     // all dt_preset_t, owning them
+  GHashTable *operations; // operation -> GPtrArray of its dt_preset_t
+};
+
+static GMutex _index_lock;
+static dt_presets_index_t *_index = NULL;
+static gint _index_generation = 0;
+static gint _index_loaded_generation = -1;
+static gboolean _index_hooked = FALSE;
+
+// operations whose presets are not history items, and are auto-applied by their own code
+static const char *_autoapply_excluded[]
+    = { "ioporder", "metadata", "modulegroups", "export", "tagging", "collect", "basecurve", NULL };
+
+static dt_preset_pattern_t *_pattern_compile(const char *pattern)
+{
+  dt_preset_pattern_t *p = g_malloc0(sizeof(dt_preset_pattern_t));
+  if(!pattern)
+  {
+    p->kind = DT_PRESET_PATTERN_NONE;
+    p->length = -1;
+    return p;
+  }
+
+  p->pattern = g_strdup(pattern);
+  p->length = g_utf8_strlen(pattern, -1);
+
+  const char *percent = strchr(pattern, '%');
+  if(strchr(pattern, '_'))
+    p->kind = DT_PRESET_PATTERN_LIKE;
+  else if(!percent)
+    p->kind = DT_PRESET_PATTERN_EXACT;
+  else if(strspn(percent, "%") == strlen(percent))
+  {
+    // only trailing wildcards
+    p->prefix_len = percent - pattern;
+    p->kind = p->prefix_len ? DT_PRESET_PATTERN_PREFIX : DT_PRESET_PATTERN_ANY;
+  }
+  else
+    p->kind = DT_PRESET_PATTERN_LIKE;
+
+  return p;
+}
+
+static void _pattern_free(dt_preset_pattern_t *p)
+{
+  if(!p) return;
+  g_free(p->pattern);
+  g_free(p);
+}
+
+// SQLite LIKE without ESCAPE: '%' matches any sequence, '_' any single character,
+// and the comparison is case-insensitive for ASCII only
+static gboolean _like(const char *p, const char *s)
+{
+  const char *star_p = NULL, *star_s = NULL;
+  while(*s)
+  {
+    if(*p == '%')
+    {
+      while(*p == '%') p++;
+      if(!*p) return TRUE;
+      star_p = p;
+      star_s = s;
+    }
+    else if(*p == '_')
+    {
+      p++;
+      s = g_utf8_next_char(s);
+    }
+    else if(*p && g_ascii_tolower(*p) == g_ascii_tolower(*s))
+    {
+      p++;
+      s++;
+    }
+    else if(star_p)
+    {
+      // backtrack: let the last '%' eat one more character
+      star_s = g_utf8_next_char(star_s);
+      p = star_p;
+      s = star_s;
+    }
+    else
+      return FALSE;
+  }
+  while(*p == '%') p++;
+  return *p == '\0';
+}
+
+static gboolean _pattern_match(const dt_preset_pattern_t *p, const char *s)
+{
+  if(!s) return FALSE;
+  switch(p->kind)
+  {
+    case DT_PRESET_PATTERN_ANY:
+      return TRUE;
+    case DT_PRESET_PATTERN_EXACT:
+      return !g_ascii_strcasecmp(p->pattern, s);
+    case DT_PRESET_PATTERN_PREFIX:
+      return !g_ascii_strncasecmp(p->pattern, s, p->prefix_len);
+    case DT_PRESET_PATTERN_LIKE:
+      return _like(p->pattern, s);
+    case DT_PRESET_PATTERN_NONE:
+    default:
+      return FALSE;
+  }
+}
+
+static void _preset_free(gpointer data)
+{
+  dt_preset_t *p = (dt_preset_t *)data;
+  g_free(p->name);
+  g_free(p->description);
+  g_free(p->operation);
+  g_free(p->op_params);
+  g_free(p->blendop_params);
+  g_free(p->multi_name);
+  _pattern_free(p->model);
+  _pattern_free(p->maker);
+  _pattern_free(p->lens);
+  g_free(p);
+}
+
+static gchar *_column_strdup(sqlite3_stmt *stmt, const int col)
+{
+  return g_strdup((const char *)sqlite3_column_text(stmt, col));
+}
+
+static void *_column_blobdup(sqlite3_stmt *stmt, const int col, int32_t *size)
+{
+  *size = sqlite3_column_bytes(stmt, col);
+  const void *blob = sqlite3_column_blob(stmt, col);
+  if(!blob) return NULL;
+  void *copy = g_malloc(*size);
+  memcpy(copy, blob, *size);
+  return copy;
+}
+
+static double _column_real(sqlite3_stmt *stmt, const int col)
+{
+  return sqlite3_column_type(stmt, col) == SQLITE_NULL ? NAN : sqlite3_column_double(stmt, col);
+}
+
+static dt_presets_index_t *_index_load(void)
+{
+  const double start = dt_get_wtime();
+  dt_presets_index_t *index = g_malloc0(sizeof(dt_presets_index_t));
+  index->ref = 1;
+  index->presets = g_ptr_array_new_with_free_func(_preset_free);
+  index->operations
+      = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, (GDestroyNotify)g_ptr_array_unref);
+
+  sqlite3_stmt *stmt;
+  // clang-format off
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT rowid, name, description, operation, op_version, op_params, enabled,"
+                              "       blendop_params, blendop_version, multi_priority, multi_name,"
+                              "       model, maker, lens, iso_min, iso_max, exposure_min, exposure_max,"
+                              "       aperture_min, aperture_max, focal_length_min, focal_length_max,"
+                              "       writeprotect, autoapply, filter, format"
+                              " FROM data.presets"
+                              " ORDER BY rowid",
+                              -1, &stmt, NULL);
+  // clang-format on
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    if(sqlite3_column_type(stmt, 3) == SQLITE_NULL) continue;
+
+    dt_preset_t *p = g_malloc0(sizeof(dt_preset_t));
+    p->rowid = sqlite3_column_int64(stmt, 0);
+    p->name = _column_strdup(stmt, 1);
+    p->description = _column_strdup(stmt, 2);
+    p->operation = _column_strdup(stmt, 3);
+    p->op_version = sqlite3_column_int(stmt, 4);
+    p->op_params = _column_blobdup(stmt, 5, &p->op_params_size);
+    p->enabled = sqlite3_column_int(stmt, 6);
+    p->blendop_params = _column_blobdup(stmt, 7, &p->blendop_params_size);
+    p->blendop_version = sqlite3_column_int(stmt, 8);
+    p->multi_priority = sqlite3_column_int(stmt, 9);
+    p->multi_name = _column_strdup(stmt, 10);
+    p->model = _pattern_compile((const char *)sqlite3_column_text(stmt, 11));
+    p->maker = _pattern_compile((const char *)sqlite3_column_text(stmt, 12));
+    p->lens = _pattern_compile((const char *)sqlite3_column_text(stmt, 13));
+    p->iso_min = _column_real(stmt, 14);
+    p->iso_max = _column_real(stmt, 15);
+    p->exposure_min = _column_real(stmt, 16);
+    p->exposure_max = _column_real(stmt, 17);
+    p->aperture_min = _column_real(stmt, 18);
+    p->aperture_max = _column_real(stmt, 19);
+    p->focal_length_min = _column_real(stmt, 20);
+    p->focal_length_max = _column_real(stmt, 21);
+    p->writeprotect = sqlite3_column_int(stmt, 22);
+    p->autoapply = sqlite3_column_int(stmt, 23);
+    p->filter = sqlite3_column_int(stmt, 24);
+    p->format = sqlite3_column_int(stmt, 25);
+
+    g_ptr_array_add(index->presets, p);
+
+    GPtrArray *op = g_hash_table_lookup(index->operations, p->operation);
+    if(!op)
+    {
+      op = g_ptr_array_new();
+      g_hash_table_insert(index->operations, p->operation, op);
+    }
+    g_ptr_array_add(op, p);
+  }
+  sqlite3_finalize(stmt);
+
+  dt_print(DT_DEBUG_PERF, "[presets] indexed %u presets of %u operations in %.3f ms\n", index->presets->len,
+           g_hash_table_size(index->operations), 1000.0 * (dt_get_wtime() - start));
+  return index;
+}
+
+// called by SQLite on every row inserted, updated or deleted on our connection
+static void _index_update_hook(void *data, int op, const char *db_name, const char *table, sqlite3_int64 rowid)
+{
+  if(!strcmp(table, "presets") && !strcmp(db_name, "data")) g_atomic_int_inc(&_index_generation);
+}
+
+dt_presets_index_t *dt_presets_index_get(void)
+{
+  g_mutex_lock(&_index_lock);
+  if(!_index_hooked)
+  {
+    sqlite3_update_hook(dt_database_get(darktable.db), _index_update_hook, NULL);
+    _index_hooked = TRUE;
+  }
+
+  const gint generation = g_atomic_int_get(&_index_generation);
+  if(_index && _index_loaded_generation != generation)
+  {
+    dt_presets_index_release(_index);
+    _index = NULL;
+  }
+  if(!_index)
+  {
+    // writes happening while we load bump the generation again, and the next call reloads
+    _index = _index_load();
+    _index_loaded_generation = generation;
+  }
+
+  dt_presets_index_t *index = _index;
+  g_atomic_int_inc(&index->ref);
+  g_mutex_unlock(&_index_lock);
+  return index;
+}
+
+void dt_presets_index_release(dt_presets_index_t *index)
+{
+  if(!index || !g_atomic_int_dec_and_test(&index->ref)) return;
+  g_hash_table_destroy(index->operations);
+  g_ptr_array_free(index->presets, TRUE);
+  g_free(index);
+}
+
+void dt_presets_index_cleanup(void)
+{
+  g_mutex_lock(&_index_lock);
+  if(_index_hooked) sqlite3_update_hook(dt_database_get(darktable.db), NULL, NULL);
+  _index_hooked = FALSE;
+  dt_presets_index_release(_index);
+  _index = NULL;
+  g_mutex_unlock(&_index_lock);
+}
+
+const GPtrArray *dt_presets_index_get_operation(const dt_presets_index_t *index, const char *operation)
+{
+  return g_hash_table_lookup(index->operations, operation);
+}
+
+const dt_preset_t *dt_presets_index_find(const dt_presets_index_t *index, const char *operation,
+                                         const int32_t op_version, const char *name)
+{
+  const GPtrArray *op = dt_presets_index_get_operation(index, operation);
+  if(!op) return NULL;
+  for(guint i = 0; i < op->len; i++)
+  {
+    const dt_preset_t *p = g_ptr_array_index(op, i);
+    if(p->op_version == op_version && !g_strcmp0(p->name, name)) return p;
+  }
+  return NULL;
+}
+
+void dt_presets_image_init(dt_presets_image_t *keys, const dt_image_t *image)
+{
+  keys->exif_model = image->exif_model;
+  keys->exif_maker = image->exif_maker;
+  keys->camera_alias = image->camera_alias;
+  keys->camera_maker = image->camera_maker;
+  keys->exif_lens = image->exif_lens;
+  keys->iso = fmaxf(0.0f, fminf(FLT_MAX, image->exif_iso));
+  keys->exposure = fmaxf(0.0f, fminf(1000000, image->exif_exposure));
+  keys->aperture = fmaxf(0.0f, fminf(1000000, image->exif_aperture));
+  keys->focal_length = fmaxf(0.0f, fminf(1000000, image->exif_focal_length));
+
+  keys->format = dt_image_is_rawprepare_supported(image) ? FOR_RAW : FOR_LDR;
+  if(dt_image_is_hdr(image)) keys->format |= FOR_HDR;
+  keys->excluded = dt_image_monochrome_flags(image) ? FOR_NOT_MONO : FOR_NOT_COLOR;
+}
+
+static inline gboolean _between(const double value, const double min, const double max)
+{
+  // false if min or max is NAN, like BETWEEN NULL
+  return value >= min && value <= max;
+}
+
+gboolean dt_presets_match_image(const dt_preset_t *p, const dt_presets_image_t *keys)
+{
+  return ((_pattern_match(p->model, keys->exif_model) && _pattern_match(p->maker, keys->exif_maker))
+          || (_pattern_match(p->model, keys->camera_alias) && _pattern_match(p->maker, keys->camera_maker)))
+         && _pattern_match(p->lens, keys->exif_lens)
+         && _between(keys->iso, p->iso_min, p->iso_max)
+         && _between(keys->exposure, p->exposure_min, p->exposure_max)
+         && _between(keys->aperture, p->aperture_min, p->aperture_max)
+         && _between(keys->focal_length, p->focal_length_min, p->focal_length_max)
+         && (p->format == 0 || ((p->format & keys->format) && (~p->format & keys->excluded)));
+}
+
+static gboolean _autoapply_is_excluded(const char *operation)
+{
+  for(const char **op = _autoapply_excluded; *op; op++)
+    if(!strcmp(*op, operation)) return TRUE;
+  return FALSE;
+}
+
+// built-in presets first, then the least specific ones
+static gint _autoapply_sort(gconstpointer a, gconstpointer b)
+{
+  const dt_preset_t *pa = (const dt_preset_t *)a;
+  const dt_preset_t *pb = (const dt_preset_t *)b;
+  if(pa->writeprotect != pb->writeprotect) return pa->writeprotect ? -1 : 1;
+  if(pa->model->length != pb->model->length) return pa->model->length < pb->model->length ? -1 : 1;
+  if(pa->maker->length != pb->maker->length) return pa->maker->length < pb->maker->length ? -1 : 1;
+  if(pa->lens->length != pb->lens->length) return pa->lens->length < pb->lens->length ? -1 : 1;
+  return pa->rowid < pb->rowid ? -1 : (pa->rowid > pb->rowid);
+}
+
+static GList *_autoapply_add(GList *list, const GPtrArray *presets, const dt_presets_image_t *keys,
+                             const int32_t op_version, const char *workflow_preset, const gboolean skip_excluded)
+{
+  if(!presets) return list;
+  for(guint i = 0; i < presets->len; i++)
+  {
+    const dt_preset_t *p = g_ptr_array_index(presets, i);
+    if(op_version >= 0 && p->op_version != op_version) continue;
+    if(skip_excluded && _autoapply_is_excluded(p->operation)) continue;
+    if((p->autoapply && dt_presets_match_image(p, keys))
+       || (workflow_preset && !g_strcmp0(p->name, workflow_preset)))
+      list = g_list_prepend(list, (gpointer)p);
+  }
+  return list;
+}
+
+GList *dt_presets_index_autoapply(const dt_presets_index_t *index, const dt_presets_image_t *keys,
+                                  const char *operation, const int32_t op_version,
+                                  const char *workflow_preset, const gboolean skip_excluded)
+{
+  GList *list = NULL;
+  if(operation)
+    list = _autoapply_add(list, dt_presets_index_get_operation(index, operation), keys, op_version,
+                          workflow_preset, skip_excluded);
+  else
+    list = _autoapply_add(list, index->presets, keys, op_version, workflow_preset, skip_excluded);
+  return g_list_sort(list, _autoapply_sort);
+}
+
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -28,6 +28,83 @@ int dt_presets_import_from_file(const char *preset_path);
 
 // does the module support autoapplying presets ?
 gboolean dt_presets_module_can_autoapply(const gchar *operation);
+
+/**
+ * In-memory index of the data.presets table, so that matching presets against an image (auto-apply,
+ * presets menus) doesn't run one SQL scan per module. The index is loaded on first use and reloaded
+ * after any write to data.presets, which is caught by an SQLite update hook: writers don't need to
+ * know about it.
+ *
+ * The index is a reference-counted snapshot: it stays valid until released, even if the table
+ * changes in the meantime. Entries are read-only.
+ */
+
+/** one row of data.presets, with its maker/model/lens patterns compiled */
+typedef struct dt_preset_t
+{
+  int64_t rowid;
+  gchar *name;
+  gchar *description;
+  gchar *operation;
+  int32_t op_version;
+  void *op_params;
+  int32_t op_params_size;
+  gboolean enabled;
+  void *blendop_params;
+  int32_t blendop_params_size;
+  int32_t blendop_version;
+  int32_t multi_priority;
+  gchar *multi_name;
+  struct dt_preset_pattern_t *model, *maker, *lens;
+  // NAN when NULL in the table, so they never match, like BETWEEN NULL in SQL
+  double iso_min, iso_max;
+  double exposure_min, exposure_max;
+  double aperture_min, aperture_max;
+  double focal_length_min, focal_length_max;
+  gboolean writeprotect;
+  gboolean autoapply;
+  gboolean filter;
+  int32_t format;
+} dt_preset_t;
+
+/** what presets are matched against, taken once from an image */
+typedef struct dt_presets_image_t
+{
+  const char *exif_model, *exif_maker;
+  const char *camera_alias, *camera_maker;
+  const char *exif_lens;
+  double iso, exposure, aperture, focal_length;
+  int format;   // FOR_LDR, FOR_RAW, FOR_HDR
+  int excluded; // FOR_NOT_MONO or FOR_NOT_COLOR
+} dt_presets_image_t;
+
+typedef struct dt_presets_index_t dt_presets_index_t;
+
+/** get a reference on the current index, loading it if needed. Thread-safe. */
+dt_presets_index_t *dt_presets_index_get(void);
+void dt_presets_index_release(dt_presets_index_t *index);
+/** drop the index and the update hook, before closing the database */
+void dt_presets_index_cleanup(void);
+
+/** presets of an operation, sorted by rowid. NULL if there is none. */
+const GPtrArray *dt_presets_index_get_operation(const dt_presets_index_t *index, const char *operation);
+/** preset of an operation by name and version, NULL if not found */
+const dt_preset_t *dt_presets_index_find(const dt_presets_index_t *index, const char *operation,
+                                         const int32_t op_version, const char *name);
+
+/** fill keys from the image. The image has to outlive keys. */
+void dt_presets_image_init(dt_presets_image_t *keys, const struct dt_image_t *image);
+/** TRUE if the maker, model, lens, exif ranges and format of the preset match the image */
+gboolean dt_presets_match_image(const dt_preset_t *preset, const dt_presets_image_t *keys);
+
+/** presets to apply on a new history: the ones marked auto-apply matching the image, and the one named
+ * workflow_preset (may be NULL). operation restricts the search to one module (NULL for all) and op_version
+ * to one version (-1 for all). If skip_excluded, the operations which are not auto-applied as history items
+ * (ioporder, metadata, export...) are left out. The list of const dt_preset_t * is ordered with the built-in
+ * presets first, then from the least to the most specific, so the last applied wins. Free with g_list_free(). */
+GList *dt_presets_index_autoapply(const dt_presets_index_t *index, const dt_presets_image_t *keys,
+                                  const char *operation, const int32_t op_version,
+                                  const char *workflow_preset, const gboolean skip_excluded);
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -378,12 +378,17 @@ static void _develop_blend_process_feather(const float *const guide, float *cons
   int w = (int)(2 * feathering_radius * scale + 0.5f);
   if(w < 1) w = 1;
 
-  float *const restrict mask_bak = dt_alloc_align_float(width * height);
+  // Large feathering radii are fitted at lower resolution, keeping the subsampled radius around 32 px:
+  // the cost of the exact filter grows with the radius and the difference is not visible on masks.
+  const int subsample = (w >= 64) ? w / 32 : 1;
+
+  float *const restrict mask_bak = dt_gf_scratch_alloc(width * height);
   if(mask_bak)
   {
     memcpy(mask_bak, mask, sizeof(float) * width * height);
-    guided_filter(guide, mask_bak, mask, width, height, ch, w, sqrt_eps, guide_weight, 0.f, 1.f);
-    dt_free_align(mask_bak);
+    guided_filter_subsampled(guide, mask_bak, mask, width, height, ch, w, sqrt_eps, guide_weight, 0.f, 1.f,
+                             subsample);
+    dt_gf_scratch_free(mask_bak);
   }
 }
 
@@ -2,6 +2,7 @@
 #include "common/undo.h"
 #include "common/history_snapshot.h"
 #include "common/image_cache.h"
+#include "common/presets.h"
 #include "develop/dev_history.h"
 #include "develop/blend.h"
 #include "develop/imageop.h"
@@ -13,6 +14,8 @@
 
 static void _process_history_db_entry(dt_develop_t *dev, sqlite3_stmt *stmt, const int32_t imgid,
                                       int *legacy_params, gboolean presets);
+static void _process_preset_entry(dt_develop_t *dev, const dt_preset_t *preset, const int32_t imgid,
+                                  int *legacy_params);
 
 // returns the first history item with hist->module == module
 static dt_dev_history_item_t *_search_history_by_module(dt_develop_t *dev, dt_iop_module_t *module)
@@ -688,8 +691,8 @@ int dt_dev_history_auto_save(dt_develop_t *dev)
 
 void dt_dev_add_history_item_real(dt_develop_t *dev, dt_iop_module_t *module, gboolean enable)
 {
-  dt_atomic_set_int(&dev->pipe->shutdown, TRUE);
-  dt_atomic_set_int(&dev->preview_pipe->shutdown, TRUE);
+  dt_dev_pixelpipe_cancel(dev->pipe);
+  dt_dev_pixelpipe_cancel(dev->preview_pipe);
 
   dt_dev_undo_start_record(dev);
 
@@ -1083,62 +1086,61 @@ static gboolean _dev_auto_apply_presets(dt_develop_t *dev, int32_t imgid)
   const gboolean has_matrix = dt_image_is_matrix_correction_supported(image);
   const char *workflow_preset = has_matrix ? _("scene-referred default") : "\t\n";
 
-  int iformat = 0;
-  if(dt_image_is_rawprepare_supported(image))
-    iformat |= FOR_RAW;
-  else
-    iformat |= FOR_LDR;
+  dt_presets_image_t keys;
+  dt_presets_image_init(&keys, image);
 
-  if(dt_image_is_hdr(image))
-    iformat |= FOR_HDR;
+  int legacy_params = 0;
+  dt_presets_index_t *index = dt_presets_index_get();
 
-  int excluded = 0;
-  if(dt_image_monochrome_flags(image))
-    excluded |= FOR_NOT_MONO;
+  if(image->flags & DT_IMAGE_NO_LEGACY_PRESETS)
+  {
+    GList *presets = dt_presets_index_autoapply(index, &keys, NULL, -1, workflow_preset, TRUE);
+    for(GList *preset = presets; preset; preset = g_list_next(preset))
+      _process_preset_entry(dev, (const dt_preset_t *)preset->data, imgid, &legacy_params);
+    g_list_free(presets);
+  }
   else
-    excluded |= FOR_NOT_COLOR;
-
-  sqlite3_stmt *stmt;
-  // clang-format off
-  char *query = g_strdup_printf(
-  " SELECT ?1, 0, op_version, operation, op_params," // 0 is num in main.history, we just need uniform params binding
-  "       enabled, blendop_params, blendop_version, multi_priority, multi_name, name"
-  " FROM %s" // SQLite doesn't like the table name to be bound with variables...
-  " WHERE ( (autoapply=1"
-  "          AND ((?2 LIKE model AND ?3 LIKE maker) OR (?4 LIKE model AND ?5 LIKE maker))"
-  "          AND ?6 LIKE lens AND ?7 BETWEEN iso_min AND iso_max"
-  "          AND ?8 BETWEEN exposure_min AND exposure_max"
-  "          AND ?9 BETWEEN aperture_min AND aperture_max"
-  "          AND ?10 BETWEEN focal_length_min AND focal_length_max"
-  "          AND (format = 0 OR (format & ?11 != 0 AND ~format & ?12 != 0)))"
-  "        OR (name = ?13))"
-  "   AND operation NOT IN"
-  "        ('ioporder', 'metadata', 'modulegroups', 'export', 'tagging', 'collect', 'basecurve')"
-  " ORDER BY writeprotect DESC, LENGTH(model), LENGTH(maker), LENGTH(lens)",
-  (image->flags & DT_IMAGE_NO_LEGACY_PRESETS) ? "data.presets" : "main.legacy_presets");
-  // clang-format on
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, image->exif_model, -1, SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, image->exif_maker, -1, SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, image->camera_alias, -1, SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 5, image->camera_maker, -1, SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 6, image->exif_lens, -1, SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 7, fmaxf(0.0f, fminf(FLT_MAX, image->exif_iso)));
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 8, fmaxf(0.0f, fminf(1000000, image->exif_exposure)));
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 9, fmaxf(0.0f, fminf(1000000, image->exif_aperture)));
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 10, fmaxf(0.0f, fminf(1000000, image->exif_focal_length)));
-  // 0: dontcare, 1: ldr, 2: raw plus monochrome & color
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 11, iformat);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 12, excluded);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 13, workflow_preset, -1, SQLITE_TRANSIENT);
+  {
+    // images from before darktable 3.0 get the presets of that time, which are not indexed
+    sqlite3_stmt *stmt;
+    // clang-format off
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+    " SELECT ?1, 0, op_version, operation, op_params," // 0 is num in main.history, we just need uniform params binding
+    "       enabled, blendop_params, blendop_version, multi_priority, multi_name, name"
+    " FROM main.legacy_presets"
+    " WHERE ( (autoapply=1"
+    "          AND ((?2 LIKE model AND ?3 LIKE maker) OR (?4 LIKE model AND ?5 LIKE maker))"
+    "          AND ?6 LIKE lens AND ?7 BETWEEN iso_min AND iso_max"
+    "          AND ?8 BETWEEN exposure_min AND exposure_max"
+    "          AND ?9 BETWEEN aperture_min AND aperture_max"
+    "          AND ?10 BETWEEN focal_length_min AND focal_length_max"
+    "          AND (format = 0 OR (format & ?11 != 0 AND ~format & ?12 != 0)))"
+    "        OR (name = ?13))"
+    "   AND operation NOT IN"
+    "        ('ioporder', 'metadata', 'modulegroups', 'export', 'tagging', 'collect', 'basecurve')"
+    " ORDER BY writeprotect DESC, LENGTH(model), LENGTH(maker), LENGTH(lens)",
+    -1, &stmt, NULL);
+    // clang-format on
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, keys.exif_model, -1, SQLITE_TRANSIENT);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, keys.exif_maker, -1, SQLITE_TRANSIENT);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, keys.camera_alias, -1, SQLITE_TRANSIENT);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 5, keys.camera_maker, -1, SQLITE_TRANSIENT);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 6, keys.exif_lens, -1, SQLITE_TRANSIENT);
+    DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 7, keys.iso);
+    DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 8, keys.exposure);
+    DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 9, keys.aperture);
+    DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 10, keys.focal_length);
+    // 0: dontcare, 1: ldr, 2: raw plus monochrome & color
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 11, keys.format);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 12, keys.excluded);
+    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 13, workflow_preset, -1, SQLITE_TRANSIENT);
 
-  int legacy_params = 0;
-  while(sqlite3_step(stmt) == SQLITE_ROW)
-    _process_history_db_entry(dev, stmt, imgid, &legacy_params, TRUE);
+    while(sqlite3_step(stmt) == SQLITE_ROW)
+      _process_history_db_entry(dev, stmt, imgid, &legacy_params, TRUE);
 
-  sqlite3_finalize(stmt);
-  g_free(query);
+    sqlite3_finalize(stmt);
+  }
 
   // now we want to auto-apply the iop-order list if one corresponds and none are
   // still applied. Note that we can already have an iop-order list set when
@@ -1146,54 +1148,26 @@ static gboolean _dev_auto_apply_presets(dt_develop_t *dev, int32_t imgid)
 
   if(!dt_ioppr_has_iop_order_list(imgid))
   {
-    // clang-format off
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "SELECT op_params"
-                                " FROM data.presets"
-                                " WHERE autoapply=1"
-                                "       AND ((?2 LIKE model AND ?3 LIKE maker) OR (?4 LIKE model AND ?5 LIKE maker))"
-                                "       AND ?6 LIKE lens AND ?7 BETWEEN iso_min AND iso_max"
-                                "       AND ?8 BETWEEN exposure_min AND exposure_max"
-                                "       AND ?9 BETWEEN aperture_min AND aperture_max"
-                                "       AND ?10 BETWEEN focal_length_min AND focal_length_max"
-                                "       AND (format = 0 OR (format & ?11 != 0 AND ~format & ?12 != 0))"
-                                "       AND operation = 'ioporder'"
-                                " ORDER BY writeprotect DESC, LENGTH(model), LENGTH(maker), LENGTH(lens)",
-                                -1, &stmt, NULL);
-    // clang-format on
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, image->exif_model, -1, SQLITE_TRANSIENT);
-    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, image->exif_maker, -1, SQLITE_TRANSIENT);
-    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, image->camera_alias, -1, SQLITE_TRANSIENT);
-    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 5, image->camera_maker, -1, SQLITE_TRANSIENT);
-    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 6, image->exif_lens, -1, SQLITE_TRANSIENT);
-    DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 7, fmaxf(0.0f, fminf(FLT_MAX, image->exif_iso)));
-    DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 8, fmaxf(0.0f, fminf(1000000, image->exif_exposure)));
-    DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 9, fmaxf(0.0f, fminf(1000000, image->exif_aperture)));
-    DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 10, fmaxf(0.0f, fminf(1000000, image->exif_focal_length)));
-    // 0: dontcare, 1: ldr, 2: raw plus monochrome & color
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 11, iformat);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 12, excluded);
-    if(sqlite3_step(stmt) == SQLITE_ROW)
+    GList *orders = dt_presets_index_autoapply(index, &keys, "ioporder", -1, NULL, FALSE);
+    GList *iop_list = NULL;
+    if(orders)
     {
-      const char *params = (char *)sqlite3_column_blob(stmt, 0);
-      const int32_t params_len = sqlite3_column_bytes(stmt, 0);
-      GList *iop_list = dt_ioppr_deserialize_iop_order_list(params, params_len);
-      dt_ioppr_write_iop_order_list(iop_list, imgid);
-      g_list_free_full(iop_list, free);
-      dt_ioppr_set_default_iop_order(dev, imgid);
+      const dt_preset_t *order = (const dt_preset_t *)orders->data;
+      iop_list = dt_ioppr_deserialize_iop_order_list(order->op_params, order->op_params_size);
     }
     else
     {
       // we have no auto-apply order, so apply iop order, depending of the workflow
-      GList *iop_list = dt_ioppr_get_iop_order_list_version(DT_IOP_ORDER_V30);
-      dt_ioppr_write_iop_order_list(iop_list, imgid);
-      g_list_free_full(iop_list, free);
-      dt_ioppr_set_default_iop_order(dev, imgid);
+      iop_list = dt_ioppr_get_iop_order_list_version(DT_IOP_ORDER_V30);
     }
-    sqlite3_finalize(stmt);
+    dt_ioppr_write_iop_order_list(iop_list, imgid);
+    g_list_free_full(iop_list, free);
+    dt_ioppr_set_default_iop_order(dev, imgid);
+    g_list_free(orders);
   }
 
+  dt_presets_index_release(index);
+
   // Notify our private image copy that auto-presets got applied
   dev->image_storage.flags |= DT_IMAGE_AUTO_PRESETS_APPLIED | DT_IMAGE_NO_LEGACY_PRESETS;
 
@@ -1404,24 +1378,13 @@ static int _sync_params(dt_dev_history_item_t *hist, const void *module_params,
 }
 
 // WARNING: this does not set hist->forms
-static void _process_history_db_entry(dt_develop_t *dev, sqlite3_stmt *stmt, const int32_t imgid, int *legacy_params, gboolean presets)
+static void _process_history_entry(dt_develop_t *dev, const int32_t imgid, const int id, const int num,
+                                   const int modversion, const char *module_name, const void *module_params,
+                                   const int param_length, const int enabled, const void *blendop_params,
+                                   const int bl_length, const int blendop_version, const int multi_priority,
+                                   const char *multi_name, const char *preset_name, int *legacy_params,
+                                   gboolean presets)
 {
-  // Unpack the DB blobs
-  const int id = sqlite3_column_int(stmt, 0);
-  const int num = sqlite3_column_int(stmt, 1);
-  const int modversion = sqlite3_column_int(stmt, 2);
-  const char *module_name = (const char *)sqlite3_column_text(stmt, 3);
-  const void *module_params = sqlite3_column_blob(stmt, 4);
-  const int enabled = sqlite3_column_int(stmt, 5);
-  const void *blendop_params = sqlite3_column_blob(stmt, 6);
-  const int blendop_version = sqlite3_column_int(stmt, 7);
-  const int multi_priority = sqlite3_column_int(stmt, 8);
-  const char *multi_name = (const char *)sqlite3_column_text(stmt, 9);
-  const char *preset_name = (presets) ? (const char *)sqlite3_column_text(stmt, 10) : "";
-
-  const int param_length = sqlite3_column_bytes(stmt, 4);
-  const int bl_length = sqlite3_column_bytes(stmt, 6);
-
   // Sanity checks
   const gboolean is_valid_id = (id == imgid);
   const gboolean has_module_name = (module_name != NULL);
@@ -1508,6 +1471,28 @@ static void _process_history_db_entry(dt_develop_t *dev, sqlite3_stmt *stmt, con
     hist->iop_order, hist->enabled, (presets) ? "preset" : "database", (presets) ? preset_name : "");
 }
 
+// WARNING: this does not set hist->forms
+static void _process_history_db_entry(dt_develop_t *dev, sqlite3_stmt *stmt, const int32_t imgid, int *legacy_params, gboolean presets)
+{
+  // Unpack the DB blobs
+  _process_history_entry(dev, imgid, sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1),
+                         sqlite3_column_int(stmt, 2), (const char *)sqlite3_column_text(stmt, 3),
+                         sqlite3_column_blob(stmt, 4), sqlite3_column_bytes(stmt, 4), sqlite3_column_int(stmt, 5),
+                         sqlite3_column_blob(stmt, 6), sqlite3_column_bytes(stmt, 6), sqlite3_column_int(stmt, 7),
+                         sqlite3_column_int(stmt, 8), (const char *)sqlite3_column_text(stmt, 9),
+                         (presets) ? (const char *)sqlite3_column_text(stmt, 10) : "", legacy_params, presets);
+}
+
+// WARNING: this does not set hist->forms
+static void _process_preset_entry(dt_develop_t *dev, const dt_preset_t *preset, const int32_t imgid,
+                                  int *legacy_params)
+{
+  _process_history_entry(dev, imgid, imgid, 0, preset->op_version, preset->operation, preset->op_params,
+                         preset->op_params_size, preset->enabled, preset->blendop_params,
+                         preset->blendop_params_size, preset->blendop_version, preset->multi_priority,
+                         preset->multi_name, preset->name, legacy_params, TRUE);
+}
+
 
 void dt_dev_read_history_ext(dt_develop_t *dev, const int32_t imgid, gboolean no_image)
 {
@@ -272,8 +272,8 @@ void dt_dev_pixelpipe_rebuild(dt_develop_t *dev)
   dev->pipe->changed |= DT_DEV_PIPE_REMOVE;
   dev->preview_pipe->changed |= DT_DEV_PIPE_REMOVE;
 
-  dt_atomic_set_int(&dev->pipe->shutdown, TRUE);
-  dt_atomic_set_int(&dev->preview_pipe->shutdown, TRUE);
+  dt_dev_pixelpipe_cancel(dev->pipe);
+  dt_dev_pixelpipe_cancel(dev->preview_pipe);
 
   dt_show_times(&start, "[dt_dev_invalidate] sending killswitch signal on all pipelines");
 }
@@ -284,7 +284,7 @@ void dt_dev_pixelpipe_resync_main(dt_develop_t *dev)
 
   _dev_pixelpipe_set_dirty(dev->pipe);
   dev->pipe->changed |= DT_DEV_PIPE_SYNCH;
-  dt_atomic_set_int(&dev->pipe->shutdown, TRUE);
+  dt_dev_pixelpipe_cancel(dev->pipe);
 }
 
 void dt_dev_pixelpipe_resync_preview(dt_develop_t *dev)
@@ -293,7 +293,7 @@ void dt_dev_pixelpipe_resync_preview(dt_develop_t *dev)
 
   _dev_pixelpipe_set_dirty(dev->preview_pipe);
   dev->preview_pipe->changed |= DT_DEV_PIPE_SYNCH;
-  dt_atomic_set_int(&dev->preview_pipe->shutdown, TRUE);
+  dt_dev_pixelpipe_cancel(dev->preview_pipe);
 }
 
 void dt_dev_pixelpipe_resync_all(dt_develop_t *dev)
@@ -313,7 +313,7 @@ void dt_dev_invalidate_real(dt_develop_t *dev)
 
   _dev_pixelpipe_set_dirty(dev->pipe);
   dev->pipe->changed |= DT_DEV_PIPE_TOP_CHANGED;
-  dt_atomic_set_int(&dev->pipe->shutdown, TRUE);
+  dt_dev_pixelpipe_cancel(dev->pipe);
 
   dt_show_times(&start, "[dt_dev_invalidate] sending killswitch signal on main image pipeline");
 }
@@ -327,7 +327,7 @@ void dt_dev_invalidate_zoom_real(dt_develop_t *dev)
 
   _dev_pixelpipe_set_dirty(dev->pipe);
   dev->pipe->changed |= DT_DEV_PIPE_ZOOMED;
-  dt_atomic_set_int(&dev->pipe->shutdown, TRUE);
+  dt_dev_pixelpipe_cancel(dev->pipe);
 
   dt_show_times(&start, "[dt_dev_invalidate_zoom] sending killswitch signal on main image pipeline");
 }
@@ -341,7 +341,7 @@ void dt_dev_invalidate_preview_real(dt_develop_t *dev)
 
   _dev_pixelpipe_set_dirty(dev->preview_pipe);
   dev->preview_pipe->changed |= DT_DEV_PIPE_TOP_CHANGED;
-  dt_atomic_set_int(&dev->preview_pipe->shutdown, TRUE);
+  dt_dev_pixelpipe_cancel(dev->preview_pipe);
 
   dt_show_times(&start, "[dt_dev_invalidate_preview] sending killswitch signal on preview pipeline");
 }
@@ -374,6 +374,17 @@ static void _flag_pipe(dt_dev_pixelpipe_t *pipe, gboolean error)
 }
 
 
+// Time between the killswitch signal (history or ROI change) and the restart of the pipe,
+// that is the time needed by the previous run to reach a cancellation checkpoint.
+static void _report_restart_latency(dt_dev_pixelpipe_t *pipe, const double now)
+{
+  const int shutdown_ms = dt_atomic_exch_int(&pipe->shutdown_time, 0);
+  const double shutdown_time = darktable.start_wtime + shutdown_ms / 1000.;
+  if(shutdown_ms > 0 && now >= shutdown_time)
+    dt_print(DT_DEBUG_PERF, "[dev_process_image] %s pipe restarted %.3f secs after cancellation\n",
+             (pipe->type & DT_DEV_PIXELPIPE_PREVIEW) ? "preview" : "main", now - shutdown_time);
+}
+
 void dt_dev_process_preview_job(dt_develop_t *dev)
 {
   dt_dev_pixelpipe_t *pipe = dev->preview_pipe;
@@ -410,7 +421,8 @@ void dt_dev_process_preview_job(dt_develop_t *dev)
     dt_times_t thread_start;
     dt_get_times(&thread_start);
 
-    // We are starting fresh, reset the killswitch signal
+    // We are starting fresh, report how long it took to get here since the killswitch signal, and reset it
+    _report_restart_latency(pipe, thread_start.clock);
     dt_atomic_set_int(&pipe->shutdown, FALSE);
 
     // In case of re-entry, we will rerun the whole pipe, so we need
@@ -569,7 +581,8 @@ void dt_dev_process_image_job(dt_develop_t *dev)
     dt_times_t thread_start;
     dt_get_times(&thread_start);
 
-    // We are starting fresh, reset the killswitch signal
+    // We are starting fresh, report how long it took to get here since the killswitch signal, and reset it
+    _report_restart_latency(pipe, thread_start.clock);
     dt_atomic_set_int(&pipe->shutdown, FALSE);
 
     // In case of re-entry, we will rerun the whole pipe, so we need
@@ -578,7 +591,7 @@ void dt_dev_process_image_job(dt_develop_t *dev)
     if(dt_dev_pixelpipe_has_reentry(pipe))
     {
       pipe->changed |= DT_DEV_PIPE_REMOVE;
-      dt_dev_pixelpipe_cache_flush(&(pipe->cache));
+      dt_dev_pixelpipe_flush_caches(pipe);
     }
 
     // this locks dev->history_mutex
@@ -606,6 +619,39 @@ void dt_dev_process_image_job(dt_develop_t *dev)
     // Processing pipelines in parallel triggers memory contention.
     dt_pthread_mutex_lock(&dev->pipe_mutex);
 
+    // Progressive rendering: when the full pass is known to be slow, first render
+    // a 1/4 scale version of the ROI and display it upscaled while the full pass runs.
+    const int coarse_factor = 4;
+    if(dt_conf_get_bool("darkroom/ui/progressive_rendering")
+       && dev->average_delay > dt_conf_get_int("darkroom/ui/progressive_rendering_min_delay")
+       && wd / coarse_factor >= 32 && ht / coarse_factor >= 32)
+    {
+      if(!dt_dev_pixelpipe_process_coarse(pipe, dev, x, y, wd, ht, scale, coarse_factor))
+      {
+        pipe->backbuf_scale = scale;
+        pipe->backbuf_factor = coarse_factor;
+        pipe->backbuf_zoom_x = zoom_x;
+        pipe->backbuf_zoom_y = zoom_y;
+        dt_control_queue_redraw_center();
+
+        dt_times_t coarse_end;
+        dt_get_times(&coarse_end);
+        dt_print(DT_DEBUG_PERF, "[dev_process_image] time to first pixel (1/%i scale): %.3f secs\n",
+                 coarse_factor, coarse_end.clock - thread_start.clock);
+      }
+
+      // The ROI or the history changed while we were busy: don't start the full pass,
+      // the loop will restart with the new parameters.
+      if(dt_atomic_get_int(&pipe->shutdown))
+      {
+        dt_pthread_mutex_unlock(&dev->pipe_mutex);
+        dt_control_log_busy_leave();
+        dt_control_toast_busy_leave();
+        pipe->status = DT_DEV_PIXELPIPE_DIRTY;
+        continue;
+      }
+    }
+
     dt_times_t start;
     dt_get_times(&start);
 
@@ -619,7 +665,8 @@ void dt_dev_process_image_job(dt_develop_t *dev)
     dt_control_toast_busy_leave();
 
     dt_show_times(&thread_start, "[dev_process_image] pixel pipeline thread");
-    dt_dev_average_delay_update(&thread_start, &dev->average_delay);
+    // Measure the full pass only, otherwise the coarse pass would feed its own trigger
+    dt_dev_average_delay_update(&start, &dev->average_delay);
 
     // If pipe is flagged for re-entry, we need to restart it right away
     if(dt_dev_pixelpipe_has_reentry(pipe))
@@ -634,6 +681,7 @@ void dt_dev_process_image_job(dt_develop_t *dev)
     if(pipe->status == DT_DEV_PIXELPIPE_VALID)
     {
       pipe->backbuf_scale = scale;
+      pipe->backbuf_factor = 1;
       pipe->backbuf_zoom_x = zoom_x;
       pipe->backbuf_zoom_y = zoom_y;
       dev->image_invalid_cnt = 0;
@@ -759,7 +807,7 @@ void dt_dev_configure_real(dt_develop_t *dev, int wd, int ht)
 void dt_dev_reprocess_all(dt_develop_t *dev)
 {
   if(darktable.gui->reset || !dev || !dev->gui_attached) return;
-  dt_dev_pixelpipe_cache_flush(&(dev->pipe->cache));
+  dt_dev_pixelpipe_flush_caches(dev->pipe);
   dt_dev_pixelpipe_cache_flush(&(dev->preview_pipe->cache));
   dt_dev_pixelpipe_rebuild(dev);
 }
@@ -28,6 +28,7 @@
 #include "common/interpolation.h"
 #include "common/module.h"
 #include "common/opencl.h"
+#include "common/presets.h"
 #include "common/usermanual_url.h"
 #include "control/control.h"
 #include "develop/blend.h"
@@ -355,10 +356,47 @@ int dt_iop_load_module_so(void *m, const char *libname, const char *module_name)
       fprintf(stderr, "[iop_load_module] failed to initialize introspection for operation `%s'\n", module_name);
   }
 
-  if(module->init_global) module->init_global(module);
+  // init_global() is deferred to the first use of the module, in dt_iop_get_global_data()
+  module->global_inited = FALSE;
   return 0;
 }
 
+dt_iop_global_data_t *dt_iop_get_global_data(dt_iop_module_t *module)
+{
+  static GMutex lock;
+  dt_iop_module_so_t *so = module->so;
+
+  if(!g_atomic_int_get(&so->global_inited))
+  {
+    g_mutex_lock(&lock);
+    if(!so->global_inited)
+    {
+      const double start = dt_get_wtime();
+      if(so->init_global) so->init_global(so);
+      g_atomic_int_set(&so->global_inited, TRUE);
+      dt_print(DT_DEBUG_PERF, "[iop] init_global of `%s' took %.3f ms\n", so->op,
+               1000.0 * (dt_get_wtime() - start));
+    }
+    g_mutex_unlock(&lock);
+  }
+
+  module->global_data = so->data;
+  return module->global_data;
+}
+
+void dt_iop_autotune(void)
+{
+  for(const GList *iop = darktable.iop; iop; iop = g_list_next(iop))
+  {
+    dt_iop_module_so_t *so = (dt_iop_module_so_t *)iop->data;
+    if(!so->autotune) continue;
+
+    const double start = dt_get_wtime();
+    so->autotune(so);
+    dt_print(DT_DEBUG_PERF, "[iop] autotune of `%s' took %.3f s\n", so->op, dt_get_wtime() - start);
+  }
+}
+
 int dt_iop_load_module_by_so(dt_iop_module_t *module, dt_iop_module_so_t *so, dt_develop_t *dev)
 {
   module->dev = dev;
@@ -1098,31 +1136,23 @@ void dt_iop_cleanup_histogram(gpointer data, gpointer user_data)
   module->histogram_stats.pixels = 0;
 }
 
-static void _init_presets(dt_iop_module_so_t *module_so)
+// check for and update legacy presets. This runs once all modules have added their built-in presets,
+// and reads the presets index rather than querying data.presets for each module.
+static void _update_legacy_presets(dt_iop_module_so_t *module_so, const dt_presets_index_t *index)
 {
-  if(module_so->init_presets) module_so->init_presets(module_so);
-
-  // this seems like a reasonable place to check for and update legacy
-  // presets.
-
   const int32_t module_version = module_so->version();
+  const GPtrArray *presets = dt_presets_index_get_operation(index, module_so->op);
 
-  sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(
-      dt_database_get(darktable.db),
-      "SELECT name, op_version, op_params, blendop_version, blendop_params FROM data.presets WHERE operation = ?1",
-      -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, module_so->op, -1, SQLITE_TRANSIENT);
-
-  while(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    const char *name = (char *)sqlite3_column_text(stmt, 0);
-    int32_t old_params_version = sqlite3_column_int(stmt, 1);
-    const void *old_params = (void *)sqlite3_column_blob(stmt, 2);
-    const int32_t old_params_size = sqlite3_column_bytes(stmt, 2);
-    const int32_t old_blend_params_version = sqlite3_column_int(stmt, 3);
-    const void *old_blend_params = (void *)sqlite3_column_blob(stmt, 4);
-    const int32_t old_blend_params_size = sqlite3_column_bytes(stmt, 4);
+  for(guint i = 0; presets && i < presets->len; i++)
+  {
+    const dt_preset_t *preset = (const dt_preset_t *)g_ptr_array_index(presets, i);
+    const char *name = preset->name;
+    int32_t old_params_version = preset->op_version;
+    const void *old_params = preset->op_params;
+    const int32_t old_params_size = preset->op_params_size;
+    const int32_t old_blend_params_version = preset->blendop_version;
+    const void *old_blend_params = preset->blendop_params;
+    const int32_t old_blend_params_size = preset->blendop_params_size;
 
     if(old_params_version == 0)
     {
@@ -1293,7 +1323,6 @@ static void _init_presets(dt_iop_module_so_t *module_so)
       free(module);
     }
   }
-  sqlite3_finalize(stmt);
 }
 
 
@@ -1301,7 +1330,7 @@ static void _init_module_so(void *m)
 {
   dt_iop_module_so_t *module = (dt_iop_module_so_t *)m;
 
-  _init_presets(module);
+  if(module->init_presets) module->init_presets(module);
 
   // do not init accelerators if there is no gui
   if(darktable.gui)
@@ -1342,8 +1371,17 @@ static void _init_module_so(void *m)
 
 void dt_iop_load_modules_so(void)
 {
+  const double start = dt_get_wtime();
   darktable.iop = dt_module_load_modules("/plugins", sizeof(dt_iop_module_so_t), dt_iop_load_module_so,
                                          _init_module_so, NULL);
+
+  dt_presets_index_t *index = dt_presets_index_get();
+  for(GList *iop = darktable.iop; iop; iop = g_list_next(iop))
+    _update_legacy_presets((dt_iop_module_so_t *)iop->data, index);
+  dt_presets_index_release(index);
+
+  dt_print(DT_DEBUG_PERF, "[iop] loaded %d modules in %.3f s, their global init is deferred to first use\n",
+           g_list_length(darktable.iop), dt_get_wtime() - start);
 }
 
 int dt_iop_load_module(dt_iop_module_t *module, dt_iop_module_so_t *module_so, dt_develop_t *dev)
@@ -1423,7 +1461,7 @@ void dt_iop_unload_modules_so()
   while(darktable.iop)
   {
     dt_iop_module_so_t *module = (dt_iop_module_so_t *)darktable.iop->data;
-    if(module->cleanup_global) module->cleanup_global(module);
+    if(module->cleanup_global && module->global_inited) module->cleanup_global(module);
     if(module->module) g_module_close(module->module);
     free(darktable.iop->data);
     darktable.iop = g_list_delete_link(darktable.iop, darktable.iop);
@@ -1703,6 +1741,9 @@ void dt_iop_commit_params(dt_iop_module_t *module, dt_iop_params_t *params,
     return;
   }
 
+  // first use of the module: its global data is needed from now on
+  dt_iop_get_global_data(module);
+
   // 1. commit params
   memcpy(piece->blendop_data, blendop_params, sizeof(dt_develop_blend_params_t));
 
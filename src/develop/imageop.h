@@ -118,7 +118,9 @@ typedef enum dt_iop_flags_t
   IOP_FLAGS_FENCE = 1 << 10,             // No module can be moved pass this one
   IOP_FLAGS_UNSAFE_COPY = 1 << 11,       // Unsafe to copy as part of history
   IOP_FLAGS_GUIDES_SPECIAL_DRAW = 1 << 12, // handle the grid drawing directly
-  IOP_FLAGS_INTERNAL_MASKS = 1 << 13     // Module uses masks internally, outside of blendops. This advertises the need to commit them to history unconditionnaly.
+  IOP_FLAGS_INTERNAL_MASKS = 1 << 13,    // Module uses masks internally, outside of blendops. This advertises the need to commit them to history unconditionnaly.
+  IOP_FLAGS_POINTWISE = 1 << 14,         // Output pixel only depends on the input pixel at the same coordinates (no neighbourhood, no ROI dependency)
+  IOP_FLAGS_SKIP_IN_DRAFT = 1 << 15      // Costly neighbourhood filter whose effect doesn't show at thumbnail size, bypassed by draft thumbnail pipes
 } dt_iop_flags_t;
 
 typedef struct dt_iop_gui_data_t
@@ -166,6 +168,8 @@ typedef struct dt_iop_module_so_t
   /** other stuff that may be needed by the module, not only in gui mode. inited only once, has to be
    * read-only then. */
   dt_iop_global_data_t *data;
+  /** init_global() is deferred until the module is used, see dt_iop_get_global_data(). */
+  gint global_inited;
   /** gui is also only inited once at startup. */
 //  dt_iop_gui_data_t *gui_data;
   /** which results in this widget here, too. */
@@ -324,6 +328,12 @@ typedef struct dt_iop_module_t
 void dt_iop_load_modules_so(void);
 /** cleans up the dlopen refs. */
 void dt_iop_unload_modules_so(void);
+/** global data of the module, shared by all its instances. init_global() of the module is run on the first
+ * call, so modules that are never used don't pay for their kernels, LUTs or databases. The pipeline calls it
+ * when committing params, other code reading global_data out of the pipeline has to call it first. */
+dt_iop_global_data_t *dt_iop_get_global_data(dt_iop_module_t *module);
+/** runs autotune() of all modules that have one. */
+void dt_iop_autotune(void);
 /** load a module for a given .so */
 int dt_iop_load_module_by_so(dt_iop_module_t *module, dt_iop_module_so_t *so, struct dt_develop_t *dev);
 /** returns a list of instances referencing stuff loaded in load_modules_so. */
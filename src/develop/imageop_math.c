@@ -90,6 +90,62 @@ void dt_iop_flip_and_zoom_8(const uint8_t *in, int32_t iw, int32_t ih, uint8_t *
   }
 }
 
+void dt_iop_downsample_8(const uint8_t *const in, const int32_t iw, const int32_t ih, uint8_t *const out,
+                         const int32_t ow, const int32_t oh, uint32_t *width, uint32_t *height)
+{
+  // same output size as dt_iop_flip_and_zoom_8(), never upscale
+  const float scale = fmaxf(1.0, fmaxf(iw / (float)ow, ih / (float)oh));
+  const int32_t wd = *width = MAX(1, MIN(ow, iw / scale));
+  const int32_t ht = *height = MAX(1, MIN(oh, ih / scale));
+
+  // Every output pixel averages the block of input pixels it covers. Blocks tile the input exactly:
+  // along x, output pixel i covers input columns [i * iw / wd, (i + 1) * iw / wd).
+  // Rows of a block are first summed into a per-thread line of 32 bits accumulators,
+  // the inner loops run over contiguous channels and vectorize.
+  size_t padded_size;
+  uint32_t *const restrict lines = dt_alloc_perthread(4 * (size_t)iw, sizeof(uint32_t), &padded_size);
+  if(!lines)
+  {
+    // out of memory: subsample instead, same output size
+    dt_iop_flip_and_zoom_8(in, iw, ih, out, ow, oh, ORIENTATION_NONE, width, height);
+    return;
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(in, out, iw, ih, wd, ht, lines, padded_size) \
+  schedule(static)
+#endif
+  for(int32_t j = 0; j < ht; j++)
+  {
+    uint32_t *const restrict line = dt_get_perthread(lines, padded_size);
+    const int32_t y0 = (int64_t)j * ih / ht;
+    const int32_t y1 = (int64_t)(j + 1) * ih / ht;
+
+    memset(line, 0, sizeof(uint32_t) * 4 * iw);
+    for(int32_t y = y0; y < y1; y++)
+    {
+      const uint8_t *const restrict row = in + (size_t)4 * iw * y;
+      for(size_t k = 0; k < (size_t)4 * iw; k++) line[k] += row[k];
+    }
+
+    uint8_t *const restrict out_row = out + (size_t)4 * wd * j;
+    for(int32_t i = 0; i < wd; i++)
+    {
+      const int32_t x0 = (int64_t)i * iw / wd;
+      const int32_t x1 = (int64_t)(i + 1) * iw / wd;
+      uint32_t sum[4] = { 0, 0, 0, 0 };
+      for(int32_t x = x0; x < x1; x++)
+        for(int c = 0; c < 4; c++) sum[c] += line[4 * x + c];
+
+      const uint32_t count = (uint32_t)(x1 - x0) * (y1 - y0);
+      for(int c = 0; c < 4; c++) out_row[4 * i + c] = (sum[c] + count / 2) / count;
+    }
+  }
+
+  dt_free_align(lines);
+}
+
 void dt_iop_clip_and_zoom_8(const uint8_t *i, int32_t ix, int32_t iy, int32_t iw, int32_t ih, int32_t ibw,
                             int32_t ibh, uint8_t *o, int32_t ox, int32_t oy, int32_t ow, int32_t oh,
                             int32_t obw, int32_t obh)
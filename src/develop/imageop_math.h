@@ -40,6 +40,12 @@ extern "C" {
 void dt_iop_flip_and_zoom_8(const uint8_t *in, int32_t iw, int32_t ih, uint8_t *out, int32_t ow, int32_t oh,
                             const dt_image_orientation_t orientation, uint32_t *width, uint32_t *height);
 
+/** downsample a 4 channels, 8 bits buffer to fit in ow × oh, averaging all the input pixels under each output
+ * pixel. Never upscales. Sets the actual output size in width and height. Falls back to
+ * dt_iop_flip_and_zoom_8() if its line buffers can't be allocated. */
+void dt_iop_downsample_8(const uint8_t *const in, const int32_t iw, const int32_t ih, uint8_t *const out,
+                         const int32_t ow, const int32_t oh, uint32_t *width, uint32_t *height);
+
 /** for homebrew pixel pipe: zoom pixel array. */
 void dt_iop_clip_and_zoom(float *out, const float *const in, const struct dt_iop_roi_t *const roi_out,
                           const struct dt_iop_roi_t *const roi_in, const int32_t out_stride,
@@ -0,0 +1,521 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "develop/lut_bake.h"
+#include "common/darktable.h"
+#include "common/colorspaces_inline_conversions.h"
+#include "common/iop_profile.h"
+#include "control/conf.h"
+#include "develop/blend.h"
+#include "develop/imageop.h"
+#include "develop/pixelpipe_hb.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Shaper of the LUT input: log2 over [MIN_EV ; MAX_EV] with an offset so 0 maps to 0.
+// Scene-referred RGB is unbounded, so a linear lattice would waste most nodes in highlights.
+#define DT_LUT_BAKE_MIN_EV -14.f
+#define DT_LUT_BAKE_MAX_EV 4.f
+
+// Number of LUTs kept around. One per style used in the current export batch is plenty.
+#define DT_LUT_BAKE_CACHE_ENTRIES 4
+
+// Max number of image pixels used to validate a LUT against the exact chain
+#define DT_LUT_BAKE_VALIDATION_SAMPLES 65536
+
+typedef struct dt_dev_lut_bake_entry_t
+{
+  uint64_t hash;
+  int out_cst;
+  float *clut;    // DT_LUT_BAKE_LEVEL³ RGBA nodes, red varying fastest
+  int users;      // entry can't be evicted while > 0
+  uint64_t age;   // LRU
+} dt_dev_lut_bake_entry_t;
+
+static struct
+{
+  dt_pthread_mutex_t lock;
+  dt_dev_lut_bake_entry_t entries[DT_LUT_BAKE_CACHE_ENTRIES];
+  uint64_t clock;
+} _cache;
+
+
+void dt_dev_lut_bake_init(void)
+{
+  memset(&_cache, 0, sizeof(_cache));
+  dt_pthread_mutex_init(&_cache.lock, NULL);
+}
+
+void dt_dev_lut_bake_cleanup(void)
+{
+  for(int i = 0; i < DT_LUT_BAKE_CACHE_ENTRIES; i++)
+  {
+    dt_free_align(_cache.entries[i].clut);
+    _cache.entries[i].clut = NULL;
+  }
+  dt_pthread_mutex_destroy(&_cache.lock);
+}
+
+
+static inline float _shaper(const float x)
+{
+  const float offset = exp2f(DT_LUT_BAKE_MIN_EV);
+  const float t = (log2f(fmaxf(x, 0.f) + offset) - DT_LUT_BAKE_MIN_EV) / (DT_LUT_BAKE_MAX_EV - DT_LUT_BAKE_MIN_EV);
+  return fminf(fmaxf(t, 0.f), 1.f);
+}
+
+static inline float _shaper_inverse(const float t)
+{
+  const float offset = exp2f(DT_LUT_BAKE_MIN_EV);
+  return exp2f(t * (DT_LUT_BAKE_MAX_EV - DT_LUT_BAKE_MIN_EV) + DT_LUT_BAKE_MIN_EV) - offset;
+}
+
+
+static gboolean _piece_is_bakeable(const dt_dev_pixelpipe_iop_t *const piece)
+{
+  const dt_iop_module_t *const module = piece->module;
+  if(!(module->flags() & IOP_FLAGS_POINTWISE)) return FALSE;
+  if(module->modify_roi_in || module->modify_roi_out) return FALSE;
+
+  const dt_develop_blend_params_t *const bp = (const dt_develop_blend_params_t *)piece->blendop_data;
+  if(bp && bp->mask_mode != DEVELOP_MASK_DISABLED) return FALSE;
+
+  return TRUE;
+}
+
+
+gboolean dt_dev_lut_bake_find_tail(dt_dev_pixelpipe_t *pipe, GList **first, GList **last)
+{
+  *first = *last = NULL;
+
+  if(pipe->type != DT_DEV_PIXELPIPE_EXPORT) return FALSE;
+  if(pipe->mask_display != DT_DEV_PIXELPIPE_DISPLAY_NONE) return FALSE;
+  if(!dt_conf_get_bool("plugins/lighttable/export/bake_color_tail")) return FALSE;
+
+  // Find colorout, the end of the tail
+  GList *node = g_list_last(pipe->nodes);
+  for(; node; node = g_list_previous(node))
+  {
+    const dt_dev_pixelpipe_iop_t *const piece = (const dt_dev_pixelpipe_iop_t *)node->data;
+    if(!strcmp(piece->module->op, "colorout")) break;
+  }
+  if(!node) return FALSE;
+
+  const dt_dev_pixelpipe_iop_t *const colorout = (const dt_dev_pixelpipe_iop_t *)node->data;
+  if(!colorout->enabled || !_piece_is_bakeable(colorout)) return FALSE;
+
+  // Walk back as long as enabled modules are bakeable. Disabled modules are skipped by the pipe anyway.
+  int count = 0;
+  GList *start = NULL;
+  for(GList *prev = node; prev; prev = g_list_previous(prev))
+  {
+    const dt_dev_pixelpipe_iop_t *const piece = (const dt_dev_pixelpipe_iop_t *)prev->data;
+    if(!piece->enabled) continue;
+    if(!_piece_is_bakeable(piece)) break;
+    start = prev;
+    count++;
+  }
+
+  // colorout alone is already a cheap matrix or a LUT-based profile: nothing to win
+  if(count < 2) return FALSE;
+
+  *first = start;
+  *last = node;
+  return TRUE;
+}
+
+
+static uint64_t _tail_hash(dt_dev_pixelpipe_t *pipe, GList *first, GList *last)
+{
+  uint64_t hash = 5381;
+  for(GList *node = first; node; node = g_list_next(node))
+  {
+    const dt_dev_pixelpipe_iop_t *const piece = (const dt_dev_pixelpipe_iop_t *)node->data;
+    if(piece->enabled)
+    {
+      hash = dt_hash(hash, piece->module->op, strlen(piece->module->op));
+      hash = dt_hash(hash, (const char *)&piece->hash, sizeof(uint64_t));
+    }
+    if(node == last) break;
+  }
+
+  // The LUT input is expressed in the working space
+  const dt_iop_order_iccprofile_info_t *const work_profile = dt_ioppr_get_pipe_work_profile_info(pipe);
+  if(work_profile)
+  {
+    hash = dt_hash(hash, (const char *)&work_profile->type, sizeof(work_profile->type));
+    hash = dt_hash(hash, work_profile->filename, strlen(work_profile->filename));
+  }
+
+  // Export may override the output profile regardless of colorout params
+  hash = dt_hash(hash, (const char *)&pipe->icc_type, sizeof(pipe->icc_type));
+  hash = dt_hash(hash, (const char *)&pipe->icc_intent, sizeof(pipe->icc_intent));
+  if(pipe->icc_filename) hash = dt_hash(hash, pipe->icc_filename, strlen(pipe->icc_filename));
+
+  return hash;
+}
+
+
+/**
+ * Run the exact chain over `in`, in place colorspace conversions included, like the pipe does.
+ * The result lands in `out`, `tmp` is scratch of the same size. Returns the output colorspace.
+ */
+static int _run_tail(dt_dev_pixelpipe_t *pipe, GList *first, GList *last, float *const in, int *in_cst,
+                     float *const out, float *const tmp, const int width, const int height)
+{
+  const dt_iop_order_iccprofile_info_t *const work_profile = dt_ioppr_get_pipe_work_profile_info(pipe);
+  const dt_iop_roi_t roi = { 0, 0, width, height, 1.f };
+
+  int steps = 0;
+  for(GList *node = first; node; node = g_list_next(node))
+  {
+    if(((dt_dev_pixelpipe_iop_t *)node->data)->enabled) steps++;
+    if(node == last) break;
+  }
+
+  // Ping-pong between out and tmp such that the last step writes into out
+  float *src = in;
+  float *dst = (steps % 2) ? out : tmp;
+  int cst = *in_cst;
+
+  for(GList *node = first; node; node = g_list_next(node))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)node->data;
+    if(piece->enabled)
+    {
+      dt_iop_module_t *module = piece->module;
+      dt_ioppr_transform_image_colorspace(module, src, src, width, height, cst,
+                                          module->input_colorspace(module, pipe, piece), &cst, work_profile);
+      if(src == in) *in_cst = cst;
+
+      module->process(module, piece, src, dst, &roi, &roi);
+      cst = module->output_colorspace(module, pipe, piece);
+
+      src = dst;
+      dst = (dst == out) ? tmp : out;
+    }
+    if(node == last) break;
+  }
+
+  return cst;
+}
+
+
+static float *_bake(dt_dev_pixelpipe_t *pipe, GList *first, GList *last, int *out_cst)
+{
+  const size_t level = DT_LUT_BAKE_LEVEL;
+  const size_t width = level * level;
+  const size_t height = level;
+  const size_t npixels = width * height;
+
+  float *const restrict samples = dt_alloc_align_float(npixels * 4);
+  float *const restrict clut = dt_alloc_align_float(npixels * 4);
+  float *const restrict tmp = dt_alloc_align_float(npixels * 4);
+
+  if(!samples || !clut || !tmp)
+  {
+    dt_free_align(samples);
+    dt_free_align(clut);
+    dt_free_align(tmp);
+    return NULL;
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(samples, level, npixels) \
+  schedule(static)
+#endif
+  for(size_t k = 0; k < npixels; k++)
+  {
+    const size_t r = k % level;
+    const size_t g = (k / level) % level;
+    const size_t b = k / (level * level);
+    samples[4 * k + 0] = _shaper_inverse((float)r / (float)(level - 1));
+    samples[4 * k + 1] = _shaper_inverse((float)g / (float)(level - 1));
+    samples[4 * k + 2] = _shaper_inverse((float)b / (float)(level - 1));
+    samples[4 * k + 3] = 0.f;
+  }
+
+  int cst = IOP_CS_RGB;
+  *out_cst = _run_tail(pipe, first, last, samples, &cst, clut, tmp, width, height);
+
+  dt_free_align(samples);
+  dt_free_align(tmp);
+  return clut;
+}
+
+
+// Tetrahedral interpolation, adapted from OpenColorIO like iop/lut3d.c,
+// but over RGBA nodes so the 4 channels blend as one SIMD vector.
+__DT_CLONE_TARGETS__
+static void _apply_clut(const float *const restrict in, float *const restrict out, const size_t npixels,
+                        const float *const restrict clut)
+{
+  const size_t level = DT_LUT_BAKE_LEVEL;
+  const size_t dr = 4;
+  const size_t dg = 4 * level;
+  const size_t db = 4 * level * level;
+  const size_t d111 = dr + dg + db;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(in, out, npixels, clut, level, dr, dg, db, d111) \
+  schedule(static)
+#endif
+  for(size_t k = 0; k < npixels; k++)
+  {
+    const float *const restrict pix_in = in + 4 * k;
+    float *const restrict pix_out = out + 4 * k;
+
+    dt_aligned_pixel_t f;
+    size_t idx[3];
+    for(int c = 0; c < 3; c++)
+    {
+      const float x = _shaper(pix_in[c]) * (float)(level - 1);
+      idx[c] = (size_t)CLAMP((int)x, 0, (int)level - 2);
+      f[c] = x - (float)idx[c];
+    }
+
+    const float *const restrict p000 = clut + idx[0] * dr + idx[1] * dg + idx[2] * db;
+
+    // Pick the tetrahedron containing the point: walk the axes by decreasing fractional part
+    size_t o1, o2;
+    float f_max, f_mid, f_min;
+    if(f[0] > f[1])
+    {
+      if(f[1] > f[2])
+      { o1 = dr; o2 = dr + dg; f_max = f[0]; f_mid = f[1]; f_min = f[2]; }
+      else if(f[0] > f[2])
+      { o1 = dr; o2 = dr + db; f_max = f[0]; f_mid = f[2]; f_min = f[1]; }
+      else
+      { o1 = db; o2 = db + dr; f_max = f[2]; f_mid = f[0]; f_min = f[1]; }
+    }
+    else
+    {
+      if(f[2] > f[1])
+      { o1 = db; o2 = db + dg; f_max = f[2]; f_mid = f[1]; f_min = f[0]; }
+      else if(f[2] > f[0])
+      { o1 = dg; o2 = dg + db; f_max = f[1]; f_mid = f[2]; f_min = f[0]; }
+      else
+      { o1 = dg; o2 = dg + dr; f_max = f[1]; f_mid = f[0]; f_min = f[2]; }
+    }
+
+    const float w0 = 1.f - f_max;
+    const float w1 = f_max - f_mid;
+    const float w2 = f_mid - f_min;
+    const float w3 = f_min;
+
+    dt_aligned_pixel_t res;
+    for_four_channels(c)
+      res[c] = w0 * p000[c] + w1 * p000[o1 + c] + w2 * p000[o2 + c] + w3 * p000[d111 + c];
+
+    pix_out[0] = res[0];
+    pix_out[1] = res[1];
+    pix_out[2] = res[2];
+    pix_out[3] = pix_in[3];
+  }
+}
+
+
+static dt_dev_lut_bake_entry_t *_cache_acquire(dt_dev_pixelpipe_t *pipe, GList *first, GList *last,
+                                               const uint64_t hash)
+{
+  dt_pthread_mutex_lock(&_cache.lock);
+  _cache.clock++;
+
+  dt_dev_lut_bake_entry_t *slot = NULL;
+  for(int i = 0; i < DT_LUT_BAKE_CACHE_ENTRIES; i++)
+  {
+    dt_dev_lut_bake_entry_t *entry = &_cache.entries[i];
+    if(entry->clut && entry->hash == hash)
+    {
+      entry->users++;
+      entry->age = _cache.clock;
+      dt_pthread_mutex_unlock(&_cache.lock);
+      dt_print(DT_DEBUG_PERF, "[lut_bake] reusing cached LUT for hash %" PRIu64 "\n", hash);
+      return entry;
+    }
+
+    // Find the least recently used entry that nobody is reading
+    if(entry->users == 0 && (!slot || !entry->clut || (slot->clut && entry->age < slot->age)))
+      slot = entry;
+  }
+
+  if(!slot)
+  {
+    // All entries are in use by concurrent exports
+    dt_pthread_mutex_unlock(&_cache.lock);
+    return NULL;
+  }
+
+  // Bake under the lock: concurrent exports of the same style will wait for it instead of baking twice
+  dt_times_t start;
+  dt_get_times(&start);
+
+  dt_free_align(slot->clut);
+  slot->clut = _bake(pipe, first, last, &slot->out_cst);
+  slot->hash = hash;
+  slot->age = _cache.clock;
+  slot->users = (slot->clut) ? 1 : 0;
+
+  dt_show_times_f(&start, "[lut_bake]", "baked %i³ LUT for hash %" PRIu64, DT_LUT_BAKE_LEVEL, hash);
+
+  dt_pthread_mutex_unlock(&_cache.lock);
+  return (slot->clut) ? slot : NULL;
+}
+
+static void _cache_release(dt_dev_lut_bake_entry_t *entry)
+{
+  dt_pthread_mutex_lock(&_cache.lock);
+  entry->users--;
+  dt_pthread_mutex_unlock(&_cache.lock);
+}
+
+
+/**
+ * Compare the LUT against the exact chain on a strided subset of the actual input.
+ * `input` needs to be in RGB already.
+ * Returns FALSE if the validation could not run.
+ */
+static gboolean _validate(dt_dev_pixelpipe_t *pipe, GList *first, GList *last, const float *const input,
+                          const size_t npixels, const dt_dev_lut_bake_entry_t *const entry,
+                          float *max_delta_e, float *mean_delta_e, size_t *samples)
+{
+  const dt_iop_order_iccprofile_info_t *const out_profile = dt_ioppr_get_pipe_output_profile_info(pipe);
+  if(!out_profile || entry->out_cst != IOP_CS_RGB) return FALSE;
+
+  const size_t n = MIN(npixels, (size_t)DT_LUT_BAKE_VALIDATION_SAMPLES);
+  const size_t stride = MAX(npixels / n, (size_t)1);
+
+  float *const restrict exact_in = dt_alloc_align_float(n * 4);
+  float *const restrict exact_out = dt_alloc_align_float(n * 4);
+  float *const restrict baked_out = dt_alloc_align_float(n * 4);
+  float *const restrict tmp = dt_alloc_align_float(n * 4);
+  if(!exact_in || !exact_out || !baked_out || !tmp)
+  {
+    dt_free_align(exact_in);
+    dt_free_align(exact_out);
+    dt_free_align(baked_out);
+    dt_free_align(tmp);
+    return FALSE;
+  }
+
+  for(size_t k = 0; k < n; k++)
+    memcpy(exact_in + 4 * k, input + 4 * k * stride, 4 * sizeof(float));
+
+  _apply_clut(exact_in, baked_out, n, entry->clut);
+
+  int cst = IOP_CS_RGB;
+  const int exact_cst = _run_tail(pipe, first, last, exact_in, &cst, exact_out, tmp, (int)n, 1);
+
+  float max_err = 0.f;
+  double sum_err = 0.;
+  if(exact_cst == entry->out_cst)
+  {
+    for(size_t k = 0; k < n; k++)
+    {
+      dt_aligned_pixel_t Lab_exact, Lab_baked;
+      dt_ioppr_rgb_matrix_to_lab(exact_out + 4 * k, Lab_exact, out_profile->matrix_in_transposed,
+                                 out_profile->lut_in, out_profile->unbounded_coeffs_in, out_profile->lutsize,
+                                 out_profile->nonlinearlut);
+      dt_ioppr_rgb_matrix_to_lab(baked_out + 4 * k, Lab_baked, out_profile->matrix_in_transposed,
+                                 out_profile->lut_in, out_profile->unbounded_coeffs_in, out_profile->lutsize,
+                                 out_profile->nonlinearlut);
+      const float dL = Lab_exact[0] - Lab_baked[0];
+      const float da = Lab_exact[1] - Lab_baked[1];
+      const float db = Lab_exact[2] - Lab_baked[2];
+      const float err = sqrtf(dL * dL + da * da + db * db);
+      // NaN from either side is a failure
+      max_err = (err == err) ? fmaxf(max_err, err) : INFINITY;
+      sum_err += err;
+    }
+  }
+  else
+    max_err = INFINITY;
+
+  dt_free_align(exact_in);
+  dt_free_align(exact_out);
+  dt_free_align(baked_out);
+  dt_free_align(tmp);
+
+  *max_delta_e = max_err;
+  *mean_delta_e = (float)(sum_err / (double)n);
+  *samples = n;
+  return TRUE;
+}
+
+
+int dt_dev_lut_bake_process(dt_dev_pixelpipe_t *pipe, GList *first, GList *last, float *const input, int *in_cst,
+                            float *const output, const dt_iop_roi_t *const roi)
+{
+  const size_t npixels = (size_t)roi->width * roi->height;
+  const dt_iop_order_iccprofile_info_t *const work_profile = dt_ioppr_get_pipe_work_profile_info(pipe);
+
+  dt_times_t start;
+  dt_get_times(&start);
+
+  dt_dev_lut_bake_entry_t *entry = NULL;
+  if(work_profile)
+  {
+    entry = _cache_acquire(pipe, first, last, _tail_hash(pipe, first, last));
+    if(entry)
+    {
+      // The LUT is sampled in the RGB working space
+      dt_ioppr_transform_image_colorspace(((dt_dev_pixelpipe_iop_t *)first->data)->module, input, input,
+                                          roi->width, roi->height, *in_cst, IOP_CS_RGB, in_cst, work_profile);
+
+      float max_delta_e = INFINITY, mean_delta_e = INFINITY;
+      size_t samples = 0;
+      const gboolean validated
+          = _validate(pipe, first, last, input, npixels, entry, &max_delta_e, &mean_delta_e, &samples);
+      const float threshold = dt_conf_get_float("plugins/lighttable/export/bake_color_tail_max_delta_e");
+
+      dt_print(DT_DEBUG_PERF, "[lut_bake] validation on %zu pixels: max ΔE = %.3f, mean ΔE = %.3f (threshold %.3f)\n",
+               samples, max_delta_e, mean_delta_e, threshold);
+
+      if(validated && max_delta_e <= threshold)
+      {
+        _apply_clut(input, output, npixels, entry->clut);
+        const int out_cst = entry->out_cst;
+        _cache_release(entry);
+        dt_show_times_f(&start, "[lut_bake]", "processed colour tail through baked LUT");
+        return out_cst;
+      }
+
+      _cache_release(entry);
+      dt_print(DT_DEBUG_PERF, "[lut_bake] LUT rejected, falling back to the exact chain\n");
+    }
+  }
+
+  // Exact chain
+  float *const tmp = dt_alloc_align_float(npixels * 4);
+  if(!tmp) return -1;
+  const int out_cst = _run_tail(pipe, first, last, input, in_cst, output, tmp, roi->width, roi->height);
+  dt_free_align(tmp);
+
+  dt_show_times_f(&start, "[lut_bake]", "processed colour tail through exact chain");
+  return out_cst;
+}
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
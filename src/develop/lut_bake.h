@@ -0,0 +1,67 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+
+struct dt_dev_pixelpipe_t;
+struct dt_iop_roi_t;
+
+/**
+ * Baking of the colour tail of export pipelines into a 3D LUT.
+ *
+ * The colour tail is the longest run of enabled modules flagged IOP_FLAGS_POINTWISE,
+ * without blending nor ROI changes, ending at colorout. Since each output pixel of such a
+ * chain depends only on the matching input pixel, the whole chain is a function RGB -> RGB
+ * that we sample once on a 65³ lattice (log-shaped to cover scene-referred values),
+ * then apply to the full image with a tetrahedral interpolation.
+ *
+ * LUTs are cached process-wide by the hash of the chain, so batch exports
+ * using the same style bake only once.
+ *
+ * Each use is validated against the exact chain on a subset of the actual image pixels.
+ * If the max ΔE 1976 exceeds `plugins/lighttable/export/bake_color_tail_max_delta_e`,
+ * the exact chain is run instead.
+ *
+ * Opt-in through `plugins/lighttable/export/bake_color_tail`.
+ */
+
+#define DT_LUT_BAKE_LEVEL 65
+
+/** init/cleanup the process-wide LUT cache */
+void dt_dev_lut_bake_init(void);
+void dt_dev_lut_bake_cleanup(void);
+
+/** find the bakeable colour tail of the pipe, if enabled in config and if the pipe is an export.
+ * `first` and `last` are links of `pipe->nodes`. Returns FALSE if nothing worth baking was found. */
+gboolean dt_dev_lut_bake_find_tail(struct dt_dev_pixelpipe_t *pipe, GList **first, GList **last);
+
+/** process the colour tail [first ; last] of the pipe over the `input` buffer, float RGBA,
+ * either through the baked LUT or through the exact chain if validation fails.
+ * `input` may be overwritten. `in_cst` is updated with its actual colour space.
+ * Returns the colour space of `output`, or -1 on error. */
+int dt_dev_lut_bake_process(struct dt_dev_pixelpipe_t *pipe, GList *first, GList *last,
+                            float *const input, int *in_cst, float *const output,
+                            const struct dt_iop_roi_t *const roi);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -20,6 +20,8 @@
 #include "common/color_picker.h"
 #include "common/colorspaces.h"
 #include "common/darktable.h"
+#include "common/bilateral.h"
+#include "common/guided_filter.h"
 #include "common/histogram.h"
 #include "common/imageio.h"
 #include "common/opencl.h"
@@ -30,6 +32,8 @@
 #include "develop/blend.h"
 #include "develop/format.h"
 #include "develop/imageop_math.h"
+#include "develop/lut_bake.h"
+#include "develop/raw_fuse.h"
 #include "develop/pixelpipe.h"
 #include "develop/tiling.h"
 #include "develop/masks.h"
@@ -172,6 +176,9 @@ int dt_dev_pixelpipe_init(dt_dev_pixelpipe_t *pipe)
   const int res = dt_dev_pixelpipe_init_cached(pipe, sizeof(float) * 4 * darktable.dtresources.darkroom_cache, dt_conf_get_int("cachelines"));
   pipe->type = DT_DEV_PIXELPIPE_FULL;
 
+  // Coarse passes of progressive rendering: lines are allocated on demand, at 1/16 of the full size
+  dt_dev_pixelpipe_cache_init(&(pipe->coarse_cache), dt_conf_get_int("cachelines"), 0);
+
   // Needed for caching
   pipe->store_all_raster_masks = TRUE;
   return res;
@@ -187,6 +194,7 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->backbuf_size = size;
   pipe->backbuf = NULL;
   pipe->backbuf_scale = 0.0f;
+  pipe->backbuf_factor = 1;
   pipe->backbuf_zoom_x = 0.0f;
   pipe->backbuf_zoom_y = 0.0f;
 
@@ -201,10 +209,12 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->processing = 0;
   pipe->running = 0;
   dt_atomic_set_int(&pipe->shutdown, FALSE);
+  dt_atomic_set_int(&pipe->shutdown_time, 0);
   pipe->opencl_error = 0;
   pipe->tiling = 0;
   pipe->mask_display = DT_DEV_PIXELPIPE_DISPLAY_NONE;
   pipe->bypass_blendif = 0;
+  pipe->draft = FALSE;
   pipe->input_timestamp = 0;
   pipe->levels = IMAGEIO_RGB | IMAGEIO_INT8;
   dt_pthread_mutex_init(&(pipe->backbuf_mutex), NULL);
@@ -223,8 +233,13 @@ int dt_dev_pixelpipe_init_cached(dt_dev_pixelpipe_t *pipe, size_t size, int32_t
   pipe->status = DT_DEV_PIXELPIPE_DIRTY;
   pipe->last_history_hash = 0;
   pipe->flush_cache = FALSE;
+  pipe->bake_tail_first = NULL;
+  pipe->bake_tail_last = NULL;
+  pipe->raw_fuse_first = NULL;
+  pipe->raw_fuse_last = NULL;
 
   dt_dev_pixelpipe_reset_reentry(pipe);
+  memset(&(pipe->coarse_cache), 0, sizeof(dt_dev_pixelpipe_cache_t));
   if(!dt_dev_pixelpipe_cache_init(&(pipe->cache), entries, pipe->backbuf_size)) return 0;
 
   return 1;
@@ -261,6 +276,10 @@ void dt_dev_pixelpipe_cleanup(dt_dev_pixelpipe_t *pipe)
   dt_dev_pixelpipe_cleanup_nodes(pipe);
   // so now it's safe to clean up cache:
   dt_dev_pixelpipe_cache_cleanup(&(pipe->cache));
+  if(pipe->coarse_cache.entries) dt_dev_pixelpipe_cache_cleanup(&(pipe->coarse_cache));
+  // and to release the scratch memory and the grids kept by the filters
+  dt_gf_scratch_cleanup();
+  dt_bilateral_cache_cleanup();
   dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
   dt_pthread_mutex_destroy(&(pipe->backbuf_mutex));
   dt_pthread_mutex_destroy(&(pipe->busy_mutex));
@@ -338,6 +357,8 @@ void dt_dev_pixelpipe_cleanup_nodes(dt_dev_pixelpipe_t *pipe)
     piece->histogram = NULL;
     g_hash_table_destroy(piece->raster_masks);
     piece->raster_masks = NULL;
+    g_hash_table_destroy(piece->coarse_raster_masks);
+    piece->coarse_raster_masks = NULL;
     free(piece);
   }
   g_list_free(pipe->nodes);
@@ -394,8 +415,11 @@ void dt_dev_pixelpipe_create_nodes(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev)
     piece->process_cl_ready = 0;
     piece->process_tiling_ready = 0;
     piece->raster_masks = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, dt_free_align_ptr);
+    piece->coarse_raster_masks = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, dt_free_align_ptr);
     memset(&piece->processed_roi_in, 0, sizeof(piece->processed_roi_in));
     memset(&piece->processed_roi_out, 0, sizeof(piece->processed_roi_out));
+    memset(&piece->coarse_roi_in, 0, sizeof(piece->coarse_roi_in));
+    memset(&piece->coarse_roi_out, 0, sizeof(piece->coarse_roi_out));
 
     // dsc_mask is static, single channel float image
     memset(&piece->dsc_mask, 0, sizeof(piece->dsc_mask));
@@ -1285,8 +1309,8 @@ static void collect_histogram_on_CPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev
 #define KILL_SWITCH_AND_FLUSH_CACHE                                                                               \
   if(dt_atomic_get_int(&pipe->shutdown))                                                                          \
   {                                                                                                               \
-    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), input);                                                     \
-    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);                                                   \
+    dt_dev_pixelpipe_cache_invalidate(cache, input);                                                              \
+    dt_dev_pixelpipe_cache_invalidate(cache, *output);                                                            \
     if(*cl_mem_output != NULL)                                                                                    \
     {                                                                                                             \
       dt_opencl_release_mem_object(*cl_mem_output);                                                               \
@@ -1398,7 +1422,7 @@ static dt_dev_pixelpipe_iop_t *_last_node_in_pipe(dt_dev_pixelpipe_t *pipe)
 }
 
 #ifdef HAVE_OPENCL
-static int pixelpipe_process_on_GPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
+static int pixelpipe_process_on_GPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_dev_pixelpipe_cache_t *cache,
                                     float *input, void *cl_mem_input, dt_iop_buffer_dsc_t *input_format, const dt_iop_roi_t *roi_in,
                                     void **output, void **cl_mem_output, dt_iop_buffer_dsc_t **out_format, const dt_iop_roi_t *roi_out,
                                     dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece,
@@ -1854,7 +1878,7 @@ static int pixelpipe_process_on_GPU(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
     }
 
     /* input is still only on GPU? Let's invalidate CPU input buffer then */
-    if(valid_input_on_gpu_only) dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), input);
+    if(valid_input_on_gpu_only) dt_dev_pixelpipe_cache_invalidate(cache, input);
   }
   else
   {
@@ -1975,7 +1999,7 @@ static void _print_nan_debug(dt_dev_pixelpipe_t *pipe, void *cl_mem_output, void
 }
 
 
-static int _init_base_buffer(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+static int _init_base_buffer(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_dev_pixelpipe_cache_t *cache, void **output,
                              void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
                              dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
                              const uint64_t hash,
@@ -1983,7 +2007,7 @@ static int _init_base_buffer(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void *
                              const size_t bufsize, const size_t bpp)
 {
   // Note: dt_dev_pixelpipe_cache_get actually init/alloc *output
-  if(bypass_cache || dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format))
+  if(bypass_cache || dt_dev_pixelpipe_cache_get(cache, hash, bufsize, output, out_format))
   {
     // Grab input buffer from mipmap cache.
     // We will have to copy it here and in pixelpipe cache because it can get evicted from mipmap cache
@@ -2090,9 +2114,193 @@ static int _process_masks_preview(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, d
 }
 
 
+static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
+                                        dt_dev_pixelpipe_cache_t *cache, void **output, void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
+                                        const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos);
+
+// Process the whole colour tail [pipe->bake_tail_first ; pipe->bake_tail_last] at once,
+// through a 3D LUT. `modules` and `pieces` point to the last node of the tail.
+static int _process_baked_tail(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_dev_pixelpipe_cache_t *cache,
+                               void **output, void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
+                               const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos,
+                               const uint64_t hash, const size_t bufsize)
+{
+  dt_iop_module_t *module = (dt_iop_module_t *)modules->data;
+  dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+
+  // Rewind to the node right before the tail. All tail modules are pointwise, so roi_in == roi_out.
+  GList *prev_modules = modules;
+  GList *prev_pieces = pieces;
+  int prev_pos = pos;
+  while(prev_pieces != pipe->bake_tail_first)
+  {
+    dt_dev_pixelpipe_iop_t *tail_piece = (dt_dev_pixelpipe_iop_t *)prev_pieces->data;
+    tail_piece->processed_roi_in = tail_piece->processed_roi_out = *roi_out;
+    prev_modules = g_list_previous(prev_modules);
+    prev_pieces = g_list_previous(prev_pieces);
+    prev_pos--;
+  }
+  ((dt_dev_pixelpipe_iop_t *)prev_pieces->data)->processed_roi_in = *roi_out;
+  ((dt_dev_pixelpipe_iop_t *)prev_pieces->data)->processed_roi_out = *roi_out;
+
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  dt_iop_buffer_dsc_t _input_format = { 0 };
+  dt_iop_buffer_dsc_t *input_format = &_input_format;
+
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, cache, &input, &cl_mem_input, &input_format, roi_out,
+                                  g_list_previous(prev_modules), g_list_previous(prev_pieces), prev_pos - 1))
+    return 1;
+
+#ifdef HAVE_OPENCL
+  // The LUT runs on CPU: fetch the input back from the GPU if needed
+  if(cl_mem_input != NULL)
+  {
+    cl_int err = dt_opencl_copy_device_to_host(pipe->devid, input, cl_mem_input, roi_out->width,
+                                               roi_out->height, dt_iop_buffer_dsc_to_bpp(input_format));
+    dt_opencl_finish(pipe->devid);
+    dt_opencl_release_mem_object(cl_mem_input);
+    if(err != CL_SUCCESS)
+    {
+      pipe->opencl_error = 1;
+      return 1;
+    }
+  }
+#endif
+
+  if(dt_atomic_get_int(&pipe->shutdown))
+  {
+    pipe->status = DT_DEV_PIXELPIPE_DIRTY;
+    return 1;
+  }
+
+  piece->dsc_out = piece->dsc_in = *input_format;
+  module->output_format(module, pipe, piece, &piece->dsc_out);
+
+  // reserve new cache line: output
+  (void)dt_dev_pixelpipe_cache_get(cache, hash, bufsize, output, out_format);
+
+  int in_cst = input_format->cst;
+  const int out_cst = dt_dev_lut_bake_process(pipe, pipe->bake_tail_first, pipe->bake_tail_last,
+                                              (float *)input, &in_cst, (float *)*output, roi_out);
+  input_format->cst = in_cst;
+
+  // The exact chain may have written intermediate results in the input cache line
+  dt_dev_pixelpipe_cache_invalidate(cache, input);
+
+  if(out_cst < 0) return 1;
+
+  piece->dsc_out.cst = out_cst;
+  **out_format = pipe->dsc = piece->dsc_out;
+  return 0;
+}
+
+// Process the raw stage [pipe->raw_fuse_first ; pipe->raw_fuse_last] in a single pass over the mosaic.
+// `modules` and `pieces` point to the last node of the run. If a module of the run needs its own process()
+// for its current params, nothing is written and `fallback` is set: the caller then runs the modules one by one.
+static int _process_fused_raw(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_dev_pixelpipe_cache_t *cache,
+                              void **output, void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
+                              const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos,
+                              const uint64_t hash, const size_t bufsize, const gboolean bypass_cache,
+                              gboolean *fallback)
+{
+  dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
+  *fallback = FALSE;
+
+  // Rewind to the first node of the run. Only its first module (rawprepare) may crop,
+  // the following ones have to work in place.
+  GList *first_modules = modules;
+  GList *first_pieces = pieces;
+  int first_pos = pos;
+  dt_iop_roi_t roi_in = *roi_out;
+  while(TRUE)
+  {
+    dt_dev_pixelpipe_iop_t *run_piece = (dt_dev_pixelpipe_iop_t *)first_pieces->data;
+    if(run_piece->enabled)
+    {
+      if(first_pieces != pipe->raw_fuse_first && memcmp(&run_piece->planned_roi_in, &roi_in, sizeof(dt_iop_roi_t)))
+      {
+        *fallback = TRUE;
+        return 0;
+      }
+      run_piece->processed_roi_out = roi_in;
+      roi_in = run_piece->planned_roi_in;
+      run_piece->processed_roi_in = roi_in;
+    }
+    if(first_pieces == pipe->raw_fuse_first) break;
+    first_modules = g_list_previous(first_modules);
+    first_pieces = g_list_previous(first_pieces);
+    first_pos--;
+  }
+
+  void *input = NULL;
+  void *cl_mem_input = NULL;
+  dt_iop_buffer_dsc_t _input_format = { 0 };
+  dt_iop_buffer_dsc_t *input_format = &_input_format;
+
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, cache, &input, &cl_mem_input, &input_format, &roi_in,
+                                  g_list_previous(first_modules), g_list_previous(first_pieces), first_pos - 1))
+    return 1;
+
+  KILL_SWITCH_ABORT;
+
+  // Let each module of the run fill its part of the kernel and update the buffer description,
+  // the same way process_rec() and their process() do.
+  dt_dev_raw_fuse_t fuse = { 0 };
+  dt_iop_buffer_dsc_t dsc = *input_format;
+  int count = 0;
+  for(GList *m = first_modules, *p = first_pieces; m && p; m = g_list_next(m), p = g_list_next(p))
+  {
+    dt_iop_module_t *run_module = (dt_iop_module_t *)m->data;
+    dt_dev_pixelpipe_iop_t *run_piece = (dt_dev_pixelpipe_iop_t *)p->data;
+    if(run_piece->enabled)
+    {
+      run_piece->dsc_out = run_piece->dsc_in = dsc;
+      run_module->output_format(run_module, pipe, run_piece, &run_piece->dsc_out);
+      pipe->dsc = run_piece->dsc_out;
+
+      if(!run_module->fuse_raw(run_module, run_piece, &run_piece->processed_roi_in,
+                               &run_piece->processed_roi_out, &fuse))
+      {
+        dt_print(DT_DEBUG_PIPE, "[pixelpipe] %s can't be fused in the raw stage for pipe %i\n", run_module->op,
+                 pipe->type);
+        *fallback = TRUE;
+        return 0;
+      }
+
+      dsc = run_piece->dsc_out = pipe->dsc;
+      count++;
+    }
+    if(p == pieces) break;
+  }
+
+  // reserve new cache line: output
+  (void)dt_dev_pixelpipe_cache_get(cache, hash, bufsize, output, out_format);
+
+  dt_times_t start;
+  dt_get_times(&start);
+
+  if(dt_dev_raw_fuse_process(pipe, &fuse, input, (float *)*output, &roi_in, roi_out))
+  {
+    dt_dev_pixelpipe_cache_invalidate(cache, *output);
+    return 1;
+  }
+
+  dt_show_times_f(&start, "[dev_pixelpipe]", "processed %i raw modules in one pass [%s]", count,
+                  _pipe_type_to_str(pipe->type));
+
+  if(bypass_cache || pipe->flush_cache)
+    dt_dev_pixelpipe_cache_invalidate(cache, *output);
+
+  KILL_SWITCH_AND_FLUSH_CACHE;
+
+  **out_format = pipe->dsc = piece->dsc_out;
+  return 0;
+}
+
 // recursive helper for process:
-static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
-                                        void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
+static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
+                                        dt_dev_pixelpipe_cache_t *cache, void **output, void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
                                         const dt_iop_roi_t *roi_out, GList *modules, GList *pieces, int pos)
 {
   // The pipeline is executed recursively, from the end. For each module n, starting from the end,
@@ -2114,7 +2322,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     piece = (dt_dev_pixelpipe_iop_t *)pieces->data;
     // skip this module?
     if(!piece->enabled)
-      return dt_dev_pixelpipe_process_rec(pipe, dev, output, cl_mem_output, out_format, &roi_in,
+      return dt_dev_pixelpipe_process_rec(pipe, dev, cache, output, cl_mem_output, out_format, &roi_in,
                                           g_list_previous(modules), g_list_previous(pieces), pos - 1);
   }
 
@@ -2127,13 +2335,13 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
   // 1) if cached buffer is still available, return data.
   uint64_t hash = _node_hash(pipe, piece, roi_out, pos);
   const gboolean bypass_cache = (module) ? piece->bypass_cache : FALSE;
-  if(!bypass_cache && !pipe->reentry && dt_dev_pixelpipe_cache_available(&(pipe->cache), hash))
+  if(!bypass_cache && !pipe->reentry && dt_dev_pixelpipe_cache_available(cache, hash))
   {
     if(module)
       dt_print(DT_DEBUG_PIPE, "[pixelpipe] cache available for pipe %i and module %s (%s) with hash %lu\n",
              pipe->type, module->op, module->multi_name, hash);
 
-    (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+    (void)dt_dev_pixelpipe_cache_get(cache, hash, bufsize, output, out_format);
 
     // Get the pipe-global histograms. We want float32 buffers, so we take all outputs
     // except for gamma which outputs uint8 so we need to deal with that internally
@@ -2155,7 +2363,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     dt_times_t start;
     dt_get_times(&start);
 
-    if(_init_base_buffer(pipe, dev, output, cl_mem_output, out_format, &roi_in, roi_out, hash, bypass_cache, bufsize,
+    if(_init_base_buffer(pipe, dev, cache, output, cl_mem_output, out_format, &roi_in, roi_out, hash, bypass_cache, bufsize,
                       bpp))
       return 1;
 
@@ -2163,7 +2371,24 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
     return 0;
   }
 
-  // 3b) recurse and obtain output array in &input
+  // 3b) bake the colour tail of export pipes into a single LUT
+  if(pipe->bake_tail_last && pieces == pipe->bake_tail_last)
+    return _process_baked_tail(pipe, dev, cache, output, cl_mem_output, out_format, roi_out, modules, pieces, pos,
+                               hash, bufsize);
+
+  // 3c) run the raw stage modules in a single pass over the mosaic
+  if(pipe->raw_fuse_last && pieces == pipe->raw_fuse_last)
+  {
+    gboolean fallback = FALSE;
+    const int err = _process_fused_raw(pipe, dev, cache, output, cl_mem_output, out_format, roi_out, modules, pieces,
+                                       pos, hash, bufsize, bypass_cache, &fallback);
+    if(!fallback) return err;
+
+    // run them one by one until the next pipe run
+    pipe->raw_fuse_first = pipe->raw_fuse_last = NULL;
+  }
+
+  // 3d) recurse and obtain output array in &input
   dt_print(DT_DEBUG_PIPE, "[pixelpipe] cache not available for pipe %i and module %s (%s) with hash %lu\n",
              pipe->type, module->op, module->multi_name, hash);
 
@@ -2181,7 +2406,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
   piece->processed_roi_in = roi_in;
   piece->processed_roi_out = *roi_out;
 
-  if(dt_dev_pixelpipe_process_rec(pipe, dev, &input, &cl_mem_input, &input_format, &roi_in,
+  if(dt_dev_pixelpipe_process_rec(pipe, dev, cache, &input, &cl_mem_input, &input_format, &roi_in,
                                   g_list_previous(modules), g_list_previous(pieces), pos - 1))
     return 1;
 
@@ -2194,7 +2419,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
   const size_t out_bpp = dt_iop_buffer_dsc_to_bpp(*out_format);
 
   // reserve new cache line: output
-  (void)dt_dev_pixelpipe_cache_get(&(pipe->cache), hash, bufsize, output, out_format);
+  (void)dt_dev_pixelpipe_cache_get(cache, hash, bufsize, output, out_format);
 
   dt_times_t start;
   dt_get_times(&start);
@@ -2238,7 +2463,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
 
   // Actual pixel processing for this module
 #ifdef HAVE_OPENCL
-  if (pixelpipe_process_on_GPU(pipe, dev, input, cl_mem_input, input_format, &roi_in, output, cl_mem_output, out_format, roi_out,
+  if (pixelpipe_process_on_GPU(pipe, dev, cache, input, cl_mem_input, input_format, &roi_in, output, cl_mem_output, out_format, roi_out,
                                module, piece, &tiling, &pixelpipe_flow, in_bpp, bpp))
     return 1;
 #else
@@ -2255,7 +2480,7 @@ static int dt_dev_pixelpipe_process_rec(dt_dev_pixelpipe_t *pipe, dt_develop_t *
   // Don't cache outputs if we requested to bypass the cache,
   // it's assumed to be temporary view (mask display, etc.),
   if(bypass_cache || pipe->flush_cache)
-    dt_dev_pixelpipe_cache_invalidate(&(pipe->cache), *output);
+    dt_dev_pixelpipe_cache_invalidate(cache, *output);
 
   KILL_SWITCH_AND_FLUSH_CACHE;
 
@@ -2328,7 +2553,8 @@ void dt_dev_pixelpipe_disable_before(dt_dev_pixelpipe_t *pipe, const char *op)
   }
 }
 
-static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, void **output,
+static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev,
+                                                     dt_dev_pixelpipe_cache_t *cache, void **output,
                                                      void **cl_mem_output, dt_iop_buffer_dsc_t **out_format,
                                                      const dt_iop_roi_t *roi_out, GList *modules, GList *pieces,
                                                      int pos)
@@ -2336,7 +2562,7 @@ static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, d
 #ifdef HAVE_OPENCL
   dt_opencl_check_tuning(pipe->devid);
 #endif
-  int ret = dt_dev_pixelpipe_process_rec(pipe, dev, output, cl_mem_output, out_format, roi_out, modules, pieces, pos);
+  int ret = dt_dev_pixelpipe_process_rec(pipe, dev, cache, output, cl_mem_output, out_format, roi_out, modules, pieces, pos);
 
 #ifdef HAVE_OPENCL
   // copy back final opencl buffer (if any) to CPU
@@ -2382,8 +2608,9 @@ static int dt_dev_pixelpipe_process_rec_and_backcopy(dt_dev_pixelpipe_t *pipe, d
     return 1;                                                                                                     \
   }
 
-int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width, int height,
-                             float scale)
+// process the pipe through `cache`, which is either the main cache or the coarse cache of the pipe
+static int _pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, dt_dev_pixelpipe_cache_t *cache,
+                              int x, int y, int width, int height, float scale)
 {
   KILL_SWITCH_PIPE
 
@@ -2405,7 +2632,7 @@ int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x,
 
   dt_iop_roi_t roi = (dt_iop_roi_t){ x, y, width, height, scale };
   // printf("pixelpipe homebrew process start\n");
-  if(darktable.unmuted & DT_DEBUG_DEV) dt_dev_pixelpipe_cache_print(&pipe->cache);
+  if(darktable.unmuted & DT_DEBUG_DEV) dt_dev_pixelpipe_cache_print(cache);
 
   // get a snapshot of mask list
   if(pipe->forms) g_list_free_full(pipe->forms, (void (*)(void *))dt_masks_free_form);
@@ -2433,11 +2660,17 @@ restart:;
   dt_dev_pixelpipe_get_roi_in(pipe, dev, roi);
   dt_pixelpipe_get_global_hash(pipe, dev);
 
+  // Look for a colour tail to bake into a 3D LUT (export only, opt-in)
+  dt_dev_lut_bake_find_tail(pipe, &pipe->bake_tail_first, &pipe->bake_tail_last);
+
+  // Look for raw stage modules to run in a single pass (CPU only)
+  dt_dev_raw_fuse_find(pipe, &pipe->raw_fuse_first, &pipe->raw_fuse_last);
+
   KILL_SWITCH_PIPE
 
   // run pixelpipe recursively and get error status
   const int err =
-    dt_dev_pixelpipe_process_rec_and_backcopy(pipe, dev, &buf, &cl_mem_out, &out_format, &roi, modules,
+    dt_dev_pixelpipe_process_rec_and_backcopy(pipe, dev, cache, &buf, &cl_mem_out, &out_format, &roi, modules,
                                               pieces, pos);
 
   // get status summary of opencl queue by checking the eventlist
@@ -2535,9 +2768,74 @@ restart:;
   return 0;
 }
 
+int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width, int height,
+                             float scale)
+{
+  return _pixelpipe_process(pipe, dev, &pipe->cache, x, y, width, height, scale);
+}
+
+// Exchange the raster masks and processed ROIs of the full passes with the ones of the coarse passes.
+// Modules served from a cache don't rewrite them, so each pass has to find its own from its previous run,
+// otherwise the full pass would distort full-size masks through 1/factor ROIs, or the other way around.
+static void _pixelpipe_swap_coarse_state(dt_dev_pixelpipe_t *pipe)
+{
+  for(GList *nodes = pipe->nodes; nodes; nodes = g_list_next(nodes))
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)nodes->data;
+
+    GHashTable *masks = piece->raster_masks;
+    piece->raster_masks = piece->coarse_raster_masks;
+    piece->coarse_raster_masks = masks;
+
+    const dt_iop_roi_t roi_in = piece->processed_roi_in;
+    const dt_iop_roi_t roi_out = piece->processed_roi_out;
+    piece->processed_roi_in = piece->coarse_roi_in;
+    piece->processed_roi_out = piece->coarse_roi_out;
+    piece->coarse_roi_in = roi_in;
+    piece->coarse_roi_out = roi_out;
+  }
+}
+
+int dt_dev_pixelpipe_process_coarse(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x, int y, int width,
+                                    int height, float scale, int factor)
+{
+  if(factor < 2 || pipe->coarse_cache.entries == 0) return 1;
+
+  // Histograms are not collected on coarse passes: they would replace the full-resolution ones
+  // of modules the full pass then serves from its cache.
+  const int nodes = g_list_length(pipe->nodes);
+  dt_dev_request_flags_t *requests = malloc(sizeof(dt_dev_request_flags_t) * MAX(nodes, 1));
+  if(requests == NULL) return 1;
+
+  int k = 0;
+  for(GList *node = pipe->nodes; node; node = g_list_next(node), k++)
+  {
+    dt_dev_pixelpipe_iop_t *piece = (dt_dev_pixelpipe_iop_t *)node->data;
+    requests[k] = piece->request_histogram;
+    piece->request_histogram = DT_REQUEST_NONE;
+  }
+
+  _pixelpipe_swap_coarse_state(pipe);
+
+  // Process the downscaled ROI into the coarse cache, so the full-resolution
+  // cache lines of the previous runs stay available to the full pass that follows.
+  const int ret = _pixelpipe_process(pipe, dev, &pipe->coarse_cache, x / factor, y / factor, width / factor,
+                                     height / factor, scale / (float)factor);
+
+  _pixelpipe_swap_coarse_state(pipe);
+
+  k = 0;
+  for(GList *node = pipe->nodes; node; node = g_list_next(node), k++)
+    ((dt_dev_pixelpipe_iop_t *)node->data)->request_histogram = requests[k];
+  free(requests);
+
+  return ret;
+}
+
 void dt_dev_pixelpipe_flush_caches(dt_dev_pixelpipe_t *pipe)
 {
   dt_dev_pixelpipe_cache_flush(&pipe->cache);
+  if(pipe->coarse_cache.entries) dt_dev_pixelpipe_cache_flush(&pipe->coarse_cache);
 }
 
 gboolean dt_dev_pixelpipe_activemodule_disables_currentmodule(struct dt_develop_t *dev, struct dt_iop_module_t *current_module)
@@ -97,6 +97,12 @@ typedef struct dt_dev_pixelpipe_iop_t
   gboolean bypass_cache;
 
   GHashTable *raster_masks; // GList* of dt_dev_pixelpipe_raster_mask_t
+
+  // state of the coarse passes of progressive rendering, swapped with the one above
+  // for the duration of a coarse pass so both passes keep their own masks and ROIs
+  // across cache hits
+  GHashTable *coarse_raster_masks;
+  dt_iop_roi_t coarse_roi_in, coarse_roi_out;
 } dt_dev_pixelpipe_iop_t;
 
 typedef enum dt_dev_pixelpipe_change_t
@@ -128,6 +134,10 @@ typedef struct dt_dev_pixelpipe_t
   // store history/zoom caches
   dt_dev_pixelpipe_cache_t cache;
 
+  // separate cache used by the coarse passes of progressive rendering,
+  // so they don't evict the full-resolution cache lines. Empty if unused.
+  dt_dev_pixelpipe_cache_t coarse_cache;
+
   // input image. Will be fetched directly from mipmap cache
   int32_t imgid;
   dt_mipmap_size_t size;
@@ -161,6 +171,9 @@ typedef struct dt_dev_pixelpipe_t
   size_t backbuf_size;
   int backbuf_width, backbuf_height;
   float backbuf_scale;
+  // the backbuffer is downscaled by this factor from backbuf_scale:
+  // 1 for full passes, the coarse factor for the coarse passes of progressive rendering
+  int backbuf_factor;
   float backbuf_zoom_x, backbuf_zoom_y;
   uint64_t backbuf_hash;
   dt_pthread_mutex_t backbuf_mutex, busy_mutex;
@@ -181,6 +194,9 @@ typedef struct dt_dev_pixelpipe_t
   int running;
   // shutting down?
   dt_atomic_int shutdown;
+  // time at which the kill-switch was last raised, in ms since startup, to measure restart latency.
+  // 0 if none pending. Atomic because it is raised from the GUI thread and reset by the pipe thread.
+  dt_atomic_int shutdown_time;
   // opencl enabled for this pixelpipe?
   int opencl_enabled;
   // opencl error detected?
@@ -191,6 +207,9 @@ typedef struct dt_dev_pixelpipe_t
   int mask_display;
   // should this pixelpipe completely suppressed the blendif module?
   int bypass_blendif;
+  // draft thumbnail: demosaic bins the raw instead of interpolating it,
+  // and modules flagged IOP_FLAGS_SKIP_IN_DRAFT are bypassed
+  gboolean draft;
   // input data based on this timestamp:
   int input_timestamp;
   dt_dev_pixelpipe_type_t type;
@@ -236,6 +255,16 @@ typedef struct dt_dev_pixelpipe_t
   // whether on success or on error.
   gboolean flush_cache;
 
+  // Colour tail of export pipes baked into a 3D LUT, as links of `nodes`.
+  // NULL if not applicable. See develop/lut_bake.h
+  GList *bake_tail_first;
+  GList *bake_tail_last;
+
+  // Raw stage modules run as a single pass over the mosaic, as links of `nodes`.
+  // NULL if not applicable. See develop/raw_fuse.h
+  GList *raw_fuse_first;
+  GList *raw_fuse_last;
+
 } dt_dev_pixelpipe_t;
 
 struct dt_develop_t;
@@ -297,9 +326,26 @@ void dt_dev_pixelpipe_synch_all_real(dt_dev_pixelpipe_t *pipe, struct dt_develop
 // adjust output node according to history stack (history pop event)
 void dt_dev_pixelpipe_synch_top(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev);
 
+/** raise the kill-switch: the pipe will stop processing at the next module boundary or cancellation checkpoint */
+static inline void dt_dev_pixelpipe_cancel(dt_dev_pixelpipe_t *pipe)
+{
+  dt_atomic_set_int(&pipe->shutdown_time, MAX(1, (int)((dt_get_wtime() - darktable.start_wtime) * 1000.)));
+  dt_atomic_set_int(&pipe->shutdown, TRUE);
+}
+
+/** cancellation checkpoint for long process() loops: when TRUE, return early, the pipe discards the output. */
+static inline gboolean dt_dev_pixelpipe_is_cancelled(dt_dev_pixelpipe_t *pipe)
+{
+  return pipe && dt_atomic_get_int(&pipe->shutdown);
+}
+
 // process region of interest of pixels. returns 1 if pipe was altered during processing.
 int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y, int width,
                              int height, float scale);
+// process a coarse version of the region of interest, downscaled by `factor`,
+// in the separate coarse cache. Used to show something quickly before the full process.
+int dt_dev_pixelpipe_process_coarse(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y, int width,
+                                    int height, float scale, int factor);
 // convenience method that does not gamma-compress the image.
 int dt_dev_pixelpipe_process_no_gamma(dt_dev_pixelpipe_t *pipe, struct dt_develop_t *dev, int x, int y,
                                       int width, int height, float scale);
@@ -0,0 +1,310 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "develop/raw_fuse.h"
+#include "common/darktable.h"
+#include "control/conf.h"
+#include "develop/blend.h"
+#include "develop/imageop.h"
+#include "develop/imageop_math.h"
+#include "develop/pixelpipe_hb.h"
+
+#include <string.h>
+
+// hot pixels are replaced from rows up to 2 above and below
+#define DT_RAW_FUSE_RING 5
+
+// rows per thread job: small enough to balance threads, large enough to amortize the 4 halo rows
+#define DT_RAW_FUSE_STRIP 32
+
+// the stages of the fused kernel, in the order it runs them
+static const char *_stages[] = { "rawprepare", "temperature", "highlights", "hotpixels" };
+
+
+static int _stage(const dt_iop_module_t *const module)
+{
+  for(int k = 0; k < G_N_ELEMENTS(_stages); k++)
+    if(!strcmp(module->op, _stages[k])) return k;
+  return -1;
+}
+
+static gboolean _piece_is_fusable(const dt_dev_pixelpipe_iop_t *const piece)
+{
+  const dt_iop_module_t *const module = piece->module;
+  if(!module->fuse_raw) return FALSE;
+
+  // the picker and the histogram need the output of this very module
+  if(module->request_color_pick != DT_REQUEST_COLORPICK_OFF) return FALSE;
+  if(piece->request_histogram & DT_REQUEST_ON) return FALSE;
+
+  const dt_develop_blend_params_t *const bp = (const dt_develop_blend_params_t *)piece->blendop_data;
+  if(bp && bp->mask_mode != DEVELOP_MASK_DISABLED) return FALSE;
+
+  return TRUE;
+}
+
+gboolean dt_dev_raw_fuse_find(dt_dev_pixelpipe_t *pipe, GList **first, GList **last)
+{
+  *first = *last = NULL;
+
+  // the fused kernel runs on the CPU, and only pays off against the CPU path of the modules
+  if(pipe->devid >= 0) return FALSE;
+  if(pipe->mask_display != DT_DEV_PIXELPIPE_DISPLAY_NONE) return FALSE;
+  if(!pipe->image.buf_dsc.filters) return FALSE;
+  if(!dt_conf_get_bool("pixelpipe_fuse_raw_stage")) return FALSE;
+
+  // Walk from the start of the pipe as long as enabled modules are stages of the kernel, in its order.
+  // Disabled modules are skipped by the pipe anyway.
+  int stage = -1;
+  int count = 0;
+  for(GList *node = pipe->nodes; node; node = g_list_next(node))
+  {
+    const dt_dev_pixelpipe_iop_t *const piece = (const dt_dev_pixelpipe_iop_t *)node->data;
+    if(!piece->enabled) continue;
+
+    const int next = _stage(piece->module);
+    if(next < 0 || next <= stage || (stage < 0 && next != 0) || !_piece_is_fusable(piece)) break;
+
+    if(!*first) *first = node;
+    *last = node;
+    stage = next;
+    count++;
+  }
+
+  // rawprepare alone is already a single pass
+  if(count < 2)
+  {
+    *first = *last = NULL;
+    return FALSE;
+  }
+  return TRUE;
+}
+
+
+// Normalize, white balance and clip one row of the output
+static void _fuse_row(const dt_dev_raw_fuse_t *const fuse, const void *const input, float *const out,
+                      const int row, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out,
+                      const uint32_t filters, const uint8_t (*const xtrans)[6])
+{
+  // black levels and colours repeat every 2 sensels on Bayer rows, every 6 on X-Trans rows
+  const int period = (filters == 9u) ? 6 : 2;
+  float sub[6], div[6], wb[6];
+  for(int k = 0; k < period; k++)
+  {
+    const int bl = (((row + roi_out->y + fuse->black_y) & 1) << 1) + ((k + roi_out->x + fuse->black_x) & 1);
+    sub[k] = fuse->sub[bl];
+    div[k] = fuse->div[bl];
+
+    const int c = (filters == 9u) ? FCxtrans(row, k, roi_out, xtrans)
+                                  : FC(row + roi_out->y, k + roi_out->x, filters);
+    wb[k] = fuse->white_balance ? fuse->wb[c] : 1.0f;
+  }
+
+  const float clip = fuse->clip_highlights ? fuse->clip : INFINITY;
+  const size_t offset = (size_t)roi_in->width * (row + fuse->crop_y) + fuse->crop_x;
+
+  if(fuse->input_is_uint16)
+  {
+    const uint16_t *const in = (const uint16_t *const)input + offset;
+    for(int i = 0; i < roi_out->width; i++)
+    {
+      const int k = i % period;
+      out[i] = MIN(clip, (in[i] - sub[k]) / div[k] * wb[k]);
+    }
+  }
+  else
+  {
+    const float *const in = (const float *const)input + offset;
+    for(int i = 0; i < roi_out->width; i++)
+    {
+      const int k = i % period;
+      out[i] = MIN(clip, (in[i] - sub[k]) / div[k] * wb[k]);
+    }
+  }
+}
+
+// Offsets (x, y) of the 4 nearest sensels of the same colour, for each position in the 6x6 CFA period.
+// Same as process_bayer() and process_xtrans() in iop/hotpixels.c
+static void _hotpixels_offsets(int offsets[6][6][4][2], const dt_iop_roi_t *const roi_out, const uint32_t filters,
+                               const uint8_t (*const xtrans)[6])
+{
+  const int bayer[4][2] = { { -2, 0 }, { 0, -2 }, { 2, 0 }, { 0, 2 } };
+  const int search[20][2] = { { -1, 0 },  { 1, 0 },   { 0, -1 },  { 0, 1 },  { -1, -1 }, { -1, 1 }, { 1, -1 },
+                              { 1, 1 },   { -2, 0 },  { 2, 0 },   { 0, -2 }, { 0, 2 },   { -2, -1 }, { -2, 1 },
+                              { 2, -1 },  { 2, 1 },   { -1, -2 }, { 1, -2 }, { -1, 2 },  { 1, 2 } };
+
+  for(int j = 0; j < 6; ++j)
+    for(int i = 0; i < 6; ++i)
+    {
+      if(filters != 9u)
+      {
+        memcpy(offsets[j][i], bayer, sizeof(bayer));
+        continue;
+      }
+
+      const uint8_t c = FCxtrans(j, i, roi_out, xtrans);
+      for(int s = 0, found = 0; s < 20 && found < 4; ++s)
+      {
+        if(c == FCxtrans(j + search[s][1], i + search[s][0], roi_out, xtrans))
+        {
+          offsets[j][i][found][0] = search[s][0];
+          offsets[j][i][found][1] = search[s][1];
+          ++found;
+        }
+      }
+    }
+}
+
+// Hot pixels of one row: `rows` points to the normalized rows from row - 2 to row + 2,
+// `out` already holds a copy of rows[2]
+static int _hotpixels_row(const dt_dev_raw_fuse_t *const fuse, const float *const rows[DT_RAW_FUSE_RING],
+                          float *const out, const int row, const int width, const int offsets[6][6][4][2],
+                          const dt_iop_roi_t *const roi_out, const uint32_t filters,
+                          const uint8_t (*const xtrans)[6])
+{
+  const float *const in = rows[2];
+  int fixed = 0;
+
+  for(int col = 2; col < width - 2; col++)
+  {
+    if(in[col] <= fuse->hot_threshold) continue;
+
+    const float mid = in[col] * fuse->hot_multiplier;
+    int count = 0;
+    float maxin = 0.0f;
+    for(int n = 0; n < 4; n++)
+    {
+      const int xx = offsets[row % 6][col % 6][n][0];
+      const int yy = offsets[row % 6][col % 6][n][1];
+      const float other = rows[2 + yy][col + xx];
+      if(mid > other)
+      {
+        count++;
+        if(other > maxin) maxin = other;
+      }
+    }
+
+    if(count < fuse->hot_min_neighbours) continue;
+
+    out[col] = maxin;
+    fixed++;
+
+    if(!fuse->hot_markfixed) continue;
+
+    if(filters != 9u)
+    {
+      for(int i = -2; i >= -10 && i >= -col; i -= 2) out[col + i] = in[col];
+      for(int i = 2; i <= 10 && i < width - col; i += 2) out[col + i] = in[col];
+    }
+    else
+    {
+      const uint8_t c = FCxtrans(row, col, roi_out, xtrans);
+      for(int i = -2; i >= -10 && i >= -col; --i)
+        if(c == FCxtrans(row, col + i, roi_out, xtrans)) out[col + i] = in[col];
+      for(int i = 2; i <= 10 && i < width - col; ++i)
+        if(c == FCxtrans(row, col + i, roi_out, xtrans)) out[col + i] = in[col];
+    }
+  }
+
+  return fixed;
+}
+
+int dt_dev_raw_fuse_process(dt_dev_pixelpipe_t *pipe, const dt_dev_raw_fuse_t *const fuse,
+                            const void *const input, float *const output,
+                            const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  const uint32_t filters = pipe->dsc.filters;
+  const uint8_t(*const xtrans)[6] = (const uint8_t(*const)[6])pipe->dsc.xtrans;
+  const int width = roi_out->width;
+  const int height = roi_out->height;
+
+  if(!fuse->hotpixels)
+  {
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+    dt_omp_firstprivate(filters, fuse, height, input, output, roi_in, roi_out, width, xtrans) \
+    schedule(static)
+#endif
+    for(int row = 0; row < height; row++)
+      _fuse_row(fuse, input, output + (size_t)row * width, row, roi_in, roi_out, filters, xtrans);
+    return 0;
+  }
+
+  int offsets[6][6][4][2];
+  _hotpixels_offsets(offsets, roi_out, filters, xtrans);
+
+  // each thread keeps the normalized rows from row - 2 to row + 2 in a ring
+  size_t padded_size;
+  float *const ring = dt_alloc_perthread_float((size_t)DT_RAW_FUSE_RING * width, &padded_size);
+  if(!ring) return 1;
+
+  const int strips = (height + DT_RAW_FUSE_STRIP - 1) / DT_RAW_FUSE_STRIP;
+  int fixed = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+    dt_omp_firstprivate(filters, fuse, height, input, output, padded_size, ring, roi_in, roi_out, strips, \
+                        width, xtrans) \
+    shared(offsets) \
+    reduction(+ : fixed) \
+    schedule(static)
+#endif
+  for(int strip = 0; strip < strips; strip++)
+  {
+    float *const buf = dt_get_perthread(ring, padded_size);
+    const int start = strip * DT_RAW_FUSE_STRIP;
+    const int end = MIN(start + DT_RAW_FUSE_STRIP, height);
+
+    for(int row = MAX(start - 2, 0); row < MIN(start + 2, height); row++)
+      _fuse_row(fuse, input, buf + (size_t)(row % DT_RAW_FUSE_RING) * width, row, roi_in, roi_out, filters,
+                xtrans);
+
+    for(int row = start; row < end; row++)
+    {
+      if(row + 2 < height)
+        _fuse_row(fuse, input, buf + (size_t)((row + 2) % DT_RAW_FUSE_RING) * width, row + 2, roi_in, roi_out,
+                  filters, xtrans);
+
+      float *const out = output + (size_t)row * width;
+      memcpy(out, buf + (size_t)(row % DT_RAW_FUSE_RING) * width, sizeof(float) * width);
+
+      // like iop/hotpixels.c, the 2 sensels on the borders are left as they are
+      if(row < 2 || row >= height - 2) continue;
+
+      const float *rows[DT_RAW_FUSE_RING];
+      for(int k = 0; k < DT_RAW_FUSE_RING; k++)
+        rows[k] = buf + (size_t)((row - 2 + k) % DT_RAW_FUSE_RING) * width;
+
+      fixed += _hotpixels_row(fuse, rows, out, row, width, (const int(*)[6][4][2])offsets, roi_out, filters,
+                              xtrans);
+    }
+  }
+
+  dt_free_align(ring);
+  if(fuse->hot_fixed) *fuse->hot_fixed = fixed;
+  return 0;
+}
+
+#undef DT_RAW_FUSE_STRIP
+#undef DT_RAW_FUSE_RING
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
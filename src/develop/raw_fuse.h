@@ -0,0 +1,88 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <glib.h>
+#include <stdint.h>
+
+struct dt_dev_pixelpipe_t;
+struct dt_iop_roi_t;
+
+/**
+ * Fused raw stage.
+ *
+ * Before demosaicing, rawprepare, temperature, highlights and hotpixels each read and write the whole
+ * mosaic, for a few arithmetic operations per sensel. When they run in a row on the CPU, the pipe runs them
+ * as a single pass over the CFA instead: black/white normalization, white balance and clipping are applied
+ * per sensel, and hot pixels are detected on a ring of 5 normalized rows that stays in cache.
+ *
+ * Modules take part through their `fuse_raw()` hook, which fills their part of dt_dev_raw_fuse_t from
+ * their committed params and applies the side effects their process() has on `pipe->dsc`. The output is
+ * the same as running the modules one by one, only their intermediate outputs are not cached.
+ *
+ * The stages always run in the order above, so the fused run is cut where the pipe order differs, and at
+ * the first module using blending, a color picker, a histogram or a mode that needs its full process().
+ *
+ * Enabled through `pixelpipe_fuse_raw_stage`, off by default. tests/unittests/develop/test_raw_fuse.c checks the
+ * output against the modules' own process().
+ */
+
+typedef struct dt_dev_raw_fuse_t
+{
+  // rawprepare: out = (in - sub[k]) / div[k], where k is the position in the 2x2 black level pattern,
+  // shifted by (black_x, black_y), and in is read at an offset of (crop_x, crop_y)
+  gboolean input_is_uint16;
+  int crop_x, crop_y;
+  int black_x, black_y;
+  float sub[4];
+  float div[4];
+
+  // temperature: out *= wb[color of the sensel]
+  gboolean white_balance;
+  float wb[4];
+
+  // highlights: out = MIN(out, clip)
+  gboolean clip_highlights;
+  float clip;
+
+  // hotpixels, see iop/hotpixels.c
+  gboolean hotpixels;
+  float hot_threshold;
+  float hot_multiplier;
+  int hot_min_neighbours;
+  gboolean hot_markfixed;
+  int *hot_fixed; // if not NULL, receives the number of fixed sensels
+} dt_dev_raw_fuse_t;
+
+/** find the run of nodes of the pipe that can be fused, starting at rawprepare.
+ * `first` and `last` are links of `pipe->nodes`. Returns FALSE if less than 2 modules can be fused. */
+gboolean dt_dev_raw_fuse_find(struct dt_dev_pixelpipe_t *pipe, GList **first, GList **last);
+
+/** run the fused stage from the raw `input` (uint16 or float) to `output`, using the CFA layout
+ * found in `pipe->dsc` once all the `fuse_raw()` hooks of the run have been called.
+ * Returns 0 on success, 1 if out of memory. */
+int dt_dev_raw_fuse_process(struct dt_dev_pixelpipe_t *pipe, const dt_dev_raw_fuse_t *const fuse,
+                            const void *const input, float *const output,
+                            const struct dt_iop_roi_t *const roi_in, const struct dt_iop_roi_t *const roi_out);
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
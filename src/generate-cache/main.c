@@ -45,7 +45,126 @@
 #include "win/main_wrapper.h"
 #endif
 
-static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mipmap_size_t max_mip, const int32_t min_imgid, const int32_t max_imgid)
+// state of the image of the history_hash table, as far as thumbnails are concerned
+typedef enum _image_state_t
+{
+  _IMAGE_UNKNOWN = 0, // no history hash: the disk cache tells if thumbnails are there
+  _IMAGE_SYNCED = 1,  // thumbnails were generated from the current history
+  _IMAGE_STALE = 2,   // history changed since thumbnails were generated
+} _image_state_t;
+
+typedef struct _generate_t
+{
+  dt_mipmap_size_t min_mip;
+  dt_mipmap_size_t max_mip;
+
+  // images to visit, and their _image_state_t
+  GArray *imgids;
+  GArray *states;
+
+  // next image to visit, shared by workers
+  gint next;
+
+  // OpenMP threads of each worker
+  int threads_per_worker;
+
+  // summary
+  gint generated;
+  gint skipped;
+  gint failed;
+} _generate_t;
+
+// returns 1 if thumbnails were generated, 0 if they were all on disk already, -1 on error
+static int _generate_image(const _generate_t *g, const int32_t imgid, const _image_state_t state)
+{
+  gboolean missing[DT_MIPMAP_F] = { FALSE };
+  gboolean any_missing = FALSE;
+
+  if(state == _IMAGE_STALE)
+  {
+    // thumbnails on disk are outdated: drop them all
+    dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+    for(int k = g->min_mip; k <= g->max_mip; k++) missing[k] = TRUE;
+    any_missing = TRUE;
+  }
+  else
+  {
+    for(int k = g->min_mip; k <= g->max_mip; k++)
+    {
+      missing[k] = !dt_mipmap_cache_has_disk_thumbnail(darktable.mipmap_cache, imgid, k);
+      any_missing |= missing[k];
+    }
+  }
+
+  if(!any_missing) return 0;
+
+  // Hold the largest size while the smaller ones are computed: they will be downsampled from it
+  // instead of running the pipeline again. If it's already on disk, it is simply loaded from there.
+  dt_mipmap_buffer_t largest;
+  dt_mipmap_cache_get(darktable.mipmap_cache, &largest, imgid, g->max_mip, DT_MIPMAP_BLOCKING, 'r');
+  // failed images get an 8×8 skull
+  const gboolean ok = largest.buf && largest.width > 8 && largest.height > 8;
+
+  if(ok)
+  {
+    for(int k = g->max_mip - 1; k >= (int)g->min_mip; k--)
+    {
+      if(!missing[k]) continue;
+      dt_mipmap_buffer_t buf;
+      dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, k, DT_MIPMAP_BLOCKING, 'r');
+      dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
+    }
+  }
+  dt_mipmap_cache_release(darktable.mipmap_cache, &largest);
+
+  // and immediately write thumbs to disc and remove from mipmap cache, so memory use doesn't grow
+  dt_mimap_cache_evict(darktable.mipmap_cache, imgid);
+
+  if(!ok) return -1;
+
+  // thumbnail in sync with image
+  dt_history_hash_set_mipmap(imgid);
+  return 1;
+}
+
+static void *_generate_worker(void *data)
+{
+  _generate_t *g = (_generate_t *)data;
+#ifdef _OPENMP // need to do this in every thread
+  // Only this worker's parallel sections are narrowed. darktable.num_openmp_threads is left alone:
+  // the per-thread buffers of the pipeline are sized from it, which covers the thread numbers of
+  // any worker.
+  omp_set_num_threads(g->threads_per_worker);
+#endif
+  dt_pthread_setname("generate-cache");
+  const guint count = g->imgids->len;
+
+  guint i;
+  while((i = g_atomic_int_add(&g->next, 1)) < count)
+  {
+    const int32_t imgid = g_array_index(g->imgids, int32_t, i);
+    const _image_state_t state = g_array_index(g->states, _image_state_t, i);
+    const int res = _generate_image(g, imgid, state);
+
+    if(res > 0)
+    {
+      g_atomic_int_inc(&g->generated);
+      fprintf(stderr, "image %u/%u (%.02f%%) (id:%d) generated\n", i + 1, count, 100.0 * (i + 1) / (float)count,
+              imgid);
+    }
+    else if(res == 0)
+      g_atomic_int_inc(&g->skipped);
+    else
+    {
+      g_atomic_int_inc(&g->failed);
+      fprintf(stderr, _("warning: could not generate thumbnails for image %d\n"), imgid);
+    }
+  }
+  return NULL;
+}
+
+static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mipmap_size_t max_mip,
+                                    const int32_t min_imgid, const int32_t max_imgid, const int threads)
 {
   fprintf(stderr, _("creating cache directories\n"));
   for(dt_mipmap_size_t k = min_mip; k <= max_mip; k++)
@@ -61,23 +180,45 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
     }
   }
 
-  // some progress counter
+  _generate_t g = { .min_mip = min_mip,
+                    .max_mip = max_mip,
+                    .imgids = g_array_new(FALSE, FALSE, sizeof(int32_t)),
+                    .states = g_array_new(FALSE, FALSE, sizeof(_image_state_t)),
+                    .next = 0,
+                    .generated = 0,
+                    .skipped = 0,
+                    .failed = 0 };
+
+  // list all images with the state of their thumbnails, from the history hashes.
+  // Only a few bytes per image are kept, so memory stays low even for large libraries.
   sqlite3_stmt *stmt;
-  size_t image_count = 0, counter = 0;
+  // clang-format off
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT COUNT(*) FROM main.images WHERE id >= ?1 AND id <= ?2", -1, &stmt, 0);
+                              "SELECT i.id,"
+                              "  CASE"
+                              "    WHEN h.imgid IS NULL THEN 0"
+                              "    WHEN h.mipmap_hash IS h.current_hash THEN 1"
+                              "    ELSE 2 END"
+                              " FROM main.images AS i"
+                              " LEFT JOIN main.history_hash AS h ON h.imgid = i.id"
+                              " WHERE i.id >= ?1 AND i.id <= ?2"
+                              " ORDER BY i.id",
+                              -1, &stmt, 0);
+  // clang-format on
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, min_imgid);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_imgid);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    image_count = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
-  }
-  else
+  size_t stale = 0;
+  while(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    return 1;
+    const int32_t imgid = sqlite3_column_int(stmt, 0);
+    const _image_state_t state = sqlite3_column_int(stmt, 1);
+    g_array_append_val(g.imgids, imgid);
+    g_array_append_val(g.states, state);
+    if(state == _IMAGE_STALE) stale++;
   }
+  sqlite3_finalize(stmt);
 
+  const size_t image_count = g.imgids->len;
   if(!image_count)
   {
     fprintf(stderr, _("warning: no images are matching the requested image id range\n"));
@@ -86,41 +227,44 @@ static int generate_thumbnail_cache(const dt_mipmap_size_t min_mip, const dt_mip
       fprintf(stderr, _("warning: did you want to swap these boundaries?\n"));
     }
   }
-
-  // go through all images:
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id, filename FROM main.images WHERE id >= ?1 AND id <= ?2", -1, &stmt, 0);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, min_imgid);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, max_imgid);
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  else
   {
-    const int32_t imgid = sqlite3_column_int(stmt, 0);
-    const char *imgfilename = (const char*)sqlite3_column_text(stmt, 1);
-
-    counter++;
-    fprintf(stderr, "image %zu/%zu (%.02f%%) (id:%d, file=%s)\n", counter, image_count, 100.0 * counter / (float)image_count, imgid, imgfilename);
+    fprintf(stderr, _("%zu images, %zu with an edited history since their thumbnails were generated\n"),
+            image_count, stale);
+  }
 
-    for(int k = max_mip; k >= min_mip && k >= 0; k--)
-    {
-      char filename[PATH_MAX] = { 0 };
-      snprintf(filename, sizeof(filename), "%s.d/%d/%d.jpg", darktable.mipmap_cache->cachedir, k, imgid);
+  // Every worker holds only one image at a time, evicted from the memory cache once written.
+  // The CPU cores are shared between workers for the OpenMP sections of the pipeline.
+  const int workers = CLAMP(threads, 1, MAX((int)image_count, 1));
+  g.threads_per_worker = MAX(1, darktable.num_openmp_threads / workers);
+  fprintf(stderr, _("using %d worker threads, %d threads each\n"), workers, g.threads_per_worker);
 
-      // if a valid thumbnail file is already on disc - do nothing
-      if(dt_util_test_image_file(filename)) continue;
+  const double start = dt_get_wtime();
 
-      // else, generate thumbnail and store in mipmap cache.
-      dt_mipmap_buffer_t buf;
-      dt_mipmap_cache_get(darktable.mipmap_cache, &buf, imgid, k, DT_MIPMAP_BLOCKING, 'r');
-      dt_mipmap_cache_release(darktable.mipmap_cache, &buf);
-    }
+  pthread_t *thread = malloc(sizeof(pthread_t) * workers);
+  int started = 0;
+  for(int k = 0; k < workers; k++)
+    if(!dt_pthread_create(&thread[started], _generate_worker, &g)) started++;
 
-    // and immediately write thumbs to disc and remove from mipmap cache.
-    dt_mimap_cache_evict(darktable.mipmap_cache, imgid);
-    // thumbnail in sync with image
-    dt_history_hash_set_mipmap(imgid);
+  // the main thread does the job alone, with all the cores, if no thread could be started
+  if(!started)
+  {
+    g.threads_per_worker = darktable.num_openmp_threads;
+    _generate_worker(&g);
   }
+  for(int k = 0; k < started; k++) pthread_join(thread[k], NULL);
+  free(thread);
 
-  sqlite3_finalize(stmt);
+  const double elapsed = dt_get_wtime() - start;
+
+  g_array_free(g.imgids, TRUE);
+  g_array_free(g.states, TRUE);
+
+  // reclaim the space of the thumbnails replaced in the pack files
+  dt_mipmap_cache_compact_disk(darktable.mipmap_cache);
+
+  fprintf(stderr, _("%d generated, %d skipped, %d failed in %.1f s (%.2f images/s)\n"), g.generated, g.skipped,
+          g.failed, elapsed, elapsed > 0.0 ? g.generated / elapsed : 0.0);
   fprintf(stderr, "done\n");
 
   return 0;
@@ -132,13 +276,19 @@ static void usage(const char *progname)
           "usage: %s [-h, --help; --version]\n"
           "  [--min-mip <0-8> (default = 0)] [-m, --max-mip <0-8> (default = 2)]\n"
           "  [--min-imgid <N>] [--max-imgid <N>]\n"
+          "  [-j, --threads <N> (default = number of CPU cores / 4)]\n"
           "  [--core <darktable options>]\n"
           "\n"
           "When multiple mipmap sizes are requested, the biggest one is computed\n"
           "while the rest are quickly downsampled.\n"
           "\n"
           "The --min-imgid and --max-imgid specify the range of internal image ID\n"
-          "numbers to work on.\n",
+          "numbers to work on.\n"
+          "\n"
+          "Images whose history didn't change since their thumbnails were\n"
+          "generated are skipped if their thumbnails are on disk.\n"
+          "Images are processed by --threads workers in parallel, sharing\n"
+          "the CPU cores between their pipelines.\n",
           progname);
 }
 
@@ -164,6 +314,7 @@ int main(int argc, char *arg[])
   dt_mipmap_size_t max_mip = DT_MIPMAP_2;
   int32_t min_imgid = UNKNOWN_IMAGE;
   int32_t max_imgid = INT32_MAX;
+  int threads = MAX(1, g_get_num_processors() / 4);
 
   int k;
   for(k = 1; k < argc; k++)
@@ -199,6 +350,11 @@ int main(int argc, char *arg[])
       k++;
       max_imgid = (int32_t)MIN(MAX(atoi(arg[k]), 0), INT32_MAX);
     }
+    else if((!strcmp(arg[k], "-j") || !strcmp(arg[k], "--threads")) && argc > k + 1)
+    {
+      k++;
+      threads = MAX(atoi(arg[k]), 1);
+    }
     else if(!strcmp(arg[k], "--core"))
     {
       // everything from here on should be passed to the core
@@ -241,7 +397,7 @@ int main(int argc, char *arg[])
 
   fprintf(stderr, _("creating complete lighttable thumbnail cache\n"));
 
-  if(generate_thumbnail_cache(min_mip, max_mip, min_imgid, max_imgid))
+  if(generate_thumbnail_cache(min_mip, max_mip, min_imgid, max_imgid, threads))
   {
     free(m_arg);
     exit(EXIT_FAILURE);
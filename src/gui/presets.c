@@ -835,41 +835,25 @@ static void _menuitem_new_preset(GtkMenuItem *menuitem, dt_iop_module_t *module)
 
 void dt_gui_presets_apply_preset(const gchar* name, dt_iop_module_t *module)
 {
-  sqlite3_stmt *stmt;
-  // clang-format off
-  DT_DEBUG_SQLITE3_PREPARE_V2(
-     dt_database_get(darktable.db),
-     "SELECT op_params, enabled, blendop_params, blendop_version, writeprotect"
-     " FROM data.presets"
-     " WHERE operation = ?1 AND op_version = ?2 AND name = ?3",
-     -1, &stmt, NULL);
-  // clang-format on
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, module->op, -1, SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, module->version());
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, name, -1, SQLITE_TRANSIENT);
+  dt_presets_index_t *index = dt_presets_index_get();
+  const dt_preset_t *preset = dt_presets_index_find(index, module->op, module->version(), name);
 
-  if(sqlite3_step(stmt) == SQLITE_ROW)
+  if(preset)
   {
-    const void *op_params = sqlite3_column_blob(stmt, 0);
-    const int op_length = sqlite3_column_bytes(stmt, 0);
-    const int enabled = sqlite3_column_int(stmt, 1);
-    const void *blendop_params = sqlite3_column_blob(stmt, 2);
-    const int bl_length = sqlite3_column_bytes(stmt, 2);
-    const int blendop_version = sqlite3_column_int(stmt, 3);
-    const int writeprotect = sqlite3_column_int(stmt, 4);
-    if(op_params && (op_length == module->params_size))
+    if(preset->op_params && (preset->op_params_size == module->params_size))
     {
-      memcpy(module->params, op_params, op_length);
-      module->enabled = enabled;
+      memcpy(module->params, preset->op_params, preset->op_params_size);
+      module->enabled = preset->enabled;
     }
-    if(blendop_params && (blendop_version == dt_develop_blend_version())
-       && (bl_length == sizeof(dt_develop_blend_params_t)))
+    if(preset->blendop_params && (preset->blendop_version == dt_develop_blend_version())
+       && (preset->blendop_params_size == sizeof(dt_develop_blend_params_t)))
     {
-      dt_iop_commit_blend_params(module, blendop_params);
+      dt_iop_commit_blend_params(module, preset->blendop_params);
     }
-    else if(blendop_params
-            && dt_develop_blend_legacy_params(module, blendop_params, blendop_version, module->blend_params,
-                                              dt_develop_blend_version(), bl_length) == 0)
+    else if(preset->blendop_params
+            && dt_develop_blend_legacy_params(module, preset->blendop_params, preset->blendop_version,
+                                              module->blend_params, dt_develop_blend_version(),
+                                              preset->blendop_params_size) == 0)
     {
       // do nothing
     }
@@ -878,9 +862,9 @@ void dt_gui_presets_apply_preset(const gchar* name, dt_iop_module_t *module)
       dt_iop_commit_blend_params(module, module->default_blendop_params);
     }
 
-    if(!writeprotect) dt_gui_store_last_preset(name);
+    if(!preset->writeprotect) dt_gui_store_last_preset(name);
   }
-  sqlite3_finalize(stmt);
+  dt_presets_index_release(index);
   dt_iop_gui_update(module);
   dt_dev_add_history_item(darktable.develop, module, FALSE);
   gtk_widget_queue_draw(module->widget);
@@ -896,62 +880,21 @@ gboolean dt_gui_presets_autoapply_for_module(dt_iop_module_t *module)
 {
   dt_image_t *image = &module->dev->image_storage;
   const gboolean has_matrix = dt_image_is_matrix_correction_supported(image);
-
-  char query[2024];
-  // clang-format off
-  snprintf(query, sizeof(query),
-     "SELECT name"
-     " FROM data.presets"
-     " WHERE operation = ?1"
-     "        AND ((autoapply=1"
-     "           AND ((?2 LIKE model AND ?3 LIKE maker) OR (?4 LIKE model AND ?5 LIKE maker))"
-     "           AND ?6 LIKE lens AND ?7 BETWEEN iso_min AND iso_max"
-     "           AND ?8 BETWEEN exposure_min AND exposure_max"
-     "           AND ?9 BETWEEN aperture_min AND aperture_max"
-     "           AND ?10 BETWEEN focal_length_min AND focal_length_max"
-     "           AND (format = 0 OR (format&?11 != 0 AND ~format&?12 != 0))"
-     "           AND operation NOT IN"
-     "               ('ioporder', 'metadata', 'export', 'tagging', 'collect', 'basecurve'))"
-     "  OR (name = ?13)) AND op_version = ?14");
-  // clang-format on
-
-  sqlite3_stmt *stmt;
   const char *workflow_preset = (has_matrix) ? _("scene-referred default") : "\t\n";
-  int iformat = 0;
-  if(dt_image_is_rawprepare_supported(image)) iformat |= FOR_RAW;
-  else iformat |= FOR_LDR;
-  if(dt_image_is_hdr(image)) iformat |= FOR_HDR;
 
-  int excluded = 0;
-  if(dt_image_monochrome_flags(image)) excluded |= FOR_NOT_MONO;
-  else excluded |= FOR_NOT_COLOR;
+  dt_presets_image_t keys;
+  dt_presets_image_init(&keys, image);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, module->op, -1, SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, image->exif_model, -1, SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, image->exif_maker, -1, SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, image->camera_alias, -1, SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 5, image->camera_maker, -1, SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 6, image->exif_lens, -1, SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 7, fmaxf(0.0f, fminf(FLT_MAX, image->exif_iso)));
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 8, fmaxf(0.0f, fminf(1000000, image->exif_exposure)));
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 9, fmaxf(0.0f, fminf(1000000, image->exif_aperture)));
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 10, fmaxf(0.0f, fminf(1000000, image->exif_focal_length)));
-  // 0: dontcare, 1: ldr, 2: raw plus monochrome & color
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 11, iformat);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 12, excluded);
-  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 13, workflow_preset, -1, SQLITE_TRANSIENT);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 14, module->version());
-
-  gboolean applied = FALSE;
-  while(sqlite3_step(stmt) == SQLITE_ROW)
-  {
-    const char *name = (const char *)sqlite3_column_text(stmt, 0);
-    dt_gui_presets_apply_preset(name, module);
-    applied = TRUE;
-  }
-  sqlite3_finalize(stmt);
+  dt_presets_index_t *index = dt_presets_index_get();
+  GList *presets = dt_presets_index_autoapply(index, &keys, module->op, module->version(), workflow_preset, TRUE);
+
+  // the index is a snapshot: it stays valid even if applying a preset writes to data.presets
+  for(GList *preset = presets; preset; preset = g_list_next(preset))
+    dt_gui_presets_apply_preset(((const dt_preset_t *)preset->data)->name, module);
 
+  const gboolean applied = (presets != NULL);
+  g_list_free(presets);
+  dt_presets_index_release(index);
   return applied;
 }
 
@@ -972,6 +915,18 @@ static gboolean _menuitem_button_released_preset(GtkMenuItem *menuitem, GdkEvent
   return FALSE;
 }
 
+// ORDER BY writeprotect DESC (or ASC), LOWER(name), rowid
+static gint _menu_sort(gconstpointer a, gconstpointer b, gpointer default_first)
+{
+  const dt_preset_t *pa = *(const dt_preset_t **)a;
+  const dt_preset_t *pb = *(const dt_preset_t **)b;
+  if(pa->writeprotect != pb->writeprotect)
+    return ((pa->writeprotect != 0) == (GPOINTER_TO_INT(default_first) != 0)) ? -1 : 1;
+  const int names = g_ascii_strcasecmp(pa->name ? pa->name : "", pb->name ? pb->name : "");
+  if(names) return names;
+  return pa->rowid < pb->rowid ? -1 : (pa->rowid > pb->rowid);
+}
+
 static void _gui_presets_popup_menu_show_internal(dt_dev_operation_t op, int32_t version,
                                                   dt_iop_params_t *params, int32_t params_size,
                                                   dt_develop_blend_params_t *bl_params, dt_iop_module_t *module,
@@ -986,85 +941,29 @@ static void _gui_presets_popup_menu_show_internal(dt_dev_operation_t op, int32_t
   const gboolean hide_default = dt_conf_get_bool("plugins/darkroom/hide_default_presets");
   const gboolean default_first = dt_conf_get_bool("modules/default_presets_first");
 
-  gchar *query = NULL;
-
   GtkWidget *mi;
   int active_preset = -1, cnt = 0, writeprotect = 0; //, selected_default = 0;
-  sqlite3_stmt *stmt;
-  // order: get shipped defaults first
-  if(image)
-  {
-    // only matching if filter is on:
-    int iformat = 0;
-    if(dt_image_is_rawprepare_supported(image))
-      iformat |= FOR_RAW;
-    else
-      iformat |= FOR_LDR;
-
-    if(dt_image_is_hdr(image))
-      iformat |= FOR_HDR;
 
-    int excluded = 0;
-    if(dt_image_monochrome_flags(image))
-      excluded |= FOR_NOT_MONO;
-    else
-      excluded |= FOR_NOT_COLOR;
-
-    // clang-format off
-    query = g_strdup_printf
-      ("SELECT name, op_params, writeprotect, description, blendop_params, "
-       "  op_version, enabled"
-       " FROM data.presets"
-       " WHERE operation=?1"
-       "   AND (filter=0"
-       "          OR"
-       "       (((?2 LIKE model AND ?3 LIKE maker) OR (?4 LIKE model AND ?5 LIKE maker))"
-       "        AND ?6 LIKE lens"
-       "        AND ?7 BETWEEN iso_min AND iso_max"
-       "        AND ?8 BETWEEN exposure_min AND exposure_max"
-       "        AND ?9 BETWEEN aperture_min AND aperture_max"
-       "        AND ?10 BETWEEN focal_length_min AND focal_length_max"
-       "        AND (format = 0 OR (format&?11 != 0 AND ~format&?12 != 0))))"
-       " ORDER BY writeprotect %s, LOWER(name), rowid",
-       default_first ? "DESC":"ASC");
-    // clang-format on
-
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, op, -1, SQLITE_TRANSIENT);
-    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, image->exif_model, -1, SQLITE_TRANSIENT);
-    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, image->exif_maker, -1, SQLITE_TRANSIENT);
-    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 4, image->camera_alias, -1, SQLITE_TRANSIENT);
-    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 5, image->camera_maker, -1, SQLITE_TRANSIENT);
-    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 6, image->exif_lens, -1, SQLITE_TRANSIENT);
-    DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 7, image->exif_iso);
-    DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 8, image->exif_exposure);
-    DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 9, image->exif_aperture);
-    DT_DEBUG_SQLITE3_BIND_DOUBLE(stmt, 10, image->exif_focal_length);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 11, iformat);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 12, excluded);
-  }
-  else
+  // collect the presets of op, only the matching ones if their filter is on and we know the image
+  dt_presets_index_t *index = dt_presets_index_get();
+  const GPtrArray *op_presets = dt_presets_index_get_operation(index, op);
+  GPtrArray *presets = g_ptr_array_new();
+  dt_presets_image_t keys;
+  if(image) dt_presets_image_init(&keys, image);
+  for(guint i = 0; op_presets && i < op_presets->len; i++)
   {
-    // don't know for which image. show all we got:
-
-    query = g_strdup_printf("SELECT name, op_params, writeprotect, "
-                            "       description, blendop_params, op_version, enabled"
-                            " FROM data.presets"
-                            " WHERE operation=?1"
-                            " ORDER BY writeprotect %s, LOWER(name), rowid",
-                            default_first ? "DESC":"ASC"
-                           );
-
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, op, -1, SQLITE_TRANSIENT);
+    dt_preset_t *preset = g_ptr_array_index(op_presets, i);
+    if(!image || !preset->filter || dt_presets_match_image(preset, &keys)) g_ptr_array_add(presets, preset);
   }
-  g_free(query);
-  // collect all presets for op from db
+  // order: get shipped defaults first, or last
+  g_ptr_array_sort_with_data(presets, _menu_sort, GINT_TO_POINTER(default_first));
+
   gboolean found = 0;
   int last_wp = -1;
-  while(sqlite3_step(stmt) == SQLITE_ROW)
+  for(guint i = 0; i < presets->len; i++)
   {
-    const int chk_writeprotect = sqlite3_column_int(stmt, 2);
+    const dt_preset_t *preset = g_ptr_array_index(presets, i);
+    const int chk_writeprotect = preset->writeprotect;
     if(hide_default && chk_writeprotect)
     {
       //skip default module if set to hide them.
@@ -1079,14 +978,14 @@ static void _gui_presets_popup_menu_show_internal(dt_dev_operation_t op, int32_t
       last_wp = chk_writeprotect;
       gtk_menu_shell_append(GTK_MENU_SHELL(menu), gtk_separator_menu_item_new());
     }
-    const void *op_params = (void *)sqlite3_column_blob(stmt, 1);
-    const int32_t op_params_size = sqlite3_column_bytes(stmt, 1);
-    const void *blendop_params = (void *)sqlite3_column_blob(stmt, 4);
-    const int32_t bl_params_size = sqlite3_column_bytes(stmt, 4);
-    const int32_t preset_version = sqlite3_column_int(stmt, 5);
-    const int32_t enabled = sqlite3_column_int(stmt, 6);
+    const void *op_params = preset->op_params;
+    const int32_t op_params_size = preset->op_params_size;
+    const void *blendop_params = preset->blendop_params;
+    const int32_t bl_params_size = preset->blendop_params_size;
+    const int32_t preset_version = preset->op_version;
+    const int32_t enabled = preset->enabled;
     const int32_t isdisabled = (preset_version == version ? 0 : 1);
-    const char *name = (char *)sqlite3_column_text(stmt, 0);
+    const char *name = preset->name;
     gboolean isdefault = FALSE;
 
     if(darktable.gui->last_preset && strcmp(darktable.gui->last_preset, name) == 0)
@@ -1114,7 +1013,7 @@ static void _gui_presets_popup_menu_show_internal(dt_dev_operation_t op, int32_t
        && module->enabled == enabled)
     {
       active_preset = cnt;
-      writeprotect = sqlite3_column_int(stmt, 2);
+      writeprotect = preset->writeprotect;
       dt_gui_add_class(mi, "menu-active");
     }
 
@@ -1133,12 +1032,13 @@ static void _gui_presets_popup_menu_show_internal(dt_dev_operation_t op, int32_t
       }
       else if(pick_callback)
         g_signal_connect(G_OBJECT(mi), "activate", G_CALLBACK(pick_callback), callback_data);
-      gtk_widget_set_tooltip_text(mi, (const char *)sqlite3_column_text(stmt, 3));
+      gtk_widget_set_tooltip_text(mi, preset->description);
     }
     gtk_menu_shell_append(GTK_MENU_SHELL(menu), mi);
     cnt++;
   }
-  sqlite3_finalize(stmt);
+  g_ptr_array_free(presets, TRUE);
+  dt_presets_index_release(index);
 
   if(cnt > 0) gtk_menu_shell_append(GTK_MENU_SHELL(menu), gtk_separator_menu_item_new());
 
@@ -24,6 +24,7 @@
 #include "common/darktable.h"
 #include "common/exif.h"
 #include "common/imageio.h"
+#include "common/imageio_jpeg_write.h"
 #include "common/imageio_module.h"
 #include "control/conf.h"
 #include "imageio/format/imageio_format_api.h"
@@ -301,6 +302,31 @@ read_icc_profile (j_decompress_ptr cinfo,
 #undef MAX_SEQ_NO
 
 
+typedef struct dt_imageio_jpeg_settings_t
+{
+  int quality;
+  int resolution;
+} dt_imageio_jpeg_settings_t;
+
+static void _setup_compressor(j_compress_ptr cinfo, const void *data)
+{
+  const dt_imageio_jpeg_settings_t *settings = (const dt_imageio_jpeg_settings_t *)data;
+  const int quality = settings->quality;
+  jpeg_set_quality(cinfo, quality, TRUE);
+  if(quality > 90) cinfo->comp_info[0].v_samp_factor = 1;
+  if(quality > 92) cinfo->comp_info[0].h_samp_factor = 1;
+  if(quality > 95) cinfo->dct_method = JDCT_FLOAT;
+  if(quality < 50) cinfo->dct_method = JDCT_IFAST;
+  if(quality < 80) cinfo->smoothing_factor = 20;
+  if(quality < 60) cinfo->smoothing_factor = 40;
+  if(quality < 40) cinfo->smoothing_factor = 60;
+  cinfo->optimize_coding = 1;
+
+  cinfo->density_unit = 1;
+  cinfo->X_density = settings->resolution;
+  cinfo->Y_density = settings->resolution;
+}
+
 int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const void *in_tmp,
                 dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
                 void *exif, int exif_len, int32_t imgid, int num, int total, struct dt_dev_pixelpipe_t *pipe,
@@ -308,6 +334,35 @@ int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const v
 {
   dt_imageio_jpeg_t *jpg = (dt_imageio_jpeg_t *)jpg_tmp;
   const uint8_t *in = (const uint8_t *)in_tmp;
+  const dt_imageio_jpeg_settings_t settings = { jpg->quality, dt_conf_get_int("metadata/resolution") };
+
+  cmsHPROFILE out_profile = dt_colorspaces_get_output_profile(imgid, &over_type, over_filename)->profile;
+  uint32_t len = 0;
+  cmsSaveProfileToMem(out_profile, NULL, &len);
+  unsigned char *profile = (len > 0) ? malloc(sizeof(unsigned char) * len) : NULL;
+  if(profile) cmsSaveProfileToMem(out_profile, profile, &len);
+
+  if(dt_conf_get_bool("jpeg_parallel_encoding"))
+  {
+    FILE *f = g_fopen(filename, "wb");
+    if(!f)
+    {
+      free(profile);
+      return 1;
+    }
+    const int res = dt_imageio_jpeg_write_parallel(f, in, jpg->global.width, jpg->global.height,
+                                                   _setup_compressor, &settings, profile, profile ? len : 0,
+                                                   NULL, 0);
+    fclose(f);
+    if(res >= 0)
+    {
+      free(profile);
+      if(res == 0) dt_exif_write_blob(exif, exif_len, filename, 1);
+      return res;
+    }
+    // else: image too small to be split, nothing written yet
+  }
+
   struct dt_imageio_jpeg_error_mgr jerr;
 
   jpg->cinfo.err = jpeg_std_error(&jerr.pub);
@@ -315,11 +370,16 @@ int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const v
   if(setjmp(jerr.setjmp_buffer))
   {
     jpeg_destroy_compress(&(jpg->cinfo));
+    free(profile);
     return 1;
   }
   jpeg_create_compress(&(jpg->cinfo));
   FILE *f = g_fopen(filename, "wb");
-  if(!f) return 1;
+  if(!f)
+  {
+    free(profile);
+    return 1;
+  }
   jpeg_stdio_dest(&(jpg->cinfo), f);
 
   jpg->cinfo.image_width = jpg->global.width;
@@ -327,36 +387,11 @@ int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const v
   jpg->cinfo.input_components = 3;
   jpg->cinfo.in_color_space = JCS_RGB;
   jpeg_set_defaults(&(jpg->cinfo));
-  jpeg_set_quality(&(jpg->cinfo), jpg->quality, TRUE);
-  if(jpg->quality > 90) jpg->cinfo.comp_info[0].v_samp_factor = 1;
-  if(jpg->quality > 92) jpg->cinfo.comp_info[0].h_samp_factor = 1;
-  if(jpg->quality > 95) jpg->cinfo.dct_method = JDCT_FLOAT;
-  if(jpg->quality < 50) jpg->cinfo.dct_method = JDCT_IFAST;
-  if(jpg->quality < 80) jpg->cinfo.smoothing_factor = 20;
-  if(jpg->quality < 60) jpg->cinfo.smoothing_factor = 40;
-  if(jpg->quality < 40) jpg->cinfo.smoothing_factor = 60;
-  jpg->cinfo.optimize_coding = 1;
-
-  const int resolution = dt_conf_get_int("metadata/resolution");
-  jpg->cinfo.density_unit = 1;
-  jpg->cinfo.X_density = resolution;
-  jpg->cinfo.Y_density = resolution;
+  _setup_compressor(&(jpg->cinfo), &settings);
 
   jpeg_start_compress(&(jpg->cinfo), TRUE);
 
-  cmsHPROFILE out_profile = dt_colorspaces_get_output_profile(imgid, &over_type, over_filename)->profile;
-  uint32_t len = 0;
-  cmsSaveProfileToMem(out_profile, NULL, &len);
-  if(len > 0)
-  {
-    unsigned char *buf = malloc(sizeof(unsigned char) * len);
-    if(buf)
-    {
-      cmsSaveProfileToMem(out_profile, buf, &len);
-      write_icc_profile(&(jpg->cinfo), buf, len);
-      free(buf);
-    }
-  }
+  if(profile) write_icc_profile(&(jpg->cinfo), profile, len);
 
   uint8_t *row = dt_alloc_align(sizeof(uint8_t) * 3 * jpg->global.width);
   const uint8_t *buf;
@@ -373,6 +408,7 @@ int write_image(dt_imageio_module_data_t *jpg_tmp, const char *filename, const v
   dt_free_align(row);
   jpeg_destroy_compress(&(jpg->cinfo));
   fclose(f);
+  free(profile);
 
   dt_exif_write_blob(exif, exif_len, filename, 1);
 
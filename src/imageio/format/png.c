@@ -31,6 +31,7 @@
 #include "common/darktable.h"
 #include "common/imageio.h"
 #include "common/imageio_module.h"
+#include "common/imageio_png_write.h"
 #include "control/conf.h"
 #include "imageio/format/imageio_format_api.h"
 
@@ -206,6 +207,18 @@ int write_image(dt_imageio_module_data_t *p_tmp, const char *filename, const voi
 
   png_write_info(png_ptr, info_ptr);
 
+  // filter and compress the rows on all cores, this writes the IDAT and IEND chunks
+  const int res = dt_conf_get_bool("png_parallel_encoding")
+                      ? dt_imageio_png_write_parallel(png_ptr, ivoid, width, height, p->bpp, p->compression)
+                      : -1;
+  if(res >= 0)
+  {
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    fclose(f);
+    return res;
+  }
+
+  // parallel writer disabled or out of memory, let libpng do it row by row
   /*
    * Get rid of filler (OR ALPHA) bytes, pack XRGB/RGBX/ARGB/RGBA into
    * RGB (4 channels -> 3 channels). The second parameter is not used.
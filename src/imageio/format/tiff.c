@@ -21,6 +21,7 @@
 #include "common/exif.h"
 #include "common/imageio.h"
 #include "common/imageio_module.h"
+#include "common/imageio_tiff.h"
 #include "common/math.h"
 #include "control/conf.h"
 #include "control/control.h"
@@ -58,6 +59,55 @@ typedef struct dt_imageio_tiff_gui_t
 } dt_imageio_tiff_gui_t;
 
 
+// what dt_imageio_tiff_write_strips() packs: either the 4-channel export buffer, or a raster mask
+// replicated over all layers
+typedef struct dt_imageio_tiff_rows_t
+{
+  const void *in;
+  const float *mask;
+  int width;
+  int layers;
+  int bpp;
+} dt_imageio_tiff_rows_t;
+
+static void _pack_row(const void *data, const int y, uint8_t *row)
+{
+  const dt_imageio_tiff_rows_t *rows = (const dt_imageio_tiff_rows_t *)data;
+  const int width = rows->width;
+  const int layers = rows->layers;
+
+  if(rows->mask)
+  {
+    const float *in = rows->mask + (size_t)y * width;
+    if(rows->bpp == 32)
+    {
+      float *out = (float *)row;
+      for(int x = 0; x < width; x++, out += layers)
+        for(int c = 0; c < layers; c++) out[c] = in[x];
+    }
+    else if(rows->bpp == 16)
+    {
+      uint16_t *out = (uint16_t *)row;
+      for(int x = 0; x < width; x++, out += layers)
+        for(int c = 0; c < layers; c++) out[c] = CLIP(in[x]) * 65535.0f + 0.5f;
+    }
+    else
+    {
+      uint8_t *out = row;
+      for(int x = 0; x < width; x++, out += layers)
+        for(int c = 0; c < layers; c++) out[c] = CLIP(in[x]) * 255.0f + 0.5f;
+    }
+  }
+  else
+  {
+    // drop the 4th channel, and the 2 others for grayscale images
+    const size_t bytes = rows->bpp / 8;
+    const uint8_t *in = (const uint8_t *)rows->in + (size_t)4 * y * width * bytes;
+    for(int x = 0; x < width; x++, in += 4 * bytes, row += layers * bytes)
+      memcpy(row, in, layers * bytes);
+  }
+}
+
 int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const void *in_void,
                 dt_colorspaces_color_profile_type_t over_type, const char *over_filename,
                 void *exif, int exif_len, int32_t imgid, int num, int total, dt_dev_pixelpipe_t *pipe,
@@ -70,8 +120,6 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
 
   TIFF *tif = NULL;
 
-  void *rowdata = NULL;
-
   gboolean free_mask = FALSE;
   float *raster_mask = NULL;
 #ifdef _WIN32
@@ -247,71 +295,15 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
   TIFFSetField(tif, TIFFTAG_YRESOLUTION, (float)resolution);
   TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, RESUNIT_INCH);
 
-  const size_t rowsize = (d->global.width * layers) * d->bpp / 8;
-  if((rowdata = malloc(rowsize)) == NULL)
+  const dt_imageio_tiff_rows_t image_rows
+      = { .in = in_void, .mask = NULL, .width = d->global.width, .layers = layers, .bpp = d->bpp };
+  if(dt_imageio_tiff_write_strips(tif, d->global.width, d->global.height, layers, d->bpp, d->compresslevel,
+                                  _pack_row, &image_rows))
   {
     rc = 1;
     goto exit;
   }
 
-  if(d->bpp == 32)
-  {
-    for(int y = 0; y < d->global.height; y++)
-    {
-      float *in = (float *)in_void + (size_t)4 * y * d->global.width;
-      float *out = (float *)rowdata;
-
-      for(int x = 0; x < d->global.width; x++, in += 4, out += layers)
-      {
-        memcpy(out, in, sizeof(float) * layers);
-      }
-
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
-    }
-  }
-  else if(d->bpp == 16)
-  {
-    for(int y = 0; y < d->global.height; y++)
-    {
-      uint16_t *in = (uint16_t *)in_void + (size_t)4 * y * d->global.width;
-      uint16_t *out = (uint16_t *)rowdata;
-
-      for(int x = 0; x < d->global.width; x++, in += 4, out += layers)
-      {
-        memcpy(out, in, sizeof(uint16_t) * layers);
-      }
-
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
-    }
-  }
-  else
-  {
-    for(int y = 0; y < d->global.height; y++)
-    {
-      uint8_t *in = (uint8_t *)in_void + (size_t)4 * y * d->global.width;
-      uint8_t *out = (uint8_t *)rowdata;
-
-      for(int x = 0; x < d->global.width; x++, in += 4, out += layers)
-      {
-        memcpy(out, in, sizeof(uint8_t) * layers);
-      }
-
-      if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-      {
-        rc = 1;
-        goto exit;
-      }
-    }
-  }
-
   rc = 0;
 
   // close the file before adding exif data
@@ -420,74 +412,12 @@ int write_image(dt_imageio_module_data_t *d_tmp, const char *filename, const voi
           TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
         else
           TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
-        TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tif, 0));
-
-        if(w != d->global.width)
-        {
-          free(rowdata);
-          const size_t _rowsize = (w * layers) * d->bpp / 8;
-          rowdata = malloc(_rowsize);
-        }
-
-        if(d->bpp == 32)
-        {
-          for(int y = 0; y < h; y++)
-          {
-            const float *in = raster_mask + (size_t)y * w;
-            float *out = (float *)rowdata;
-
-            for(int x = 0; x < w; x++, out += layers)
-            {
-              for(int c = 0; c < layers; c++)
-                out[c] = in[x];
-            }
-
-            if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-            {
-              rc = 1;
-              goto exit;
-            }
-          }
-        }
-        else if(d->bpp == 16)
+        const dt_imageio_tiff_rows_t mask_rows
+            = { .in = NULL, .mask = raster_mask, .width = w, .layers = layers, .bpp = d->bpp };
+        if(dt_imageio_tiff_write_strips(tif, w, h, layers, d->bpp, d->compresslevel, _pack_row, &mask_rows))
         {
-          for(int y = 0; y < h; y++)
-          {
-            const float *in = raster_mask + (size_t)y * w;
-            uint16_t *out = (uint16_t *)rowdata;
-
-            for(int x = 0; x < w; x++, out += layers)
-            {
-              for(int c = 0; c < layers; c++)
-                out[c] = CLIP(in[x]) * 65535.0f + 0.5f;
-            }
-
-            if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-            {
-              rc = 1;
-              goto exit;
-            }
-          }
-        }
-        else
-        {
-          for(int y = 0; y < h; y++)
-          {
-            const float *in = raster_mask + (size_t)y * w;
-            uint8_t *out = (uint8_t *)rowdata;
-
-            for(int x = 0; x < w; x++, out += layers)
-            {
-              for(int c = 0; c < layers; c++)
-                out[c] = CLIP(in[x]) * 255.0f + 0.5f;
-            }
-
-            if(TIFFWriteScanline(tif, rowdata, y, 0) == -1)
-            {
-              rc = 1;
-              goto exit;
-            }
-          }
+          rc = 1;
+          goto exit;
         }
 #else // MASKS_USE_SAME_FORMAT
         TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1);
@@ -530,8 +460,6 @@ exit:
   }
   free(profile);
   profile = NULL;
-  free(rowdata);
-  rowdata = NULL;
 #ifdef _WIN32
   g_free(wfilename);
 #endif
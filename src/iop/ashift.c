@@ -72,6 +72,11 @@
 #define LSD_DENSITY_TH 0.7                  // LSD: minimal density of region points in rectangle
 #define LSD_N_BINS 1024                     // LSD: number of bins in pseudo-ordering of gradient modulus
 #define LSD_GAMMA 0.45                      // gamma correction to apply on raw images prior to line detection
+#define LSD_COARSE_PIXELS 2000000           // LSD: larger images get their lines detected downscaled to this size, then refined
+#define LSD_REFINE_SAMPLES 256              // LSD: maximum number of edge points sampled along a line to refine it
+#define LSD_REFINE_STEP 0.5                 // LSD: step in pixels of the edge search across a line to refine it
+#define LSD_REFINE_MIN_GRADIENT 2.0         // LSD: minimum gradient of an edge point to refine a line
+#define LSD_REFINE_MAX_ANGLE 2.0            // LSD: maximum deviation in degrees of a refined line from the detected one
 #define RANSAC_RUNS 400                     // how many iterations to run in ransac
 #define RANSAC_EPSILON 2                    // starting value for ransac epsilon (in -log10 units)
 #define RANSAC_EPSILON_STEP 1               // step size of epsilon optimization (log10 units)
@@ -83,6 +88,7 @@
 #define NMS_EPSILON 1e-3                    // break criterion for Nelder-Mead simplex
 #define NMS_SCALE 1.0                       // scaling factor for Nelder-Mead simplex
 #define NMS_ITERATIONS 400                  // number of iterations for Nelder-Mead simplex
+#define NMS_PARALLEL_LINES 2048             // number of lines from which model fitness is computed by all threads
 #define NMS_CROP_EPSILON 100.0              // break criterion for Nelder-Mead simplex on crop fitting
 #define NMS_CROP_SCALE 0.5                  // scaling factor for Nelder-Mead simplex on crop fitting
 #define NMS_CROP_ITERATIONS 100             // number of iterations for Nelder-Mead simplex on crop fitting
@@ -405,6 +411,14 @@ typedef struct dt_iop_ashift_fit_params_t
   float lensshift_v_range;
   float lensshift_h_range;
   float shear_range;
+  // the lines matching linetype and linemask, packed by fit_lines_pack() for model_fitness():
+  // end points, and weight of the vertical and horizontal ones (0 for the lines of the other direction)
+  int fit_count;
+  float *fit_buf;
+  float *x1, *y1, *x2, *y2;
+  float *weight_v, *weight_h;
+  double sum_weight_v, sum_weight_h;
+  int count_v, count_h;
 } dt_iop_ashift_fit_params_t;
 
 typedef struct dt_iop_ashift_cropfit_params_t
@@ -1427,6 +1441,129 @@ static void gamma_correct(const float *const in, float *const out, const int wid
   }
 }
 
+// bilinear interpolation in a greyscale buffer, the point needs to be inside the buffer
+static inline double grey_sample(const double *const grey, const int width, const float x, const float y)
+{
+  const int xi = (int)x;
+  const int yi = (int)y;
+  const double fx = x - xi;
+  const double fy = y - yi;
+  const double *const p = grey + (size_t)yi * width + xi;
+  return (1.0 - fy) * ((1.0 - fx) * p[0] + fx * p[1]) + fy * ((1.0 - fx) * p[width] + fx * p[width + 1]);
+}
+
+// refine a line segment that has been detected on a downscaled image: look for the edge across the
+// line at a few points along it, at full resolution, and fit a line through these edge points.
+// the search covers +/- radius pixels around the detected line. the end points get projected onto the refined
+// line. returns FALSE and leaves the line as is if the edge can not be followed reliably.
+static int line_refine(const double *const grey, const int width, const int height, const float radius,
+                       float *x1, float *y1, float *x2, float *y2)
+{
+  const float length = sqrtf(SQR(*x2 - *x1) + SQR(*y2 - *y1));
+  const int samples = MIN(LSD_REFINE_SAMPLES, (int)(length / 2.0f));
+  if(samples < 4) return FALSE;
+
+  // unit vectors along and across the line
+  const float dx = (*x2 - *x1) / length;
+  const float dy = (*y2 - *y1) / length;
+  const float nx = -dy;
+  const float ny = dx;
+
+  const int steps = MIN((int)ceilf(radius / LSD_REFINE_STEP), 32);
+  const float reach = (steps + 1) * LSD_REFINE_STEP;
+
+  float px[LSD_REFINE_SAMPLES], py[LSD_REFINE_SAMPLES];
+  int count = 0;
+
+  for(int k = 0; k < samples; k++)
+  {
+    // sample points are evenly spread over the inner 80% of the line, every 2 pixels at most.
+    // many of them are needed to average out the bias of the interpolation, which depends on the sub-pixel position
+    const float t = length * (0.1f + 0.8f * (k + 0.5f) / samples);
+    const float cx = *x1 + t * dx;
+    const float cy = *y1 + t * dy;
+
+    // the whole search segment needs to be inside the image
+    if(fminf(cx - reach * fabsf(nx), cy - reach * fabsf(ny)) < 0.0f
+       || cx + reach * fabsf(nx) > width - 2 || cy + reach * fabsf(ny) > height - 2)
+      continue;
+
+    // gradient across the line, centered on the search positions
+    double grad[2 * 32 + 1];
+    int best = -1;
+    for(int i = 0; i <= 2 * steps; i++)
+    {
+      const float o = (i - steps) * LSD_REFINE_STEP;
+      const float h = 0.5f * LSD_REFINE_STEP;
+      grad[i] = fabs(grey_sample(grey, width, cx + (o + h) * nx, cy + (o + h) * ny)
+                     - grey_sample(grey, width, cx + (o - h) * nx, cy + (o - h) * ny)) / LSD_REFINE_STEP;
+      if(best < 0 || grad[i] > grad[best]) best = i;
+    }
+
+    // the edge needs to be a clear maximum inside the search segment
+    if(best == 0 || best == 2 * steps || grad[best] < LSD_REFINE_MIN_GRADIENT) continue;
+
+    // sub-pixel position of the edge: centroid of the gradient around the maximum
+    double sum = 0.0, moment = 0.0;
+    for(int i = MAX(best - 3, 0); i <= MIN(best + 3, 2 * steps); i++)
+    {
+      sum += grad[i];
+      moment += grad[i] * (i - steps);
+    }
+    const float o = moment / sum * LSD_REFINE_STEP;
+
+    px[count] = cx + o * nx;
+    py[count] = cy + o * ny;
+    count++;
+  }
+
+  if(count < 4 || count < samples / 2) return FALSE;
+
+  // total least squares fit: the line goes through the centroid, along the main axis of the points
+  double mx = 0.0, my = 0.0;
+  for(int k = 0; k < count; k++)
+  {
+    mx += px[k];
+    my += py[k];
+  }
+  mx /= count;
+  my /= count;
+
+  double sxx = 0.0, sxy = 0.0, syy = 0.0;
+  for(int k = 0; k < count; k++)
+  {
+    sxx += SQR(px[k] - mx);
+    sxy += (px[k] - mx) * (py[k] - my);
+    syy += SQR(py[k] - my);
+  }
+
+  const float theta = 0.5 * atan2(2.0 * sxy, sxx - syy);
+  float ex = cosf(theta);
+  float ey = sinf(theta);
+
+  // keep the orientation of the detected line
+  if(ex * dx + ey * dy < 0.0f)
+  {
+    ex = -ex;
+    ey = -ey;
+  }
+
+  // the refined line may only slightly differ from the detected one, and needs to fit the edge points well
+  const double residual = fmax(0.0, 0.5 * (sxx + syy) - sqrt(0.25 * SQR(sxx - syy) + SQR(sxy)));
+  if(ex * dx + ey * dy < cosf(LSD_REFINE_MAX_ANGLE * M_PI / 180.0f) || residual > count)
+    return FALSE;
+
+  // project the end points onto the refined line
+  const float t1 = (*x1 - mx) * ex + (*y1 - my) * ey;
+  const float t2 = (*x2 - mx) * ex + (*y2 - my) * ey;
+  *x1 = mx + t1 * ex;
+  *y1 = my + t1 * ey;
+  *x2 = mx + t2 * ex;
+  *y2 = my + t2 * ey;
+
+  return TRUE;
+}
+
 // do actual line_detection based on LSD algorithm and return results according
 // to this module's conventions
 static int line_detect(float *in, const int width, const int height, const int x_off, const int y_off,
@@ -1472,11 +1609,46 @@ static int line_detect(float *in, const int width, const int height, const int x
   // it returns structural details as vector 'double lines[7 * lines_count]'
   int lines_count;
 
+  // large images are analyzed coarse to fine: LSD detects the lines on a downscaled copy of the image,
+  // which is much faster and finds the same structure, then the lines get refined at full size.
+  // coordinates returned by LSD are always in full size.
+  const double npixels = (double)width * height;
+  const double lsd_scale = MIN(LSD_SCALE, sqrt(LSD_COARSE_PIXELS / npixels));
+  const int coarse = lsd_scale < LSD_SCALE;
+
   lsd_lines = LineSegmentDetection(&lines_count, greyscale, width, height,
-                                   LSD_SCALE, LSD_SIGMA_SCALE, LSD_QUANT,
+                                   lsd_scale, LSD_SIGMA_SCALE, LSD_QUANT,
                                    LSD_ANG_TH, LSD_LOG_EPS, LSD_DENSITY_TH,
                                    LSD_N_BINS, NULL, NULL, NULL);
 
+  if(coarse && lines_count > 0)
+  {
+    // detected lines are up to one downscaled pixel off
+    const float radius = 1.0f / lsd_scale + 1.0f;
+    int refined = 0;
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+    dt_omp_firstprivate(greyscale, width, height, radius, lines_count, lsd_lines) \
+    reduction(+ : refined) \
+    schedule(dynamic, 16)
+#endif
+    for(int n = 0; n < lines_count; n++)
+    {
+      double *const l = lsd_lines + 7 * n;
+      float x1 = l[0], y1 = l[1], x2 = l[2], y2 = l[3];
+      if(line_refine(greyscale, width, height, radius, &x1, &y1, &x2, &y2))
+      {
+        l[0] = x1;
+        l[1] = y1;
+        l[2] = x2;
+        l[3] = y2;
+        refined++;
+      }
+    }
+    dt_print(DT_DEBUG_PERF, "[ashift] %d lines detected at scale %.3f, %d refined at full size\n", lines_count,
+             lsd_scale, refined);
+  }
+
   // we count the lines that we really want to use
   int lct = 0;
   if(lines_count > 0)
@@ -1648,10 +1820,13 @@ static int _get_structure(dt_iop_module_t *module, dt_iop_ashift_enhance_t enhan
   float horizontal_weight;
 
   // get new structural data
+  const double start = dt_get_wtime();
   if(!line_detect(buffer, width, height, x_off, y_off, scale, &lines, &lines_count,
                   &vertical_count, &horizontal_count, &vertical_weight, &horizontal_weight,
                   enhance, dt_image_is_raw(&module->dev->image_storage)))
     goto error;
+  dt_print(DT_DEBUG_PERF, "[ashift] image %d: line detection on %dx%d took %.3f s\n",
+           module->dev->image_storage.id, width, height, dt_get_wtime() - start);
 
   // save new structural data
   g->lines_in_width = width;
@@ -2024,6 +2199,56 @@ static inline double ilogit(double L, double min, double max)
   return (p * (max - min) + min);
 }
 
+// pack the lines taking part in the fit into the arrays of the fit structure, so that model_fitness()
+// runs over them without branching. returns FALSE if out of memory.
+static int fit_lines_pack(dt_iop_ashift_fit_params_t *fit)
+{
+  const dt_iop_ashift_line_t *lines = fit->lines;
+
+  int count = 0;
+  for(int n = 0; n < fit->lines_count; n++)
+    if((lines[n].type & fit->linemask) == fit->linetype) count++;
+
+  // arrays start on 64 byte boundaries
+  const size_t stride = ((size_t)count + 15) & ~(size_t)15;
+  fit->fit_count = count;
+  fit->fit_buf = count > 0 ? dt_alloc_align_float(6 * stride) : NULL;
+  fit->sum_weight_v = fit->sum_weight_h = 0.0;
+  fit->count_v = fit->count_h = 0;
+  if(count > 0 && fit->fit_buf == NULL) return FALSE;
+
+  fit->x1 = fit->fit_buf;
+  fit->y1 = fit->x1 + stride;
+  fit->x2 = fit->y1 + stride;
+  fit->y2 = fit->x2 + stride;
+  fit->weight_v = fit->y2 + stride;
+  fit->weight_h = fit->weight_v + stride;
+
+  int k = 0;
+  for(int n = 0; n < fit->lines_count; n++)
+  {
+    // skip the lines which are not part of the fit
+    if((lines[n].type & fit->linemask) != fit->linetype) continue;
+
+    const int isvertical = lines[n].type & ASHIFT_LINE_DIRVERT;
+    fit->x1[k] = lines[n].p1[0];
+    fit->y1[k] = lines[n].p1[1];
+    fit->x2[k] = lines[n].p2[0];
+    fit->y2[k] = lines[n].p2[1];
+    fit->weight_v[k] = isvertical ? lines[n].weight : 0.0f;
+    fit->weight_h[k] = isvertical ? 0.0f : lines[n].weight;
+
+    // the weights and the counts don't depend on the model
+    fit->sum_weight_v += fit->weight_v[k];
+    fit->sum_weight_h += fit->weight_h[k];
+    fit->count_v += isvertical ? 1 : 0;
+    fit->count_h += isvertical ? 0 : 1;
+    k++;
+  }
+
+  return TRUE;
+}
+
 // helper function for simplex() return quality parameter for the given model
 // strategy:
 //    * generate homography matrix out of fixed parameters and fitting parameters
@@ -2036,8 +2261,6 @@ static double model_fitness(double *params, void *data)
   dt_iop_ashift_fit_params_t *fit = (dt_iop_ashift_fit_params_t *)data;
 
   // just for convenience: get shorter names
-  dt_iop_ashift_line_t *lines = fit->lines;
-  const int lines_count = fit->lines_count;
   const int width = fit->width;
   const int height = fit->height;
   const float f_length_kb = fit->f_length_kb;
@@ -2082,10 +2305,6 @@ static double model_fitness(double *params, void *data)
 
   assert(pcount == fit->params_count);
 
-  // the possible reference axes
-  const float Av[3] = { 1.0f, 0.0f, 0.0f };
-  const float Ah[3] = { 0.0f, 1.0f, 0.0f };
-
   // generate homograph out of the parameters
   float homograph[3][3];
   homography((float *)homograph, rotation, lensshift_v, lensshift_h, shear, f_length_kb,
@@ -2094,53 +2313,49 @@ static double model_fitness(double *params, void *data)
   // accounting variables
   double sumsq_v = 0.0;
   double sumsq_h = 0.0;
-  double weight_v = 0.0;
-  double weight_h = 0.0;
-  int count_v = 0;
-  int count_h = 0;
-  int count = 0;
 
-  // iterate over all lines
-  for(int n = 0; n < lines_count; n++)
+  const float *const x1 = fit->x1;
+  const float *const y1 = fit->y1;
+  const float *const x2 = fit->x2;
+  const float *const y2 = fit->y2;
+  const float *const weight_v = fit->weight_v;
+  const float *const weight_h = fit->weight_h;
+  const int count = fit->fit_count;
+  const float *const H = (const float *)homograph;
+
+  // iterate over all lines. for each of them, we apply the homographic transformation to the end points,
+  // get the line L connecting the two points, normalized so that x^2 + y^2 = 1, and the scalar product s
+  // of L with the perpendicular reference axis, which gives 0 if the line is perpendicular to it:
+  // s = L[1] for vertical lines and s = L[0] for horizontal ones, so only L[0] and L[1] are needed.
+#ifdef _OPENMP
+#pragma omp parallel for simd default(none) \
+  dt_omp_firstprivate(x1, y1, x2, y2, weight_v, weight_h, count, H) \
+  reduction(+ : sumsq_v, sumsq_h) \
+  schedule(simd:static) if(count >= NMS_PARALLEL_LINES)
+#endif
+  for(int n = 0; n < count; n++)
   {
-    // check if this is a line which we must skip
-    if((lines[n].type & fit->linemask) != fit->linetype)
-      continue;
+    const float P1x = H[0] * x1[n] + H[1] * y1[n] + H[2];
+    const float P1y = H[3] * x1[n] + H[4] * y1[n] + H[5];
+    const float P1z = H[6] * x1[n] + H[7] * y1[n] + H[8];
+    const float P2x = H[0] * x2[n] + H[1] * y2[n] + H[2];
+    const float P2y = H[3] * x2[n] + H[4] * y2[n] + H[5];
+    const float P2z = H[6] * x2[n] + H[7] * y2[n] + H[8];
 
-    // the direction of this line (vertical?)
-    const int isvertical = lines[n].type & ASHIFT_LINE_DIRVERT;
-
-    // select the perpendicular reference axis
-    const float *A = isvertical ? Ah : Av;
-
-    // apply homographic transformation to the end points
-    float P1[3], P2[3];
-    mat3mulv(P1, (float *)homograph, lines[n].p1);
-    mat3mulv(P2, (float *)homograph, lines[n].p2);
-
-    // get line connecting the two points
-    float L[3];
-    vec3prodn(L, P1, P2);
-
-    // normalize L so that x^2 + y^2 = 1; makes sure that
-    // y^2 = 1 / (1 + m^2) and x^2 = m^2 / (1 + m^2) with m defining the slope of the line
-    vec3lnorm(L, L);
-
-    // get scalar product of line L with orthogonal axis A -> gives 0 if line is perpendicular
-    float s = vec3scalar(L, A);
+    const float L0 = P1y * P2z - P1z * P2y;
+    const float L1 = P1z * P2x - P1x * P2z;
+    const float norm = L0 * L0 + L1 * L1;
+    const float f = norm > 0.0f ? 1.0f / norm : 0.0f;
 
     // sum up weighted s^2 for both directions individually
-    sumsq_v += isvertical ? s * s * lines[n].weight : 0.0;
-    weight_v  += isvertical ? lines[n].weight : 0.0;
-    count_v += isvertical ? 1 : 0;
-    sumsq_h += !isvertical ? s * s * lines[n].weight : 0.0;
-    weight_h  += !isvertical ? lines[n].weight : 0.0;
-    count_h += !isvertical ? 1 : 0;
-    count++;
+    sumsq_v += L1 * L1 * f * weight_v[n];
+    sumsq_h += L0 * L0 * f * weight_h[n];
   }
 
-  const double v = weight_v > 0.0f && count > 0 ? sumsq_v / weight_v * (float)count_v / count : 0.0;
-  const double h = weight_h > 0.0f && count > 0 ? sumsq_h / weight_h * (float)count_h / count : 0.0;
+  const double wv = fit->sum_weight_v;
+  const double wh = fit->sum_weight_h;
+  const double v = wv > 0.0f && count > 0 ? sumsq_v / wv * (float)fit->count_v / count : 0.0;
+  const double h = wh > 0.0f && count > 0 ? sumsq_h / wh * (float)fit->count_h / count : 0.0;
 
   double sum = sqrt(1.0 - (1.0 - v) * (1.0 - h)) * 1.0e6;
   //double sum = sqrt(v + h) * 1.0e6;
@@ -2275,8 +2490,15 @@ static dt_iop_ashift_nmsresult_t nmsfit(dt_iop_module_t *module, dt_iop_ashift_p
     return NMS_NOT_ENOUGH_LINES;
   }
 
+  // out of memory: report a failed fit
+  if(!fit_lines_pack(&fit)) return NMS_DID_NOT_CONVERGE;
+
   // start the simplex fit
+  const double start = dt_get_wtime();
   int iter = simplex(model_fitness, params, fit.params_count, NMS_EPSILON, NMS_SCALE, NMS_ITERATIONS, NULL, (void*)&fit);
+  dt_print(DT_DEBUG_PERF, "[ashift] image %d: fit over %d lines in %d iterations took %.3f s\n",
+           module->dev->image_storage.id, fit.fit_count, iter, dt_get_wtime() - start);
+  dt_free_align(fit.fit_buf);
 
   // error case: the fit did not converge
   if(iter >= NMS_ITERATIONS)
@@ -2407,7 +2629,9 @@ static void model_probe(dt_iop_module_t *module, dt_iop_ashift_params_t *p, dt_i
     fit.linemask = ASHIFT_LINE_RELEVANT | ASHIFT_LINE_SELECTED;
   }
 
+  if(!fit_lines_pack(&fit)) return;
   double quality = model_fitness(params, (void *)&fit);
+  dt_free_align(fit.fit_buf);
 
   printf("model fitness: %.8f (rotation %f, lensshift_v %f, lensshift_h %f, shear %f)\n",
          quality, p->rotation, p->lensshift_v, p->lensshift_h, p->shear);
@@ -3041,7 +3265,11 @@ static void _do_get_structure_quad(dt_iop_module_t *self)
   _gui_update_structure_states(self, TRUE);
 }
 
-// helper function to start parameter fit and report about errors
+// helper function to start parameter fit and report about errors.
+// The fit only runs from the darkroom: the lines are detected on the preview buffer kept in the GUI
+// data, and the lines, fit ranges and flip state live there too. There is no batch auto-fit over a
+// lighttable selection or in ansel-cli, the per-image time of detection and fit is only reported
+// with -d perf.
 static void do_fit(dt_iop_module_t *module, dt_iop_ashift_params_t *p, dt_iop_ashift_fitaxis_t dir)
 {
   dt_iop_ashift_gui_data_t *g = (dt_iop_ashift_gui_data_t *)module->gui_data;
@@ -3174,15 +3402,19 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   const float cx = roi_out->scale * fullwidth * data->cl;
   const float cy = roi_out->scale * fullheight * data->ct;
 
+  dt_dev_pixelpipe_t *const pipe = piece->pipe;
+
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(ch, ch_width, cx, cy, ivoid, ovoid, roi_in, roi_out) \
+  dt_omp_firstprivate(ch, ch_width, cx, cy, ivoid, ovoid, roi_in, roi_out, pipe) \
   shared(ihomograph, interpolation) \
   schedule(static)
 #endif
   // go over all pixels of output image
   for(int j = 0; j < roi_out->height; j++)
   {
+    if(dt_dev_pixelpipe_is_cancelled(pipe)) continue;
+
     float *const restrict out = ((float *)ovoid) + (size_t)ch * j * roi_out->width;
     for(int i = 0; i < roi_out->width; i++)
     {
@@ -22,6 +22,7 @@
 #include "bauhaus/bauhaus.h"
 #include "common/bilateral.h"
 #include "common/bilateralcl.h"
+#include "common/imagebuf.h"
 #include "common/locallaplacian.h"
 #include "common/locallaplaciancl.h"
 #include "develop/imageop.h"
@@ -33,12 +34,13 @@
 #include "iop/iop_api.h"
 
 #include <gtk/gtk.h>
+#include <stddef.h>
 #include <stdlib.h>
 
 
 // this is the version of the modules parameters,
 // and includes version information about compile-time dt
-DT_MODULE_INTROSPECTION(3, dt_iop_bilat_params_t)
+DT_MODULE_INTROSPECTION(4, dt_iop_bilat_params_t)
 
 typedef enum dt_iop_bilat_mode_t
 {
@@ -54,9 +56,20 @@ typedef struct dt_iop_bilat_params_t
   float sigma_s; // $MIN: 0.0 $MAX: 100.0 $DEFAULT: 0.5 shadows 100 & spatial 1 100 50
   float detail;  // $MIN: -1.0 $MAX: 4.0 $DEFAULT: 0.25
   float midtone; // $MIN: 0.001 $MAX: 1.0 $DEFAULT: 0.5 $DESCRIPTION: "midtone range"
+  gboolean fast; // $DEFAULT: FALSE $DESCRIPTION: "fast mode"
 }
 dt_iop_bilat_params_t;
 
+typedef struct dt_iop_bilat_params_v3_t
+{
+  uint32_t mode;
+  float sigma_r;
+  float sigma_s;
+  float detail;
+  float midtone;
+}
+dt_iop_bilat_params_v3_t;
+
 typedef struct dt_iop_bilat_params_v2_t
 {
   uint32_t mode;
@@ -74,13 +87,26 @@ typedef struct dt_iop_bilat_params_v1_t
 }
 dt_iop_bilat_params_v1_t;
 
-typedef dt_iop_bilat_params_t dt_iop_bilat_data_t;
+typedef struct dt_iop_bilat_data_t
+{
+  dt_iop_bilat_mode_t mode;
+  float sigma_r;
+  float sigma_s;
+  float detail;
+  float midtone;
+  gboolean fast;
+  // input pyramid of the local laplacian, reused while only the parameters change.
+  // Non-constant pointer, kept last and out of the integrity hash, see init_pipe()
+  local_laplacian_cache_t *cache;
+}
+dt_iop_bilat_data_t;
 
 typedef struct dt_iop_bilat_gui_data_t
 {
   GtkWidget *highlights;
   GtkWidget *shadows;
   GtkWidget *midtone;
+  GtkWidget *fast;
   GtkWidget *spatial;
   GtkWidget *range;
   GtkWidget *detail;
@@ -124,7 +150,19 @@ int legacy_params(
     dt_iop_module_t *self, const void *const old_params, const int old_version,
     void *new_params, const int new_version)
 {
-  if(old_version == 2 && new_version == 3)
+  if(old_version == 3 && new_version == 4)
+  {
+    const dt_iop_bilat_params_v3_t *p3 = old_params;
+    dt_iop_bilat_params_t *p = new_params;
+    p->detail  = p3->detail;
+    p->sigma_r = p3->sigma_r;
+    p->sigma_s = p3->sigma_s;
+    p->midtone = p3->midtone;
+    p->mode    = p3->mode;
+    p->fast    = FALSE;
+    return 0;
+  }
+  else if(old_version == 2 && new_version == 4)
   {
     const dt_iop_bilat_params_v2_t *p2 = old_params;
     dt_iop_bilat_params_t *p = new_params;
@@ -133,9 +171,10 @@ int legacy_params(
     p->sigma_s = p2->sigma_s;
     p->midtone = 0.2f;
     p->mode    = p2->mode;
+    p->fast    = FALSE;
     return 0;
   }
-  else if(old_version == 1 && new_version == 3)
+  else if(old_version == 1 && new_version == 4)
   {
     const dt_iop_bilat_params_v1_t *p1 = old_params;
     dt_iop_bilat_params_t *p = new_params;
@@ -144,6 +183,7 @@ int legacy_params(
     p->sigma_s = p1->sigma_s;
     p->midtone = 0.2f;
     p->mode    = s_mode_bilateral;
+    p->fast    = FALSE;
     return 0;
   }
   return 1;
@@ -274,7 +314,12 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
 {
   dt_iop_bilat_params_t *p = (dt_iop_bilat_params_t *)p1;
   dt_iop_bilat_data_t *d = (dt_iop_bilat_data_t *)piece->data;
-  *d = *p;
+  d->mode = p->mode;
+  d->sigma_r = p->sigma_r;
+  d->sigma_s = p->sigma_s;
+  d->detail = p->detail;
+  d->midtone = p->midtone;
+  d->fast = p->fast;
 
 #ifdef HAVE_OPENCL
   if(d->mode == s_mode_bilateral)
@@ -282,18 +327,26 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
 #endif
   if(d->mode == s_mode_local_laplacian)
     piece->process_tiling_ready = 0; // can't deal with tiles, sorry.
+  else
+    local_laplacian_cache_free(d->cache); // don't hold on to the pyramid of an unused filter
 }
 
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = calloc(1, sizeof(dt_iop_bilat_data_t));
-  piece->data_size = sizeof(dt_iop_bilat_data_t);
+  dt_iop_bilat_data_t *d = calloc(1, sizeof(dt_iop_bilat_data_t));
+  d->cache = calloc(1, sizeof(local_laplacian_cache_t));
+  piece->data = d;
+  // the cache pointer is last and not constant: only hash the parameters
+  piece->data_size = offsetof(dt_iop_bilat_data_t, cache);
 }
 
 
 void cleanup_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
+  dt_iop_bilat_data_t *d = (dt_iop_bilat_data_t *)piece->data;
+  local_laplacian_cache_free(d->cache);
+  free(d->cache);
   free(piece->data);
   piece->data = NULL;
 }
@@ -315,15 +368,20 @@ void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, c
 
   if(d->mode == s_mode_bilateral)
   {
-    dt_bilateral_t *b = dt_bilateral_init(roi_in->width, roi_in->height, sigma_s, sigma_r);
-    dt_bilateral_splat(b, (float *)i);
-    dt_bilateral_blur(b);
+    // the grid only depends on the input: it is reused while the detail changes
+    dt_bilateral_t *b = dt_bilateral_shared((float *)i, roi_in->width, roi_in->height, sigma_s, sigma_r);
+    if(!b)
+    {
+      dt_iop_copy_image_roi((float *)o, (const float *)i, 4, roi_in, roi_out, TRUE);
+      return;
+    }
     dt_bilateral_slice(b, (float *)i, (float *)o, d->detail);
     dt_bilateral_free(b);
   }
   else // s_mode_local_laplacian
   {
-    local_laplacian_sse2(i, o, roi_in->width, roi_in->height, d->midtone, d->sigma_s, d->sigma_r, d->detail, 0);
+    local_laplacian_sse2(i, o, roi_in->width, roi_in->height, d->midtone, d->sigma_s, d->sigma_r, d->detail,
+                         d->fast, 0, d->cache);
   }
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(i, o, roi_in->width, roi_in->height);
@@ -345,15 +403,20 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
   if(d->mode == s_mode_bilateral)
   {
-    dt_bilateral_t *b = dt_bilateral_init(roi_in->width, roi_in->height, sigma_s, sigma_r);
-    dt_bilateral_splat(b, (float *)i);
-    dt_bilateral_blur(b);
+    // the grid only depends on the input: it is reused while the detail changes
+    dt_bilateral_t *b = dt_bilateral_shared((float *)i, roi_in->width, roi_in->height, sigma_s, sigma_r);
+    if(!b)
+    {
+      dt_iop_copy_image_roi((float *)o, (const float *)i, 4, roi_in, roi_out, TRUE);
+      return;
+    }
     dt_bilateral_slice(b, (float *)i, (float *)o, d->detail);
     dt_bilateral_free(b);
   }
   else // s_mode_local_laplacian
   {
-    local_laplacian(i, o, roi_in->width, roi_in->height, d->midtone, d->sigma_s, d->sigma_r, d->detail, 0);
+    local_laplacian(i, o, roi_in->width, roi_in->height, d->midtone, d->sigma_s, d->sigma_r, d->detail,
+                    d->fast, 0, d->cache);
   }
 
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(i, o, roi_in->width, roi_in->height);
@@ -390,6 +453,7 @@ void gui_changed(dt_iop_module_t *self, GtkWidget *w, void *previous)
     gtk_widget_set_visible(g->highlights, p->mode == s_mode_local_laplacian);
     gtk_widget_set_visible(g->shadows, p->mode == s_mode_local_laplacian);
     gtk_widget_set_visible(g->midtone, p->mode == s_mode_local_laplacian);
+    gtk_widget_set_visible(g->fast, p->mode == s_mode_local_laplacian);
     gtk_widget_set_visible(g->range, p->mode != s_mode_local_laplacian);
     gtk_widget_set_visible(g->spatial, p->mode != s_mode_local_laplacian);
   }
@@ -416,6 +480,7 @@ void gui_update(dt_iop_module_t *self)
     dt_bauhaus_slider_set(g->highlights, 0.5f);
     dt_bauhaus_slider_set(g->shadows, 0.5f);
   }
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(g->fast), p->fast);
 
   gui_changed(self, NULL, NULL);
 }
@@ -464,10 +529,15 @@ void gui_init(dt_iop_module_t *self)
   dt_bauhaus_slider_set_digits(g->midtone, 3);
   gtk_widget_set_tooltip_text(g->midtone, _("defines what counts as mid-tones. lower for better dynamic range compression (reduce shadow and highlight contrast), increase for more powerful local contrast"));
 
+  g->fast = dt_bauhaus_toggle_from_params(self, "fast");
+  gtk_widget_set_tooltip_text(g->fast, _("use fewer brightness levels, interpolated smoothly.\n"
+                                         "faster, but less accurate for strong settings."));
+
   // work around multi-instance issue which calls show all a fair bit:
   g_object_set(G_OBJECT(g->highlights), "no-show-all", TRUE, NULL);
   g_object_set(G_OBJECT(g->shadows), "no-show-all", TRUE, NULL);
   g_object_set(G_OBJECT(g->midtone), "no-show-all", TRUE, NULL);
+  g_object_set(G_OBJECT(g->fast), "no-show-all", TRUE, NULL);
   g_object_set(G_OBJECT(g->range), "no-show-all", TRUE, NULL);
   g_object_set(G_OBJECT(g->spatial), "no-show-all", TRUE, NULL);
 
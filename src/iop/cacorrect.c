@@ -89,7 +89,7 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_DEPRECATED;
+  return IOP_FLAGS_ONE_INSTANCE | IOP_FLAGS_DEPRECATED | IOP_FLAGS_SKIP_IN_DRAFT;
 }
 
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -19,8 +19,10 @@
 #include "config.h"
 #endif
 #include "bauhaus/bauhaus.h"
+#include "common/clahe.h"
 #include "common/colorspaces.h"
 #include "common/darktable.h"
+#include "common/imagebuf.h"
 #include "common/math.h"
 #include "control/control.h"
 #include "develop/develop.h"
@@ -35,27 +37,34 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define ROUND_POSISTIVE(f) ((unsigned int)((f)+0.5))
+DT_MODULE(2)
 
-DT_MODULE(1)
+typedef struct dt_iop_rlce_params_v1_t
+{
+  double radius;
+  double slope;
+} dt_iop_rlce_params_v1_t;
 
 typedef struct dt_iop_rlce_params_t
 {
   double radius;
   double slope;
+  int method; // dt_clahe_method_t
 } dt_iop_rlce_params_t;
 
 typedef struct dt_iop_rlce_gui_data_t
 {
   GtkBox *vbox1, *vbox2;
-  GtkWidget *label1, *label2;
+  GtkWidget *label1, *label2, *label3;
   GtkWidget *scale1, *scale2; // radie pixels, slope
+  GtkWidget *method;
 } dt_iop_rlce_gui_data_t;
 
 typedef struct dt_iop_rlce_data_t
 {
   double radius;
   double slope;
+  dt_clahe_method_t method;
 } dt_iop_rlce_data_t;
 
 
@@ -79,6 +88,21 @@ int flags()
   return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_DEPRECATED;
 }
 
+int legacy_params(dt_iop_module_t *self, const void *const old_params, const int old_version,
+                  void *new_params, const int new_version)
+{
+  if(old_version == 1 && new_version == 2)
+  {
+    const dt_iop_rlce_params_v1_t *o = (dt_iop_rlce_params_v1_t *)old_params;
+    dt_iop_rlce_params_t *n = (dt_iop_rlce_params_t *)new_params;
+    n->radius = o->radius;
+    n->slope = o->slope;
+    n->method = DT_CLAHE_SLIDING;
+    return 0;
+  }
+  return 1;
+}
+
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
   return IOP_CS_RGB;
@@ -116,141 +140,44 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 
   // Params
   const int rad = data->radius * roi_in->scale / piece->iscale;
-
-#define BINS (256)
-
   const float slope = data->slope;
 
-  size_t destbuf_size;
-  float *const restrict dest_buf = dt_alloc_perthread_float(roi_out->width, &destbuf_size);
+  // CLAHE
+  float *const dest = dt_alloc_align_float((size_t)roi_out->width * roi_out->height);
+  if(!dest || dt_clahe(luminance, dest, roi_out->width, roi_out->height, rad, slope, data->method))
+  {
+    // out of memory, so just copy image through to output
+    dt_iop_copy_image_roi(ovoid, ivoid, ch, roi_in, roi_out, TRUE);
+    dt_free_align(dest);
+    free(luminance);
+    return;
+  }
 
-// CLAHE
+  // Apply
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(ch, dest_buf, destbuf_size, ivoid, ovoid, rad, roi_in, \
-                      roi_out, slope) \
-  shared(luminance) \
+  dt_omp_firstprivate(ch, dest, ivoid, ovoid, roi_out) \
   schedule(static)
 #endif
   for(int j = 0; j < roi_out->height; j++)
   {
-    int yMin = fmax(0, j - rad);
-    int yMax = fmin(roi_in->height, j + rad + 1);
-    int h = yMax - yMin;
-
-    int xMin0 = fmax(0, 0 - rad);
-    int xMax0 = fmin(roi_in->width - 1, rad);
-
-    int hist[BINS + 1];
-    int clippedhist[BINS + 1];
-
-    float *dest = dt_get_perthread(dest_buf, destbuf_size);
-
-    /* initially fill histogram */
-    memset(hist, 0, sizeof(int) * (BINS + 1));
-    for(int yi = yMin; yi < yMax; ++yi)
-      for(int xi = xMin0; xi < xMax0; ++xi)
-        ++hist[ROUND_POSISTIVE(luminance[(size_t)yi * roi_in->width + xi] * (float)BINS)];
-
-    // Destination row
-    memset(dest, 0, sizeof(float) * roi_out->width);
-    float *ld = dest;
-
-    for(int i = 0; i < roi_out->width; i++)
-    {
-
-      int v = ROUND_POSISTIVE(luminance[(size_t)j * roi_in->width + i] * (float)BINS);
-
-      int xMin = fmax(0, i - rad);
-      int xMax = i + rad + 1;
-      int w = fmin(roi_in->width, xMax) - xMin;
-      int n = h * w;
-
-      int limit = (int)(slope * n / BINS + 0.5f);
-
-      /* remove left behind values from histogram */
-      if(xMin > 0)
-      {
-        int xMin1 = xMin - 1;
-        for(int yi = yMin; yi < yMax; ++yi)
-          --hist[ROUND_POSISTIVE(luminance[(size_t)yi * roi_in->width + xMin1] * (float)BINS)];
-      }
-
-      /* add newly included values to histogram */
-      if(xMax <= roi_in->width)
-      {
-        int xMax1 = xMax - 1;
-        for(int yi = yMin; yi < yMax; ++yi)
-          ++hist[ROUND_POSISTIVE(luminance[(size_t)yi * roi_in->width + xMax1] * (float)BINS)];
-      }
-
-      /* clip histogram and redistribute clipped entries */
-      memcpy(clippedhist, hist, sizeof(int) * (BINS + 1));
-      int ce = 0, ceb = 0;
-      do
-      {
-        ceb = ce;
-        ce = 0;
-        for(int b = 0; b <= BINS; b++)
-        {
-          int d = clippedhist[b] - limit;
-          if(d > 0)
-          {
-            ce += d;
-            clippedhist[b] = limit;
-          }
-        }
-
-        int d = (ce / (float)(BINS + 1));
-        int m = ce % (BINS + 1);
-        for(int b = 0; b <= BINS; b++) clippedhist[b] += d;
-
-        if(m != 0)
-        {
-          int s = BINS / (float)m;
-          for(int b = 0; b <= BINS; b += s) ++clippedhist[b];
-        }
-      } while(ce != ceb);
-
-      /* build cdf of clipped histogram */
-      unsigned int hMin = BINS;
-      for(int b = 0; b < hMin; b++)
-        if(clippedhist[b] != 0) hMin = b;
-
-      int cdf = 0;
-      for(int b = hMin; b <= v; b++) cdf += clippedhist[b];
-
-      int cdfMax = cdf;
-      for(int b = v + 1; b <= BINS; b++) cdfMax += clippedhist[b];
-
-      int cdfMin = clippedhist[hMin];
-
-      *ld = (cdf - cdfMin) / (float)(cdfMax - cdfMin);
-
-      ld++;
-    }
-
-    // Apply row
-    float *in = ((float *)ivoid) + (size_t)j * roi_out->width * ch;
+    const float *in = ((float *)ivoid) + (size_t)j * roi_out->width * ch;
     float *out = ((float *)ovoid) + (size_t)j * roi_out->width * ch;
+    const float *ld = dest + (size_t)j * roi_out->width;
     for(int r = 0; r < roi_out->width; r++)
     {
       float H, S, L;
       rgb2hsl(in, &H, &S, &L);
       // hsl2rgb(out,H,S,( L / dest[r] ) * (L-lsmin) + lsmin );
-      hsl2rgb(out, H, S, dest[r]);
+      hsl2rgb(out, H, S, ld[r]);
       out += ch;
       in += ch;
-      ld++;
     }
   }
 
-  dt_free_align(dest_buf);
-
   // Cleanup
+  dt_free_align(dest);
   free(luminance);
-
-#undef BINS
 }
 
 static void radius_callback(GtkWidget *slider, gpointer user_data)
@@ -271,7 +198,14 @@ static void slope_callback(GtkWidget *slider, gpointer user_data)
   dt_dev_add_history_item(darktable.develop, self, TRUE);
 }
 
-
+static void method_callback(GtkWidget *combo, gpointer user_data)
+{
+  dt_iop_module_t *self = (dt_iop_module_t *)user_data;
+  if(darktable.gui->reset) return;
+  dt_iop_rlce_params_t *p = (dt_iop_rlce_params_t *)self->params;
+  p->method = dt_bauhaus_combobox_get(combo);
+  dt_dev_add_history_item(darktable.develop, self, TRUE);
+}
 
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe,
                    dt_dev_pixelpipe_iop_t *piece)
@@ -281,6 +215,7 @@ void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pix
 
   d->radius = p->radius;
   d->slope = p->slope;
+  d->method = p->method;
 }
 
 void init_pipe(struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -301,6 +236,7 @@ void gui_update(struct dt_iop_module_t *self)
   dt_iop_rlce_params_t *p = (dt_iop_rlce_params_t *)self->params;
   dt_bauhaus_slider_set(g->scale1, p->radius);
   dt_bauhaus_slider_set(g->scale2, p->slope);
+  dt_bauhaus_combobox_set(g->method, p->method);
 }
 
 void init(dt_iop_module_t *module)
@@ -310,7 +246,7 @@ void init(dt_iop_module_t *module)
   module->default_enabled = 0;
   module->params_size = sizeof(dt_iop_rlce_params_t);
   module->gui_data = NULL;
-  *((dt_iop_rlce_params_t *)module->default_params) = (dt_iop_rlce_params_t){ 64, 1.25 };
+  *((dt_iop_rlce_params_t *)module->default_params) = (dt_iop_rlce_params_t){ 64, 1.25, DT_CLAHE_SLIDING };
 }
 
 void cleanup(dt_iop_module_t *module)
@@ -337,6 +273,8 @@ void gui_init(struct dt_iop_module_t *self)
   gtk_box_pack_start(GTK_BOX(g->vbox1), g->label1, TRUE, TRUE, 0);
   g->label2 = dtgtk_reset_label_new(_("amount"), self, &p->slope, sizeof(float));
   gtk_box_pack_start(GTK_BOX(g->vbox1), g->label2, TRUE, TRUE, 0);
+  g->label3 = dtgtk_reset_label_new(_("method"), self, &p->method, sizeof(int));
+  gtk_box_pack_start(GTK_BOX(g->vbox1), g->label3, TRUE, TRUE, 0);
 
   g->scale1 = dt_bauhaus_slider_new_with_range(darktable.bauhaus, DT_GUI_MODULE(NULL), 0.0, 256.0, 0, p->radius, 0);
   g->scale2 = dt_bauhaus_slider_new_with_range(darktable.bauhaus, DT_GUI_MODULE(NULL), 1.0, 3.0, 0, p->slope, 2);
@@ -344,11 +282,21 @@ void gui_init(struct dt_iop_module_t *self)
 
   gtk_box_pack_start(GTK_BOX(g->vbox2), GTK_WIDGET(g->scale1), TRUE, TRUE, 0);
   gtk_box_pack_start(GTK_BOX(g->vbox2), GTK_WIDGET(g->scale2), TRUE, TRUE, 0);
+
+  g->method = dt_bauhaus_combobox_new(darktable.bauhaus, DT_GUI_MODULE(NULL));
+  dt_bauhaus_combobox_add(g->method, _("exact"));
+  dt_bauhaus_combobox_add(g->method, _("interpolated"));
+  dt_bauhaus_combobox_set(g->method, p->method);
+  gtk_box_pack_start(GTK_BOX(g->vbox2), GTK_WIDGET(g->method), TRUE, TRUE, 0);
   gtk_widget_set_tooltip_text(GTK_WIDGET(g->scale1), _("size of features to preserve"));
   gtk_widget_set_tooltip_text(GTK_WIDGET(g->scale2), _("strength of the effect"));
+  gtk_widget_set_tooltip_text(g->method, _("exact: equalize the neighbourhood of every pixel.\n"
+                                           "interpolated: equalize the neighbourhoods of a grid of points, and "
+                                           "interpolate between them. much faster, slightly smoother."));
 
   g_signal_connect(G_OBJECT(g->scale1), "value-changed", G_CALLBACK(radius_callback), self);
   g_signal_connect(G_OBJECT(g->scale2), "value-changed", G_CALLBACK(slope_callback), self);
+  g_signal_connect(G_OBJECT(g->method), "value-changed", G_CALLBACK(method_callback), self);
 }
 
 // clang-format off
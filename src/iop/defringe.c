@@ -92,7 +92,7 @@ int default_group()
 int flags()
 {
   // a second instance might help to reduce artifacts when thick fringe needs to be removed
-  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_DEPRECATED;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_DEPRECATED | IOP_FLAGS_SKIP_IN_DRAFT;
 }
 
 const char *deprecated_msg()
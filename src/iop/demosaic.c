@@ -125,6 +125,15 @@ typedef enum dt_iop_demosaic_lmmse_t
   LMMSE_REFINE_4 = 4,   // $DESCRIPTION: "2x refine + medians"
 } dt_iop_demosaic_lmmse_t;
 
+// CPU kernels working on internal tiles, whose size can be benchmarked per machine, see demosaic/tilesize.c
+typedef enum dt_iop_demosaic_tiled_t
+{
+  DEMOSAIC_TILED_RCD = 0,
+  DEMOSAIC_TILED_LMMSE = 1,
+  DEMOSAIC_TILED_MARKESTEIJN = 2,
+  DEMOSAIC_TILED_LAST
+} dt_iop_demosaic_tiled_t;
+
 typedef struct dt_iop_demosaic_global_data_t
 {
   // demosaic pattern
@@ -180,6 +189,7 @@ typedef struct dt_iop_demosaic_global_data_t
   int kernel_write_blended_dual;
   float *lmmse_gamma_in;
   float *lmmse_gamma_out;
+  int tilesize[DEMOSAIC_TILED_LAST];
 } dt_iop_demosaic_global_data_t;
 
 
@@ -240,6 +250,12 @@ static int demosaic_qual_flags(const dt_dev_pixelpipe_iop_t *const piece,
                                const dt_image_t *const img,
                                const dt_iop_roi_t *const roi_out)
 {
+  // draft thumbnails: when the output is at least 2x (Bayer) or 3x (X-Trans) smaller
+  // than the sensor data, bin the CFA straight into RGB pixels instead of interpolating
+  // at full size and downscaling afterwards
+  if(piece->pipe->draft && roi_out->scale <= ((piece->pipe->dsc.filters == 9u) ? 1.f / 3.f : 0.5f))
+    return 0;
+
   return DEMOSAIC_FULL_SCALE | DEMOSAIC_XTRANS_FULL;
 }
 
@@ -263,6 +279,7 @@ void amaze_demosaic_RT(
 #include "demosaic/vng.c"
 #include "demosaic/markesteijn.c"
 #include "demosaic/dual.c"
+#include "demosaic/tilesize.c"
 
 
 const char *name()
@@ -536,11 +553,13 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     {
       const int passes = (demosaicing_method == DT_IOP_DEMOSAIC_MARKESTEIJN) ? 1 : 3;
       if(demosaicing_method == DT_IOP_DEMOSAIC_MARKEST3_VNG)
-        xtrans_markesteijn_interpolate(tmp, pixels, &roo, &roi, xtrans, passes);
+        xtrans_markesteijn_interpolate(tmp, pixels, &roo, &roi, xtrans, passes,
+                                       gd->tilesize[DEMOSAIC_TILED_MARKESTEIJN]);
       else if(demosaicing_method == DT_IOP_DEMOSAIC_FDC && (qual_flags & DEMOSAIC_XTRANS_FULL))
         xtrans_fdc_interpolate(self, tmp, pixels, &roo, &roi, xtrans);
       else if(demosaicing_method >= DT_IOP_DEMOSAIC_MARKESTEIJN && (qual_flags & DEMOSAIC_XTRANS_FULL))
-        xtrans_markesteijn_interpolate(tmp, pixels, &roo, &roi, xtrans, passes);
+        xtrans_markesteijn_interpolate(tmp, pixels, &roo, &roi, xtrans, passes,
+                                       gd->tilesize[DEMOSAIC_TILED_MARKESTEIJN]);
       else
         vng_interpolate(tmp, pixels, &roo, &roi, piece->pipe->dsc.filters, xtrans, qual_flags & DEMOSAIC_ONLY_VNG_LINEAR);
     }
@@ -584,7 +603,7 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       }
       else if((demosaicing_method & ~DEMOSAIC_DUAL) == DT_IOP_DEMOSAIC_RCD)
       {
-        rcd_demosaic(piece, tmp, in, &roo, &roi, piece->pipe->dsc.filters);
+        rcd_demosaic(piece, tmp, in, &roo, &roi, piece->pipe->dsc.filters, gd->tilesize[DEMOSAIC_TILED_RCD]);
       }
       else if(demosaicing_method == DT_IOP_DEMOSAIC_LMMSE)
       {
@@ -592,17 +611,10 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
         {
           gd->lmmse_gamma_in = dt_alloc_align_float(65536);
           gd->lmmse_gamma_out = dt_alloc_align_float(65536);
-#ifdef _OPENMP
-    #pragma omp for
-#endif
-          for(int j = 0; j < 65536; j++)
-          {
-            const double x = (double)j / 65535.0;
-            gd->lmmse_gamma_in[j]  = (x <= 0.001867) ? x * 17.0 : 1.044445 * exp(log(x) / 2.4) - 0.044445;
-            gd->lmmse_gamma_out[j] = (x <= 0.031746) ? x / 17.0 : exp(log((x + 0.044445) / 1.044445) * 2.4);
-          }
+          lmmse_gamma_tables(gd->lmmse_gamma_in, gd->lmmse_gamma_out);
         }
-        lmmse_demosaic(piece, tmp, in, &roo, &roi, piece->pipe->dsc.filters, data->lmmse_refine, gd->lmmse_gamma_in, gd->lmmse_gamma_out);
+        lmmse_demosaic(piece, tmp, in, &roo, &roi, piece->pipe->dsc.filters, data->lmmse_refine, gd->lmmse_gamma_in,
+                       gd->lmmse_gamma_out, gd->tilesize[DEMOSAIC_TILED_LMMSE]);
       }
       else if((demosaicing_method & ~DEMOSAIC_DUAL) != DT_IOP_DEMOSAIC_AMAZE)
         demosaic_ppg(tmp, in, &roo, &roi, piece->pipe->dsc.filters,
@@ -1076,6 +1088,7 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
                      struct dt_develop_tiling_t *tiling)
 {
   dt_iop_demosaic_data_t *data = (dt_iop_demosaic_data_t *)piece->data;
+  const dt_iop_demosaic_global_data_t *gd = (dt_iop_demosaic_global_data_t *)self->global_data;
 
   const float ioratio = (float)roi_out->width * roi_out->height / ((float)roi_in->width * roi_in->height);
   const float smooth = data->color_smoothing ? ioratio : 0.0f;
@@ -1149,7 +1162,7 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
     else
       tiling->factor += smooth;                        // + smooth
     tiling->maxbuf = 1.0f;
-    tiling->overhead = sizeof(float) * RCD_TILESIZE * RCD_TILESIZE * 8 * MAX(1, darktable.num_openmp_threads);
+    tiling->overhead = sizeof(float) * gd->tilesize[DEMOSAIC_TILED_RCD] * gd->tilesize[DEMOSAIC_TILED_RCD] * 8 * MAX(1, darktable.num_openmp_threads);
     tiling->xalign = 2;
     tiling->yalign = 2;
     tiling->overlap = 10;
@@ -1165,7 +1178,7 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
     else
       tiling->factor += smooth;                        // + smooth
     tiling->maxbuf = 1.0f;
-    tiling->overhead = sizeof(float) * LMMSE_GRP * LMMSE_GRP * 6 * MAX(1, darktable.num_openmp_threads);
+    tiling->overhead = sizeof(float) * gd->tilesize[DEMOSAIC_TILED_LMMSE] * gd->tilesize[DEMOSAIC_TILED_LMMSE] * 6 * MAX(1, darktable.num_openmp_threads);
     tiling->xalign = 2;
     tiling->yalign = 2;
     tiling->overlap = 10;
@@ -1266,6 +1279,20 @@ void init_global(dt_iop_module_so_t *module)
   gd->kernel_write_blended_dual  = dt_opencl_create_kernel(rcd, "write_blended_dual");
   gd->lmmse_gamma_in = NULL;
   gd->lmmse_gamma_out = NULL;
+
+  // benchmarked only by ansel-cli --autotune
+  demosaic_tilesize_load(gd->tilesize);
+}
+
+void autotune(dt_iop_module_so_t *module)
+{
+  int tilesize[DEMOSAIC_TILED_LAST];
+  demosaic_tilesize_benchmark(tilesize);
+  demosaic_tilesize_save(tilesize);
+
+  // pipes started from now on use the new sizes
+  dt_iop_demosaic_global_data_t *gd = (dt_iop_demosaic_global_data_t *)module->data;
+  if(gd) memcpy(gd->tilesize, tilesize, sizeof(tilesize));
 }
 
 void cleanup_global(dt_iop_module_so_t *module)
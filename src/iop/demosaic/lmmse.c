@@ -42,6 +42,10 @@
    The performance has been tested on a E-2288G for 45mpix images, tiling improves performance > 2-fold.
    times in sec: basic (0.5->0.15), median (0.6->0.18), 3xmedian (0.8->0.22), 3xmedian + 2x refine (1.2->0.30)
    The default is now 2 times slower than RCD and 2 times faster than AMaZE
+
+   Each tile reads its neighbours' data into its border, and the overlap is wide enough for the median
+   and refine passes, so the result doesn't depend on the tile size. The size is given at runtime and
+   benchmarked per machine in demosaic/tilesize.c, it has to be 40 + a multiple of 8.
 */
 
 #ifndef LMMSE_GRP
@@ -53,14 +57,8 @@
   #pragma GCC optimize ("fast-math", "fp-contract=fast", "finite-math-only", "no-math-errno")
 #endif
 
-#define LMMSE_OVERLAP 8
+#define LMMSE_OVERLAP 16
 #define BORDER_AROUND 4
-#define LMMSE_TILESIZE (LMMSE_GRP - 2 * BORDER_AROUND)
-#define LMMSE_TILEVALID (LMMSE_TILESIZE - 2 * LMMSE_OVERLAP)
-#define w1 (LMMSE_GRP)
-#define w2 (LMMSE_GRP * 2)
-#define w3 (LMMSE_GRP * 3)
-#define w4 (LMMSE_GRP * 4)
 
 static INLINE float limf(float x, float min, float max)
 {
@@ -128,11 +126,23 @@ static INLINE float calc_gamma(float val, float *table)
   return (p1 + p2 * diff);
 }
 
+// gamma_in and gamma_out hold 65536 floats each
+static void lmmse_gamma_tables(float *const restrict gamma_in, float *const restrict gamma_out)
+{
+  for(int j = 0; j < 65536; j++)
+  {
+    const double x = (double)j / 65535.0;
+    gamma_in[j]  = (x <= 0.001867) ? x * 17.0 : 1.044445 * exp(log(x) / 2.4) - 0.044445;
+    gamma_out[j] = (x <= 0.031746) ? x / 17.0 : exp(log((x + 0.044445) / 1.044445) * 2.4);
+  }
+}
+
 #ifdef _OPENMP
   #pragma omp declare simd aligned(in, out, gamma_in, gamma_out)
 #endif
 static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict out, const float *const restrict in, dt_iop_roi_t *const roi_out,
-                                   const dt_iop_roi_t *const roi_in, const uint32_t filters, const uint32_t mode, float *const restrict gamma_in, float *const restrict gamma_out)
+                                   const dt_iop_roi_t *const roi_in, const uint32_t filters, const uint32_t mode, float *const restrict gamma_in, float *const restrict gamma_out,
+                                   const int grp)
 {
   const int width = roi_in->width;
   const int height = roi_in->height;
@@ -163,22 +173,25 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
   const float scaler = fmaxf(piece->pipe->dsc.processed_maximum[0], fmaxf(piece->pipe->dsc.processed_maximum[1], piece->pipe->dsc.processed_maximum[2]));
   const float revscaler = 1.0f / scaler;
 
-  const int num_vertical =   1 + (height - 2 * LMMSE_OVERLAP -1) / LMMSE_TILEVALID;
-  const int num_horizontal = 1 + (width  - 2 * LMMSE_OVERLAP -1) / LMMSE_TILEVALID;
+  const int tilesize = grp - 2 * BORDER_AROUND;
+  const int tilevalid = tilesize - 2 * LMMSE_OVERLAP;
+  const int w1 = grp, w2 = grp * 2, w3 = grp * 3, w4 = grp * 4;
+
+  const int num_vertical =   1 + (height - 2 * LMMSE_OVERLAP -1) / tilevalid;
+  const int num_horizontal = 1 + (width  - 2 * LMMSE_OVERLAP -1) / tilevalid;
 #ifdef _OPENMP
   #pragma omp parallel \
-  dt_omp_firstprivate(width, height, out, in, scaler, revscaler, filters)
+  dt_omp_firstprivate(width, height, out, in, scaler, revscaler, filters, grp, tilesize, tilevalid, w1, w2, w3, w4)
 #endif
   {
     float *qix[6];
-    float *buffer = dt_alloc_align_float(LMMSE_GRP * LMMSE_GRP * 6);
+    float *buffer = dt_alloc_align_float(grp * grp * 6);
 
     qix[0] = buffer;
     for(int i = 1; i < 6; i++)
     {
-      qix[i] = qix[i - 1] + LMMSE_GRP * LMMSE_GRP;
+      qix[i] = qix[i - 1] + grp * grp;
     }
-    memset_zero(buffer, sizeof(float) * LMMSE_GRP * LMMSE_GRP * 6);
 
 #ifdef _OPENMP
   #pragma omp for schedule(simd:dynamic, 6) collapse(2)
@@ -187,26 +200,29 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
     {
       for(int tile_horizontal = 0; tile_horizontal < num_horizontal; tile_horizontal++)
       {
-        const int rowStart = tile_vertical * LMMSE_TILEVALID;
-        const int rowEnd = MIN(rowStart + LMMSE_TILESIZE, height);
+        const int rowStart = tile_vertical * tilevalid;
+        const int rowEnd = MIN(rowStart + tilesize, height);
 
-        const int colStart = tile_horizontal * LMMSE_TILEVALID;
-        const int colEnd = MIN(colStart + LMMSE_TILESIZE, width);
+        const int colStart = tile_horizontal * tilevalid;
+        const int colEnd = MIN(colStart + tilesize, width);
 
-        const int tileRows = MIN(rowEnd - rowStart, LMMSE_TILESIZE);
-        const int tileCols = MIN(colEnd - colStart, LMMSE_TILESIZE);
+        const int tileRows = MIN(rowEnd - rowStart, tilesize);
+        const int tileCols = MIN(colEnd - colStart, tilesize);
 
-        // index limit; normally is LMMSE_GRP but maybe missing bottom lines or right columns for outermost tile
+        // index limit; normally is grp but maybe missing bottom lines or right columns for outermost tile
         const int last_rr = tileRows + 2 * BORDER_AROUND;
         const int last_cc = tileCols + 2 * BORDER_AROUND;
 
-        for(int rrr = BORDER_AROUND, row = rowStart; rrr < tileRows + BORDER_AROUND; rrr++, row++)
+        // start from a clean buffer, and read the border from the neighbouring tiles so the result
+        // doesn't depend on the tile size, nor on the tiles processed before by this thread
+        memset_zero(buffer, sizeof(float) * grp * grp * 6);
+        for(int rrr = 0, row = rowStart - BORDER_AROUND; rrr < tileRows + 2 * BORDER_AROUND; rrr++, row++)
         {
-          float *cfa = qix[5] + rrr * LMMSE_GRP + BORDER_AROUND;
-          int idx = row * width + colStart;
-          for(int ccc = BORDER_AROUND, col = colStart; ccc < tileCols + BORDER_AROUND; ccc++, col++, cfa++, idx++)
+          float *cfa = qix[5] + rrr * grp;
+          for(int ccc = 0, col = colStart - BORDER_AROUND; ccc < tileCols + 2 * BORDER_AROUND; ccc++, col++)
           {
-            cfa[0] = calc_gamma(revscaler * in[idx], gamma_in);
+            const gboolean inside = ((row >= 0) && (row < height) && (col >= 0) && (col < width));
+            cfa[ccc] = (inside) ? calc_gamma(revscaler * in[(size_t)row * width + col], gamma_in) : 0.0f;
           }
         }
 
@@ -216,17 +232,17 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
           // G-R(B) at R(B) location
           for(int cc = 2 + (FC(rr, 2, filters) & 1); cc < last_cc - 2; cc += 2)
           {
-            float *cfa = qix[5] + rr * LMMSE_GRP + cc;
+            float *cfa = qix[5] + rr * grp + cc;
             const float v0 = 0.0625f * (cfa[-w1 - 1] + cfa[-w1 + 1] + cfa[w1 - 1] + cfa[w1 + 1]) + 0.25f * cfa[0];
             // horizontal
-            float *hdiff = qix[0] + rr * LMMSE_GRP + cc;
+            float *hdiff = qix[0] + rr * grp + cc;
             hdiff[0] = -0.25f * (cfa[ -2] + cfa[ 2]) + 0.5f * (cfa[ -1] + cfa[0] + cfa[ 1]);
             const float Y0 = v0 + 0.5f * hdiff[0];
             hdiff[0] = (cfa[0] > 1.75f * Y0) ? median3f(hdiff[0], cfa[ -1], cfa[ 1]) : limf(hdiff[0], 0.0f, 1.0f);
             hdiff[0] -= cfa[0];
 
             // vertical
-            float *vdiff = qix[1] + rr * LMMSE_GRP + cc;
+            float *vdiff = qix[1] + rr * grp + cc;
             vdiff[0] = -0.25f * (cfa[-w2] + cfa[w2]) + 0.5f * (cfa[-w1] + cfa[0] + cfa[w1]);
             const float Y1 = v0 + 0.5f * vdiff[0];
             vdiff[0] = (cfa[0] > 1.75f * Y1) ? median3f(vdiff[0], cfa[-w1], cfa[w1]) : limf(vdiff[0], 0.0f, 1.0f);
@@ -236,9 +252,9 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
           // G-R(B) at G location
           for(int ccc = 2 + (FC(rr, 3, filters) & 1); ccc < last_cc - 2; ccc += 2)
           {
-            float *cfa = qix[5] + rr * LMMSE_GRP + ccc;
-            float *hdiff = qix[0] + rr * LMMSE_GRP + ccc;
-            float *vdiff = qix[1] + rr * LMMSE_GRP + ccc;
+            float *cfa = qix[5] + rr * grp + ccc;
+            float *hdiff = qix[0] + rr * grp + ccc;
+            float *vdiff = qix[1] + rr * grp + ccc;
             hdiff[0] = 0.25f * (cfa[ -2] + cfa[ 2]) - 0.5f * (cfa[ -1] + cfa[0] + cfa[ 1]);
             vdiff[0] = 0.25f * (cfa[-w2] + cfa[w2]) - 0.5f * (cfa[-w1] + cfa[0] + cfa[w1]);
             hdiff[0] = limf(hdiff[0], -1.0f, 0.0f) + cfa[0];
@@ -251,10 +267,10 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
         {
           for(int cc = 4; cc < last_cc - 4; cc++)
           {
-            float *hdiff = qix[0] + rr * LMMSE_GRP + cc;
-            float *vdiff = qix[1] + rr * LMMSE_GRP + cc;
-            float *hlp   = qix[2] + rr * LMMSE_GRP + cc;
-            float *vlp   = qix[3] + rr * LMMSE_GRP + cc;
+            float *hdiff = qix[0] + rr * grp + cc;
+            float *vdiff = qix[1] + rr * grp + cc;
+            float *hlp   = qix[2] + rr * grp + cc;
+            float *vlp   = qix[3] + rr * grp + cc;
             hlp[0] = h0 * hdiff[0] + h1 * (hdiff[ -1] + hdiff[ 1]) + h2 * (hdiff[ -2] + hdiff[ 2]) + h3 * (hdiff[ -3] + hdiff[ 3]) + h4 * (hdiff[ -4] + hdiff[ 4]);
             vlp[0] = h0 * vdiff[0] + h1 * (vdiff[-w1] + vdiff[w1]) + h2 * (vdiff[-w2] + vdiff[w2]) + h3 * (vdiff[-w3] + vdiff[w3]) + h4 * (vdiff[-w4] + vdiff[w4]);
           }
@@ -264,11 +280,11 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
         {
           for(int cc = 4 + (FC(rr, 4, filters) & 1); cc < last_cc - 4; cc += 2)
           {
-            float *hdiff = qix[0] + rr * LMMSE_GRP + cc;
-            float *vdiff = qix[1] + rr * LMMSE_GRP + cc;
-            float *hlp   = qix[2] + rr * LMMSE_GRP + cc;
-            float *vlp   = qix[3] + rr * LMMSE_GRP + cc;
-            float *interp = qix[4] + rr * LMMSE_GRP + cc;
+            float *hdiff = qix[0] + rr * grp + cc;
+            float *vdiff = qix[1] + rr * grp + cc;
+            float *hlp   = qix[2] + rr * grp + cc;
+            float *vlp   = qix[3] + rr * grp + cc;
+            float *interp = qix[4] + rr * grp + cc;
             // horizontal
             float p1 = hlp[-4];
             float p2 = hlp[-3];
@@ -330,12 +346,12 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
           {
             const int c = FC(rr, cc, filters);
             const gboolean inside = ((row_in >= 0) && (row_in < height) && (col_in >= 0) && (col_in < width));
-            float *colc = qix[c] + rr * LMMSE_GRP + cc;
-            colc[0] = (inside) ? qix[5][rr * LMMSE_GRP + cc] : 0.0f;
+            float *colc = qix[c] + rr * grp + cc;
+            colc[0] = (inside) ? qix[5][rr * grp + cc] : 0.0f;
             if(c != 1)
             {
-              float *col1   = qix[1] + rr * LMMSE_GRP + cc;
-              float *interp = qix[4] + rr * LMMSE_GRP + cc;
+              float *col1   = qix[1] + rr * grp + cc;
+              float *interp = qix[4] + rr * grp + cc;
               col1[0] = (inside) ? colc[0] + interp[0] : 0.0f;
             }
           }
@@ -347,11 +363,11 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
         {
           for(int cc = 1 + (FC(rr, 2, filters) & 1), c = FC(rr, cc + 1, filters); cc < last_cc - 1; cc += 2)
           {
-            float *colc = qix[c] + rr * LMMSE_GRP + cc;
-            float *col1 = qix[1] + rr * LMMSE_GRP + cc;
+            float *colc = qix[c] + rr * grp + cc;
+            float *col1 = qix[1] + rr * grp + cc;
             colc[0] = col1[0] + 0.5f * (colc[ -1] - col1[ -1] + colc[ 1] - col1[ 1]);
             c = 2 - c;
-            colc = qix[c] + rr * LMMSE_GRP + cc;
+            colc = qix[c] + rr * grp + cc;
             colc[0] = col1[0] + 0.5f * (colc[-w1] - col1[-w1] + colc[w1] - col1[w1]);
             c = 2 - c;
           }
@@ -362,8 +378,8 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
         {
           for(int cc = 1 + (FC(rr, 1, filters) & 1), c = 2 - FC(rr, cc, filters); cc < last_cc - 1; cc += 2)
           {
-            float *colc = qix[c] + rr * LMMSE_GRP + cc;
-            float *col1 = qix[1] + rr * LMMSE_GRP + cc;
+            float *colc = qix[c] + rr * grp + cc;
+            float *col1 = qix[1] + rr * grp + cc;
             colc[0] = col1[0] + 0.25f * (colc[-w1] - col1[-w1] + colc[ -1] - col1[ -1] + colc[  1] - col1[  1] + colc[ w1] - col1[ w1]);
           }
         }
@@ -387,9 +403,9 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
               const int d = c + 3 - (c == 0 ? 0 : 1);
               for(int cc = 1; cc < last_cc - 1; cc++)
               {
-                float *corr = qix[d] + rr * LMMSE_GRP + cc;
-                float *colc = qix[c] + rr * LMMSE_GRP + cc;
-                float *col1 = qix[1] + rr * LMMSE_GRP + cc;
+                float *corr = qix[d] + rr * grp + cc;
+                float *colc = qix[c] + rr * grp + cc;
+                float *col1 = qix[1] + rr * grp + cc;
                 // Assign 3x3 differential color values
                 corr[0] = median9f(colc[-w1-1] - col1[-w1-1],
                                    colc[-w1  ] - col1[-w1  ],
@@ -407,11 +423,11 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
           // red/blue at GREEN pixel locations & red/blue and green at BLUE/RED pixel locations
           for(int rr = rrmin; rr < rrmax - 1; rr++)
           {
-            float *col0 = qix[0] + rr * LMMSE_GRP + ccmin;
-            float *col1 = qix[1] + rr * LMMSE_GRP + ccmin;
-            float *col2 = qix[2] + rr * LMMSE_GRP + ccmin;
-            float *corr3 = qix[3] + rr * LMMSE_GRP + ccmin;
-            float *corr4 = qix[4] + rr * LMMSE_GRP + ccmin;
+            float *col0 = qix[0] + rr * grp + ccmin;
+            float *col1 = qix[1] + rr * grp + ccmin;
+            float *col2 = qix[2] + rr * grp + ccmin;
+            float *corr3 = qix[3] + rr * grp + ccmin;
+            float *corr4 = qix[4] + rr * grp + ccmin;
             int c0 = FC(rr, 0, filters);
             int c1 = FC(rr, 1, filters);
 
@@ -420,8 +436,8 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
               c1 = 2 - c1;
               const int d = c1 + 3 - (c1 == 0 ? 0 : 1);
               int cc;
-              float *col_c1 = qix[c1] + rr * LMMSE_GRP + ccmin;
-              float *corr_d = qix[d] + rr * LMMSE_GRP + ccmin;
+              float *col_c1 = qix[c1] + rr * grp + ccmin;
+              float *corr_d = qix[d] + rr * grp + ccmin;
               for(cc = ccmin; cc < ccmax - 1; cc += 2)
               {
                 col0[0] = col1[0] + corr3[0];
@@ -454,8 +470,8 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
             {
               c0 = 2 - c0;
               const int d = c0 + 3 - (c0 == 0 ? 0 : 1);
-              float *col_c0 = qix[c0] + rr * LMMSE_GRP + ccmin;
-              float *corr_d = qix[d] + rr * LMMSE_GRP + ccmin;
+              float *col_c0 = qix[c0] + rr * grp + ccmin;
+              float *corr_d = qix[d] + rr * grp + ccmin;
               int cc;
               for(cc = ccmin; cc < ccmax - 1; cc += 2)
               {
@@ -493,7 +509,7 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
         {
           for(int ccc = 4; ccc < last_cc - 4; ccc++)
           {
-            const int idx = rrr * LMMSE_GRP + ccc;
+            const int idx = rrr * grp + ccc;
             const int c = FC(rrr, ccc, filters);
             qix[c][idx] = qix[5][idx];
           }
@@ -507,8 +523,8 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
           {
             for(int cc = ccmin + 2 + (FC(rr, 2, filters) & 1), c = FC(rr, cc, filters); cc < ccmax - 2; cc += 2)
             {
-              float *rgb1 = qix[1] + rr * LMMSE_GRP + cc;
-              float *rgbc = qix[c] + rr * LMMSE_GRP + cc;
+              float *rgb1 = qix[1] + rr * grp + cc;
+              float *rgbc = qix[c] + rr * grp + cc;
 
               const float dL = 1.0f / (1.0f + fabsf(rgbc[ -2] - rgbc[0]) + fabsf(rgb1[ 1] - rgb1[ -1]));
               const float dR = 1.0f / (1.0f + fabsf(rgbc[  2] - rgbc[0]) + fabsf(rgb1[ 1] - rgb1[ -1]));
@@ -524,8 +540,8 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
             {
               for(int i = 0; i < 2; c = 2 - c, i++)
               {
-                float *rgb1 = qix[1] + rr * LMMSE_GRP + cc;
-                float *rgbc = qix[c] + rr * LMMSE_GRP + cc;
+                float *rgb1 = qix[1] + rr * grp + cc;
+                float *rgbc = qix[c] + rr * grp + cc;
 
                 const float dL = 1.0f / (1.0f + fabsf(rgb1[ -2] - rgb1[0]) + fabsf(rgbc[ 1] - rgbc[ -1]));
                 const float dR = 1.0f / (1.0f + fabsf(rgb1[  2] - rgb1[0]) + fabsf(rgbc[ 1] - rgbc[ -1]));
@@ -541,9 +557,9 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
             for(int cc = ccmin + 2 + (FC(rr, 2, filters) & 1), c = 2 - FC(rr, cc, filters); cc < ccmax - 2; cc += 2)
             {
               const int d = 2 - c;
-              float *rgb1 = qix[1] + rr * LMMSE_GRP + cc;
-              float *rgbc = qix[c] + rr * LMMSE_GRP + cc;
-              float *rgbd = qix[d] + rr * LMMSE_GRP + cc;
+              float *rgb1 = qix[1] + rr * grp + cc;
+              float *rgbc = qix[c] + rr * grp + cc;
+              float *rgbd = qix[d] + rr * grp + cc;
 
               const float dL = 1.0f / (1.0f + fabsf(rgbd[ -2] - rgbd[0]) + fabsf(rgb1[ 1] - rgb1[ -1]));
               const float dR = 1.0f / (1.0f + fabsf(rgbd[  2] - rgbd[0]) + fabsf(rgb1[ 1] - rgb1[ -1]));
@@ -563,7 +579,7 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
         for(int row = first_vertical, rr = row - rowStart + BORDER_AROUND; row < last_vertical; row++, rr++)
         {
           float *dest = out + 4 * (row * width + first_horizontal);
-          const int idx = rr * LMMSE_GRP + first_horizontal - colStart + BORDER_AROUND;
+          const int idx = rr * grp + first_horizontal - colStart + BORDER_AROUND;
           float *col0 = qix[0] + idx;
           float *col1 = qix[1] + idx;
           float *col2 = qix[2] + idx;
@@ -586,14 +602,8 @@ static void lmmse_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict
   #pragma GCC pop_options
 #endif
 
-#undef LMMSE_TILESIZE
 #undef LMMSE_OVERLAP
 #undef BORDER_AROUND
-#undef LMMSE_TILEVALID
-#undef w1
-#undef w2
-#undef w3
-#undef w4
 
 // clang-format off
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
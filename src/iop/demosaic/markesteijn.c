@@ -6,7 +6,8 @@
 // xtrans_interpolate adapted from dcraw 9.20
 
 #define SQR(x) ((x) * (x))
-// tile size, optimized to keep data in L2 cache
+// tile size, optimized to keep data in L2 cache. Markesteijn gets it at runtime, benchmarked per machine
+// in demosaic/tilesize.c, and this is only its default.
 #define TS 122
 
 /** Lookup for allhex[], making sure that row/col aren't negative **/
@@ -29,12 +30,12 @@ static inline const short * hexmap(const int row, const int col, short (*const a
 static void xtrans_markesteijn_interpolate(float *out, const float *const in,
                                            const dt_iop_roi_t *const roi_out,
                                            const dt_iop_roi_t *const roi_in,
-                                           const uint8_t (*const xtrans)[6], const int passes)
+                                           const uint8_t (*const xtrans)[6], const int passes, const int ts)
 {
   static const short orth[12] = { 1, 0, 0, 1, -1, 0, 0, -1, 1, 0, 0, 1 },
                      patt[2][16] = { { 0, 1, 0, -1, 2, 0, -1, 0, 1, 1, 1, -1, 0, 0, 0, 0 },
-                                     { 0, 1, 0, -2, 1, 0, -2, 0, 1, 1, -2, -2, 1, -1, -1, 1 } },
-                     dir[4] = { 1, TS, TS + 1, TS - 1 };
+                                     { 0, 1, 0, -2, 1, 0, -2, 0, 1, 1, -2, -2, 1, -1, -1, 1 } };
+  const short dir[4] = { 1, ts, ts + 1, ts - 1 };
 
   short allhex[3][3][8];
   // sgrow/sgcol is the offset in the sensor matrix of the solitary
@@ -45,7 +46,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
   const int height = roi_out->height;
   const int ndir = 4 << (passes > 1);
 
-  const size_t buffer_size = (size_t)TS * TS * (ndir * 4 + 3) * sizeof(float);
+  const size_t buffer_size = (size_t)ts * ts * (ndir * 4 + 3) * sizeof(float);
   size_t padded_buffer_size;
   char *const all_buffers = (char *)dt_alloc_perthread(buffer_size, sizeof(char), &padded_buffer_size);
   if(!all_buffers)
@@ -77,7 +78,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
             const int v = orth[d] * patt[g][c * 2] + orth[d + 1] * patt[g][c * 2 + 1];
             const int h = orth[d + 2] * patt[g][c * 2] + orth[d + 3] * patt[g][c * 2 + 1];
             // offset within TSxTS buffer
-            allhex[row][col][c ^ (g * 2 & d)] = h + v * TS;
+            allhex[row][col][c ^ (g * 2 & d)] = h + v * ts;
           }
       }
 
@@ -85,37 +86,37 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
   const int pad_tile = (passes == 1) ? 12 : 17;
 #ifdef _OPENMP
 #pragma omp parallel for default(none) \
-  dt_omp_firstprivate(all_buffers, padded_buffer_size, dir, height, in, ndir, pad_tile, passes, roi_in, width, xtrans) \
+  dt_omp_firstprivate(all_buffers, padded_buffer_size, dir, height, in, ndir, pad_tile, passes, roi_in, width, xtrans, ts) \
   shared(sgrow, sgcol, allhex, out) \
   schedule(static)
 #endif
   // step through TSxTS cells of image, each tile overlapping the
   // prior as interpolation needs a substantial border
-  for(int top = -pad_tile; top < height - pad_tile; top += TS - (pad_tile*2))
+  for(int top = -pad_tile; top < height - pad_tile; top += ts - (pad_tile*2))
   {
     char *const buffer = dt_get_perthread(all_buffers, padded_buffer_size);
     // rgb points to ndir TSxTS tiles of 3 channels (R, G, and B)
-    float(*rgb)[TS][TS][3] = (float(*)[TS][TS][3])buffer;
+    float(*rgb)[ts][ts][3] = (float(*)[ts][ts][3])buffer;
     // yuv points to 3 channel (Y, u, and v) TSxTS tiles
     // note that channels come before tiles to allow for a
     // vectorization optimization when building drv[] from yuv[]
-    float (*const yuv)[TS][TS] = (float(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
+    float (*const yuv)[ts][ts] = (float(*)[ts][ts])(buffer + ts * ts * (ndir * 3) * sizeof(float));
     // drv points to ndir TSxTS tiles, each a single channel of derivatives
-    float (*const drv)[TS][TS] = (float(*)[TS][TS])(buffer + TS * TS * (ndir * 3 + 3) * sizeof(float));
+    float (*const drv)[ts][ts] = (float(*)[ts][ts])(buffer + ts * ts * (ndir * 3 + 3) * sizeof(float));
     // gmin and gmax reuse memory which is used later by yuv buffer;
     // each points to a TSxTS tile of single channel data
-    float (*const gmin)[TS] = (float(*)[TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
-    float (*const gmax)[TS] = (float(*)[TS])(buffer + TS * TS * (ndir * 3 + 1) * sizeof(float));
+    float (*const gmin)[ts] = (float(*)[ts])(buffer + ts * ts * (ndir * 3) * sizeof(float));
+    float (*const gmax)[ts] = (float(*)[ts])(buffer + ts * ts * (ndir * 3 + 1) * sizeof(float));
     // homo and homosum reuse memory which is used earlier in the
     // loop; each points to ndir single-channel TSxTS tiles
-    uint8_t (*const homo)[TS][TS] = (uint8_t(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float));
-    uint8_t (*const homosum)[TS][TS] = (uint8_t(*)[TS][TS])(buffer + TS * TS * (ndir * 3) * sizeof(float)
-                                                            + TS * TS * ndir * sizeof(uint8_t));
+    uint8_t (*const homo)[ts][ts] = (uint8_t(*)[ts][ts])(buffer + ts * ts * (ndir * 3) * sizeof(float));
+    uint8_t (*const homosum)[ts][ts] = (uint8_t(*)[ts][ts])(buffer + ts * ts * (ndir * 3) * sizeof(float)
+                                                            + ts * ts * ndir * sizeof(uint8_t));
 
-    for(int left = -pad_tile; left < width - pad_tile; left += TS - (pad_tile*2))
+    for(int left = -pad_tile; left < width - pad_tile; left += ts - (pad_tile*2))
     {
-      int mrow = MIN(top + TS, height + pad_tile);
-      int mcol = MIN(left + TS, width + pad_tile);
+      int mrow = MIN(top + ts, height + pad_tile);
+      int mcol = MIN(left + ts, width + pad_tile);
 
       // Copy current tile from in to image buffer. If border goes
       // beyond edges of image, fill with mirrored/interpolated edges.
@@ -302,7 +303,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
             // 3,5 to rgb[2], rgb[3] of best of interp hori/vert
             // results. Each pass which outputs moves on to the next
             // rgb[] for input of interp greens.
-            for(int i = 1, d = 0; d < 6; d++, i ^= TS ^ 1, h ^= 2)
+            for(int i = 1, d = 0; d < 6; d++, i ^= ts ^ 1, h ^= 2)
             {
               // look 1 and 2 pixels distance from solitary green to
               // red then blue or blue then red
@@ -332,7 +333,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
                 const int d_out = d - ((d > 1) && (diff[d-1] < diff[d]));
                 rfx[0][0] = color[0][d_out] / 2.f;
                 rfx[0][2] = color[1][d_out] / 2.f;
-                rfx += TS * TS;
+                rfx += ts * ts;
               }
             }
           }
@@ -345,9 +346,9 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
             const int f = 2 - FCxtrans(row, col, roi_in, xtrans);
             if(f == 1) continue;
             float(*rfx)[3] = &rgb[0][row - top][col - left];
-            const int c = (row - sgrow) % 3 ? TS : 1;
-            const int h = 3 * (c ^ TS ^ 1);
-            for(int d = 0; d < 4; d++, rfx += TS * TS)
+            const int c = (row - sgrow) % 3 ? ts : 1;
+            const int h = 3 * (c ^ ts ^ 1);
+            for(int d = 0; d < 4; d++, rfx += ts * ts)
             {
               const int i = d > 1 || ((d ^ c) & 1) ||
                 ((fabsf(rfx[0][1]-rfx[c][1]) + fabsf(rfx[0][1]-rfx[-c][1])) <
@@ -366,7 +367,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
               {
                 float(*rfx)[3] = &rgb[0][row - top][col - left];
                 const short *const hex = hexmap(row,col,allhex);
-                for(int d = 0; d < ndir; d += 2, rfx += TS * TS)
+                for(int d = 0; d < ndir; d += 2, rfx += ts * ts)
                   if(hex[d] + hex[d + 1])
                   {
                     const float g = 3.f * rfx[0][1] - 2.f * rfx[hex[d]][1] - rfx[hex[d + 1]][1];
@@ -385,7 +386,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
 
       // jump back to the first set of rgb buffers (this is a nop
       // unless on the second pass)
-      rgb = (float(*)[TS][TS][3])buffer;
+      rgb = (float(*)[ts][ts][3])buffer;
       // from here on out, mainly are working within the current tile
       // rather than in reference to the image, so don't offset
       // mrow/mcol by top/left of tile
@@ -415,7 +416,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
             yuv[2][row][col] = (rx[0] - y) * 0.67815f;
           }
         // Note that f can offset by a column (-1 or +1) and by a row
-        // (-TS or TS). The row-wise offsets cause the undefined
+        // (-ts or ts). The row-wise offsets cause the undefined
         // behavior sanitizer to warn of an out of bounds index, but
         // as yfx is multi-dimensional and there is sufficient
         // padding, that is not actually so.
@@ -424,7 +425,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
         for(int row = pad_drv; row < mrow - pad_drv; row++)
           for(int col = pad_drv; col < mcol - pad_drv; col++)
           {
-            const float(*yfx)[TS][TS] = (float(*)[TS][TS]) & yuv[0][row][col];
+            const float(*yfx)[ts][ts] = (float(*)[ts][ts]) & yuv[0][row][col];
             drv[d][row][col] = SQR(2 * yfx[0][0][0] - yfx[0][0][f] - yfx[0][0][-f])
                                + SQR(2 * yfx[1][0][0] - yfx[1][0][f] - yfx[1][0][-f])
                                + SQR(2 * yfx[2][0][0] - yfx[2][0][f] - yfx[2][0][-f]);
@@ -432,7 +433,7 @@ static void xtrans_markesteijn_interpolate(float *out, const float *const in,
       }
 
       /* Build homogeneity maps from the derivatives:                   */
-      memset_zero(homo, sizeof(uint8_t) * ndir * TS * TS);
+      memset_zero(homo, sizeof(uint8_t) * ndir * ts * ts);
       const int pad_homo = (passes == 1) ? 10 : 15;
       for(int row = pad_homo; row < mrow - pad_homo; row++)
         for(int col = pad_homo; col < mcol - pad_homo; col++)
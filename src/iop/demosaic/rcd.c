@@ -39,10 +39,12 @@
 */
 
 /* Some notes about the algorithm
-* 1. The calculated data at the tiling borders RCD_BORDER must be at least 9 to be stable. Why does 8 **not** work?
+* 1. The calculated data at the tiling borders RCD_BORDER must be at least 10 for the result not to depend
+*    on the tile size. With 9, pixels along the tile seams still differ by up to 1e-3.
 * 2. For the outermost tiles we only have to discard a 6 pixel border region interpolated otherwise.
 * 3. The tilesize has a significant influence on performance, the default is a good guess for modern
-*    x86/64 machines, tested on Xeon E-2288G, i5-8250U.
+*    x86/64 machines, tested on Xeon E-2288G, i5-8250U. It is given at runtime, benchmarked per machine
+*    in demosaic/tilesize.c, and has to be even.
 */
 
 #ifndef RCD_TILESIZE
@@ -70,13 +72,8 @@
   #pragma GCC optimize ("fast-math", "fp-contract=fast", "finite-math-only", "no-math-errno")
 #endif
 
-#define RCD_BORDER 9          // avoid tile-overlap errors
+#define RCD_BORDER 10         // avoid tile-overlap errors
 #define RCD_MARGIN 6          // for the outermost tiles we can have a smaller outer border
-#define RCD_TILEVALID (RCD_TILESIZE - 2 * RCD_BORDER)
-#define w1 RCD_TILESIZE
-#define w2 (2 * RCD_TILESIZE)
-#define w3 (3 * RCD_TILESIZE)
-#define w4 (4 * RCD_TILESIZE)
 
 #define eps 1e-5f              // Tolerance to avoid dividing by zero
 #define epssq 1e-10f
@@ -280,7 +277,7 @@ static void rcd_ppg_border(float *const out, const float *const in, const int wi
   #pragma omp declare simd aligned(in, out)
 #endif
 static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict out, const float *const restrict in, dt_iop_roi_t *const roi_out,
-                                   const dt_iop_roi_t *const roi_in, const uint32_t filters)
+                                   const dt_iop_roi_t *const roi_in, const uint32_t filters, const int tilesize)
 {
   const int width = roi_in->width;
   const int height = roi_in->height;
@@ -296,23 +293,26 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
   const float scaler = fmaxf(piece->pipe->dsc.processed_maximum[0], fmaxf(piece->pipe->dsc.processed_maximum[1], piece->pipe->dsc.processed_maximum[2]));
   const float revscaler = 1.0f / scaler;
 
-  const int num_vertical = 1 + (height - 2 * RCD_BORDER -1) / RCD_TILEVALID;
-  const int num_horizontal = 1 + (width - 2 * RCD_BORDER -1) / RCD_TILEVALID;
+  const int tilevalid = tilesize - 2 * RCD_BORDER;
+  const int w1 = tilesize, w2 = 2 * tilesize, w3 = 3 * tilesize, w4 = 4 * tilesize;
+
+  const int num_vertical = 1 + (height - 2 * RCD_BORDER -1) / tilevalid;
+  const int num_horizontal = 1 + (width - 2 * RCD_BORDER -1) / tilevalid;
 
 #ifdef _OPENMP
   #pragma omp parallel \
-  dt_omp_firstprivate(width, height, filters, out, in, scaler, revscaler)
+  dt_omp_firstprivate(width, height, filters, out, in, scaler, revscaler, tilesize, tilevalid, w1, w2, w3, w4)
 #endif
   {
-    float *const VH_Dir = dt_alloc_align_float((size_t) RCD_TILESIZE * RCD_TILESIZE);
+    float *const VH_Dir = dt_alloc_align_float((size_t) tilesize * tilesize);
     // ensure that border elements which are read but never actually set below are zeroed out
-    memset(VH_Dir, 0, sizeof(*VH_Dir) * RCD_TILESIZE * RCD_TILESIZE);
-    float *const PQ_Dir = dt_alloc_align_float((size_t) RCD_TILESIZE * RCD_TILESIZE / 2);
-    float *const cfa =    dt_alloc_align_float((size_t) RCD_TILESIZE * RCD_TILESIZE);
-    float *const P_CDiff_Hpf = dt_alloc_align_float((size_t) RCD_TILESIZE * RCD_TILESIZE / 2);
-    float *const Q_CDiff_Hpf = dt_alloc_align_float((size_t) RCD_TILESIZE * RCD_TILESIZE / 2);
+    memset(VH_Dir, 0, sizeof(*VH_Dir) * tilesize * tilesize);
+    float *const PQ_Dir = dt_alloc_align_float((size_t) tilesize * tilesize / 2);
+    float *const cfa =    dt_alloc_align_float((size_t) tilesize * tilesize);
+    float *const P_CDiff_Hpf = dt_alloc_align_float((size_t) tilesize * tilesize / 2);
+    float *const Q_CDiff_Hpf = dt_alloc_align_float((size_t) tilesize * tilesize / 2);
 
-    float (*const rgb)[RCD_TILESIZE * RCD_TILESIZE] = (void *)dt_alloc_align_float((size_t)3 * RCD_TILESIZE * RCD_TILESIZE);
+    float (*const rgb)[tilesize * tilesize] = (void *)dt_alloc_align_float((size_t)3 * tilesize * tilesize);
 
     // No overlapping use so re-use same buffer
     float *const lpf = PQ_Dir;
@@ -326,47 +326,47 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
     {
       for(int tile_horizontal = 0; tile_horizontal < num_horizontal; tile_horizontal++)
       {
-        const int rowStart = tile_vertical * RCD_TILEVALID;
-        const int rowEnd = MIN(rowStart + RCD_TILESIZE, height);
+        const int rowStart = tile_vertical * tilevalid;
+        const int rowEnd = MIN(rowStart + tilesize, height);
 
-        const int colStart = tile_horizontal * RCD_TILEVALID;
-        const int colEnd = MIN(colStart + RCD_TILESIZE, width);
+        const int colStart = tile_horizontal * tilevalid;
+        const int colEnd = MIN(colStart + tilesize, width);
 
-        const int tileRows = MIN(rowEnd - rowStart, RCD_TILESIZE);
-        const int tileCols = MIN(colEnd - colStart, RCD_TILESIZE);
+        const int tileRows = MIN(rowEnd - rowStart, tilesize);
+        const int tileCols = MIN(colEnd - colStart, tilesize);
 
-        if (rowStart + RCD_TILESIZE > height || colStart + RCD_TILESIZE > width)
+        if (rowStart + tilesize > height || colStart + tilesize > width)
         {
           // VH_Dir is only filled for (4,4)..(height-4,width-4), but the refinement code reads (3,3)...(h-3,w-3),
           // so we need to ensure that the border is zeroed for partial tiles to get consistent results
-          memset(VH_Dir, 0, sizeof(*VH_Dir) * RCD_TILESIZE * RCD_TILESIZE);
+          memset(VH_Dir, 0, sizeof(*VH_Dir) * tilesize * tilesize);
           // TODO: figure out what part of rgb is being accessed without initialization on partial tiles
-          memset(rgb, 0, sizeof(float) * 3 * RCD_TILESIZE * RCD_TILESIZE);
+          memset(rgb, 0, sizeof(float) * 3 * tilesize * tilesize);
         }
         // Step 0: fill data and make sure data are not negative.
         for(int row = rowStart; row < rowEnd; row++)
         {
           const int c0 = FC(row, colStart, filters);
           const int c1 = FC(row, colStart + 1, filters);
-          for(int col = colStart, indx = (row - rowStart) * RCD_TILESIZE, in_indx = row * width + colStart; col < colEnd; col++, indx++, in_indx++)
+          for(int col = colStart, indx = (row - rowStart) * tilesize, in_indx = row * width + colStart; col < colEnd; col++, indx++, in_indx++)
           {
             cfa[indx] = rgb[c0][indx] = rgb[c1][indx] = safe_in(in[in_indx], revscaler);
           }
         }
 
         // STEP 1: Find vertical and horizontal interpolation directions
-        float bufferV[3][RCD_TILESIZE - 8];
+        float bufferV[3][tilesize - 8];
         // Step 1.1: Calculate the square of the vertical and horizontal color difference high pass filter
         for(int row = 3; row < MIN(tileRows - 3, 5); row++ )
         {
-          for(int col = 4, indx = row * RCD_TILESIZE + col; col < tileCols - 4; col++, indx++ )
+          for(int col = 4, indx = row * tilesize + col; col < tileCols - 4; col++, indx++ )
           {
             bufferV[row - 3][col - 4] = sqf((cfa[indx - w3] - cfa[indx - w1] - cfa[indx + w1] + cfa[indx + w3]) - 3.0f * (cfa[indx - w2] + cfa[indx + w2]) + 6.0f * cfa[indx]);
           }
         }
 
         // Step 1.2: Obtain the vertical and horizontal directional discrimination strength
-        float DT_ALIGNED_PIXEL bufferH[RCD_TILESIZE];
+        float DT_ALIGNED_PIXEL bufferH[tilesize];
         // We start with V0, V1 and V2 pointing to row -1, row and row +1
         // After row is processed V0 must point to the old V1, V1 must point to the old V2 and V2 must point to the old V0
         // because the old V0 is not used anymore and will be filled with row + 1 data in next iteration
@@ -375,15 +375,15 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
         float* V2 = bufferV[2];
         for(int row = 4; row < tileRows - 4; row++ )
         {
-          for(int col = 3, indx = row * RCD_TILESIZE + col; col < tileCols - 3; col++, indx++)
+          for(int col = 3, indx = row * tilesize + col; col < tileCols - 3; col++, indx++)
           {
             bufferH[col - 3] = sqf((cfa[indx -  3] - cfa[indx -  1] - cfa[indx +  1] + cfa[indx +  3]) - 3.0f * (cfa[indx -  2] + cfa[indx +  2]) + 6.0f * cfa[indx]);
           }
-          for(int col = 4, indx = (row + 1) * RCD_TILESIZE + col; col < tileCols - 4; col++, indx++)
+          for(int col = 4, indx = (row + 1) * tilesize + col; col < tileCols - 4; col++, indx++)
           {
             V2[col - 4] = sqf((cfa[indx - w3] - cfa[indx - w1] - cfa[indx + w1] + cfa[indx + w3]) - 3.0f * (cfa[indx - w2] + cfa[indx + w2]) + 6.0f * cfa[indx]);
           }
-          for(int col = 4, indx = row * RCD_TILESIZE + col; col < tileCols - 4; col++, indx++ )
+          for(int col = 4, indx = row * tilesize + col; col < tileCols - 4; col++, indx++ )
           {
             const float V_Stat = fmaxf(epssq,      V0[col - 4] +      V1[col - 4] +      V2[col - 4]);
             const float H_Stat = fmaxf(epssq, bufferH[col - 4] + bufferH[col - 3] + bufferH[col - 2]);
@@ -397,7 +397,7 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
         // Step 2.1: Low pass filter incorporating green, red and blue local samples from the raw data
         for(int row = 2; row < tileRows - 2; row++)
         {
-          for(int col = 2 + (FC(row, 0, filters) & 1), indx = row * RCD_TILESIZE + col, lp_indx = indx / 2; col < tileCols - 2; col += 2, indx +=2, lp_indx++)
+          for(int col = 2 + (FC(row, 0, filters) & 1), indx = row * tilesize + col, lp_indx = indx / 2; col < tileCols - 2; col += 2, indx +=2, lp_indx++)
           {
             lpf[lp_indx] = cfa[indx]
                         + 0.5f * (cfa[indx - w1]     + cfa[indx + w1] +     cfa[indx - 1] +      cfa[indx + 1])
@@ -409,7 +409,7 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
         // Step 3.1: Populate the green channel at blue and red CFA positions
         for(int row = 4; row < tileRows - 4; row++)
         {
-          for(int col = 4 + (FC(row, 0, filters) & 1), indx = row * RCD_TILESIZE + col, lpindx = indx / 2; col < tileCols - 4; col += 2, indx += 2, lpindx++)
+          for(int col = 4 + (FC(row, 0, filters) & 1), indx = row * tilesize + col, lpindx = indx / 2; col < tileCols - 4; col += 2, indx += 2, lpindx++)
           {
             const float cfai = cfa[indx];
 
@@ -445,7 +445,7 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
         // Step 4.0: Calculate the square of the P/Q diagonals color difference high pass filter
         for(int row = 3; row < tileRows - 3; row++)
         {
-          for(int col = 3, indx = row * RCD_TILESIZE + col, indx2 = indx / 2; col < tileCols - 3; col+=2, indx+=2, indx2++)
+          for(int col = 3, indx = row * tilesize + col, indx2 = indx / 2; col < tileCols - 3; col+=2, indx+=2, indx2++)
           {
             P_CDiff_Hpf[indx2] = sqf((cfa[indx - w3 - 3] - cfa[indx - w1 - 1] - cfa[indx + w1 + 1] + cfa[indx + w3 + 3]) - 3.0f * (cfa[indx - w2 - 2] + cfa[indx + w2 + 2]) + 6.0f * cfa[indx]);
             Q_CDiff_Hpf[indx2] = sqf((cfa[indx - w3 + 3] - cfa[indx - w1 + 1] - cfa[indx + w1 - 1] + cfa[indx + w3 - 3]) - 3.0f * (cfa[indx - w2 + 2] + cfa[indx + w2 - 2]) + 6.0f * cfa[indx]);
@@ -454,7 +454,7 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
         // Step 4.1: Obtain the P/Q diagonals directional discrimination strength
         for(int row = 4; row < tileRows - 4; row++)
         {
-          for(int col = 4 + (FC(row, 0, filters) & 1), indx = row * RCD_TILESIZE + col, indx2 = indx / 2, indx3 = (indx - w1 - 1) / 2, indx4 = (indx + w1 - 1) / 2; col < tileCols - 4; col += 2, indx += 2, indx2++, indx3++, indx4++ )
+          for(int col = 4 + (FC(row, 0, filters) & 1), indx = row * tilesize + col, indx2 = indx / 2, indx3 = (indx - w1 - 1) / 2, indx4 = (indx + w1 - 1) / 2; col < tileCols - 4; col += 2, indx += 2, indx2++, indx3++, indx4++ )
           {
             const float P_Stat = fmaxf(epssq, P_CDiff_Hpf[indx3]     + P_CDiff_Hpf[indx2] + P_CDiff_Hpf[indx4 + 1]);
             const float Q_Stat = fmaxf(epssq, Q_CDiff_Hpf[indx3 + 1] + Q_CDiff_Hpf[indx2] + Q_CDiff_Hpf[indx4]);
@@ -465,7 +465,7 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
         // Step 4.2: Populate the red and blue channels at blue and red CFA positions
         for(int row = 4; row < tileRows - 4; row++)
         {
-          for(int col = 4 + (FC(row, 0, filters) & 1), indx = row * RCD_TILESIZE + col, c = 2 - FC(row, col, filters), pqindx = indx / 2, pqindx2 = (indx - w1 - 1) / 2, pqindx3 = (indx + w1 - 1) / 2; col < tileCols - 4; col += 2, indx += 2, pqindx++, pqindx2++, pqindx3++)
+          for(int col = 4 + (FC(row, 0, filters) & 1), indx = row * tilesize + col, c = 2 - FC(row, col, filters), pqindx = indx / 2, pqindx2 = (indx - w1 - 1) / 2, pqindx3 = (indx + w1 - 1) / 2; col < tileCols - 4; col += 2, indx += 2, pqindx++, pqindx2++, pqindx3++)
           {
             // Refined P/Q diagonal local discrimination
             const float PQ_Central_Value   = PQ_Dir[pqindx];
@@ -497,7 +497,7 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
         // Step 4.3: Populate the red and blue channels at green CFA positions
         for(int row = 4; row < tileRows - 4; row++)
         {
-          for(int col = 4 + (FC(row, 1, filters) & 1), indx = row * RCD_TILESIZE + col; col < tileCols - 4; col += 2, indx +=2)
+          for(int col = 4 + (FC(row, 1, filters) & 1), indx = row * tilesize + col; col < tileCols - 4; col += 2, indx +=2)
           {
             // Refined vertical and horizontal local discrimination
             const float VH_Central_Value = VH_Dir[indx];
@@ -548,7 +548,7 @@ static void rcd_demosaic(dt_dev_pixelpipe_iop_t *piece, float *const restrict ou
         const int last_horizontal =  colEnd   - ((tile_horizontal == num_horizontal - 1) ? RCD_MARGIN : RCD_BORDER);
         for(int row = first_vertical; row < last_vertical; row++)
         {
-          for(int col = first_horizontal, idx = (row - rowStart) * RCD_TILESIZE + col - colStart, o_idx = (row * width + col) * 4; col < last_horizontal; col++, o_idx += 4, idx++)
+          for(int col = first_horizontal, idx = (row - rowStart) * tilesize + col - colStart, o_idx = (row * width + col) * 4; col < last_horizontal; col++, o_idx += 4, idx++)
           {
             out[o_idx]   = scaler * fmaxf(0.0f, rgb[0][idx]);
             out[o_idx+1] = scaler * fmaxf(0.0f, rgb[1][idx]);
@@ -917,11 +917,6 @@ error:
 
 #undef RCD_BORDER
 #undef RCD_MARGIN
-#undef RCD_TILEVALID
-#undef w1
-#undef w2
-#undef w3
-#undef w4
 #undef eps
 #undef epssq
 //#undef RCD_TILESIZE
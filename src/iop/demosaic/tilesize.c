@@ -0,0 +1,213 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+   Tile sizes of the CPU demosaicing kernels.
+
+   RCD, LMMSE and Markesteijn work on square tiles meant to stay in the CPU cache, so their fastest size
+   depends on the cache sizes and on the number of cores sharing them. Their output doesn't depend on
+   the tile size, so `ansel-cli --autotune` benchmarks it on a synthetic raw and stores the fastest size
+   in anselrc. Until then, or with a size of 0 in anselrc, the compiled-in size is used: the benchmark
+   takes seconds and never runs on its own while the module is being loaded.
+
+   AMaZE keeps its compiled-in AMAZETS: its tiles don't overlap enough for its output to be independent
+   from their size.
+*/
+
+#define DEMOSAIC_TILESIZE_MIN 64
+#define DEMOSAIC_TILESIZE_MAX 512
+
+// synthetic raw of the benchmark: large enough for all threads to get a few tiles
+#define DEMOSAIC_BENCH_WIDTH 1536
+#define DEMOSAIC_BENCH_HEIGHT 1024
+#define DEMOSAIC_BENCH_RUNS 2
+
+typedef struct dt_iop_demosaic_tilesize_t
+{
+  const char *name;   // in the anselrc key and in the debug output
+  int fallback;       // the compiled-in size
+  int candidates[8];  // benchmarked sizes, 0-terminated
+} dt_iop_demosaic_tilesize_t;
+
+static const dt_iop_demosaic_tilesize_t _tilesizes[DEMOSAIC_TILED_LAST] = {
+  [DEMOSAIC_TILED_RCD] = { "rcd", RCD_TILESIZE, { 64, 96, 112, 128, 160, 192, 256, 0 } },
+  [DEMOSAIC_TILED_LMMSE] = { "lmmse", LMMSE_GRP, { 104, 136, 168, 200, 264, 328, 0 } },
+  [DEMOSAIC_TILED_MARKESTEIJN] = { "markesteijn", 122, { 92, 122, 152, 182, 242, 0 } },
+};
+
+static gboolean _tilesize_valid(const dt_iop_demosaic_tiled_t algo, const int size)
+{
+  if(size < DEMOSAIC_TILESIZE_MIN || size > DEMOSAIC_TILESIZE_MAX) return FALSE;
+
+  switch(algo)
+  {
+    case DEMOSAIC_TILED_RCD:
+      return (size & 1) == 0;        // tiles have to start on the same CFA phase
+    case DEMOSAIC_TILED_LMMSE:
+      return ((size - 40) & 7) == 0; // same, after the border and the overlap are taken out
+    default:
+      return TRUE;
+  }
+}
+
+static gchar *_tilesize_key(const dt_iop_demosaic_tiled_t algo)
+{
+  return g_strdup_printf("plugins/darkroom/demosaic/tilesize/%s", _tilesizes[algo].name);
+}
+
+// read the sizes from anselrc, falling back to the compiled-in ones if not benchmarked
+static void demosaic_tilesize_load(int tilesize[DEMOSAIC_TILED_LAST])
+{
+  for(dt_iop_demosaic_tiled_t algo = 0; algo < DEMOSAIC_TILED_LAST; algo++)
+  {
+    gchar *key = _tilesize_key(algo);
+    const int size = dt_conf_get_int(key);
+    g_free(key);
+
+    tilesize[algo] = _tilesize_valid(algo, size) ? size : _tilesizes[algo].fallback;
+  }
+}
+
+static void demosaic_tilesize_save(const int tilesize[DEMOSAIC_TILED_LAST])
+{
+  for(dt_iop_demosaic_tiled_t algo = 0; algo < DEMOSAIC_TILED_LAST; algo++)
+  {
+    gchar *key = _tilesize_key(algo);
+    dt_conf_set_int(key, tilesize[algo]);
+    g_free(key);
+  }
+}
+
+// smooth gradients, edges and some deterministic noise, so the kernels take their usual branches
+static void _tilesize_bench_raw(float *const raw, const int width, const int height)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(raw, width, height) \
+  schedule(static)
+#endif
+  for(int row = 0; row < height; row++)
+    for(int col = 0; col < width; col++)
+    {
+      const uint32_t hash = ((uint32_t)row * 73856093u) ^ ((uint32_t)col * 19349663u);
+      const float noise = (float)(hash % 1024u) / 1024.f - 0.5f;
+      const float edges = (((row >> 5) + (col >> 5)) & 1) ? 0.15f : 0.f;
+      raw[(size_t)row * width + col] = 0.4f + 0.25f * sinf(col * 0.013f) * cosf(row * 0.021f) + edges + 0.02f * noise;
+    }
+}
+
+static double _tilesize_run(const dt_iop_demosaic_tiled_t algo, const int size, dt_dev_pixelpipe_iop_t *piece,
+                            float *const out, const float *const bayer, const float *const xtrans_raw,
+                            dt_iop_roi_t *const roi, float *const gamma_in, float *const gamma_out)
+{
+  // standard X-Trans layout, and RGGB
+  static const uint8_t xtrans[6][6] = { { 1, 1, 0, 1, 1, 2 }, { 1, 1, 2, 1, 1, 0 }, { 2, 0, 1, 0, 2, 1 },
+                                        { 1, 1, 2, 1, 1, 0 }, { 1, 1, 0, 1, 1, 2 }, { 0, 2, 1, 2, 0, 1 } };
+  const uint32_t filters = 0x94949494u;
+
+  double best = INFINITY;
+  for(int run = 0; run < DEMOSAIC_BENCH_RUNS; run++)
+  {
+    const double start = dt_get_wtime();
+    switch(algo)
+    {
+      case DEMOSAIC_TILED_RCD:
+        rcd_demosaic(piece, out, bayer, roi, roi, filters, size);
+        break;
+      case DEMOSAIC_TILED_LMMSE:
+        lmmse_demosaic(piece, out, bayer, roi, roi, filters, LMMSE_REFINE_1, gamma_in, gamma_out, size);
+        break;
+      default:
+        xtrans_markesteijn_interpolate(out, xtrans_raw, roi, roi, xtrans, 1, size);
+        break;
+    }
+    best = MIN(best, dt_get_wtime() - start);
+  }
+  return best;
+}
+
+// time every candidate size on a synthetic raw and keep the fastest, in tilesize[]
+static void demosaic_tilesize_benchmark(int tilesize[DEMOSAIC_TILED_LAST])
+{
+  const double start = dt_get_wtime();
+  const size_t npixels = (size_t)DEMOSAIC_BENCH_WIDTH * DEMOSAIC_BENCH_HEIGHT;
+  float *bayer = dt_alloc_align_float(npixels);
+  float *xtrans_raw = dt_alloc_align_float(npixels);
+  float *out = dt_alloc_align_float(4 * npixels);
+  float *gamma_in = dt_alloc_align_float(65536);
+  float *gamma_out = dt_alloc_align_float(65536);
+  dt_dev_pixelpipe_t *pipe = calloc(1, sizeof(dt_dev_pixelpipe_t));
+
+  for(dt_iop_demosaic_tiled_t algo = 0; algo < DEMOSAIC_TILED_LAST; algo++)
+    tilesize[algo] = _tilesizes[algo].fallback;
+
+  if(!bayer || !xtrans_raw || !out || !gamma_in || !gamma_out || !pipe)
+    fprintf(stderr, "[demosaic] not enough memory to benchmark the tile sizes\n");
+  else
+  {
+    _tilesize_bench_raw(bayer, DEMOSAIC_BENCH_WIDTH, DEMOSAIC_BENCH_HEIGHT);
+    memcpy(xtrans_raw, bayer, npixels * sizeof(float));
+    lmmse_gamma_tables(gamma_in, gamma_out);
+    for(int c = 0; c < 3; c++) pipe->dsc.processed_maximum[c] = 1.0f;
+    dt_dev_pixelpipe_iop_t piece = { .pipe = pipe };
+    dt_iop_roi_t roi = { .x = 0, .y = 0, .width = DEMOSAIC_BENCH_WIDTH, .height = DEMOSAIC_BENCH_HEIGHT, .scale = 1.0f };
+
+    for(dt_iop_demosaic_tiled_t algo = 0; algo < DEMOSAIC_TILED_LAST; algo++)
+    {
+      // warm up the caches and the thread pool
+      _tilesize_run(algo, _tilesizes[algo].fallback, &piece, out, bayer, xtrans_raw, &roi, gamma_in, gamma_out);
+
+      double best = INFINITY;
+      for(const int *size = _tilesizes[algo].candidates; *size; size++)
+      {
+        const double time = _tilesize_run(algo, *size, &piece, out, bayer, xtrans_raw, &roi, gamma_in, gamma_out);
+        dt_print(DT_DEBUG_DEMOSAIC | DT_DEBUG_PERF, "[demosaic] %s tiles of %i px: %.4f s\n",
+                 _tilesizes[algo].name, *size, time);
+        if(time < best)
+        {
+          best = time;
+          tilesize[algo] = *size;
+        }
+      }
+      dt_print(DT_DEBUG_DEMOSAIC | DT_DEBUG_PERF, "[demosaic] %s will use tiles of %i px\n",
+               _tilesizes[algo].name, tilesize[algo]);
+    }
+
+    dt_print(DT_DEBUG_DEMOSAIC | DT_DEBUG_PERF, "[demosaic] tile sizes benchmarked in %.3f s\n",
+             dt_get_wtime() - start);
+  }
+
+  free(pipe);
+  dt_free_align(gamma_out);
+  dt_free_align(gamma_in);
+  dt_free_align(out);
+  dt_free_align(xtrans_raw);
+  dt_free_align(bayer);
+}
+
+#undef DEMOSAIC_BENCH_RUNS
+#undef DEMOSAIC_BENCH_HEIGHT
+#undef DEMOSAIC_BENCH_WIDTH
+#undef DEMOSAIC_TILESIZE_MAX
+#undef DEMOSAIC_TILESIZE_MIN
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -25,6 +25,7 @@
 #include "common/nlmeans_core.h"
 #include "common/noiseprofiles.h"
 #include "common/opencl.h"
+#include "control/conf.h"
 #include "control/control.h"
 #include "develop/blend.h"
 #include "develop/imageop.h"
@@ -731,7 +732,7 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_SKIP_IN_DRAFT;
 }
 
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -1391,6 +1392,8 @@ static void process_wavelets(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_
     float *buf3 = buf2;
     buf2 = buf1;
     buf1 = buf3;
+
+    if(dt_dev_pixelpipe_is_cancelled(piece->pipe)) break;
   }
 
   // add in the final residue
@@ -1614,7 +1617,8 @@ static void process_nlmeans_cpu(dt_dev_pixelpipe_iop_t *piece,
                                       .patch_radius = P,
                                       .search_radius = K,
                                       .decimate = 0,
-                                      .norm = norm2 };
+                                      .norm = norm2,
+                                      .pipe = piece->pipe };
   denoiser(in,ovoid,roi_in,roi_out,&params);
 
   dt_free_align(in);
@@ -1628,7 +1632,8 @@ static void process_nlmeans(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t
                             const void *const ivoid, void *const ovoid, const dt_iop_roi_t *const roi_in,
                             const dt_iop_roi_t *const roi_out)
 {
-  process_nlmeans_cpu(piece,ivoid,ovoid,roi_in,roi_out,nlmeans_denoise);
+  process_nlmeans_cpu(piece,ivoid,ovoid,roi_in,roi_out,
+                      dt_conf_get_bool("nlmeans_banded") ? nlmeans_denoise_banded : nlmeans_denoise);
   return;
 }
 
@@ -1637,7 +1642,8 @@ static void process_nlmeans_sse(struct dt_iop_module_t *self, dt_dev_pixelpipe_i
                                 const void *const ivoid, void *const ovoid, const dt_iop_roi_t *const roi_in,
                                 const dt_iop_roi_t *const roi_out)
 {
-  process_nlmeans_cpu(piece,ivoid,ovoid,roi_in,roi_out,nlmeans_denoise_sse2);
+  process_nlmeans_cpu(piece,ivoid,ovoid,roi_in,roi_out,
+                      dt_conf_get_bool("nlmeans_banded") ? nlmeans_denoise_banded : nlmeans_denoise_sse2);
   return;
 }
 #endif
@@ -1856,7 +1862,8 @@ static int process_nlmeans_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop
         .kernel_dist = gd->kernel_denoiseprofile_dist,
         .kernel_horiz = gd->kernel_denoiseprofile_horiz,
         .kernel_vert = gd->kernel_denoiseprofile_vert,
-        .kernel_accu = gd->kernel_denoiseprofile_accu
+        .kernel_accu = gd->kernel_denoiseprofile_accu,
+        .pipe = piece->pipe
       };
     err = nlmeans_denoiseprofile_cl(&params, devid, dev_tmp, dev_U2, roi_in);
   }
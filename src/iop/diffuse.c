@@ -26,10 +26,12 @@
 #include "common/darktable.h"
 #include "common/dwt.h"
 #include "common/gaussian.h"
+#include "common/half.h"
 #include "common/image.h"
 #include "common/imagebuf.h"
 #include "common/iop_profile.h"
 #include "common/opencl.h"
+#include "control/conf.h"
 #include "control/control.h"
 #include "develop/develop.h"
 #include "develop/imageop_gui.h"
@@ -157,7 +159,7 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING;
+  return IOP_FLAGS_INCLUDE_IN_STYLES | IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_SKIP_IN_DRAFT;
 }
 
 int default_colorspace(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -486,6 +488,12 @@ void init_presets(dt_iop_module_so_t *self)
                              DEVELOP_BLEND_CS_RGB_SCENE);
 }
 
+// store the wavelet details as half floats on CPU: half the memory for details, math still in float32
+static inline gboolean _half_scales(void)
+{
+  return dt_conf_get_bool("memory_half_precision_wavelets");
+}
+
 void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
                      const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out,
                      struct dt_develop_tiling_t *tiling)
@@ -498,8 +506,8 @@ void tiling_callback(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t
   const int scales = CLAMP(diffusion_scales, 1, MAX_NUM_SCALES);
   const int max_filter_radius = (1 << scales);
 
-  // in + out + 2 * tmp + 2 * LF + s details + grey mask
-  tiling->factor = 6.25f + scales;
+  // in + out + 2 * tmp + 2 * LF + s details + grey mask. Details stored as half floats take half the space.
+  tiling->factor = 6.25f + (_half_scales() ? 0.5f : 1.f) * scales;
   tiling->factor_cl = 6.25f + scales;
 
   tiling->maxbuf = 1.0f;
@@ -685,7 +693,19 @@ static inline void compute_kernel(const dt_aligned_pixel_t c2, const dt_aligned_
   }
 }
 
-static inline void heat_PDE_diffusion(const float *const restrict high_freq, const float *const restrict low_freq,
+// fetch a pixel of the details, stored either as float or as half floats
+static inline void _load_HF(dt_aligned_pixel_t pixel, const float *const restrict HF,
+                            const dt_half_t *const restrict HF_half, const size_t index)
+{
+  if(HF_half)
+    dt_load_half_4(pixel, HF_half + index);
+  else
+    for_four_channels(c) pixel[c] = HF[index + c];
+}
+
+static inline void heat_PDE_diffusion(const float *const restrict high_freq,
+                                      const dt_half_t *const restrict high_freq_half,
+                                      const float *const restrict low_freq,
                                       const uint8_t *const restrict mask, const int has_mask,
                                       float *const restrict output, const size_t width, const size_t height,
                                       const dt_aligned_pixel_t anisotropy, const dt_isotropy_t isotropy_type[4],
@@ -704,13 +724,14 @@ static inline void heat_PDE_diffusion(const float *const restrict high_freq, con
 
   float *const restrict out = DT_IS_ALIGNED(output);
   const float *const restrict LF = DT_IS_ALIGNED(low_freq);
-  const float *const restrict HF = DT_IS_ALIGNED(high_freq);
+  const float *const restrict HF = high_freq;
+  const dt_half_t *const restrict HF_half = high_freq_half;
 
   const float regularization_factor = regularization * current_radius_square / 9.f;
 
 #ifdef _OPENMP
 #pragma omp parallel for default(none)                                                                            \
-    dt_omp_firstprivate(out, mask, HF, LF, height, width, ABCD, has_mask, variance_threshold, anisotropy,         \
+    dt_omp_firstprivate(out, mask, HF, HF_half, LF, height, width, ABCD, has_mask, variance_threshold, anisotropy, \
                         regularization_factor, mult, strength, isotropy_type) schedule(static)
 #endif
   for(size_t row = 0; row < height; ++row)
@@ -744,11 +765,9 @@ static inline void heat_PDE_diffusion(const float *const restrict high_freq, con
           for(size_t jj = 0; jj < 3; jj++)
           {
             size_t neighbor = 4 * (i_neighbours[ii] + j_neighbours[jj]);
+            _load_HF(neighbour_pixel_HF[3 * ii + jj], HF, HF_half, neighbor);
             for_each_channel(c)
-            {
-              neighbour_pixel_HF[3 * ii + jj][c] = HF[neighbor + c];
               neighbour_pixel_LF[3 * ii + jj][c] = LF[neighbor + c];
-            }
           }
 
         // c² in https://www.researchgate.net/publication/220663968
@@ -839,9 +858,10 @@ static inline void heat_PDE_diffusion(const float *const restrict high_freq, con
           for_each_channel(c, aligned(acc,derivatives,ABCD))
             acc[c] += derivatives[k][c] * ABCD[k];
         }
-        for_each_channel(c, aligned(acc,HF,LF,variance,out))
+        // neighbour_pixel_HF[4] is the current pixel
+        for_each_channel(c, aligned(acc,neighbour_pixel_HF,LF,variance,out))
         {
-          acc[c] = (HF[index + c] * strength + acc[c] / variance[c]);
+          acc[c] = (neighbour_pixel_HF[4][c] * strength + acc[c] / variance[c]);
           // update the solution
           out[index + c] = fmaxf(acc[c] + LF[index + c], 0.f);
         }
@@ -849,8 +869,10 @@ static inline void heat_PDE_diffusion(const float *const restrict high_freq, con
       else
       {
         // only copy input to output, do nothing
-        for_each_channel(c, aligned(out, HF, LF : 64))
-          out[index + c] = HF[index + c] + LF[index + c];
+        dt_aligned_pixel_t detail;
+        _load_HF(detail, HF, HF_half, index);
+        for_each_channel(c, aligned(out, detail, LF : 64))
+          out[index + c] = detail[c] + LF[index + c];
       }
     }
   }
@@ -883,6 +905,7 @@ static inline gint wavelets_process(const float *const restrict in, float *const
                                     const float final_radius, const float zoom, const int scales,
                                     const int has_mask,
                                     float *const restrict HF[MAX_NUM_SCALES],
+                                    dt_half_t *const restrict HF_half[MAX_NUM_SCALES],
                                     float *const restrict LF_odd,
                                     float *const restrict LF_even)
 {
@@ -934,7 +957,10 @@ static inline gint wavelets_process(const float *const restrict in, float *const
       buffer_out = LF_odd;
     }
 
-    decompose_2D_Bspline(buffer_in, HF[s], buffer_out, width, height, mult, tempbuf, padded_size);
+    if(HF_half[s])
+      decompose_2D_Bspline_half(buffer_in, HF_half[s], buffer_out, width, height, mult, tempbuf, padded_size);
+    else
+      decompose_2D_Bspline(buffer_in, HF[s], buffer_out, width, height, mult, tempbuf, padded_size);
 
     residual = buffer_out;
 
@@ -991,7 +1017,7 @@ static inline gint wavelets_process(const float *const restrict in, float *const
     if(s == 0) buffer_out = reconstructed;
 
     // Compute wavelets low-frequency scales
-    heat_PDE_diffusion(HF[s], buffer_in, mask, has_mask, buffer_out, width, height,
+    heat_PDE_diffusion(HF[s], HF_half[s], buffer_in, mask, has_mask, buffer_out, width, height,
                        anisotropy, isotropy_type, regularization,
                        variance_threshold, sqf(current_radius), mult, ABCD, strength);
 
@@ -1084,12 +1110,17 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
 
   gboolean out_of_memory = FALSE;
 
-  // wavelets scales buffers
-  float *restrict HF[MAX_NUM_SCALES];
+  // wavelets scales buffers, either float or half float
+  const gboolean half_scales = _half_scales();
+  float *restrict HF[MAX_NUM_SCALES] = { NULL };
+  dt_half_t *restrict HF_half[MAX_NUM_SCALES] = { NULL };
   for(int s = 0; s < scales; s++)
   {
-    HF[s] = dt_alloc_align_float(width * height * 4);
-    if(!HF[s]) out_of_memory = TRUE;
+    if(half_scales)
+      HF_half[s] = dt_alloc_align(sizeof(dt_half_t) * width * height * 4);
+    else
+      HF[s] = dt_alloc_align_float(width * height * 4);
+    if(!HF[s] && !HF_half[s]) out_of_memory = TRUE;
   }
 
   // temp buffer for blurs. We will need to cycle between them for memory efficiency
@@ -1141,7 +1172,9 @@ void process(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *c
 
     wavelets_process(temp_in, temp_out, mask,
                      roi_out->width, roi_out->height,
-                     data, final_radius, scale, scales, has_mask, HF, LF_odd, LF_even);
+                     data, final_radius, scale, scales, has_mask, HF, HF_half, LF_odd, LF_even);
+
+    if(dt_dev_pixelpipe_is_cancelled(piece->pipe)) break;
   }
 
 error:
@@ -1150,7 +1183,11 @@ error:
   if(temp2) dt_free_align(temp2);
   if(LF_even) dt_free_align(LF_even);
   if(LF_odd) dt_free_align(LF_odd);
-  for(int s = 0; s < scales; s++) if(HF[s]) dt_free_align(HF[s]);
+  for(int s = 0; s < scales; s++)
+  {
+    if(HF[s]) dt_free_align(HF[s]);
+    if(HF_half[s]) dt_free_align(HF_half[s]);
+  }
 }
 
 #if HAVE_OPENCL
@@ -1415,6 +1452,8 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     if(it == (int)iterations - 1) temp_out = dev_out;
     err = wavelets_process_cl(devid, temp_in, temp_out, mask, sizes, width, height, data, gd, final_radius, scale, scales, has_mask, HF, LF_odd, LF_even);
     if(err != CL_SUCCESS) goto error;
+
+    if(dt_dev_pixelpipe_is_cancelled(piece->pipe)) break;
   }
 
   // cleanup and exit on success
@@ -287,9 +287,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   dt_bilateral_t *b = NULL;
   if(data->detail != 0.0f)
   {
-    b = dt_bilateral_init(roi_in->width, roi_in->height, sigma_s, sigma_r);
     // get detail from unchanged input buffer
-    dt_bilateral_splat(b, (float *)ivoid);
+    b = dt_bilateral_shared((float *)ivoid, roi_in->width, roi_in->height, sigma_s, sigma_r);
   }
 
   switch(data->operator)
@@ -305,9 +304,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
       break;
   }
 
-  if(data->detail != 0.0f)
+  if(b)
   {
-    dt_bilateral_blur(b);
     // and apply it to output buffer after logscale
     dt_bilateral_slice_to_output(b, (float *)ivoid, (float *)ovoid, data->detail);
     dt_bilateral_free(b);
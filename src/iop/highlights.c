@@ -34,6 +34,7 @@
 #include "develop/imageop_math.h"
 #include "develop/imageop_gui.h"
 #include "develop/noise_generator.h"
+#include "develop/raw_fuse.h"
 #include "develop/tiling.h"
 
 #include "gui/gtk.h"
@@ -2089,6 +2090,29 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK) dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
 }
 
+gboolean fuse_raw(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *const roi_in,
+                  const dt_iop_roi_t *const roi_out, dt_dev_raw_fuse_t *fuse)
+{
+  const dt_iop_highlights_data_t *const data = (dt_iop_highlights_data_t *)piece->data;
+  const dt_iop_highlights_gui_data_t *const g = (dt_iop_highlights_gui_data_t *)self->gui_data;
+
+  // only the clipping mode of process() on raw mosaics is a per-sensel operation
+  if(!piece->pipe->dsc.filters) return FALSE;
+  if(data->mode != DT_IOP_HIGHLIGHTS_CLIP && data->mode <= DT_IOP_HIGHLIGHTS_LAPLACIAN) return FALSE;
+
+  const gboolean fullpipe = (piece->pipe->type & DT_DEV_PIXELPIPE_FULL) == DT_DEV_PIXELPIPE_FULL;
+  if(g && g->show_visualize && fullpipe) return FALSE;
+
+  fuse->clip_highlights = TRUE;
+  fuse->clip = data->clip * fminf(piece->pipe->dsc.processed_maximum[0],
+                                  fminf(piece->pipe->dsc.processed_maximum[1], piece->pipe->dsc.processed_maximum[2]));
+
+  const float m = fmaxf(fmaxf(piece->pipe->dsc.processed_maximum[0], piece->pipe->dsc.processed_maximum[1]),
+                        piece->pipe->dsc.processed_maximum[2]);
+  for(int k = 0; k < 3; k++) piece->pipe->dsc.processed_maximum[k] = m;
+  return TRUE;
+}
+
 void commit_params(struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pixelpipe_t *pipe,
                    dt_dev_pixelpipe_iop_t *piece)
 {
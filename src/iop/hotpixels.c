@@ -25,6 +25,7 @@
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
 #include "develop/imageop_gui.h"
+#include "develop/raw_fuse.h"
 #include "dtgtk/resetlabel.h"
 
 #include "gui/gtk.h"
@@ -299,6 +300,23 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   }
 }
 
+gboolean fuse_raw(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *const roi_in,
+                  const dt_iop_roi_t *const roi_out, dt_dev_raw_fuse_t *fuse)
+{
+  dt_iop_hotpixels_gui_data_t *g = (dt_iop_hotpixels_gui_data_t *)self->gui_data;
+  const dt_iop_hotpixels_data_t *data = (dt_iop_hotpixels_data_t *)piece->data;
+
+  fuse->hotpixels = TRUE;
+  fuse->hot_threshold = data->threshold;
+  fuse->hot_multiplier = data->multiplier;
+  fuse->hot_min_neighbours = data->permissive ? 3 : 4;
+  fuse->hot_markfixed = data->markfixed;
+
+  if(g != NULL && self->dev->gui_attached && (piece->pipe->type & DT_DEV_PIXELPIPE_FULL) == DT_DEV_PIXELPIPE_FULL)
+    fuse->hot_fixed = &g->pixels_fixed;
+  return TRUE;
+}
+
 void reload_defaults(dt_iop_module_t *module)
 {
   const dt_image_t *img = &module->dev->image_storage;
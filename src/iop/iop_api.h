@@ -46,6 +46,7 @@ struct dt_dev_pixelpipe_iop_t;
 struct dt_iop_roi_t;
 struct dt_develop_tiling_t;
 struct dt_iop_buffer_dsc_t;
+struct dt_dev_raw_fuse_t;
 struct dt_gui_module_t;
 struct _GtkWidget;
 
@@ -66,6 +67,9 @@ OPTIONAL(void, init_presets, struct dt_iop_module_so_t *self);
 OPTIONAL(void, init_global, struct dt_iop_module_so_t *self);
 /** called once per module, at shutdown. */
 OPTIONAL(void, cleanup_global, struct dt_iop_module_so_t *self);
+/** benchmark the CPU code paths on this machine and store the fastest settings in anselrc.
+    run on demand by `ansel-cli --autotune`, whether init_global() has been called or not. */
+OPTIONAL(void, autotune, struct dt_iop_module_so_t *self);
 
 /** get name of the module, to be translated. */
 REQUIRED(const char *, name, void);
@@ -199,6 +203,12 @@ OPTIONAL(void, process_sse2, struct dt_iop_module_t *self, struct dt_dev_pixelpi
                              const struct dt_iop_roi_t *const roi_out);
 #endif
 
+/** take part in the fused raw stage (see develop/raw_fuse.h): fill this module's part of `fuse` and apply
+  * the side effects process() has on `piece->pipe->dsc`. Return FALSE if process() is needed for these params. */
+OPTIONAL(gboolean, fuse_raw, struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece,
+                             const struct dt_iop_roi_t *const roi_in, const struct dt_iop_roi_t *const roi_out,
+                             struct dt_dev_raw_fuse_t *fuse);
+
 #ifdef HAVE_OPENCL
 /** the opencl equivalent of process(). */
 OPTIONAL(int, process_cl, struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in,
@@ -52,6 +52,8 @@ const int   LOOKUP_OVERSAMPLE = 10;
 const int   INTERPOLATION_POINTS = 100; // when interpolating bezier
 const float STAMP_RELOCATION = 0.1;     // how many radii to move stamp forward when following a path
 
+#define TILE_HEIGHT 32 // rows of the distortion map built by a thread at a time
+
 #define CONF_RADIUS "plugins/darkroom/liquify/radius"
 #define CONF_ANGLE "plugins/darkroom/liquify/angle"
 #define CONF_STRENGTH "plugins/darkroom/liquify/strength"
@@ -854,7 +856,9 @@ static float *build_lookup_table(const int distance, const float control1, const
     const float dx2 = x - crealf(cptr[-1]);
     *ptr++ = cimagf(cptr[0]) +(dx2 / dx1) * (cimagf(cptr[0]) - cimagf(cptr[-1]));
   }
-  *ptr++ = 0.0f;
+  // the bezier may run out of points before @a distance: no warp from there
+  while(ptr < lookup + distance + 2)
+    *ptr++ = 0.0f;
 
   dt_free_align(clookup);
   return lookup;
@@ -874,9 +878,9 @@ static void compute_round_stamp_extent(cairo_rectangle_int_t *const restrict sta
 }
 
 /*
-  Compute a round(circular) stamp.
+  Round (circular) stamps.
 
-  The stamp is a vector field of warp vectors around a center point.
+  A stamp is a vector field of warp vectors around a center point.
 
   In a linear warp the center point gets a warp of @a strength, while
   points on the circumference of the circle get no warp at all.
@@ -890,132 +894,401 @@ static void compute_round_stamp_extent(cairo_rectangle_int_t *const restrict sta
   circumference get no warp. Between center and circumference the
   warp magnitude follows a curve with maximum at radius / 0.5
 
-  Our stamp is stored in a rectangular region.
+  Stamps are not stored: the warp is computed while adding the stamp
+  to the distortion map, from the warp intensity over a quadrant of the
+  circle, shared by all the stamps of the same radius and controls.
+*/
+
+typedef struct dt_liquify_stamp_t
+{
+  cairo_rectangle_int_t extent; ///< in piece coordinates
+  int iradius;
+  float control1;
+  float control2;
+  dt_liquify_warp_type_enum_t type;
+  float complex strength;
+  const float *profile;         ///< owned by the cache
+} dt_liquify_stamp_t;
+
+typedef struct dt_liquify_profile_t
+{
+  int iradius;
+  float control1;
+  float control2;
+  float *intensity;             ///< (iradius + 1)^2, from the center
+  gboolean used;
+} dt_liquify_profile_t;
+
+/*
+  Per pipe piece: the intensity profiles of the stamps, and the last
+  distortion map with the stamps it was built from. When the paths
+  change, only the parts of the map covered by changed stamps are
+  built again.
+
+  Maps larger than LIQUIFY_CACHE_MAX_MAP_BYTES, as built for exports
+  of large warps, are freed once applied: only the stamps and the
+  profiles are kept, and the next map is built in full.
 */
 
-static void build_round_stamp(float complex **pstamp,
-                               cairo_rectangle_int_t *const restrict stamp_extent,
-                               const dt_liquify_warp_t *const restrict warp)
+#define LIQUIFY_CACHE_MAX_MAP_BYTES ((size_t)128 << 20)
+
+typedef struct dt_liquify_cache_t
+{
+  dt_liquify_profile_t *profiles;
+  int num_profiles;
+  dt_liquify_stamp_t *stamps;
+  int num_stamps;
+  float complex *map;
+  cairo_rectangle_int_t map_extent;
+} dt_liquify_cache_t;
+
+typedef struct dt_iop_liquify_data_t
+{
+  dt_iop_liquify_params_t params;
+  dt_liquify_cache_t *cache; // keep last: not part of the pipe cache hash
+} dt_iop_liquify_data_t;
+
+static void cache_cleanup(dt_liquify_cache_t *cache)
+{
+  for(int k = 0; k < cache->num_profiles; k++)
+    dt_free_align(cache->profiles[k].intensity);
+  free(cache->profiles);
+  free(cache->stamps);
+  dt_free_align(cache->map);
+  memset(cache, 0, sizeof(dt_liquify_cache_t));
+}
+
+static void compute_round_stamp(dt_liquify_stamp_t *const restrict stamp,
+                                const dt_liquify_warp_t *const restrict warp)
 {
   const int iradius = round(cabsf(warp->radius - warp->point));
   assert(iradius > 0);
 
-  stamp_extent->x = stamp_extent->y = -iradius;
-  stamp_extent->width = stamp_extent->height = 2 * iradius + 1;
+  stamp->iradius = iradius;
+  stamp->extent.x = (int) round(crealf(warp->point)) - iradius;
+  stamp->extent.y = (int) round(cimagf(warp->point)) - iradius;
+  stamp->extent.width = stamp->extent.height = 2 * iradius + 1;
+  stamp->control1 = warp->control1;
+  stamp->control2 = warp->control2;
+  stamp->type = warp->type;
 
   // 0.5 is factored in so the warp starts to degenerate when the
   // strength arrow crosses the warp radius.
-  float complex strength = 0.5f * (warp->strength - warp->point);
-  strength = (warp->status & DT_LIQUIFY_STATUS_INTERPOLATED) ?
+  const float complex strength = 0.5f * (warp->strength - warp->point);
+  stamp->strength = (warp->status & DT_LIQUIFY_STATUS_INTERPOLATED) ?
     (strength * STAMP_RELOCATION) : strength;
-  const float abs_strength = cabsf(strength);
+  stamp->profile = NULL;
+}
 
-  float complex *restrict stamp =
-    calloc(sizeof(float complex), (size_t)stamp_extent->width * stamp_extent->height);
+// The expensive operation here is sqrtf(). By dividing the circle in
+// quadrants we have to compute it only for a quarter of the stamp area.
 
+static float *build_round_profile(const int iradius, const float control1, const float control2)
+{
   // lookup table: map of distance from center point => warp
   const int table_size = iradius * LOOKUP_OVERSAMPLE;
-  const float *const restrict lookup_table = build_lookup_table(table_size, warp->control1, warp->control2);
-
-  // points into buffer at the center of the circle
-  float complex *const center = stamp + 2 * iradius * iradius + 2 * iradius;
-
-  // The expensive operation here is hypotf ().  By dividing the
-  // circle in quadrants and doing only the inside we have to calculate
-  // hypotf only for PI / 16 = 0.196 of the stamp area.
-  // We don't do octants to avoid false sharing of cache lines between threads.
-  // doesn't work for OSX see issue #7349
-  #if defined(_OPENMP) && !defined(__APPLE__)
-  #pragma omp parallel for schedule(static) default(none) \
-    dt_omp_firstprivate(iradius, strength, abs_strength, table_size)   \
-    dt_omp_sharedconst(center, warp, stamp_extent, lookup_table, LOOKUP_OVERSAMPLE)
-  #endif
+  float *const restrict lookup_table = build_lookup_table(table_size, control1, control2);
+  const int width = iradius + 1;
+  float *const restrict intensity = dt_alloc_align_float((size_t)width * width);
 
   for(int y = 0; y <= iradius; y++)
-  {
     for(int x = 0; x <= iradius; x++)
     {
       const float dist = sqrtf(x*x + y*y); // faster than hypotf(), and we know we won't have overflow or denormals
       const int idist = round(dist * LOOKUP_OVERSAMPLE);
-      if(idist >= table_size)
-        // idist will only grow bigger in this row
-        break;
+      intensity[y * width + x] = idist < table_size ? lookup_table[idist] : 0.0f;
+    }
 
-      // pointers into the 4 quadrants of the circle
-      // quadrant count is ccw from positive x-axis
-      float complex *const q1 = center - y * stamp_extent->width + x;
-      float complex *const q2 = center - y * stamp_extent->width - x;
-      float complex *const q3 = center + y * stamp_extent->width - x;
-      float complex *const q4 = center + y * stamp_extent->width + x;
+  dt_free_align(lookup_table);
+  return intensity;
+}
 
-      float abs_lookup = abs_strength * lookup_table[idist] / iradius;
+static gboolean same_stamp(const dt_liquify_stamp_t *const a, const dt_liquify_stamp_t *const b)
+{
+  return a->extent.x == b->extent.x && a->extent.y == b->extent.y && a->iradius == b->iradius
+    && a->control1 == b->control1 && a->control2 == b->control2 && a->type == b->type
+    && a->strength == b->strength;
+}
 
-      switch (warp->type)
-      {
-         case DT_LIQUIFY_WARP_TYPE_RADIAL_GROW:
-           *q1 = abs_lookup * ( x - y * I);
-           *q2 = abs_lookup * (-x - y * I);
-           *q3 = abs_lookup * (-x + y * I);
-           *q4 = abs_lookup * ( x + y * I);
-           break;
-
-         case DT_LIQUIFY_WARP_TYPE_RADIAL_SHRINK:
-           *q1 = -abs_lookup * ( x - y * I);
-           *q2 = -abs_lookup * (-x - y * I);
-           *q3 = -abs_lookup * (-x + y * I);
-           *q4 = -abs_lookup * ( x + y * I);
-           break;
-
-         default:
-           *q1 = *q2 = *q3 = *q4 = strength * lookup_table[idist];
-           break;
-      }
+// compute the stamps of the warps, with their profiles taken from the
+// cache or built in parallel.
+
+static dt_liquify_stamp_t *compute_round_stamps(dt_liquify_cache_t *cache,
+                                                const GSList *interpolated,
+                                                int *num_stamps)
+{
+  const int n = g_slist_length((GSList *) interpolated);
+  dt_liquify_stamp_t *stamps = malloc(sizeof(dt_liquify_stamp_t) * MAX(n, 1));
+  int *profile_index = malloc(sizeof(int) * MAX(n, 1));
+
+  int k = 0;
+  for(const GSList *i = interpolated; i; i = g_slist_next(i), k++)
+  {
+    dt_liquify_stamp_t *stamp = stamps + k;
+    compute_round_stamp(stamp, (const dt_liquify_warp_t *) i->data);
+
+    int l = 0;
+    while(l < cache->num_profiles
+          && !(cache->profiles[l].iradius == stamp->iradius && cache->profiles[l].control1 == stamp->control1
+               && cache->profiles[l].control2 == stamp->control2))
+      l++;
+
+    if(l == cache->num_profiles)
+    {
+      cache->profiles = realloc(cache->profiles, sizeof(dt_liquify_profile_t) * (l + 1));
+      cache->profiles[l] = (dt_liquify_profile_t){ stamp->iradius, stamp->control1, stamp->control2, NULL, FALSE };
+      cache->num_profiles++;
     }
+    cache->profiles[l].used = TRUE;
+    profile_index[k] = l;
   }
 
-  dt_free_align((void *) lookup_table);
-  *pstamp = stamp;
+  dt_liquify_profile_t *const profiles = cache->profiles;
+  const int num_profiles = cache->num_profiles;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(profiles, num_profiles) \
+  schedule(dynamic)
+#endif
+  for(int l = 0; l < num_profiles; l++)
+    if(profiles[l].intensity == NULL)
+      profiles[l].intensity = build_round_profile(profiles[l].iradius, profiles[l].control1, profiles[l].control2);
+
+  for(k = 0; k < n; k++)
+    stamps[k].profile = profiles[profile_index[k]].intensity;
+
+  free(profile_index);
+  *num_stamps = n;
+  return stamps;
 }
 
-/*
-  Applies a stamp at a specified position.
+// drop the profiles not used by the last stamps.
 
-  Applies a stamp at the position specified by @a point and adds the
-  resulting vector field to the global distortion map @a global_map.
+static void cache_evict_profiles(dt_liquify_cache_t *cache)
+{
+  int kept = 0;
+  for(int l = 0; l < cache->num_profiles; l++)
+  {
+    if(cache->profiles[l].used)
+    {
+      cache->profiles[kept] = cache->profiles[l];
+      cache->profiles[kept].used = FALSE;
+      kept++;
+    }
+    else
+      dt_free_align(cache->profiles[l].intensity);
+  }
+  cache->num_profiles = kept;
+}
+
+/*
+  Applies a stamp to the part of the global distortion map in @a tile.
 
   The global distortion map is a map of relative pixel displacements
   encompassing all our paths.
 */
 
-static void add_to_global_distortion_map(float complex *global_map,
-                                          const cairo_rectangle_int_t *const restrict global_map_extent,
-                                          const dt_liquify_warp_t *const restrict warp,
-                                          const float complex *const restrict stamp,
-                                          const cairo_rectangle_int_t *stamp_extent)
-{
-  cairo_rectangle_int_t mmext = *stamp_extent;
-  mmext.x += (int) round(crealf(warp->point));
-  mmext.y += (int) round(cimagf(warp->point));
-  cairo_rectangle_int_t cmmext = mmext;
-  cairo_region_t *mmreg = cairo_region_create_rectangle(&mmext);
-  cairo_region_intersect_rectangle(mmreg, global_map_extent);
-  cairo_region_get_extents(mmreg, &cmmext);
-  free(mmreg);
+static inline void add_to_global_distortion_map(float complex *const restrict global_map,
+                                                const cairo_rectangle_int_t *const restrict global_map_extent,
+                                                const dt_liquify_stamp_t *const restrict stamp,
+                                                const cairo_rectangle_int_t *const restrict tile)
+{
+  const int x0 = MAX(stamp->extent.x, tile->x);
+  const int x1 = MIN(stamp->extent.x + stamp->extent.width, tile->x + tile->width);
+  const int y0 = MAX(stamp->extent.y, tile->y);
+  const int y1 = MIN(stamp->extent.y + stamp->extent.height, tile->y + tile->height);
+  if(x0 >= x1 || y0 >= y1) return;
+
+  const int iradius = stamp->iradius;
+  const int cx = stamp->extent.x + iradius;
+  const int cy = stamp->extent.y + iradius;
+  const float complex strength = stamp->strength;
+  const gboolean radial = stamp->type == DT_LIQUIFY_WARP_TYPE_RADIAL_GROW
+                          || stamp->type == DT_LIQUIFY_WARP_TYPE_RADIAL_SHRINK;
+  const float sign = stamp->type == DT_LIQUIFY_WARP_TYPE_RADIAL_SHRINK ? -1.0f : 1.0f;
+  const float radial_strength = sign * cabsf(strength) / iradius;
+
+  // the left part of the row reads the profile backwards
+  const int xc0 = MIN(x1, cx);
+  const int xc1 = MAX(x0, cx);
+
+  for(int y = y0; y < y1; y++)
+  {
+    float complex *const restrict row =
+      global_map + (size_t)(y - global_map_extent->y) * global_map_extent->width - global_map_extent->x;
+    const float *const restrict profile = stamp->profile + (size_t)abs(y - cy) * (iradius + 1);
+    const int dy = y - cy;
 
-  #ifdef _OPENMP
-  #pragma omp parallel for schedule (static) default (shared)
-  #endif
+    if(radial)
+    {
+      for(int x = x0; x < xc0; x++)
+        row[x] -= radial_strength * profile[cx - x] * ((x - cx) + dy * I);
+      for(int x = xc1; x < x1; x++)
+        row[x] -= radial_strength * profile[x - cx] * ((x - cx) + dy * I);
+    }
+    else
+    {
+      for(int x = x0; x < xc0; x++)
+        row[x] -= strength * profile[cx - x];
+      for(int x = xc1; x < x1; x++)
+        row[x] -= strength * profile[x - cx];
+    }
+  }
+}
+
+/*
+  Builds the parts of the distortion map in @a region from all the stamps.
+
+  The region is split in tiles of rows, built in parallel. Each tile
+  adds the stamps in their order, so every pixel gets the same sum as
+  if the stamps had been applied one after another to the whole map.
+
+  Returns TRUE if the pipe was cancelled meanwhile.
+*/
+
+static gboolean build_distortion_map_region(float complex *const map,
+                                            const cairo_rectangle_int_t *const map_extent,
+                                            const dt_liquify_stamp_t *const stamps,
+                                            const int num_stamps,
+                                            const cairo_region_t *region,
+                                            dt_dev_pixelpipe_t *pipe)
+{
+  const int num_rects = cairo_region_num_rectangles(region);
+  int num_tiles = 0;
+  for(int r = 0; r < num_rects; r++)
+  {
+    cairo_rectangle_int_t rect;
+    cairo_region_get_rectangle(region, r, &rect);
+    num_tiles += (rect.height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+  }
+  if(num_tiles == 0) return FALSE;
 
-  for(int y = cmmext.y; y < cmmext.y + cmmext.height; y++)
+  cairo_rectangle_int_t *const tiles = malloc(sizeof(cairo_rectangle_int_t) * num_tiles);
+  int t = 0;
+  for(int r = 0; r < num_rects; r++)
   {
-    const float complex *const srcrow = stamp + ((y - mmext.y) * mmext.width);
-    float complex *const destrow = global_map + ((y - global_map_extent->y) * global_map_extent->width);
+    cairo_rectangle_int_t rect;
+    cairo_region_get_rectangle(region, r, &rect);
+    for(int y = rect.y; y < rect.y + rect.height; y += TILE_HEIGHT)
+      tiles[t++] = (cairo_rectangle_int_t){ rect.x, y, rect.width, MIN(TILE_HEIGHT, rect.y + rect.height - y) };
+  }
 
-    for(int x = cmmext.x; x < cmmext.x + cmmext.width; x++)
+  gboolean cancelled = FALSE;
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(map, map_extent, stamps, num_stamps, tiles, num_tiles, pipe) \
+  schedule(dynamic) reduction(|| : cancelled)
+#endif
+  for(int k = 0; k < num_tiles; k++)
+  {
+    if(dt_dev_pixelpipe_is_cancelled(pipe))
     {
-      destrow[x - global_map_extent->x] -= srcrow[x - mmext.x];
+      cancelled = TRUE;
+      continue;
     }
+
+    const cairo_rectangle_int_t *const tile = tiles + k;
+    for(int y = tile->y; y < tile->y + tile->height; y++)
+      memset(map + (size_t)(y - map_extent->y) * map_extent->width + tile->x - map_extent->x, 0,
+             sizeof(float complex) * tile->width);
+
+    for(int s = 0; s < num_stamps; s++)
+      add_to_global_distortion_map(map, map_extent, stamps + s, tile);
   }
+
+  free(tiles);
+  return cancelled;
+}
+
+/*
+  Brings the distortion map of the cache up to date with the stamps of
+  the warps in @a interpolated over @a map_extent.
+
+  The stamps common to the start and the end of the old and new list
+  keep their order, so the pixels they alone cover keep their value:
+  only the extents of the other stamps, old and new, and the parts of
+  the map outside the old extent are built again.
+
+  Returns FALSE, with the cache emptied, if the pipe was cancelled
+  meanwhile.
+*/
+
+static gboolean update_global_distortion_map(dt_liquify_cache_t *cache,
+                                             const cairo_rectangle_int_t *map_extent,
+                                             const GSList *interpolated,
+                                             dt_dev_pixelpipe_t *pipe)
+{
+  int num_stamps = 0;
+  dt_liquify_stamp_t *stamps = compute_round_stamps(cache, interpolated, &num_stamps);
+
+  const size_t mapsize = (size_t)map_extent->width * map_extent->height;
+  float complex *map = cache->map;
+  cairo_region_t *dirty = cairo_region_create_rectangle(map_extent);
+
+  if(map)
+  {
+    const cairo_rectangle_int_t *old_extent = &cache->map_extent;
+    if(old_extent->x != map_extent->x || old_extent->y != map_extent->y
+       || old_extent->width != map_extent->width || old_extent->height != map_extent->height)
+    {
+      // keep the overlap of the old and new extents
+      map = dt_alloc_align(sizeof(float complex) * mapsize);
+      cairo_region_t *overlap = cairo_region_create_rectangle(map_extent);
+      cairo_region_intersect_rectangle(overlap, old_extent);
+      cairo_rectangle_int_t o;
+      cairo_region_get_extents(overlap, &o);
+      cairo_region_destroy(overlap);
+
+      for(int y = o.y; y < o.y + o.height; y++)
+        memcpy(map + (size_t)(y - map_extent->y) * map_extent->width + o.x - map_extent->x,
+               cache->map + (size_t)(y - old_extent->y) * old_extent->width + o.x - old_extent->x,
+               sizeof(float complex) * o.width);
+
+      cairo_region_subtract_rectangle(dirty, &o);
+      dt_free_align(cache->map);
+    }
+    else
+    {
+      cairo_region_destroy(dirty);
+      dirty = cairo_region_create();
+    }
+
+    int first = 0;
+    const int common = MIN(num_stamps, cache->num_stamps);
+    while(first < common && same_stamp(stamps + first, cache->stamps + first))
+      first++;
+    int last = 0;
+    while(last < common - first
+          && same_stamp(stamps + num_stamps - 1 - last, cache->stamps + cache->num_stamps - 1 - last))
+      last++;
+
+    for(int k = first; k < cache->num_stamps - last; k++)
+      cairo_region_union_rectangle(dirty, &cache->stamps[k].extent);
+    for(int k = first; k < num_stamps - last; k++)
+      cairo_region_union_rectangle(dirty, &stamps[k].extent);
+    cairo_region_intersect_rectangle(dirty, map_extent);
+  }
+  else
+    map = dt_alloc_align(sizeof(float complex) * mapsize);
+
+  const gboolean cancelled = build_distortion_map_region(map, map_extent, stamps, num_stamps, dirty, pipe);
+  cairo_region_destroy(dirty);
+
+  free(cache->stamps);
+  cache->stamps = stamps;
+  cache->num_stamps = num_stamps;
+  cache->map = map;
+  cache->map_extent = *map_extent;
+  cache_evict_profiles(cache);
+
+  if(cancelled)
+  {
+    cache_cleanup(cache);
+    return FALSE;
+  }
+  return TRUE;
 }
 
 /*
@@ -1119,9 +1392,12 @@ static GSList *_get_map_extent(const dt_iop_roi_t *roi_out,
   return g_slist_reverse(in_roi);
 }
 
+// `pipe`, if not NULL, is polled for cancellation between warps.
+// Returns NULL if there is nothing to distort or if the pipe was cancelled meanwhile.
 static float complex *create_global_distortion_map(const cairo_rectangle_int_t *map_extent,
                                                    const GSList *interpolated,
-                                                   gboolean inverted)
+                                                   gboolean inverted,
+                                                   dt_dev_pixelpipe_t *pipe)
 {
   const int mapsize = map_extent->width * map_extent->height;
   if (mapsize == 0)
@@ -1131,20 +1407,14 @@ static float complex *create_global_distortion_map(const cairo_rectangle_int_t *
     return NULL;
   }
 
-  // allocate distortion map big enough to contain all paths
-  float complex *map = dt_alloc_align(sizeof(float complex) * mapsize);
-  memset(map, 0, sizeof(float complex) * mapsize);
+  // build a distortion map big enough to contain all paths
+  dt_liquify_cache_t cache = { 0 };
+  if(!update_global_distortion_map(&cache, map_extent, interpolated, pipe))
+    return NULL;
 
-  // build map
-  for(const GSList *i = interpolated; i; i = g_slist_next(i))
-  {
-    const dt_liquify_warp_t *warp = ((dt_liquify_warp_t *) i->data);
-    float complex *stamp = NULL;
-    cairo_rectangle_int_t r;
-    build_round_stamp(&stamp, &r, warp);
-    add_to_global_distortion_map(map, map_extent, warp, stamp, &r);
-    free((void *) stamp);
-  }
+  float complex *map = cache.map;
+  cache.map = NULL;
+  cache_cleanup(&cache);
 
   if(inverted)
   {
@@ -1206,11 +1476,13 @@ static float complex *create_global_distortion_map(const cairo_rectangle_int_t *
   return map;
 }
 
-static float complex *build_global_distortion_map(struct dt_iop_module_t *module,
-                                                   const dt_dev_pixelpipe_iop_t *piece,
-                                                   const dt_iop_roi_t *roi_in,
-                                                   const dt_iop_roi_t *roi_out,
-                                                   cairo_rectangle_int_t *map_extent)
+// the map is owned by the cache of the piece, and valid until the next call.
+
+static const float complex *build_global_distortion_map(struct dt_iop_module_t *module,
+                                                        const dt_dev_pixelpipe_iop_t *piece,
+                                                        const dt_iop_roi_t *roi_in,
+                                                        const dt_iop_roi_t *roi_out,
+                                                        cairo_rectangle_int_t *map_extent)
 {
   // copy params
   dt_iop_liquify_params_t copy_params;
@@ -1221,13 +1493,29 @@ static float complex *build_global_distortion_map(struct dt_iop_module_t *module
   GList *interpolated = interpolate_paths(&copy_params);
   GSList *interpolated_in_roi = _get_map_extent(roi_out, interpolated, map_extent);
 
-  float complex *map = create_global_distortion_map(map_extent, interpolated_in_roi, FALSE);
+  dt_liquify_cache_t *cache = ((dt_iop_liquify_data_t *)piece->data)->cache;
+  const float complex *map = NULL;
+  if(map_extent->width != 0 && map_extent->height != 0
+     && update_global_distortion_map(cache, map_extent, interpolated_in_roi, piece->pipe))
+    map = cache->map;
 
   g_slist_free(interpolated_in_roi);
   g_list_free_full(interpolated, free);
   return map;
 }
 
+// to call once the map returned by build_global_distortion_map() has been applied
+static void release_global_distortion_map(dt_dev_pixelpipe_iop_t *piece)
+{
+  dt_liquify_cache_t *cache = ((dt_iop_liquify_data_t *)piece->data)->cache;
+  const size_t bytes = sizeof(float complex) * cache->map_extent.width * cache->map_extent.height;
+  if(cache->map && bytes > LIQUIFY_CACHE_MAX_MAP_BYTES)
+  {
+    dt_free_align(cache->map);
+    cache->map = NULL;
+  }
+}
+
 // 1st pass: how large would the output be, given this input roi?
 // this is always called with the full buffer before processing.
 void modify_roi_out(struct dt_iop_module_t *module,
@@ -1342,7 +1630,7 @@ static int _distort_xtransform(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *pi
     dt_iop_roi_t roi_in = { .x = extent.x, .y = extent.y, .width = extent.width, .height = extent.height };
     GSList *interpolated_in_roi = _get_map_extent(&roi_in, interpolated, &extent);
 
-    float complex *map = create_global_distortion_map(&extent, interpolated_in_roi, inverted);
+    float complex *map = create_global_distortion_map(&extent, interpolated_in_roi, inverted, NULL);
     g_slist_free(interpolated_in_roi);
     g_list_free_full(interpolated, free);
 
@@ -1427,7 +1715,7 @@ void distort_mask(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *p
   // 2. build the distortion map
 
   cairo_rectangle_int_t map_extent;
-  float complex *map = build_global_distortion_map(self, piece, roi_in, roi_out, &map_extent);
+  const float complex *map = build_global_distortion_map(self, piece, roi_in, roi_out, &map_extent);
   if(map == NULL)
     return;
 
@@ -1440,9 +1728,7 @@ void distort_mask(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *p
     apply_global_distortion_map(self, piece, in, out, roi_in, roi_out, map, &map_extent);
     piece->colors = ch;
   }
-
-  dt_free_align((void *) map);
-
+  release_global_distortion_map(piece);
 }
 
 void process(struct dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, const void *const in,
@@ -1473,7 +1759,7 @@ void process(struct dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, cons
   // 2. build the distortion map
 
   cairo_rectangle_int_t map_extent;
-  float complex *map = build_global_distortion_map(module, piece, roi_in, roi_out, &map_extent);
+  const float complex *map = build_global_distortion_map(module, piece, roi_in, roi_out, &map_extent);
   if(map == NULL)
     return;
 
@@ -1481,8 +1767,7 @@ void process(struct dt_iop_module_t *module, dt_dev_pixelpipe_iop_t *piece, cons
 
   if(map_extent.width != 0 && map_extent.height != 0)
     apply_global_distortion_map(module, piece, in, out, roi_in, roi_out, map, &map_extent);
-
-  dt_free_align((void *)map);
+  release_global_distortion_map(piece);
 }
 
 #ifdef HAVE_OPENCL
@@ -1643,7 +1928,7 @@ int process_cl(struct dt_iop_module_t *module,
   // 3. apply the map
   if(map_extent.width != 0 && map_extent.height != 0)
     err = apply_global_distortion_map_cl(module, piece, dev_in, dev_out, roi_in, roi_out, map, &map_extent);
-  dt_free_align((void *) map);
+  release_global_distortion_map(piece);
   if(err != CL_SUCCESS) goto error;
 
   return TRUE;
@@ -1687,12 +1972,17 @@ void init(dt_iop_module_t *module)
 
 void init_pipe(struct dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
-  piece->data = malloc(module->params_size);
+  dt_iop_liquify_data_t *d = calloc(1, sizeof(dt_iop_liquify_data_t));
+  d->cache = calloc(1, sizeof(dt_liquify_cache_t));
+  piece->data = d;
   piece->data_size = module->params_size;
 }
 
 void cleanup_pipe(struct dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
 {
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)piece->data;
+  cache_cleanup(d->cache);
+  free(d->cache);
   free(piece->data);
   piece->data = NULL;
 }
@@ -1704,7 +1994,8 @@ void commit_params(struct dt_iop_module_t *module,
                     dt_dev_pixelpipe_t *pipe,
                     dt_dev_pixelpipe_iop_t *piece)
 {
-  memcpy(piece->data, params, module->params_size);
+  dt_iop_liquify_data_t *d = (dt_iop_liquify_data_t *)piece->data;
+  memcpy(&d->params, params, module->params_size);
 }
 
 // calculate the dot product of 2 vectors.
@@ -1811,7 +2102,7 @@ static GList *interpolate_paths(dt_iop_liquify_params_t *p)
       {
         dt_liquify_warp_t *w = malloc(sizeof(dt_liquify_warp_t));
         *w = *warp2;
-        l = g_list_append(l, w);
+        l = g_list_prepend(l, w);
       }
       continue;
     }
@@ -1831,7 +2122,7 @@ static GList *interpolate_paths(dt_iop_liquify_params_t *p)
         mix_warps(w, warp1, warp2, pt, t);
         w->status = DT_LIQUIFY_STATUS_INTERPOLATED;
         arc_length += cabsf(w->radius - w->point) * STAMP_RELOCATION;
-        l = g_list_append(l, w);
+        l = g_list_prepend(l, w);
       }
       continue;
     }
@@ -1857,13 +2148,13 @@ static GList *interpolate_paths(dt_iop_liquify_params_t *p)
         mix_warps(w, warp1, warp2, pt, t);
         w->status = DT_LIQUIFY_STATUS_INTERPOLATED;
         arc_length += cabsf(w->radius - w->point) * STAMP_RELOCATION;
-        l = g_list_append(l, w);
+        l = g_list_prepend(l, w);
       }
       free((void *) buffer);
       continue;
     }
   }
-  return l;
+  return g_list_reverse(l);
 }
 
 #define FG_COLOR     set_source_rgba(cr, fg_color)
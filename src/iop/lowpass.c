@@ -401,10 +401,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
     const float sigma_s = sigma;
     const float detail = -1.0f; // we want the bilateral base layer
 
-    dt_bilateral_t *b = dt_bilateral_init(width, height, sigma_s, sigma_r);
+    dt_bilateral_t *b = dt_bilateral_shared(in, width, height, sigma_s, sigma_r);
     if(!b) return;
-    dt_bilateral_splat(b, in);
-    dt_bilateral_blur(b);
     dt_bilateral_slice(b, in, out, detail);
     dt_bilateral_free(b);
   }
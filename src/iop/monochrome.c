@@ -194,9 +194,9 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   const float sigma_s = 20.0f / scale;
   const float detail = -1.0f; // bilateral base layer
 
-  dt_bilateral_t *b = dt_bilateral_init(roi_in->width, roi_in->height, sigma_s, sigma_r);
-  dt_bilateral_splat(b, (float *)o);
-  dt_bilateral_blur(b);
+  // the filter contribution only depends on the filter color: its grid is reused while the highlights change
+  dt_bilateral_t *b = dt_bilateral_shared((float *)o, roi_in->width, roi_in->height, sigma_s, sigma_r);
+  if(!b) return;
   dt_bilateral_slice(b, (float *)o, (float *)o, detail);
   dt_bilateral_free(b);
 
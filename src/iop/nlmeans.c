@@ -21,6 +21,7 @@
 #include "bauhaus/bauhaus.h"
 #include "common/nlmeans_core.h"
 #include "common/opencl.h"
+#include "control/conf.h"
 #include "control/control.h"
 #include "develop/imageop.h"
 #include "develop/imageop_math.h"
@@ -130,7 +131,7 @@ int default_group()
 
 int flags()
 {
-  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING;
+  return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING | IOP_FLAGS_SKIP_IN_DRAFT;
 }
 
 #if defined(HAVE_OPENCL) && !USE_NEW_IMPL_CL
@@ -189,7 +190,8 @@ int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_m
     .kernel_dist = gd->kernel_nlmeans_dist,
     .kernel_horiz = gd->kernel_nlmeans_horiz,
     .kernel_vert = gd->kernel_nlmeans_vert,
-    .kernel_accu = gd->kernel_nlmeans_accu
+    .kernel_accu = gd->kernel_nlmeans_accu,
+    .pipe = piece->pipe
   };
   cl_int err = nlmeans_denoise_cl(&params, devid, dev_in, dev_U2, roi_in);
   if (err == CL_SUCCESS)
@@ -431,7 +433,8 @@ static void process_cpu(dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
                                       .patch_radius = P,
                                       .search_radius = K,
                                       .decimate = decimate,
-                                      .norm = norm2 };
+                                      .norm = norm2,
+                                      .pipe = piece->pipe };
   denoiser(ivoid,ovoid,roi_in,roi_out,&params);
   if(piece->pipe->mask_display & DT_DEV_PIXELPIPE_DISPLAY_MASK)
     dt_iop_alpha_copy(ivoid, ovoid, roi_out->width, roi_out->height);
@@ -440,7 +443,8 @@ static void process_cpu(dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
 void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
              void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  process_cpu(piece,ivoid,ovoid,roi_in,roi_out,nlmeans_denoise);
+  process_cpu(piece,ivoid,ovoid,roi_in,roi_out,
+              dt_conf_get_bool("nlmeans_banded") ? nlmeans_denoise_banded : nlmeans_denoise);
   return;
 }
 
@@ -449,7 +453,8 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
 void process_sse2(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const ivoid,
                   void *const ovoid, const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
 {
-  process_cpu(piece,ivoid,ovoid,roi_in,roi_out,nlmeans_denoise_sse2);
+  process_cpu(piece,ivoid,ovoid,roi_in,roi_out,
+              dt_conf_get_bool("nlmeans_banded") ? nlmeans_denoise_banded : nlmeans_denoise_sse2);
   return;
 }
 #endif
@@ -26,6 +26,7 @@
 #include "common/imagebuf.h"
 #include "develop/imageop.h"
 #include "develop/imageop_gui.h"
+#include "develop/raw_fuse.h"
 #include "develop/tiling.h"
 #include "common/image_cache.h"
 
@@ -448,6 +449,38 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = 1.0f;
 }
 
+gboolean fuse_raw(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *const roi_in,
+                  const dt_iop_roi_t *const roi_out, dt_dev_raw_fuse_t *fuse)
+{
+  const dt_iop_rawprepare_data_t *const d = (dt_iop_rawprepare_data_t *)piece->data;
+
+  // only the raw mosaic path of process(), without gain maps nor detail mask
+  if(!piece->pipe->dsc.filters || piece->dsc_in.channels != 1) return FALSE;
+  if(piece->dsc_in.datatype != TYPE_UINT16 && piece->dsc_in.datatype != TYPE_FLOAT) return FALSE;
+  if(d->apply_gainmaps) return FALSE;
+  if(piece->pipe->want_detail_mask == (DT_DEV_DETAIL_MASK_REQUIRED | DT_DEV_DETAIL_MASK_RAWPREPARE)) return FALSE;
+
+  const int csx = compute_proper_crop(piece, roi_in, d->x), csy = compute_proper_crop(piece, roi_in, d->y);
+
+  fuse->input_is_uint16 = (piece->dsc_in.datatype == TYPE_UINT16);
+  fuse->crop_x = csx;
+  fuse->crop_y = csy;
+  fuse->black_x = d->x;
+  fuse->black_y = d->y;
+  for(int k = 0; k < 4; k++)
+  {
+    fuse->sub[k] = d->sub[k];
+    fuse->div[k] = d->div[k];
+  }
+
+  // side effects of process() on the pipe: nothing is written in the detail mask, it only gets cleared
+  piece->pipe->dsc.filters = dt_rawspeed_crop_dcraw_filters(self->dev->image_storage.buf_dsc.filters, csx, csy);
+  adjust_xtrans_filters(piece->pipe, csx, csy);
+  dt_dev_write_rawdetail_mask(piece, NULL, roi_in, DT_DEV_DETAIL_MASK_RAWPREPARE);
+  for(int k = 0; k < 4; k++) piece->pipe->dsc.processed_maximum[k] = 1.0f;
+  return TRUE;
+}
+
 #ifdef HAVE_OPENCL
 int process_cl(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
                const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
@@ -36,6 +36,7 @@
 #include "develop/develop.h"
 #include "develop/imageop_gui.h"
 #include "develop/imageop_math.h"
+#include "develop/raw_fuse.h"
 #include "develop/tiling.h"
 #include "dtgtk/expander.h"
 #include "external/wb_presets.c"
@@ -571,6 +572,25 @@ void process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const
   }
 }
 
+gboolean fuse_raw(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *const roi_in,
+                  const dt_iop_roi_t *const roi_out, dt_dev_raw_fuse_t *fuse)
+{
+  if(!piece->pipe->dsc.filters) return FALSE;
+
+  const dt_iop_temperature_data_t *const d = (dt_iop_temperature_data_t *)piece->data;
+
+  fuse->white_balance = TRUE;
+  piece->pipe->dsc.temperature.enabled = 1;
+  for(int k = 0; k < 4; k++)
+  {
+    fuse->wb[k] = d->coeffs[k];
+    piece->pipe->dsc.temperature.coeffs[k] = d->coeffs[k];
+    piece->pipe->dsc.processed_maximum[k] = d->coeffs[k] * piece->pipe->dsc.processed_maximum[k];
+    self->dev->proxy.wb_coeffs[k] = d->coeffs[k];
+  }
+  return TRUE;
+}
+
 #ifdef HAVE_OPENCL
 int process_cl(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, cl_mem dev_in, cl_mem dev_out,
                const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
@@ -792,10 +792,14 @@ static inline float pixel_correction(const float exposure,
 
 
 __DT_CLONE_TARGETS__
-static inline void compute_luminance_mask(const float *const restrict in, float *const restrict luminance,
-                                          const size_t width, const size_t height, const size_t ch,
-                                          const dt_iop_toneequalizer_data_t *const d)
-{
+// Returns FALSE if the guided filter was interrupted by the pipe kill-switch or failed to allocate
+// its buffers: the mask is then unfinished and must not be cached.
+static inline gboolean compute_luminance_mask(const float *const restrict in, float *const restrict luminance,
+                                              const size_t width, const size_t height, const size_t ch,
+                                              const dt_iop_toneequalizer_data_t *const d,
+                                              dt_dev_pixelpipe_t *const pipe)
+{
+  gboolean complete = TRUE;
   switch(d->details)
   {
     case(DT_TONEEQ_NONE):
@@ -809,8 +813,9 @@ static inline void compute_luminance_mask(const float *const restrict in, float
     {
       // Still no contrast boost
       luminance_mask(in, luminance, width, height, ch, d->method, d->exposure_boost, 0.0f, 1.0f);
-      fast_surface_blur(luminance, width, height, d->radius, d->feathering, d->iterations,
-                    DT_GF_BLENDING_GEOMEAN, d->scale, d->quantization, exp2f(-14.0f), 4.0f);
+      complete = fast_surface_blur(luminance, width, height, d->radius, d->feathering, d->iterations,
+                    DT_GF_BLENDING_GEOMEAN, d->scale, d->quantization, exp2f(-14.0f), 4.0f,
+                    &pipe->shutdown);
       break;
     }
 
@@ -825,8 +830,9 @@ static inline void compute_luminance_mask(const float *const restrict in, float
       // the exposure boost should be used to make this assumption true
       luminance_mask(in, luminance, width, height, ch, d->method, d->exposure_boost,
                       CONTRAST_FULCRUM, d->contrast_boost);
-      fast_surface_blur(luminance, width, height, d->radius, d->feathering, d->iterations,
-                    DT_GF_BLENDING_LINEAR, d->scale, d->quantization, exp2f(-14.0f), 4.0f);
+      complete = fast_surface_blur(luminance, width, height, d->radius, d->feathering, d->iterations,
+                    DT_GF_BLENDING_LINEAR, d->scale, d->quantization, exp2f(-14.0f), 4.0f,
+                    &pipe->shutdown);
       break;
     }
 
@@ -834,8 +840,9 @@ static inline void compute_luminance_mask(const float *const restrict in, float
     {
       // Still no contrast boost
       luminance_mask(in, luminance, width, height, ch, d->method, d->exposure_boost, 0.0f, 1.0f);
-      fast_eigf_surface_blur(luminance, width, height, d->radius, d->feathering, d->iterations,
-                    DT_GF_BLENDING_GEOMEAN, d->scale, d->quantization, exp2f(-14.0f), 4.0f);
+      complete = fast_eigf_surface_blur(luminance, width, height, d->radius, d->feathering, d->iterations,
+                    DT_GF_BLENDING_GEOMEAN, d->scale, d->quantization, exp2f(-14.0f), 4.0f,
+                    &pipe->shutdown);
       break;
     }
 
@@ -843,8 +850,9 @@ static inline void compute_luminance_mask(const float *const restrict in, float
     {
       luminance_mask(in, luminance, width, height, ch, d->method, d->exposure_boost,
                       CONTRAST_FULCRUM, d->contrast_boost);
-      fast_eigf_surface_blur(luminance, width, height, d->radius, d->feathering, d->iterations,
-                    DT_GF_BLENDING_LINEAR, d->scale, d->quantization, exp2f(-14.0f), 4.0f);
+      complete = fast_eigf_surface_blur(luminance, width, height, d->radius, d->feathering, d->iterations,
+                    DT_GF_BLENDING_LINEAR, d->scale, d->quantization, exp2f(-14.0f), 4.0f,
+                    &pipe->shutdown);
       break;
     }
 
@@ -854,6 +862,7 @@ static inline void compute_luminance_mask(const float *const restrict in, float
       break;
     }
   }
+  return complete;
 }
 
 
@@ -1023,6 +1032,7 @@ void toneeq_process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
   }
 
   // Compute the luminance mask
+  gboolean mask_complete = TRUE;
   if(cached)
   {
     // caching path : store the luminance mask for GUI access
@@ -1039,8 +1049,13 @@ void toneeq_process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
       if(hash != saved_hash || !luminance_valid)
       {
         /* compute only if upstream pipe state has changed */
-        compute_luminance_mask(in, luminance, width, height, ch, d);
-        hash_set_get(&hash, &g->ui_preview_hash, &self->gui_lock);
+        dt_iop_gui_enter_critical_section(self);
+        g->histogram_valid = FALSE;
+        mask_complete = compute_luminance_mask(in, luminance, width, height, ch, d, piece->pipe);
+        // don't keep an unfinished mask
+        g->ui_preview_hash = mask_complete ? hash : 0;
+        g->luminance_valid = mask_complete;
+        dt_iop_gui_leave_critical_section(self);
       }
     }
     else if((piece->pipe->type & DT_DEV_PIXELPIPE_PREVIEW) == DT_DEV_PIXELPIPE_PREVIEW)
@@ -1056,22 +1071,31 @@ void toneeq_process(struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece,
       {
         /* compute only if upstream pipe state has changed */
         dt_iop_gui_enter_critical_section(self);
-        g->thumb_preview_hash = hash;
         g->histogram_valid = FALSE;
-        compute_luminance_mask(in, luminance, width, height, ch, d);
-        g->luminance_valid = TRUE;
+        mask_complete = compute_luminance_mask(in, luminance, width, height, ch, d, piece->pipe);
+        // don't keep an unfinished mask
+        g->thumb_preview_hash = mask_complete ? hash : 0;
+        g->luminance_valid = mask_complete;
         dt_iop_gui_leave_critical_section(self);
       }
     }
     else // make it dummy-proof
     {
-      compute_luminance_mask(in, luminance, width, height, ch, d);
+      mask_complete = compute_luminance_mask(in, luminance, width, height, ch, d, piece->pipe);
     }
   }
   else
   {
     // no caching path : compute no matter what
-    compute_luminance_mask(in, luminance, width, height, ch, d);
+    mask_complete = compute_luminance_mask(in, luminance, width, height, ch, d, piece->pipe);
+  }
+
+  if(!mask_complete)
+  {
+    // the guided filter failed to allocate its buffers, rather than being cancelled: pass input through
+    if(!dt_dev_pixelpipe_is_cancelled(piece->pipe)) dt_simd_memcpy(in, out, num_elem * ch);
+    if(!cached) dt_free_align(luminance);
+    return;
   }
 
   // Display output
@@ -0,0 +1,252 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * benchmark of the line detection and the fit quality of the module iop/ashift.c: on a synthetic
+ * 24 Mpx facade, prints the time to detect the lines at full size and coarse to fine, how far the refined
+ * lines are from the ones detected at full size, and the time and the relative deviation of model_fitness()
+ * against the per-line evaluation it replaces.
+ *
+ * Please see README.txt for more detailed documentation.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#include "iop/ashift.c"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+// a 24 Mpx image: a grid of windows, slightly rotated
+#define WIDTH 6000
+#define HEIGHT 4000
+#define TILT 1.2f
+#define PERIOD 300.0f
+#define WINDOW_W 180.0f
+#define WINDOW_H 220.0f
+
+// refined lines are matched to the lines found at full size within this distance and angle
+#define MATCH_DISTANCE 3.0f
+#define MATCH_ANGLE 2.0f
+
+#define FITNESS_RUNS 200
+
+// anti-aliased dark windows on a light wall, with some noise
+static float *facade_alloc(void)
+{
+  float *img = dt_alloc_align_float((size_t)4 * WIDTH * HEIGHT);
+  const float c = cosf(TILT * M_PI / 180.0f);
+  const float s = sinf(TILT * M_PI / 180.0f);
+
+#ifdef _OPENMP
+#pragma omp parallel for default(none) dt_omp_firstprivate(img, c, s) schedule(static)
+#endif
+  for(int y = 0; y < HEIGHT; y++)
+  {
+    uint32_t seed = 0x9E3779B9u * (y + 1);
+    for(int x = 0; x < WIDTH; x++)
+    {
+      // position in the facade, then signed distance to the edge of the closest window
+      const float u = c * (x - 0.5f * WIDTH) + s * (y - 0.5f * HEIGHT);
+      const float v = -s * (x - 0.5f * WIDTH) + c * (y - 0.5f * HEIGHT);
+      const float du = fabsf(u - PERIOD * roundf(u / PERIOD)) - 0.5f * WINDOW_W;
+      const float dv = fabsf(v - PERIOD * roundf(v / PERIOD)) - 0.5f * WINDOW_H;
+      const float coverage = CLAMP(0.5f - fmaxf(du, dv), 0.0f, 1.0f);
+      seed = seed * 1664525u + 1013904223u;
+      const float value = 0.6f - 0.45f * coverage + 0.01f * ((seed >> 8) / 16777216.f - 0.5f);
+      for(int k = 0; k < 3; k++) img[4 * ((size_t)y * WIDTH + x) + k] = value;
+      img[4 * ((size_t)y * WIDTH + x) + 3] = 0.0f;
+    }
+  }
+  return img;
+}
+
+// mean distance of the end points of a line to the closest line of the same direction detected at full size,
+// or -1 if none is close
+static float endpoint_error(const dt_iop_ashift_line_t *line, const double *full, const int full_count)
+{
+  const float dx = line->p2[0] - line->p1[0];
+  const float dy = line->p2[1] - line->p1[1];
+  const float length = sqrtf(dx * dx + dy * dy);
+  float best = -1.0f;
+
+  for(int n = 0; n < full_count; n++)
+  {
+    const double *const l = full + 7 * n;
+    const float fx = l[2] - l[0];
+    const float fy = l[3] - l[1];
+    const float flength = sqrtf(fx * fx + fy * fy);
+    if(fabsf(dx * fx + dy * fy) < cosf(MATCH_ANGLE * M_PI / 180.0f) * length * flength) continue;
+
+    // distance of the end points to the full size line, which has to overlap the refined one
+    const float d1 = fabsf((line->p1[0] - l[0]) * fy - (line->p1[1] - l[1]) * fx) / flength;
+    const float d2 = fabsf((line->p2[0] - l[0]) * fy - (line->p2[1] - l[1]) * fx) / flength;
+    const float t1 = ((line->p1[0] - l[0]) * fx + (line->p1[1] - l[1]) * fy) / flength;
+    const float t2 = ((line->p2[0] - l[0]) * fx + (line->p2[1] - l[1]) * fy) / flength;
+    if(fmaxf(d1, d2) > MATCH_DISTANCE || fmaxf(t1, t2) < 0.0f || fminf(t1, t2) > flength) continue;
+
+    const float error = 0.5f * (d1 + d2);
+    if(best < 0.0f || error < best) best = error;
+  }
+  return best;
+}
+
+// model_fitness() as it was before the lines got packed, as a reference
+static double reference_fitness(double *params, void *data)
+{
+  dt_iop_ashift_fit_params_t *fit = (dt_iop_ashift_fit_params_t *)data;
+  const float rotation = ilogit(params[0], -fit->rotation_range, fit->rotation_range);
+  const float lensshift_v = ilogit(params[1], -fit->lensshift_v_range, fit->lensshift_v_range);
+  const float lensshift_h = ilogit(params[2], -fit->lensshift_h_range, fit->lensshift_h_range);
+  const float shear = ilogit(params[3], -fit->shear_range, fit->shear_range);
+
+  const float Av[3] = { 1.0f, 0.0f, 0.0f };
+  const float Ah[3] = { 0.0f, 1.0f, 0.0f };
+  float homograph[3][3];
+  homography((float *)homograph, rotation, lensshift_v, lensshift_h, shear, fit->f_length_kb,
+             fit->orthocorr, fit->aspect, fit->width, fit->height, ASHIFT_HOMOGRAPH_FORWARD);
+
+  double sumsq_v = 0.0, sumsq_h = 0.0, weight_v = 0.0, weight_h = 0.0;
+  int count_v = 0, count_h = 0, count = 0;
+  for(int n = 0; n < fit->lines_count; n++)
+  {
+    const dt_iop_ashift_line_t *line = fit->lines + n;
+    if((line->type & fit->linemask) != fit->linetype) continue;
+    const int isvertical = line->type & ASHIFT_LINE_DIRVERT;
+    const float *A = isvertical ? Ah : Av;
+    float P1[3], P2[3], L[3];
+    mat3mulv(P1, (float *)homograph, line->p1);
+    mat3mulv(P2, (float *)homograph, line->p2);
+    vec3prodn(L, P1, P2);
+    vec3lnorm(L, L);
+    const float s = vec3scalar(L, A);
+    sumsq_v += isvertical ? s * s * line->weight : 0.0;
+    weight_v += isvertical ? line->weight : 0.0;
+    count_v += isvertical ? 1 : 0;
+    sumsq_h += !isvertical ? s * s * line->weight : 0.0;
+    weight_h += !isvertical ? line->weight : 0.0;
+    count_h += !isvertical ? 1 : 0;
+    count++;
+  }
+
+  const double v = weight_v > 0.0f && count > 0 ? sumsq_v / weight_v * (float)count_v / count : 0.0;
+  const double h = weight_h > 0.0f && count > 0 ? sumsq_h / weight_h * (float)count_h / count : 0.0;
+  return sqrt(1.0 - (1.0 - v) * (1.0 - h)) * 1.0e6;
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+
+  float *img = facade_alloc();
+
+  // LSD at full size, as the module did before the coarse to fine detection
+  const double start = dt_get_wtime();
+  double *greyscale = malloc(sizeof(double) * WIDTH * HEIGHT);
+  rgb2grey256(img, greyscale, WIDTH, HEIGHT);
+  int full_count = 0;
+  double *full = LineSegmentDetection(&full_count, greyscale, WIDTH, HEIGHT, LSD_SCALE, LSD_SIGMA_SCALE, LSD_QUANT,
+                                      LSD_ANG_TH, LSD_LOG_EPS, LSD_DENSITY_TH, LSD_N_BINS, NULL, NULL, NULL);
+  free(greyscale);
+  const double mid = dt_get_wtime();
+
+  dt_iop_ashift_line_t *lines = NULL;
+  int lines_count = 0, vertical_count = 0, horizontal_count = 0;
+  float vertical_weight = 0.0f, horizontal_weight = 0.0f;
+  line_detect(img, WIDTH, HEIGHT, 0, 0, 1.0f, &lines, &lines_count, &vertical_count, &horizontal_count,
+              &vertical_weight, &horizontal_weight, ASHIFT_ENHANCE_NONE, FALSE);
+  const double end = dt_get_wtime();
+
+  double error = 0.0;
+  int matched = 0;
+  for(int n = 0; n < lines_count; n++)
+  {
+    const float e = endpoint_error(lines + n, full, full_count);
+    if(e < 0.0f) continue;
+    error += e;
+    matched++;
+  }
+
+  fprintf(stdout, "[ashift] line detection on %ix%i: full size %9.2f ms (%i lines), coarse to fine %9.2f ms "
+                  "(%i lines, %i matched), mean endpoint error %.4f px\n",
+          WIDTH, HEIGHT, (mid - start) * 1000., full_count, (end - mid) * 1000., lines_count, matched,
+          matched ? error / matched : 0.0);
+
+  // fit of the 4 parameters on all the lines, as for auto-fit of everything
+  dt_iop_ashift_fit_params_t fit = { .params_count = 4,
+                                     .linetype = ASHIFT_LINE_RELEVANT | ASHIFT_LINE_SELECTED,
+                                     .linemask = ASHIFT_LINE_RELEVANT | ASHIFT_LINE_SELECTED,
+                                     .lines = lines,
+                                     .lines_count = lines_count,
+                                     .width = WIDTH,
+                                     .height = HEIGHT,
+                                     .f_length_kb = DEFAULT_F_LENGTH,
+                                     .orthocorr = 0.0f,
+                                     .aspect = 1.0f,
+                                     .rotation = NAN,
+                                     .lensshift_v = NAN,
+                                     .lensshift_h = NAN,
+                                     .shear = NAN,
+                                     .rotation_range = ROTATION_RANGE,
+                                     .lensshift_v_range = LENSSHIFT_RANGE,
+                                     .lensshift_h_range = LENSSHIFT_RANGE,
+                                     .shear_range = SHEAR_RANGE };
+
+  double params[FITNESS_RUNS][4];
+  uint32_t seed = 11;
+  for(int k = 0; k < FITNESS_RUNS; k++)
+    for(int i = 0; i < 4; i++)
+    {
+      seed = seed * 1664525u + 1013904223u;
+      params[k][i] = 4.0 * ((seed >> 8) / 16777216.0 - 0.5);
+    }
+
+  double reference[FITNESS_RUNS];
+  const double fstart = dt_get_wtime();
+  for(int k = 0; k < FITNESS_RUNS; k++) reference[k] = reference_fitness(params[k], &fit);
+  const double fmid = dt_get_wtime();
+  fit_lines_pack(&fit);
+  double deviation = 0.0;
+  for(int k = 0; k < FITNESS_RUNS; k++)
+  {
+    const double packed = model_fitness(params[k], &fit);
+    deviation = fmax(deviation, fabs(packed - reference[k]) / fmax(fabs(reference[k]), DBL_MIN));
+  }
+  const double fend = dt_get_wtime();
+
+  fprintf(stdout, "[ashift] %i fit quality evaluations on %i lines: per line %9.2f ms, packed %9.2f ms, "
+                  "max relative deviation %.2e\n",
+          FITNESS_RUNS, fit.fit_count, (fmid - fstart) * 1000., (fend - fmid) * 1000., deviation);
+
+  dt_free_align(fit.fit_buf);
+  free(lines);
+  free(full);
+  dt_free_align(img);
+  return 0;
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
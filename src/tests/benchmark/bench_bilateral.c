@@ -0,0 +1,185 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * benchmark of common/bilateral.c: prints the throughput of the splat, blur and slice against the
+ * per-pixel trilinear interpolations, and of the shared grids, over a range of sigmas.
+ *
+ * Please see README.txt for more detailed documentation.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "common/darktable.h"
+#include "common/bilateral.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+#define WIDTH 2000
+#define HEIGHT 1000
+
+// Lab-like values: smooth gradients, edges, and uniform noise
+static float *gen_image(const int width, const int height)
+{
+  float *img = dt_alloc_align_float((size_t)4 * width * height);
+  uint32_t seed = 1;
+  for(int y = 0; y < height; y++)
+    for(int x = 0; x < width; x++)
+    {
+      seed = seed * 1664525u + 1013904223u;
+      const float noise = ((seed >> 9) / 8388608.f - 0.5f) * 4.f;
+      float *const pixel = img + 4 * ((size_t)y * width + x);
+      pixel[0] = CLAMPS(50.f + 30.f * sinf(x * 0.01f) * cosf(y * 0.013f) + (((x / 57 + y / 41) & 1) ? 20.f : 0.f)
+                            + noise,
+                        0.f, 100.f);
+      pixel[1] = x * 0.01f;
+      pixel[2] = -y * 0.01f;
+      pixel[3] = 0.5f;
+    }
+  return img;
+}
+
+// position of a pixel in the grid, as computed by common/bilateral.c before the SIMD splat and slice
+static size_t reference_grid_index(const dt_bilateral_t *const b, const int i, const int j, const float L,
+                                   float *xf, float *yf, float *zf)
+{
+  const float x = CLAMPS(i / b->sigma_s, 0, b->size_x - 1);
+  const float y = CLAMPS(j / b->sigma_s, 0, b->size_y - 1);
+  const float z = CLAMPS(L / b->sigma_r, 0, b->size_z - 1);
+  const int xi = MIN((int)x, b->size_x - 2);
+  const int yi = MIN((int)y, b->size_y - 2);
+  const int zi = MIN((int)z, b->size_z - 2);
+  *xf = x - xi;
+  *yf = y - yi;
+  *zf = z - zi;
+  return ((xi + yi * b->size_x) * b->size_z) + zi;
+}
+
+// the per-pixel trilinear splat, into the first rows of the buffer of b
+static void reference_splat(const dt_bilateral_t *const b, const float *const in)
+{
+  const size_t ox = b->size_z;
+  const size_t oy = b->size_x * b->size_z;
+  const float norm = 100.0f / (b->sigma_s * b->sigma_s);
+  memset(b->buf, 0, sizeof(float) * b->size_x * b->size_y * b->size_z);
+  for(int j = 0; j < b->height; j++)
+    for(int i = 0; i < b->width; i++)
+    {
+      float xf, yf, zf;
+      const size_t gi = reference_grid_index(b, i, j, in[4 * ((size_t)j * b->width + i)], &xf, &yf, &zf);
+      for(int k = 0; k < 8; k++)
+      {
+        const int dx = k & 1, dy = (k >> 1) & 1, dz = k >> 2;
+        b->buf[gi + dx * ox + dy * oy + dz] += norm * (dx ? xf : 1.0f - xf) * (dy ? yf : 1.0f - yf)
+                                               * (dz ? zf : 1.0f - zf);
+      }
+    }
+}
+
+// the per-pixel trilinear lookup
+static void reference_slice(const dt_bilateral_t *const b, const float *const in, float *const out,
+                            const float detail)
+{
+  const size_t ox = b->size_z;
+  const size_t oy = b->size_x * b->size_z;
+  const float norm = -detail * b->sigma_r * 0.04f;
+  for(int j = 0; j < b->height; j++)
+    for(int i = 0; i < b->width; i++)
+    {
+      const size_t k = 4 * ((size_t)j * b->width + i);
+      float xf, yf, zf;
+      const size_t gi = reference_grid_index(b, i, j, in[k], &xf, &yf, &zf);
+      float v = 0.0f;
+      for(int c = 0; c < 8; c++)
+      {
+        const int dx = c & 1, dy = (c >> 1) & 1, dz = c >> 2;
+        v += b->buf[gi + dx * ox + dy * oy + dz] * (dx ? xf : 1.0f - xf) * (dy ? yf : 1.0f - yf)
+             * (dz ? zf : 1.0f - zf);
+      }
+      out[k] = fmaxf(0.0f, in[k] + norm * v);
+      out[k + 1] = in[k + 1];
+      out[k + 2] = in[k + 2];
+      out[k + 3] = in[k + 3];
+    }
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+
+  const size_t npixels = (size_t)WIDTH * HEIGHT;
+  const float mpx = npixels / 1e6f;
+  float *in = gen_image(WIDTH, HEIGHT);
+  float *out = dt_alloc_align_float(4 * npixels);
+
+  const float sigmas_s[] = { 2.0f, 8.0f, 32.0f, 100.0f };
+  const float sigmas_r[] = { 4.0f, 20.0f, 100.0f };
+  for(int s = 0; s < 4; s++)
+    for(int r = 0; r < 3; r++)
+    {
+      dt_bilateral_t *ref_grid = dt_bilateral_init(WIDTH, HEIGHT, sigmas_s[s], sigmas_r[r]);
+      const double start = dt_get_wtime();
+      reference_splat(ref_grid, in);
+      const double ref_splat = dt_get_wtime();
+      dt_bilateral_blur(ref_grid);
+      const double ref_blur = dt_get_wtime();
+      reference_slice(ref_grid, in, out, -1.0f);
+      const double ref_slice = dt_get_wtime();
+
+      dt_bilateral_t *grid = dt_bilateral_init(WIDTH, HEIGHT, sigmas_s[s], sigmas_r[r]);
+      const double init = dt_get_wtime();
+      dt_bilateral_splat(grid, in);
+      const double splat = dt_get_wtime();
+      dt_bilateral_blur(grid);
+      const double blur = dt_get_wtime();
+      dt_bilateral_slice(grid, in, out, -1.0f);
+      const double slice = dt_get_wtime();
+
+      // the first call builds and caches the grid, the second one only hashes the input
+      dt_bilateral_free(dt_bilateral_shared(in, WIDTH, HEIGHT, sigmas_s[s], sigmas_r[r]));
+      const double shared_miss = dt_get_wtime();
+      dt_bilateral_free(dt_bilateral_shared(in, WIDTH, HEIGHT, sigmas_s[s], sigmas_r[r]));
+      const double shared_hit = dt_get_wtime();
+
+      fprintf(stdout, "[bilateral] grid %4zux%4zux%2zu: splat %7.1f -> %7.1f Mpx/s, blur %7.1f Mpx/s, "
+                      "slice %7.1f -> %7.1f Mpx/s, shared grid %7.1f Mpx/s, cached %7.1f Mpx/s\n",
+              grid->size_x, grid->size_y, grid->size_z, mpx / (ref_splat - start), mpx / (splat - init),
+              mpx / (blur - splat), mpx / (ref_slice - ref_blur), mpx / (slice - blur),
+              mpx / (shared_miss - slice), mpx / (shared_hit - shared_miss));
+
+      dt_bilateral_free(grid);
+      dt_bilateral_free(ref_grid);
+    }
+
+  dt_free_align(out);
+  dt_free_align(in);
+
+  dt_bilateral_cache_cleanup();
+  return 0;
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
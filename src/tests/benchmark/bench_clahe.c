@@ -0,0 +1,187 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * benchmark of common/clahe.c: prints the cost of the per-pixel histograms of the former iop/clahe.c,
+ * and of the sliding and tiled methods, over a range of radii.
+ *
+ * Please see README.txt for more detailed documentation.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "common/darktable.h"
+#include "common/clahe.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+// 1 Mpx so timings read directly as ms/Mpx
+#define WIDTH 1000
+#define HEIGHT 1000
+
+#define BINS 256
+#define ROUND_POSISTIVE(f) ((unsigned int)((f)+0.5))
+
+// smooth gradients, edges and fine texture in [0; 1]
+static float *gen_image(const int width, const int height)
+{
+  float *img = dt_alloc_align_float((size_t)width * height);
+  for(int y = 0; y < height; y++)
+    for(int x = 0; x < width; x++)
+      img[(size_t)y * width + x] = CLAMPS(0.4f + 0.3f * sinf(x * 0.011f) * cosf(y * 0.007f)
+                                              + (((x / 37 + y / 23) & 1) ? 0.15f : 0.f)
+                                              + 0.05f * sinf(x * 1.3f + y * 0.7f),
+                                          0.f, 1.f);
+  return img;
+}
+
+// the per-pixel sliding histogram of iop/clahe.c before common/clahe.c, as a reference
+static void reference_clahe(const float *const luminance, float *const out, const int width, const int height,
+                            const int rad, const float slope)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(luminance, out, width, height, rad, slope) \
+  schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+  {
+    int yMin = fmax(0, j - rad);
+    int yMax = fmin(height, j + rad + 1);
+    int h = yMax - yMin;
+
+    int xMin0 = fmax(0, 0 - rad);
+    int xMax0 = fmin(width - 1, rad);
+
+    int hist[BINS + 1];
+    int clippedhist[BINS + 1];
+
+    memset(hist, 0, sizeof(int) * (BINS + 1));
+    for(int yi = yMin; yi < yMax; ++yi)
+      for(int xi = xMin0; xi < xMax0; ++xi)
+        ++hist[ROUND_POSISTIVE(luminance[(size_t)yi * width + xi] * (float)BINS)];
+
+    for(int i = 0; i < width; i++)
+    {
+      int v = ROUND_POSISTIVE(luminance[(size_t)j * width + i] * (float)BINS);
+
+      int xMin = fmax(0, i - rad);
+      int xMax = i + rad + 1;
+      int w = fmin(width, xMax) - xMin;
+      int n = h * w;
+
+      int limit = (int)(slope * n / BINS + 0.5f);
+
+      if(xMin > 0)
+      {
+        int xMin1 = xMin - 1;
+        for(int yi = yMin; yi < yMax; ++yi)
+          --hist[ROUND_POSISTIVE(luminance[(size_t)yi * width + xMin1] * (float)BINS)];
+      }
+
+      if(xMax <= width)
+      {
+        int xMax1 = xMax - 1;
+        for(int yi = yMin; yi < yMax; ++yi)
+          ++hist[ROUND_POSISTIVE(luminance[(size_t)yi * width + xMax1] * (float)BINS)];
+      }
+
+      memcpy(clippedhist, hist, sizeof(int) * (BINS + 1));
+      int ce = 0, ceb = 0;
+      do
+      {
+        ceb = ce;
+        ce = 0;
+        for(int b = 0; b <= BINS; b++)
+        {
+          int d = clippedhist[b] - limit;
+          if(d > 0)
+          {
+            ce += d;
+            clippedhist[b] = limit;
+          }
+        }
+
+        int d = (ce / (float)(BINS + 1));
+        int m = ce % (BINS + 1);
+        for(int b = 0; b <= BINS; b++) clippedhist[b] += d;
+
+        if(m != 0)
+        {
+          int s = BINS / (float)m;
+          for(int b = 0; b <= BINS; b += s) ++clippedhist[b];
+        }
+      } while(ce != ceb);
+
+      unsigned int hMin = BINS;
+      for(int b = 0; b < hMin; b++)
+        if(clippedhist[b] != 0) hMin = b;
+
+      int cdf = 0;
+      for(int b = hMin; b <= v; b++) cdf += clippedhist[b];
+
+      int cdfMax = cdf;
+      for(int b = v + 1; b <= BINS; b++) cdfMax += clippedhist[b];
+
+      int cdfMin = clippedhist[hMin];
+
+      out[(size_t)j * width + i] = (cdf - cdfMin) / (float)(cdfMax - cdfMin);
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+
+  const size_t npixels = (size_t)WIDTH * HEIGHT;
+  const float mpx = npixels / 1e6f;
+  float *in = gen_image(WIDTH, HEIGHT);
+  float *out = dt_alloc_align_float(npixels);
+
+  const int radii[] = { 32, 64, 128, 256, 512 };
+  for(int r = 0; r < 5; r++)
+  {
+    const double start = dt_get_wtime();
+    reference_clahe(in, out, WIDTH, HEIGHT, radii[r], 1.25f);
+    const double mid = dt_get_wtime();
+    dt_clahe(in, out, WIDTH, HEIGHT, radii[r], 1.25f, DT_CLAHE_SLIDING);
+    const double mid2 = dt_get_wtime();
+    dt_clahe(in, out, WIDTH, HEIGHT, radii[r], 1.25f, DT_CLAHE_TILED);
+    const double end = dt_get_wtime();
+
+    fprintf(stdout, "[clahe] radius %3i: per-pixel histograms %9.2f ms/Mpx, sliding %9.2f ms/Mpx, "
+                    "tiled %9.2f ms/Mpx\n",
+            radii[r], (mid - start) * 1000. / mpx, (mid2 - mid) * 1000. / mpx, (end - mid2) * 1000. / mpx);
+  }
+
+  dt_free_align(out);
+  dt_free_align(in);
+  return 0;
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
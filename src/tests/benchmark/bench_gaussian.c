@@ -0,0 +1,94 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * benchmark of common/gaussian.c: prints the throughput of the 1 and 4 channels blurs over a range
+ * of sigmas.
+ *
+ * Please see README.txt for more detailed documentation.
+ */
+#include <stdio.h>
+#include <math.h>
+
+#include "common/darktable.h"
+#include "common/gaussian.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+// 1 Mpx so timings read directly as ms/Mpx
+#define WIDTH 1000
+#define HEIGHT 1000
+
+static float *gen_image(const int width, const int height, const int ch)
+{
+  float *img = dt_alloc_align_float((size_t)width * height * ch);
+  for(int y = 0; y < height; y++)
+    for(int x = 0; x < width; x++)
+      for(int c = 0; c < ch; c++)
+        img[((size_t)y * width + x) * ch + c]
+            = 0.5f + 0.4f * sinf(x * 0.05f * (c + 1)) * cosf(y * 0.07f) + (((x / 13 + y / 7) % 2) ? 0.05f : 0.f);
+  return img;
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+
+  const dt_aligned_pixel_t min = { -INFINITY, -INFINITY, -INFINITY, -INFINITY };
+  const dt_aligned_pixel_t max = { INFINITY, INFINITY, INFINITY, INFINITY };
+  const float mpx = (float)WIDTH * HEIGHT / 1e6f;
+  const float sigmas[] = { 2.f, 8.f, 32.f, 128.f, 512.f };
+
+  for(int ch = 1; ch <= 4; ch += 3)
+  {
+    float *in = gen_image(WIDTH, HEIGHT, ch);
+    float *out = dt_alloc_align_float((size_t)WIDTH * HEIGHT * ch);
+
+    for(int s = 0; s < 5; s++)
+    {
+      dt_gaussian_t *g = dt_gaussian_init(WIDTH, HEIGHT, ch, max, min, sigmas[s], DT_IOP_GAUSSIAN_ZERO);
+      if(!g) return 1;
+
+      const double start = dt_get_wtime();
+      if(ch == 4)
+        dt_gaussian_blur_4c(g, in, out);
+      else
+        dt_gaussian_blur(g, in, out);
+      const double end = dt_get_wtime();
+
+      fprintf(stdout, "[gaussian] %i channel(s), sigma %5.0f: %8.2f ms/Mpx, %8.1f Mpx/s\n", ch, sigmas[s],
+              (end - start) * 1000. / mpx, mpx / (end - start));
+      dt_gaussian_free(g);
+    }
+
+    dt_free_align(out);
+    dt_free_align(in);
+  }
+
+  return 0;
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,107 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * benchmark of common/guided_filter.c: prints the cost per megapixel of the exact and the
+ * subsampled filters over a range of radii.
+ *
+ * Please see README.txt for more detailed documentation.
+ */
+#include <stdio.h>
+#include <math.h>
+
+#include "../unittests/util/testimg.h"
+
+#include "common/darktable.h"
+#include "common/guided_filter.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+// 1 Mpx so timings read directly as ms/Mpx
+#define WIDTH 1000
+#define HEIGHT 1000
+
+// smooth waves plus a checkerboard of flat patches as guide
+static Testimg *gen_guide(void)
+{
+  Testimg *ti = testimg_alloc(WIDTH, HEIGHT);
+  for_testimg_pixels_p_yx(ti)
+  {
+    const float v = 0.5f + 0.3f * sinf(x * 0.01f) * cosf(y * 0.013f) + (((x / 200 + y / 150) % 2) ? 0.1f : 0.f);
+    p[0] = v;
+    p[1] = 0.8f * v + 0.1f * cosf(x * 0.017f + y * 0.006f);
+    p[2] = 0.6f * v + 0.1f * sinf(y * 0.021f - x * 0.004f);
+    p[3] = 0.f;
+  }
+  return ti;
+}
+
+// the checkerboard of the guide as input mask
+static float *gen_mask(void)
+{
+  float *mask = dt_alloc_align_float((size_t)WIDTH * HEIGHT);
+  for(int y = 0; y < HEIGHT; y++)
+    for(int x = 0; x < WIDTH; x++)
+      mask[(size_t)y * WIDTH + x] = ((x / 200 + y / 150) % 2) ? 0.8f : 0.2f;
+  return mask;
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+#ifdef __SSE2__
+  darktable.codepath.SSE2 = 1;
+#endif
+
+  Testimg *guide = gen_guide();
+  float *mask = gen_mask();
+  float *out = dt_alloc_align_float((size_t)WIDTH * HEIGHT);
+  const float mpx = (float)WIDTH * HEIGHT / 1e6f;
+
+  const int radii[] = { 8, 16, 32, 64, 128, 256 };
+  for(int r = 0; r < 6; r++)
+  {
+    const int w = radii[r];
+    const int subsample = MAX(w / 32, 1);
+
+    const double start = dt_get_wtime();
+    guided_filter(guide->pixels, mask, out, WIDTH, HEIGHT, 4, w, 0.1f, 1.f, 0.f, 1.f);
+    const double mid = dt_get_wtime();
+    guided_filter_subsampled(guide->pixels, mask, out, WIDTH, HEIGHT, 4, w, 0.1f, 1.f, 0.f, 1.f, subsample);
+    const double end = dt_get_wtime();
+
+    fprintf(stdout, "[guided filter] radius %3i: exact %8.2f ms/Mpx, subsampled x%i %8.2f ms/Mpx\n", w,
+            (mid - start) * 1000. / mpx, subsample, (end - mid) * 1000. / mpx);
+  }
+
+  dt_free_align(out);
+  dt_free_align(mask);
+  testimg_free(guide);
+  dt_gf_scratch_cleanup();
+  return 0;
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
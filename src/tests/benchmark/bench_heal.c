@@ -0,0 +1,113 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * benchmark of common/heal.c: prints the iterations and time of the plain SOR solver and of the
+ * multigrid initial solution on stamps of increasing size.
+ *
+ * Please see README.txt for more detailed documentation.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "common/darktable.h"
+#include "common/heal.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+// the default of the retouch module
+#define MAX_ITER 2000
+
+// two different smooth textures as source and destination, and a disc as mask
+static void stamp_alloc(const int size, float **src, float **dest, float **mask)
+{
+  const size_t npixels = (size_t)size * size;
+  *src = dt_alloc_align_float(4 * npixels);
+  *dest = dt_alloc_align_float(4 * npixels);
+  *mask = dt_alloc_align_float(npixels);
+
+  const float radius = 0.45f * size;
+  for(int y = 0; y < size; y++)
+    for(int x = 0; x < size; x++)
+    {
+      const size_t k = (size_t)y * size + x;
+      for(int c = 0; c < 4; c++)
+      {
+        (*src)[4 * k + c] = 0.3f + 0.2f * sinf(x * 0.01f + c) + 0.05f * sinf(x * 0.3f) * cosf(y * 0.2f);
+        (*dest)[4 * k + c] = 0.5f + 0.3f * cosf(y * 0.007f + c) * sinf(x * 0.005f) + 0.05f * sinf(y * 0.25f);
+      }
+      const float dx = x - 0.5f * size + 0.5f;
+      const float dy = y - 0.5f * size + 0.5f;
+      (*mask)[k] = (dx * dx + dy * dy < radius * radius) ? 1.f : 0.f;
+    }
+}
+
+static float max_difference(const float *const a, const float *const b, const size_t npixels)
+{
+  float max_err = 0.f;
+  for(size_t k = 0; k < npixels; k++)
+    for(int c = 0; c < 3; c++) max_err = fmaxf(max_err, fabsf(a[4 * k + c] - b[4 * k + c]));
+  return max_err;
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+
+  const int sizes[] = { 100, 250, 500, 1000, 2000 };
+  for(int i = 0; i < 5; i++)
+  {
+    const int size = sizes[i];
+    const size_t npixels = (size_t)size * size;
+    float *src, *dest, *mask;
+    stamp_alloc(size, &src, &dest, &mask);
+    float *plain = dt_alloc_align_float(4 * npixels);
+    float *multigrid = dt_alloc_align_float(4 * npixels);
+    memcpy(plain, dest, sizeof(float) * 4 * npixels);
+    memcpy(multigrid, dest, sizeof(float) * 4 * npixels);
+
+    const double start = dt_get_wtime();
+    const int plain_iter = dt_heal_ext(src, plain, mask, size, size, 4, MAX_ITER, FALSE);
+    const double mid = dt_get_wtime();
+    const int mg_iter = dt_heal_ext(src, multigrid, mask, size, size, 4, MAX_ITER, TRUE);
+    const double end = dt_get_wtime();
+
+    fprintf(stdout, "[heal] %4i px stamp: SOR %4i iterations %8.3f s, multigrid %4i iterations %8.3f s, "
+                    "max difference %.2e\n",
+            size, plain_iter, mid - start, mg_iter, end - mid, max_difference(plain, multigrid, npixels));
+
+    dt_free_align(multigrid);
+    dt_free_align(plain);
+    dt_free_align(mask);
+    dt_free_align(dest);
+    dt_free_align(src);
+  }
+
+  return 0;
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,224 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * benchmark of the parallel TIFF strip writer (common/imageio_tiff.c), PNG IDAT writer
+ * (common/imageio_png_write.c) and JPEG restart-interval writer (common/imageio_jpeg_write.c):
+ * prints the encoding time per megapixel of a typical export.
+ *
+ * Please see README.txt for more detailed documentation.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "common/darktable.h"
+#include "common/imageio_jpeg_write.h"
+#include "common/imageio_png_write.h"
+#include "common/imageio_tiff.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+// 6 Mpx as a typical export
+#define WIDTH 3000
+#define HEIGHT 2000
+
+typedef struct rows_t
+{
+  const uint8_t *in;
+  int width;
+  int layers;
+  int bpp;
+} rows_t;
+
+// 4-channel buffer, as handed to the format modules, with smooth gradients and some noise
+static uint8_t *gen_image(const int width, const int height, const int bpp)
+{
+  const size_t n = (size_t)width * height * 4;
+  uint8_t *img = dt_alloc_align(n * bpp / 8);
+  for(size_t k = 0; k < n; k++)
+  {
+    const int x = (k / 4) % width;
+    const int y = (k / 4) / width;
+    const int c = k % 4;
+    const float v = 0.5f + 0.4f * sinf(x * 0.01f * (c + 1)) * cosf(y * 0.02f) + (rand() % 64) / 4096.f;
+    if(bpp == 32)
+      ((float *)img)[k] = v;
+    else if(bpp == 16)
+      ((uint16_t *)img)[k] = (uint16_t)(v * 65535.f);
+    else
+      img[k] = (uint8_t)(v * 255.f);
+  }
+  return img;
+}
+
+static void _pack_row(const void *data, const int y, uint8_t *out)
+{
+  const rows_t *r = (const rows_t *)data;
+  const size_t bytes = r->bpp / 8;
+  const uint8_t *in = r->in + (size_t)4 * y * r->width * bytes;
+  for(int x = 0; x < r->width; x++, in += 4 * bytes, out += r->layers * bytes)
+    memcpy(out, in, r->layers * bytes);
+}
+
+// the timings below return a negative time on failure
+static double write_tiff(const char *path, const uint8_t *img, const int bpp)
+{
+  TIFF *tif = TIFFOpen(path, "w");
+  if(!tif) return -1.;
+  TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, WIDTH);
+  TIFFSetField(tif, TIFFTAG_IMAGELENGTH, HEIGHT);
+  TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 3);
+  TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, bpp);
+  TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, bpp == 32 ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT);
+  TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+  TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
+  TIFFSetField(tif, TIFFTAG_PREDICTOR, bpp == 32 ? PREDICTOR_FLOATINGPOINT : PREDICTOR_HORIZONTAL);
+  TIFFSetField(tif, TIFFTAG_ZIPQUALITY, 6);
+
+  const rows_t rows = { img, WIDTH, 3, bpp };
+  const double start = dt_get_wtime();
+  const int err = dt_imageio_tiff_write_strips(tif, WIDTH, HEIGHT, 3, bpp, 6, _pack_row, &rows);
+  const double end = dt_get_wtime();
+  TIFFClose(tif);
+  return err ? -1. : end - start;
+}
+
+static double write_png(const char *path, const uint8_t *img, const int bpp)
+{
+  FILE *f = g_fopen(path, "wb");
+  if(!f) return -1.;
+  png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  png_infop info_ptr = png_create_info_struct(png_ptr);
+  png_init_io(png_ptr, f);
+  png_set_compression_level(png_ptr, 6);
+  png_set_IHDR(png_ptr, info_ptr, WIDTH, HEIGHT, bpp, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+               PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+  png_write_info(png_ptr, info_ptr);
+
+  const double start = dt_get_wtime();
+  const int err = dt_imageio_png_write_parallel(png_ptr, img, WIDTH, HEIGHT, bpp, 6);
+  const double end = dt_get_wtime();
+  png_destroy_write_struct(&png_ptr, &info_ptr);
+  fclose(f);
+  return err ? -1. : end - start;
+}
+
+static void _jpeg_setup(j_compress_ptr cinfo, const void *data)
+{
+  const int quality = *(const int *)data;
+  jpeg_set_quality(cinfo, quality, TRUE);
+  if(quality > 90) cinfo->comp_info[0].v_samp_factor = 1;
+  if(quality > 92) cinfo->comp_info[0].h_samp_factor = 1;
+}
+
+// plain libjpeg encoder with the same settings and optimized Huffman tables, as the baseline writer
+static double write_jpeg_serial(const char *path, const uint8_t *img, const int quality)
+{
+  FILE *f = g_fopen(path, "wb");
+  if(!f) return -1.;
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+  jpeg_stdio_dest(&cinfo, f);
+  cinfo.image_width = WIDTH;
+  cinfo.image_height = HEIGHT;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  _jpeg_setup(&cinfo, &quality);
+  cinfo.optimize_coding = TRUE;
+
+  const double start = dt_get_wtime();
+  jpeg_start_compress(&cinfo, TRUE);
+  uint8_t *row = g_malloc((size_t)3 * WIDTH);
+  while(cinfo.next_scanline < cinfo.image_height)
+  {
+    const uint8_t *in = img + (size_t)4 * cinfo.next_scanline * WIDTH;
+    for(int x = 0; x < WIDTH; x++)
+      for(int c = 0; c < 3; c++) row[3 * x + c] = in[4 * x + c];
+    JSAMPROW tmp[1] = { row };
+    jpeg_write_scanlines(&cinfo, tmp, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  const double end = dt_get_wtime();
+  g_free(row);
+  jpeg_destroy_compress(&cinfo);
+  fclose(f);
+  return end - start;
+}
+
+static double write_jpeg_parallel(const char *path, const uint8_t *img, const int quality)
+{
+  FILE *f = g_fopen(path, "wb");
+  if(!f) return -1.;
+  const double start = dt_get_wtime();
+  const int err = dt_imageio_jpeg_write_parallel(f, img, WIDTH, HEIGHT, _jpeg_setup, &quality, NULL, 0, NULL, 0);
+  const double end = dt_get_wtime();
+  fclose(f);
+  return err ? -1. : end - start;
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+
+  gchar *path = g_build_filename(g_get_tmp_dir(), "ansel_bench_imageio_write", NULL);
+  const float mpx = (float)WIDTH * HEIGHT / 1e6f;
+  for(int bpp = 8; bpp <= 32; bpp *= 2)
+  {
+    uint8_t *img = gen_image(WIDTH, HEIGHT, bpp);
+    const double t = write_tiff(path, img, bpp);
+    fprintf(stdout, "[imageio_write] TIFF deflate %2i bits: %8.2f ms/Mpx\n", bpp, t * 1000. / mpx);
+    if(bpp <= 16)
+    {
+      const double p = write_png(path, img, bpp);
+      fprintf(stdout, "[imageio_write] PNG level 6 %2i bits: %8.2f ms/Mpx\n", bpp, p * 1000. / mpx);
+    }
+    dt_free_align(img);
+  }
+
+  uint8_t *img = gen_image(WIDTH, HEIGHT, 8);
+  const double serial = write_jpeg_serial(path, img, 90);
+  fprintf(stdout, "[imageio_write] JPEG quality 90, libjpeg:   %8.2f ms/Mpx\n", serial * 1000. / mpx);
+  if(darktable.num_openmp_threads > 1)
+  {
+    const double parallel = write_jpeg_parallel(path, img, 90);
+    fprintf(stdout, "[imageio_write] JPEG quality 90, parallel:  %8.2f ms/Mpx\n", parallel * 1000. / mpx);
+  }
+  dt_free_align(img);
+
+  g_unlink(path);
+  g_free(path);
+  return 0;
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
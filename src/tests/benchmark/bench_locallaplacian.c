@@ -0,0 +1,113 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * benchmark of common/locallaplacian.c: prints the cost of the fine and fast modes, on a fresh input
+ * and with a cached input pyramid, for the default and preset parameters.
+ *
+ * Please see README.txt for more detailed documentation.
+ */
+#include <stdio.h>
+#include <math.h>
+
+#include "common/darktable.h"
+#include "common/locallaplacian.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+// 1 Mpx so timings read directly as ms/Mpx
+#define WIDTH 1000
+#define HEIGHT 1000
+
+// sigma, shadows, highlights, clarity: defaults, "HDR local tone-mapping" and "clarity" presets
+static const float params[][4] = { { 0.5f, 0.5f, 0.5f, 0.25f }, { 0.25f, 0.0f, 0.0f, 1.0f }, { 0.5f, 0.0f, 0.0f, 0.33f } };
+#define NUM_PARAMS 3
+
+// Lab with uniform noise, L in [0; 100]
+static float *gen_image(const int width, const int height, const int kind)
+{
+  float *img = dt_alloc_align_float((size_t)4 * width * height);
+  uint32_t seed = 7;
+  for(int y = 0; y < height; y++)
+    for(int x = 0; x < width; x++)
+    {
+      seed = seed * 1664525u + 1013904223u;
+      const float noise = (seed >> 9) / 8388608.f - 0.5f;
+      float L;
+      if(kind == 0)
+        L = 50.f + 40.f * sinf(x * 0.01f) * cosf(y * 0.013f) + 2.f * noise;
+      else if(kind == 1)
+        L = (((x / 64 + y / 48) & 1) ? 80.f : 15.f) + 3.f * sinf(x * 0.3f) * sinf(y * 0.2f) + noise;
+      else
+        L = 100.f * powf((x + 0.5f) / width, 2.2f) * (0.6f + 0.4f * sinf(y * 0.05f)) + 5.f * noise;
+      float *const pixel = img + 4 * ((size_t)y * width + x);
+      pixel[0] = CLAMPS(L, 0.f, 100.f);
+      pixel[1] = 5.f;
+      pixel[2] = -5.f;
+      pixel[3] = 0.f;
+    }
+  return img;
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+
+  const size_t npixels = (size_t)WIDTH * HEIGHT;
+  const float mpx = npixels / 1e6f;
+  float *in = gen_image(WIDTH, HEIGHT, 0);
+  float *out = dt_alloc_align_float(4 * npixels);
+  local_laplacian_cache_t cache = { 0 };
+
+  for(int p = 0; p < NUM_PARAMS; p++)
+  {
+    const float *const q = params[p];
+    double timings[4];
+    for(int fast = FALSE; fast <= TRUE; fast++)
+    {
+      // a fresh input, then a parameter change on the same input
+      local_laplacian_cache_free(&cache);
+      const double start = dt_get_wtime();
+      local_laplacian(in, out, WIDTH, HEIGHT, q[0], q[1], q[2], q[3], fast, 0, &cache);
+      const double mid = dt_get_wtime();
+      local_laplacian(in, out, WIDTH, HEIGHT, q[0], q[1] + 0.1f, q[2], q[3], fast, 0, &cache);
+      const double end = dt_get_wtime();
+      timings[2 * fast] = mid - start;
+      timings[2 * fast + 1] = end - mid;
+    }
+    fprintf(stdout, "[locallaplacian] params %i: fine %9.2f ms/Mpx, cached input %9.2f ms/Mpx, "
+                    "fast %9.2f ms/Mpx, cached input %9.2f ms/Mpx\n",
+            p, timings[0] * 1000. / mpx, timings[1] * 1000. / mpx, timings[2] * 1000. / mpx,
+            timings[3] * 1000. / mpx);
+  }
+
+  local_laplacian_cache_free(&cache);
+  dt_free_align(out);
+  dt_free_align(in);
+  return 0;
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,139 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * benchmark of the banded backend of common/nlmeans_core.c: prints the cost of the sliding window and
+ * of the banded backend over a range of patch and search radii.
+ *
+ * Please see README.txt for more detailed documentation.
+ */
+#include <stdio.h>
+#include <math.h>
+
+#include "common/darktable.h"
+#include "common/nlmeans_core.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+#define WIDTH 1000
+#define HEIGHT 500
+
+// the two ways the iops call the core
+typedef enum bench_mode_t
+{
+  MODE_NONLOCAL = 0, // denoise (non-local means): Lab, sharpness, luma/chroma blending
+  MODE_PROFILED = 1  // denoise (profiled): variance-stabilized RGB, center pixel weight
+} bench_mode_t;
+
+// Lab-like values: smooth gradients, edges, and uniform noise
+static float *gen_image(const int width, const int height)
+{
+  float *img = dt_alloc_align_float((size_t)4 * width * height);
+  uint32_t seed = 1;
+  for(int y = 0; y < height; y++)
+    for(int x = 0; x < width; x++)
+      for(int c = 0; c < 4; c++)
+      {
+        seed = seed * 1664525u + 1013904223u;
+        const float noise = ((seed >> 9) / 8388608.f - 0.5f) * 8.f;
+        img[4 * ((size_t)y * width + x) + c] = 50.f + 30.f * sinf(x * 0.05f + c) * cosf(y * 0.03f)
+                                               + (((x / 17 + y / 11) & 1) ? 20.f : 0.f) + noise;
+      }
+  return img;
+}
+
+// parameters as set by the iops, with the sharpness scaled by the patch area so that the weights of the
+// large patches don't all vanish on the test image
+static dt_nlmeans_param_t get_params(const bench_mode_t mode, const int P, const int K, const float *const norm)
+{
+  const float area = (2 * P + 1) * (2 * P + 1);
+  const dt_nlmeans_param_t params = { .scattering = 0.0f,
+                                      .scale = 1.0f,
+                                      .luma = mode == MODE_PROFILED ? 1.0f : 0.6f,
+                                      .chroma = mode == MODE_PROFILED ? 1.0f : 0.8f,
+                                      .center_weight = mode == MODE_PROFILED ? 0.1f : -1.0f,
+                                      .sharpness = mode == MODE_PROFILED ? 0.03f / area : 1000.0f / area,
+                                      .patch_radius = P,
+                                      .search_radius = K,
+                                      .decimate = 0,
+                                      .norm = norm,
+                                      .pipe = NULL };
+  return params;
+}
+
+static void get_norm(const bench_mode_t mode, dt_aligned_pixel_t norm)
+{
+  if(mode == MODE_PROFILED)
+  {
+    for_four_channels(c) norm[c] = 1.0f;
+  }
+  else
+  {
+    const float nL = 1.0f / 120.0f, nC = 1.0f / 512.0f;
+    norm[0] = nL * nL;
+    norm[1] = norm[2] = nC * nC;
+    norm[3] = 1.0f;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+
+  const size_t npixels = (size_t)WIDTH * HEIGHT;
+  const float mpx = npixels / 1e6f;
+  const dt_iop_roi_t roi = { 0, 0, WIDTH, HEIGHT, 1.0f };
+  float *in = gen_image(WIDTH, HEIGHT);
+  float *out = dt_alloc_align_float(4 * npixels);
+
+  const int patch_radii[] = { 1, 2, 4, 8 };
+  const int search_radii[] = { 5, 10, 20 };
+  for(int mode = MODE_NONLOCAL; mode <= MODE_PROFILED; mode++)
+    for(int p = 0; p < 4; p++)
+      for(int s = 0; s < 3; s++)
+      {
+        dt_aligned_pixel_t norm;
+        get_norm(mode, norm);
+        const dt_nlmeans_param_t params = get_params(mode, patch_radii[p], search_radii[s], norm);
+
+        const double start = dt_get_wtime();
+        nlmeans_denoise(in, out, &roi, &roi, &params);
+        const double mid = dt_get_wtime();
+        nlmeans_denoise_banded(in, out, &roi, &roi, &params);
+        const double end = dt_get_wtime();
+
+        fprintf(stdout, "[nlmeans] mode %i, P %i, K %2i: sliding window %9.2f ms/Mpx, banded %9.2f ms/Mpx, "
+                        "speed-up x%.2f\n",
+                mode, patch_radii[p], search_radii[s], (mid - start) * 1000. / mpx, (end - mid) * 1000. / mpx,
+                (mid - start) / (end - mid));
+      }
+
+  dt_free_align(out);
+  dt_free_align(in);
+  return 0;
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
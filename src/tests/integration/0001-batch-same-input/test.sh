@@ -0,0 +1,35 @@
+#!/bin/bash
+
+# Two --batch jobs on the same input, the first with an xmp rotating the image,
+# the second without: the second export must match a plain export of the input,
+# not carry over the history of the first job.
+
+CLI=${DARKTABLE_CLI:-darktable-cli}
+COMPARE=$(which compare)
+TEST_IMAGES=$PWD/images
+IMAGE=mire1.cr2
+
+[ -z "$COMPARE" ] && echo "      compare tool not found" && exit 1
+
+cd $(dirname $0)
+rm -rf output && mkdir output
+
+CORE_OPTIONS="--conf host_memory_limit=8192 --conf worker_threads=4 -t 4"
+
+$CLI --width 512 --height 512 --apply-custom-presets false \
+     "$TEST_IMAGES/$IMAGE" output/reference.png \
+     --core --disable-opencl $CORE_OPTIONS 1> /dev/null 2> /dev/null || exit 1
+
+cat > output/jobs.json <<JOBS
+{"input": "$TEST_IMAGES/$IMAGE", "xmp": "$PWD/batch-same-input.xmp", "output": "$PWD/output/rotated.png"}
+{"input": "$TEST_IMAGES/$IMAGE", "output": "$PWD/output/default.png"}
+JOBS
+
+$CLI --width 512 --height 512 --apply-custom-presets false --threads 1 --batch output/jobs.json \
+     --core --disable-opencl $CORE_OPTIONS 1> /dev/null 2> /dev/null || exit 1
+
+# the xmp of the first job has been applied
+$COMPARE output/reference.png output/rotated.png -metric ae null: 1> /dev/null 2>&1 && exit 1
+
+# and not carried over to the second one
+$COMPARE output/reference.png output/default.png -metric ae null: 1> /dev/null 2>&1
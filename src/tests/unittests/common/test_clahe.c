@@ -0,0 +1,241 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for common/clahe.c
+ *
+ * Please see ../README.md for more detailed documentation.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/assert.h"
+#include "../util/tracing.h"
+
+#include "common/darktable.h"
+#include "common/clahe.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// odd size for the accuracy tests
+#define SMALL_WIDTH 307
+#define SMALL_HEIGHT 211
+
+// max acceptable mean deviation of the tiled method from the exact neighbourhoods, on [0; 1] data
+#define E_TILED 0.03f
+
+#define BINS 256
+#define ROUND_POSISTIVE(f) ((unsigned int)((f)+0.5))
+
+/*
+ * HELPERS
+ */
+
+// smooth gradients, edges and fine texture in [0; 1]
+static float *gen_image(const int width, const int height)
+{
+  float *img = dt_alloc_align_float((size_t)width * height);
+  for(int y = 0; y < height; y++)
+    for(int x = 0; x < width; x++)
+      img[(size_t)y * width + x] = CLAMPS(0.4f + 0.3f * sinf(x * 0.011f) * cosf(y * 0.007f)
+                                              + (((x / 37 + y / 23) & 1) ? 0.15f : 0.f)
+                                              + 0.05f * sinf(x * 1.3f + y * 0.7f),
+                                          0.f, 1.f);
+  return img;
+}
+
+// the per-pixel sliding histogram of iop/clahe.c before common/clahe.c, as a reference
+static void reference_clahe(const float *const luminance, float *const out, const int width, const int height,
+                            const int rad, const float slope)
+{
+#ifdef _OPENMP
+#pragma omp parallel for default(none) \
+  dt_omp_firstprivate(luminance, out, width, height, rad, slope) \
+  schedule(static)
+#endif
+  for(int j = 0; j < height; j++)
+  {
+    int yMin = fmax(0, j - rad);
+    int yMax = fmin(height, j + rad + 1);
+    int h = yMax - yMin;
+
+    int xMin0 = fmax(0, 0 - rad);
+    int xMax0 = fmin(width - 1, rad);
+
+    int hist[BINS + 1];
+    int clippedhist[BINS + 1];
+
+    memset(hist, 0, sizeof(int) * (BINS + 1));
+    for(int yi = yMin; yi < yMax; ++yi)
+      for(int xi = xMin0; xi < xMax0; ++xi)
+        ++hist[ROUND_POSISTIVE(luminance[(size_t)yi * width + xi] * (float)BINS)];
+
+    for(int i = 0; i < width; i++)
+    {
+      int v = ROUND_POSISTIVE(luminance[(size_t)j * width + i] * (float)BINS);
+
+      int xMin = fmax(0, i - rad);
+      int xMax = i + rad + 1;
+      int w = fmin(width, xMax) - xMin;
+      int n = h * w;
+
+      int limit = (int)(slope * n / BINS + 0.5f);
+
+      if(xMin > 0)
+      {
+        int xMin1 = xMin - 1;
+        for(int yi = yMin; yi < yMax; ++yi)
+          --hist[ROUND_POSISTIVE(luminance[(size_t)yi * width + xMin1] * (float)BINS)];
+      }
+
+      if(xMax <= width)
+      {
+        int xMax1 = xMax - 1;
+        for(int yi = yMin; yi < yMax; ++yi)
+          ++hist[ROUND_POSISTIVE(luminance[(size_t)yi * width + xMax1] * (float)BINS)];
+      }
+
+      memcpy(clippedhist, hist, sizeof(int) * (BINS + 1));
+      int ce = 0, ceb = 0;
+      do
+      {
+        ceb = ce;
+        ce = 0;
+        for(int b = 0; b <= BINS; b++)
+        {
+          int d = clippedhist[b] - limit;
+          if(d > 0)
+          {
+            ce += d;
+            clippedhist[b] = limit;
+          }
+        }
+
+        int d = (ce / (float)(BINS + 1));
+        int m = ce % (BINS + 1);
+        for(int b = 0; b <= BINS; b++) clippedhist[b] += d;
+
+        if(m != 0)
+        {
+          int s = BINS / (float)m;
+          for(int b = 0; b <= BINS; b += s) ++clippedhist[b];
+        }
+      } while(ce != ceb);
+
+      unsigned int hMin = BINS;
+      for(int b = 0; b < hMin; b++)
+        if(clippedhist[b] != 0) hMin = b;
+
+      int cdf = 0;
+      for(int b = hMin; b <= v; b++) cdf += clippedhist[b];
+
+      int cdfMax = cdf;
+      for(int b = v + 1; b <= BINS; b++) cdfMax += clippedhist[b];
+
+      int cdfMin = clippedhist[hMin];
+
+      out[(size_t)j * width + i] = (cdf - cdfMin) / (float)(cdfMax - cdfMin);
+    }
+  }
+}
+
+static int setup(void **state)
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+// the sliding method gives the same results as the per-pixel histograms, and the tiled method is close
+static void test_matches_reference(void **state)
+{
+  const size_t npixels = (size_t)SMALL_WIDTH * SMALL_HEIGHT;
+  float *in = gen_image(SMALL_WIDTH, SMALL_HEIGHT);
+  float *ref = dt_alloc_align_float(npixels);
+  float *out = dt_alloc_align_float(npixels);
+
+  const int radii[] = { 0, 1, 7, 32, 100, 200 };
+  const float slopes[] = { 1.0f, 1.25f, 3.0f };
+  for(int r = 0; r < 6; r++)
+    for(int s = 0; s < 3; s++)
+    {
+      reference_clahe(in, ref, SMALL_WIDTH, SMALL_HEIGHT, radii[r], slopes[s]);
+
+      assert_int_equal(dt_clahe(in, out, SMALL_WIDTH, SMALL_HEIGHT, radii[r], slopes[s], DT_CLAHE_SLIDING), 0);
+      for(size_t k = 0; k < npixels; k++)
+      {
+        if(isfinite(ref[k]))
+          assert_float_equal(out[k], ref[k], 1e-6f);
+        else
+          assert_false(isfinite(out[k]));
+      }
+
+      // small radii space the nodes further apart than the neighbourhoods, so only check the usual ones
+      if(radii[r] < 32) continue;
+      assert_int_equal(dt_clahe(in, out, SMALL_WIDTH, SMALL_HEIGHT, radii[r], slopes[s], DT_CLAHE_TILED), 0);
+      double sum_err = 0.0;
+      for(size_t k = 0; k < npixels; k++) sum_err += fabsf(out[k] - ref[k]);
+      fprintf(stdout, "[clahe] radius %3i, slope %.2f: tiled mean error %.2e\n", radii[r], slopes[s],
+              sum_err / npixels);
+      assert_true(sum_err / npixels < E_TILED);
+    }
+
+  dt_free_align(out);
+  dt_free_align(ref);
+  dt_free_align(in);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_matches_reference)
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,228 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for common/gaussian.c
+ *
+ * Please see ../README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/assert.h"
+#include "../util/tracing.h"
+
+#include "common/darktable.h"
+#include "common/gaussian.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// odd size for the accuracy tests, so that vertical panels and horizontal tiles get partial borders
+#define SMALL_WIDTH 107
+#define SMALL_HEIGHT 61
+
+// max acceptable deviation from the column-by-column reference, on [0; 1] data. The blocked
+// implementation may fuse multiply-adds, so it is not bit-exact.
+#define E_REFERENCE 1e-4f
+
+/*
+ * HELPERS
+ */
+
+static float *gen_image(const int width, const int height, const int ch)
+{
+  float *img = dt_alloc_align_float((size_t)width * height * ch);
+  for(int y = 0; y < height; y++)
+    for(int x = 0; x < width; x++)
+      for(int c = 0; c < ch; c++)
+        img[((size_t)y * width + x) * ch + c]
+            = 0.5f + 0.4f * sinf(x * 0.05f * (c + 1)) * cosf(y * 0.07f) + (((x / 13 + y / 7) % 2) ? 0.05f : 0.f);
+  return img;
+}
+
+// straightforward Deriche filter, one column then one row at a time, as a reference
+static void reference_blur(const float *const in, float *const out, const int width, const int height,
+                           const int ch, const float sigma, const float *const min, const float *const max)
+{
+  const float alpha = 1.695f / sigma;
+  const float ema = expf(-alpha);
+  const float ema2 = expf(-2.0f * alpha);
+  const float b1 = -2.0f * ema;
+  const float b2 = ema2;
+  const float k = (1.0f - ema) * (1.0f - ema) / (1.0f + (2.0f * alpha * ema) - ema2);
+  const float a0 = k;
+  const float a1 = k * (alpha - 1.0f) * ema;
+  const float a2 = k * (alpha + 1.0f) * ema;
+  const float a3 = -k * ema2;
+  const float coefp = (a0 + a1) / (1.0f + b1 + b2);
+  const float coefn = (a2 + a3) / (1.0f + b1 + b2);
+
+  float *temp = dt_alloc_align_float((size_t)width * height * ch);
+
+  for(int pass = 0; pass < 2; pass++)
+  {
+    // first pass runs along columns, second along rows
+    const float *const src = pass ? temp : in;
+    float *const dst = pass ? out : temp;
+    const int lines = pass ? height : width;
+    const int n = pass ? width : height;
+    const size_t step = pass ? (size_t)ch : (size_t)width * ch;
+
+    for(int line = 0; line < lines; line++)
+      for(int c = 0; c < ch; c++)
+      {
+        const size_t first = (pass ? (size_t)line * width * ch : (size_t)line * ch) + c;
+#define SRC(j) CLAMPF(src[first + (size_t)(j) * step], min[c], max[c])
+        float xp = SRC(0), yb = xp * coefp, yp = yb;
+        for(int j = 0; j < n; j++)
+        {
+          const float xc = SRC(j);
+          const float yc = (a0 * xc) + (a1 * xp) - (b1 * yp) - (b2 * yb);
+          dst[first + (size_t)j * step] = yc;
+          xp = xc;
+          yb = yp;
+          yp = yc;
+        }
+        float xn = SRC(n - 1), xa = xn, yn = xn * coefn, ya = yn;
+        for(int j = n - 1; j >= 0; j--)
+        {
+          const float xc = SRC(j);
+          const float yc = (a2 * xn) + (a3 * xa) - (b1 * yn) - (b2 * ya);
+          xa = xn;
+          xn = xc;
+          ya = yn;
+          yn = yc;
+          dst[first + (size_t)j * step] += yc;
+        }
+#undef SRC
+      }
+  }
+
+  dt_free_align(temp);
+}
+
+static int setup(void **state)
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_matches_reference(void **state)
+{
+  const dt_aligned_pixel_t min = { 0.1f, 0.f, 0.f, 0.f };
+  const dt_aligned_pixel_t max = { 0.9f, 1.f, 1.f, 1.f };
+  const int channels[] = { 1, 3, 4 };
+  const float sigmas[] = { 0.5f, 3.f, 40.f };
+
+  for(int c = 0; c < 3; c++)
+    for(int s = 0; s < 3; s++)
+    {
+      const int ch = channels[c];
+      float *in = gen_image(SMALL_WIDTH, SMALL_HEIGHT, ch);
+      float *ref = dt_alloc_align_float((size_t)SMALL_WIDTH * SMALL_HEIGHT * ch);
+      float *out = dt_alloc_align_float((size_t)SMALL_WIDTH * SMALL_HEIGHT * ch);
+
+      reference_blur(in, ref, SMALL_WIDTH, SMALL_HEIGHT, ch, sigmas[s], min, max);
+
+      dt_gaussian_t *g = dt_gaussian_init(SMALL_WIDTH, SMALL_HEIGHT, ch, max, min, sigmas[s], DT_IOP_GAUSSIAN_ZERO);
+      assert_non_null(g);
+      if(ch == 4)
+        dt_gaussian_blur_4c(g, in, out);
+      else
+        dt_gaussian_blur(g, in, out);
+
+      float max_err = 0.f;
+      for(size_t k = 0; k < (size_t)SMALL_WIDTH * SMALL_HEIGHT * ch; k++)
+        max_err = fmaxf(max_err, fabsf(ref[k] - out[k]));
+      TR_DEBUG("%i channels, sigma %f: max error %e", ch, sigmas[s], max_err);
+      assert_true(max_err < E_REFERENCE);
+
+      // in-place blurring is allowed
+      dt_gaussian_blur(g, in, in);
+      for(size_t k = 0; k < (size_t)SMALL_WIDTH * SMALL_HEIGHT * ch; k++)
+        assert_float_equal(in[k], out[k], 0.f);
+
+      dt_gaussian_free(g);
+      dt_free_align(out);
+      dt_free_align(ref);
+      dt_free_align(in);
+    }
+}
+
+static void test_constant_is_preserved(void **state)
+{
+  const dt_aligned_pixel_t min = { 0.f, 0.f, 0.f, 0.f };
+  const dt_aligned_pixel_t max = { 1.f, 1.f, 1.f, 1.f };
+  const size_t npixels = (size_t)SMALL_WIDTH * SMALL_HEIGHT;
+
+  float *in = dt_alloc_align_float(npixels * 4);
+  float *out = dt_alloc_align_float(npixels * 4);
+  for(size_t k = 0; k < npixels * 4; k++) in[k] = 0.25f * (k % 4) + 0.1f;
+
+  dt_gaussian_t *g = dt_gaussian_init(SMALL_WIDTH, SMALL_HEIGHT, 4, max, min, 20.f, DT_IOP_GAUSSIAN_ZERO);
+  assert_non_null(g);
+  dt_gaussian_blur_4c(g, in, out);
+  for(size_t k = 0; k < npixels * 4; k++)
+    assert_float_equal(in[k], out[k], 1e-4f);
+
+  dt_gaussian_free(g);
+  dt_free_align(out);
+  dt_free_align(in);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_matches_reference),
+    cmocka_unit_test(test_constant_is_preserved)
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
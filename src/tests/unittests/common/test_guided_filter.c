@@ -0,0 +1,184 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for common/guided_filter.c
+ *
+ * Please see ../README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/assert.h"
+#include "../util/tracing.h"
+#include "../util/testimg.h"
+
+#include "common/darktable.h"
+#include "common/guided_filter.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// size of the synthetic test image
+#define WIDTH 1000
+#define HEIGHT 1000
+
+// max acceptable deviation of the subsampled filter from the exact one, on a [0; 1] mask:
+// max over the image, and mean
+#define E_SUBSAMPLED 1e-2f
+#define E_SUBSAMPLED_MEAN 2e-3f
+
+// regularization of the accuracy tests, small enough for the filter to follow the edges of the guide
+#define SQRT_EPS 0.1f
+
+/*
+ * HELPERS
+ */
+
+// smooth waves plus a checkerboard of flat patches as guide. The channels are not proportional,
+// otherwise the covariance matrix of the guide is singular and the filter degrades to a box blur.
+static Testimg *gen_guide(void)
+{
+  Testimg *ti = testimg_alloc(WIDTH, HEIGHT);
+  for_testimg_pixels_p_yx(ti)
+  {
+    const float v = 0.5f + 0.3f * sinf(x * 0.01f) * cosf(y * 0.013f) + (((x / 200 + y / 150) % 2) ? 0.1f : 0.f);
+    p[0] = v;
+    p[1] = 0.8f * v + 0.1f * cosf(x * 0.017f + y * 0.006f);
+    p[2] = 0.6f * v + 0.1f * sinf(y * 0.021f - x * 0.004f);
+    p[3] = 0.f;
+  }
+  return ti;
+}
+
+// the checkerboard of the guide as input mask
+static float *gen_mask(void)
+{
+  float *mask = dt_alloc_align_float((size_t)WIDTH * HEIGHT);
+  for(int y = 0; y < HEIGHT; y++)
+    for(int x = 0; x < WIDTH; x++)
+      mask[(size_t)y * WIDTH + x] = ((x / 200 + y / 150) % 2) ? 0.8f : 0.2f;
+  return mask;
+}
+
+static int setup(void **state)
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+#ifdef __SSE2__
+  darktable.codepath.SSE2 = 1;
+#endif
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  dt_gf_scratch_cleanup();
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_subsampled_fallback_is_exact(void **state)
+{
+  Testimg *guide = gen_guide();
+  float *mask = gen_mask();
+  float *exact = dt_alloc_align_float((size_t)WIDTH * HEIGHT);
+  float *fast = dt_alloc_align_float((size_t)WIDTH * HEIGHT);
+
+  guided_filter(guide->pixels, mask, exact, WIDTH, HEIGHT, 4, 8, 1.f, 1.f, 0.f, 1.f);
+  guided_filter_subsampled(guide->pixels, mask, fast, WIDTH, HEIGHT, 4, 8, 1.f, 1.f, 0.f, 1.f, 1);
+
+  for(size_t k = 0; k < (size_t)WIDTH * HEIGHT; k++)
+    assert_float_equal(exact[k], fast[k], 0.f);
+
+  dt_free_align(fast);
+  dt_free_align(exact);
+  dt_free_align(mask);
+  testimg_free(guide);
+}
+
+static void test_subsampled_accuracy(void **state)
+{
+  Testimg *guide = gen_guide();
+  float *mask = gen_mask();
+  float *exact = dt_alloc_align_float((size_t)WIDTH * HEIGHT);
+  float *fast = dt_alloc_align_float((size_t)WIDTH * HEIGHT);
+
+  // the largest radius still leaves enough resolution not to fall back to the exact filter
+  const int radii[] = { 64, 128, 192 };
+  for(int r = 0; r < 3; r++)
+  {
+    const int w = radii[r];
+    const int subsample = w / 32;
+    guided_filter(guide->pixels, mask, exact, WIDTH, HEIGHT, 4, w, SQRT_EPS, 1.f, 0.f, 1.f);
+    guided_filter_subsampled(guide->pixels, mask, fast, WIDTH, HEIGHT, 4, w, SQRT_EPS, 1.f, 0.f, 1.f, subsample);
+
+    float max_err = 0.f;
+    double sum_err = 0.;
+    for(size_t k = 0; k < (size_t)WIDTH * HEIGHT; k++)
+    {
+      const float err = fabsf(exact[k] - fast[k]);
+      max_err = fmaxf(max_err, err);
+      sum_err += err;
+    }
+    const float mean_err = sum_err / ((double)WIDTH * HEIGHT);
+
+    TR_DEBUG("radius %i, subsampling %i: max error %e, mean error %e", w, subsample, max_err, mean_err);
+    assert_true(max_err < E_SUBSAMPLED);
+    assert_true(mean_err < E_SUBSAMPLED_MEAN);
+  }
+
+  dt_free_align(fast);
+  dt_free_align(exact);
+  dt_free_align(mask);
+  testimg_free(guide);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_subsampled_fallback_is_exact),
+    cmocka_unit_test(test_subsampled_accuracy)
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
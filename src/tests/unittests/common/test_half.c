@@ -0,0 +1,236 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for common/half.h, and accuracy report of the wavelet details stored as half
+ * floats (common/bspline.h) against float32.
+ *
+ * Please see ../README.md for more detailed documentation.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/assert.h"
+#include "../util/tracing.h"
+
+#include "common/darktable.h"
+#include "common/bspline.h"
+#include "common/half.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// relative rounding error of half floats: 11 significant bits
+#define E_HALF 4.8828125e-4f
+
+// smallest positive subnormal half float: 2^-24
+#define HALF_MIN 5.9604644775390625e-8f
+
+#define WIDTH 1500
+#define HEIGHT 1000
+#define SCALES 6
+
+/*
+ * HELPERS
+ */
+
+// smooth gradients over several stops, edges, fine texture and a specular highlight
+static float *scene_alloc(void)
+{
+  float *img = dt_alloc_align_float((size_t)4 * WIDTH * HEIGHT);
+  for(int y = 0; y < HEIGHT; y++)
+    for(int x = 0; x < WIDTH; x++)
+      for(int c = 0; c < 4; c++)
+      {
+        float v = 0.18f * expf(2.5f * sinf(x * 0.004f + c) * cosf(y * 0.003f))
+                  + ((((x / 40) + (y / 40)) & 1) ? 0.3f : 0.f) + 0.02f * sinf(x * 1.3f + y * 0.7f);
+        if((x - 700) * (x - 700) + (y - 500) * (y - 500) < 2500) v *= 40.f;
+        img[4 * ((size_t)y * WIDTH + x) + c] = v;
+      }
+  return img;
+}
+
+static int setup(void **state)
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+// every half float but NaN survives a round-trip through float32
+static void test_roundtrip(void **state)
+{
+  for(uint32_t h = 0; h < 65536; h++)
+  {
+    const float f = dt_half_to_float((dt_half_t)h);
+    if(isnan(f))
+      assert_true(isnan(dt_half_to_float(dt_float_to_half(f))));
+    else
+      assert_int_equal(dt_float_to_half(f), h);
+  }
+}
+
+static void test_rounding(void **state)
+{
+  // ties to even
+  assert_float_equal(dt_half_to_float(dt_float_to_half(1.f + E_HALF)), 1.f, 0.f);
+  assert_float_equal(dt_half_to_float(dt_float_to_half(1.f + 3.f * E_HALF)), 1.f + 4.f * E_HALF, 0.f);
+  assert_float_equal(dt_half_to_float(dt_float_to_half(-1.f - 3.f * E_HALF)), -1.f - 4.f * E_HALF, 0.f);
+
+  // overflow
+  assert_float_equal(dt_half_to_float(dt_float_to_half(65504.f)), 65504.f, 0.f);
+  assert_float_equal(dt_half_to_float(dt_float_to_half(65519.f)), 65504.f, 0.f);
+  assert_true(isinf(dt_half_to_float(dt_float_to_half(65520.f))));
+  assert_true(isinf(dt_half_to_float(dt_float_to_half(-1e10f))));
+  assert_true(isnan(dt_half_to_float(dt_float_to_half(NAN))));
+
+  // subnormals and underflow
+  assert_float_equal(dt_half_to_float(dt_float_to_half(HALF_MIN)), HALF_MIN, 0.f);
+  assert_float_equal(dt_half_to_float(dt_float_to_half(0.5f * HALF_MIN)), 0.f, 0.f);
+  assert_float_equal(dt_half_to_float(dt_float_to_half(0.75f * HALF_MIN)), HALF_MIN, 0.f);
+  assert_float_equal(dt_half_to_float(dt_float_to_half(1.5f * HALF_MIN)), 2.f * HALF_MIN, 0.f);
+}
+
+// the pixel helpers (F16C when compiled in) give the same results as the scalar code
+static void test_pixels(void **state)
+{
+  uint32_t seed = 12345;
+  for(int i = 0; i < 1000000; i++)
+  {
+    dt_aligned_pixel_t in, out;
+    dt_half_t DT_ALIGNED_PIXEL half[4];
+    for(int c = 0; c < 4; c++)
+    {
+      seed = seed * 1664525u + 1013904223u;
+      union { float f; uint32_t u; } v = { .u = seed };
+      in[c] = isnan(v.f) ? 0.f : v.f;
+    }
+    dt_store_half_4(half, in);
+    dt_load_half_4(out, half);
+    for(int c = 0; c < 4; c++)
+    {
+      const float expected = dt_half_to_float(half[c]);
+      assert_int_equal(half[c], dt_float_to_half(in[c]));
+      assert_memory_equal(&out[c], &expected, sizeof(float)); // bitwise, to compare infinities
+    }
+  }
+}
+
+// the details stored as half floats are rounded to the nearest half float of the float32 ones,
+// and the low frequencies are identical. Prints the error per scale and on the reconstructed image.
+static void test_wavelets_accuracy(void **state)
+{
+  const size_t npixels = (size_t)WIDTH * HEIGHT;
+  float *const img = scene_alloc();
+  float *const HF = dt_alloc_align_float(4 * npixels);
+  dt_half_t *const HF_half = dt_alloc_align(sizeof(dt_half_t) * 4 * npixels);
+  float *LF[2] = { dt_alloc_align_float(4 * npixels), dt_alloc_align_float(4 * npixels) };
+  float *LF_half[2] = { dt_alloc_align_float(4 * npixels), dt_alloc_align_float(4 * npixels) };
+  float *const error = dt_alloc_align_float(4 * npixels);
+  size_t padded_size;
+  float *const tempbuf = dt_alloc_perthread_float(4 * WIDTH, &padded_size);
+  dt_iop_image_fill(error, 0.f, WIDTH, HEIGHT, 4);
+
+  const float *in = img;
+  const float *in_half = img;
+  for(int s = 0; s < SCALES; s++)
+  {
+    decompose_2D_Bspline(in, HF, LF[s & 1], WIDTH, HEIGHT, 1 << s, tempbuf, padded_size);
+    decompose_2D_Bspline_half(in_half, HF_half, LF_half[s & 1], WIDTH, HEIGHT, 1 << s, tempbuf, padded_size);
+
+    float max_err = 0.f;
+    double sum_err = 0.;
+    for(size_t k = 0; k < 4 * npixels; k++)
+    {
+      const float err = dt_half_to_float(HF_half[k]) - HF[k];
+      assert_true(fabsf(err) <= fmaxf(E_HALF * fabsf(HF[k]), 0.5f * HALF_MIN));
+      assert_float_equal(LF_half[s & 1][k], LF[s & 1][k], 0.f);
+      error[k] += err;
+      max_err = fmaxf(max_err, fabsf(err));
+      sum_err += fabsf(err);
+    }
+    fprintf(stdout, "[half] scale %i: max error %.2e, mean error %.2e\n", s, max_err, sum_err / (4 * npixels));
+
+    in = LF[s & 1];
+    in_half = LF_half[s & 1];
+  }
+
+  // the error on the image reconstructed from all the scales is the sum of the errors of the details
+  float max_err = 0.f;
+  double sum_err = 0.;
+  for(size_t k = 0; k < 4 * npixels; k++)
+  {
+    max_err = fmaxf(max_err, fabsf(error[k]));
+    sum_err += fabsf(error[k]);
+  }
+  fprintf(stdout, "[half] reconstruction over %i scales: max error %.2e, mean error %.2e\n", SCALES, max_err,
+          sum_err / (4 * npixels));
+  assert_true(sum_err / (4 * npixels) < 1e-4);
+
+  dt_free_align(tempbuf);
+  dt_free_align(error);
+  for(int k = 0; k < 2; k++)
+  {
+    dt_free_align(LF[k]);
+    dt_free_align(LF_half[k]);
+  }
+  dt_free_align(HF_half);
+  dt_free_align(HF);
+  dt_free_align(img);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_roundtrip),
+    cmocka_unit_test(test_rounding),
+    cmocka_unit_test(test_pixels),
+    cmocka_unit_test(test_wavelets_accuracy)
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
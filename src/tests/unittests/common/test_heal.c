@@ -0,0 +1,192 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for common/heal.c: the multigrid initial solution against plain SOR.
+ *
+ * Please see ../README.md for more detailed documentation.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/assert.h"
+#include "../util/tracing.h"
+
+#include "common/darktable.h"
+#include "common/opencl.h"
+#include "common/heal.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// the default of the retouch module
+#define MAX_ITER 2000
+
+// max acceptable deviation between both solvers, on [0; 1] pixels: 0.25/255
+#define E_SOLVERS 1e-3f
+
+/*
+ * HELPERS
+ */
+
+typedef struct stamp_t
+{
+  int size;
+  float *src;
+  float *dest;
+  float *mask;
+} stamp_t;
+
+// two different smooth textures as source and destination, and a disc as mask
+static stamp_t *stamp_alloc(const int size)
+{
+  stamp_t *s = calloc(1, sizeof(stamp_t));
+  const size_t npixels = (size_t)size * size;
+  s->size = size;
+  s->src = dt_alloc_align_float(4 * npixels);
+  s->dest = dt_alloc_align_float(4 * npixels);
+  s->mask = dt_alloc_align_float(npixels);
+
+  const float radius = 0.45f * size;
+  for(int y = 0; y < size; y++)
+    for(int x = 0; x < size; x++)
+    {
+      const size_t k = (size_t)y * size + x;
+      for(int c = 0; c < 4; c++)
+      {
+        s->src[4 * k + c] = 0.3f + 0.2f * sinf(x * 0.01f + c) + 0.05f * sinf(x * 0.3f) * cosf(y * 0.2f);
+        s->dest[4 * k + c] = 0.5f + 0.3f * cosf(y * 0.007f + c) * sinf(x * 0.005f) + 0.05f * sinf(y * 0.25f);
+      }
+      const float dx = x - 0.5f * size + 0.5f;
+      const float dy = y - 0.5f * size + 0.5f;
+      s->mask[k] = (dx * dx + dy * dy < radius * radius) ? 1.f : 0.f;
+    }
+  return s;
+}
+
+static float *stamp_copy_dest(const stamp_t *s)
+{
+  const size_t size = (size_t)4 * s->size * s->size;
+  float *dest = dt_alloc_align_float(size);
+  memcpy(dest, s->dest, size * sizeof(float));
+  return dest;
+}
+
+static void stamp_free(stamp_t *s)
+{
+  dt_free_align(s->src);
+  dt_free_align(s->dest);
+  dt_free_align(s->mask);
+  free(s);
+}
+
+static float max_difference(const float *const a, const float *const b, const size_t npixels)
+{
+  float max_err = 0.f;
+  for(size_t k = 0; k < npixels; k++)
+    for(int c = 0; c < 3; c++) max_err = fmaxf(max_err, fabsf(a[4 * k + c] - b[4 * k + c]));
+  return max_err;
+}
+
+static int setup(void **state)
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+// stamps too small for a pyramid are solved exactly as before
+static void test_small_stamp_unchanged(void **state)
+{
+  stamp_t *s = stamp_alloc(50);
+  float *plain = stamp_copy_dest(s);
+  float *multigrid = stamp_copy_dest(s);
+
+  dt_heal_ext(s->src, plain, s->mask, s->size, s->size, 4, MAX_ITER, FALSE);
+  dt_heal_ext(s->src, multigrid, s->mask, s->size, s->size, 4, MAX_ITER, TRUE);
+
+  assert_float_equal(max_difference(plain, multigrid, (size_t)s->size * s->size), 0.f, 0.f);
+
+  dt_free_align(multigrid);
+  dt_free_align(plain);
+  stamp_free(s);
+}
+
+// both solvers converge to the same solution, and don't touch the pixels out of the mask
+static void test_multigrid_accuracy(void **state)
+{
+  stamp_t *s = stamp_alloc(250);
+  const size_t npixels = (size_t)s->size * s->size;
+  float *plain = stamp_copy_dest(s);
+  float *multigrid = stamp_copy_dest(s);
+
+  const int plain_iter = dt_heal_ext(s->src, plain, s->mask, s->size, s->size, 4, MAX_ITER, FALSE);
+  const int mg_iter = dt_heal_ext(s->src, multigrid, s->mask, s->size, s->size, 4, MAX_ITER, TRUE);
+
+  const float max_err = max_difference(plain, multigrid, npixels);
+  TR_DEBUG("SOR %i iterations, multigrid %i iterations, max difference %e", plain_iter, mg_iter, max_err);
+  assert_true(max_err < E_SOLVERS);
+  assert_true(mg_iter < plain_iter);
+
+  for(size_t k = 0; k < npixels; k++)
+    if(s->mask[k] == 0.f)
+      for(int c = 0; c < 3; c++) assert_float_equal(multigrid[4 * k + c], s->dest[4 * k + c], 0.f);
+
+  dt_free_align(multigrid);
+  dt_free_align(plain);
+  stamp_free(s);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_small_stamp_unchanged),
+    cmocka_unit_test(test_multigrid_accuracy)
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,415 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka round-trip tests for the parallel TIFF strip writer
+ * (common/imageio_tiff.c), PNG IDAT writer (common/imageio_png_write.c) and JPEG restart-interval
+ * writer (common/imageio_jpeg_write.c).
+ * Files are written with our writers and read back with plain libtiff / libpng / libjpeg.
+ *
+ * Please see ../README.md for more detailed documentation.
+ */
+#include <limits.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <cmocka.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "../util/assert.h"
+#include "../util/tracing.h"
+
+#include "common/darktable.h"
+#include "common/imageio_jpeg_write.h"
+#include "common/imageio_png_write.h"
+#include "common/imageio_tiff.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// odd size for the round-trips, so that strips and IDAT blocks end on partial rows
+#define SMALL_WIDTH 517
+#define SMALL_HEIGHT 333
+
+typedef struct rows_t
+{
+  const uint8_t *in;
+  int width;
+  int layers;
+  int bpp;
+} rows_t;
+
+/*
+ * HELPERS
+ */
+
+// 4-channel buffer, as handed to the format modules, with smooth gradients and some noise
+static uint8_t *gen_image(const int width, const int height, const int bpp)
+{
+  const size_t n = (size_t)width * height * 4;
+  uint8_t *img = dt_alloc_align(n * bpp / 8);
+  for(size_t k = 0; k < n; k++)
+  {
+    const int x = (k / 4) % width;
+    const int y = (k / 4) / width;
+    const int c = k % 4;
+    const float v = 0.5f + 0.4f * sinf(x * 0.01f * (c + 1)) * cosf(y * 0.02f) + (rand() % 64) / 4096.f;
+    if(bpp == 32)
+      ((float *)img)[k] = v;
+    else if(bpp == 16)
+      ((uint16_t *)img)[k] = (uint16_t)(v * 65535.f);
+    else
+      img[k] = (uint8_t)(v * 255.f);
+  }
+  return img;
+}
+
+static void _pack_row(const void *data, const int y, uint8_t *out)
+{
+  const rows_t *r = (const rows_t *)data;
+  const size_t bytes = r->bpp / 8;
+  const uint8_t *in = r->in + (size_t)4 * y * r->width * bytes;
+  for(int x = 0; x < r->width; x++, in += 4 * bytes, out += r->layers * bytes)
+    memcpy(out, in, r->layers * bytes);
+}
+
+static gchar *tmp_file(const char *ext)
+{
+  gchar *name = g_strdup_printf("ansel_test_imageio_write.%s", ext);
+  gchar *path = g_build_filename(g_get_tmp_dir(), name, NULL);
+  g_free(name);
+  return path;
+}
+
+static double write_tiff(const char *path, const uint8_t *img, const int width, const int height,
+                         const int layers, const int bpp, const uint16_t compression, const uint16_t predictor)
+{
+  TIFF *tif = TIFFOpen(path, "w");
+  assert_non_null(tif);
+  TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, width);
+  TIFFSetField(tif, TIFFTAG_IMAGELENGTH, height);
+  TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, layers);
+  TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, bpp);
+  TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, bpp == 32 ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT);
+  TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, layers == 3 ? PHOTOMETRIC_RGB : PHOTOMETRIC_MINISBLACK);
+  TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField(tif, TIFFTAG_COMPRESSION, compression);
+  if(compression == COMPRESSION_ADOBE_DEFLATE)
+  {
+    TIFFSetField(tif, TIFFTAG_PREDICTOR, predictor);
+    TIFFSetField(tif, TIFFTAG_ZIPQUALITY, 6);
+  }
+
+  const rows_t rows = { img, width, layers, bpp };
+  const double start = dt_get_wtime();
+  const int err = dt_imageio_tiff_write_strips(tif, width, height, layers, bpp, 6, _pack_row, &rows);
+  const double end = dt_get_wtime();
+  TIFFClose(tif);
+  assert_int_equal(err, 0);
+  return end - start;
+}
+
+static void check_tiff(const char *path, const uint8_t *img, const int width, const int height,
+                       const int layers, const int bpp)
+{
+  TIFF *tif = TIFFOpen(path, "r");
+  assert_non_null(tif);
+  const size_t bytes = bpp / 8;
+  uint8_t *row = g_malloc(TIFFScanlineSize(tif));
+  for(int y = 0; y < height; y++)
+  {
+    assert_true(TIFFReadScanline(tif, row, y, 0) >= 0);
+    const uint8_t *in = img + (size_t)4 * y * width * bytes;
+    for(int x = 0; x < width; x++)
+      assert_memory_equal(row + x * layers * bytes, in + (size_t)4 * x * bytes, layers * bytes);
+  }
+  g_free(row);
+  TIFFClose(tif);
+}
+
+static double write_png(const char *path, const uint8_t *img, const int width, const int height, const int bpp,
+                        const int level)
+{
+  FILE *f = g_fopen(path, "wb");
+  assert_non_null(f);
+  png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  png_infop info_ptr = png_create_info_struct(png_ptr);
+  assert_non_null(info_ptr);
+  png_init_io(png_ptr, f);
+  png_set_compression_level(png_ptr, level);
+  png_set_IHDR(png_ptr, info_ptr, width, height, bpp, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+               PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+  png_write_info(png_ptr, info_ptr);
+
+  const double start = dt_get_wtime();
+  const int err = dt_imageio_png_write_parallel(png_ptr, img, width, height, bpp, level);
+  const double end = dt_get_wtime();
+  png_destroy_write_struct(&png_ptr, &info_ptr);
+  fclose(f);
+  assert_int_equal(err, 0);
+  return end - start;
+}
+
+static void check_png(const char *path, const uint8_t *img, const int width, const int height, const int bpp)
+{
+  FILE *f = g_fopen(path, "rb");
+  assert_non_null(f);
+  png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  png_infop info_ptr = png_create_info_struct(png_ptr);
+  assert_non_null(info_ptr);
+  png_init_io(png_ptr, f);
+  png_read_info(png_ptr, info_ptr);
+  assert_int_equal(png_get_image_width(png_ptr, info_ptr), width);
+  assert_int_equal(png_get_image_height(png_ptr, info_ptr), height);
+  assert_int_equal(png_get_bit_depth(png_ptr, info_ptr), bpp);
+
+  uint8_t *row = g_malloc(png_get_rowbytes(png_ptr, info_ptr));
+  for(int y = 0; y < height; y++)
+  {
+    png_read_row(png_ptr, row, NULL);
+    for(int x = 0; x < width; x++)
+      for(int c = 0; c < 3; c++)
+      {
+        const size_t k = ((size_t)y * width + x) * 4 + c;
+        if(bpp == 16)
+        {
+          // PNG samples are big-endian
+          const uint16_t v = (row[2 * (3 * x + c)] << 8) | row[2 * (3 * x + c) + 1];
+          assert_int_equal(v, ((const uint16_t *)img)[k]);
+        }
+        else
+          assert_int_equal(row[3 * x + c], img[k]);
+      }
+  }
+  png_read_end(png_ptr, NULL);
+  g_free(row);
+  png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+  fclose(f);
+}
+
+static void _jpeg_setup(j_compress_ptr cinfo, const void *data)
+{
+  const int quality = *(const int *)data;
+  jpeg_set_quality(cinfo, quality, TRUE);
+  if(quality > 90) cinfo->comp_info[0].v_samp_factor = 1;
+  if(quality > 92) cinfo->comp_info[0].h_samp_factor = 1;
+}
+
+// plain libjpeg encoder with the same settings and the standard Huffman tables, as a reference
+static double write_jpeg_serial(const char *path, const uint8_t *img, const int width, const int height,
+                                const int quality, const boolean optimize_coding)
+{
+  FILE *f = g_fopen(path, "wb");
+  assert_non_null(f);
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+  jpeg_stdio_dest(&cinfo, f);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  _jpeg_setup(&cinfo, &quality);
+  cinfo.optimize_coding = optimize_coding;
+
+  const double start = dt_get_wtime();
+  jpeg_start_compress(&cinfo, TRUE);
+  uint8_t *row = g_malloc((size_t)3 * width);
+  while(cinfo.next_scanline < cinfo.image_height)
+  {
+    const uint8_t *in = img + (size_t)4 * cinfo.next_scanline * width;
+    for(int x = 0; x < width; x++)
+      for(int c = 0; c < 3; c++) row[3 * x + c] = in[4 * x + c];
+    JSAMPROW tmp[1] = { row };
+    jpeg_write_scanlines(&cinfo, tmp, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  const double end = dt_get_wtime();
+  g_free(row);
+  jpeg_destroy_compress(&cinfo);
+  fclose(f);
+  return end - start;
+}
+
+static double write_jpeg_parallel(const char *path, const uint8_t *img, const int width, const int height,
+                                  const int quality)
+{
+  FILE *f = g_fopen(path, "wb");
+  assert_non_null(f);
+  const double start = dt_get_wtime();
+  const int err = dt_imageio_jpeg_write_parallel(f, img, width, height, _jpeg_setup, &quality, NULL, 0, NULL, 0);
+  const double end = dt_get_wtime();
+  fclose(f);
+  assert_int_equal(err, 0);
+  return end - start;
+}
+
+static uint8_t *read_jpeg(const char *path, const int width, const int height)
+{
+  FILE *f = g_fopen(path, "rb");
+  assert_non_null(f);
+  struct jpeg_decompress_struct dinfo;
+  struct jpeg_error_mgr jerr;
+  dinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_decompress(&dinfo);
+  jpeg_stdio_src(&dinfo, f);
+  jpeg_read_header(&dinfo, TRUE);
+  dinfo.out_color_space = JCS_RGB;
+  jpeg_start_decompress(&dinfo);
+  assert_int_equal(dinfo.output_width, width);
+  assert_int_equal(dinfo.output_height, height);
+
+  uint8_t *out = g_malloc((size_t)3 * width * height);
+  while(dinfo.output_scanline < dinfo.output_height)
+  {
+    JSAMPROW tmp[1] = { out + (size_t)3 * width * dinfo.output_scanline };
+    jpeg_read_scanlines(&dinfo, tmp, 1);
+  }
+  // corrupt data or restart markers out of sequence raise warnings
+  assert_int_equal(jerr.num_warnings, 0);
+  jpeg_finish_decompress(&dinfo);
+  jpeg_destroy_decompress(&dinfo);
+  fclose(f);
+  return out;
+}
+
+static int setup(void **state)
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_tiff_roundtrip(void **state)
+{
+  gchar *path = tmp_file("tif");
+  for(int bpp = 8; bpp <= 32; bpp *= 2)
+  {
+    uint8_t *img = gen_image(SMALL_WIDTH, SMALL_HEIGHT, bpp);
+    const uint16_t predictor = (bpp == 32) ? PREDICTOR_FLOATINGPOINT : PREDICTOR_HORIZONTAL;
+    for(int layers = 1; layers <= 3; layers += 2)
+    {
+      write_tiff(path, img, SMALL_WIDTH, SMALL_HEIGHT, layers, bpp, COMPRESSION_NONE, PREDICTOR_NONE);
+      check_tiff(path, img, SMALL_WIDTH, SMALL_HEIGHT, layers, bpp);
+      write_tiff(path, img, SMALL_WIDTH, SMALL_HEIGHT, layers, bpp, COMPRESSION_ADOBE_DEFLATE, PREDICTOR_NONE);
+      check_tiff(path, img, SMALL_WIDTH, SMALL_HEIGHT, layers, bpp);
+      write_tiff(path, img, SMALL_WIDTH, SMALL_HEIGHT, layers, bpp, COMPRESSION_ADOBE_DEFLATE, predictor);
+      check_tiff(path, img, SMALL_WIDTH, SMALL_HEIGHT, layers, bpp);
+    }
+    // single pixel: one strip holding one row
+    write_tiff(path, img, 1, 1, 3, bpp, COMPRESSION_ADOBE_DEFLATE, predictor);
+    check_tiff(path, img, 1, 1, 3, bpp);
+    dt_free_align(img);
+  }
+  g_unlink(path);
+  g_free(path);
+}
+
+static void test_png_roundtrip(void **state)
+{
+  gchar *path = tmp_file("png");
+  const int levels[] = { 0, 1, 6, 9 };
+  for(int bpp = 8; bpp <= 16; bpp *= 2)
+  {
+    uint8_t *img = gen_image(SMALL_WIDTH, SMALL_HEIGHT, bpp);
+    for(int l = 0; l < 4; l++)
+    {
+      write_png(path, img, SMALL_WIDTH, SMALL_HEIGHT, bpp, levels[l]);
+      check_png(path, img, SMALL_WIDTH, SMALL_HEIGHT, bpp);
+    }
+    write_png(path, img, 1, 1, bpp, 6);
+    check_png(path, img, 1, 1, bpp);
+    dt_free_align(img);
+  }
+  g_unlink(path);
+  g_free(path);
+}
+
+static void test_jpeg_roundtrip(void **state)
+{
+  // the parallel writer declines to split for a single thread
+  const int threads = darktable.num_openmp_threads;
+  darktable.num_openmp_threads = MAX(threads, 4);
+
+  gchar *path = tmp_file("jpg");
+  const int sizes[4][2] = { { SMALL_WIDTH, SMALL_HEIGHT }, { 64, 200 }, { 1, 300 }, { 4000, 129 } };
+  const int qualities[] = { 40, 85, 91, 95 };
+  for(int s = 0; s < 4; s++)
+  {
+    const int width = sizes[s][0];
+    const int height = sizes[s][1];
+    uint8_t *img = gen_image(width, height, 8);
+    for(int q = 0; q < 4; q++)
+    {
+      // same DCT and tables, so the decoded pixels must be identical to the single-threaded encoder's
+      write_jpeg_serial(path, img, width, height, qualities[q], FALSE);
+      uint8_t *reference = read_jpeg(path, width, height);
+      write_jpeg_parallel(path, img, width, height, qualities[q]);
+      uint8_t *decoded = read_jpeg(path, width, height);
+      assert_memory_equal(decoded, reference, (size_t)3 * width * height);
+      g_free(decoded);
+      g_free(reference);
+    }
+    dt_free_align(img);
+  }
+  g_unlink(path);
+  g_free(path);
+  darktable.num_openmp_threads = threads;
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_tiff_roundtrip),
+    cmocka_unit_test(test_png_roundtrip),
+    cmocka_unit_test(test_jpeg_roundtrip)
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,442 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for common/locallaplacian.c
+ *
+ * Please see ../README.md for more detailed documentation.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/assert.h"
+#include "../util/tracing.h"
+
+#include "common/darktable.h"
+#include "common/locallaplacian.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// odd size for the accuracy tests
+#define SMALL_WIDTH 307
+#define SMALL_HEIGHT 211
+
+// max acceptable deviation of the fine mode from the per-pixel reference, in L
+#define E_FINE 1e-4f
+
+// max acceptable mean deviation of the fast mode from the fine one, in L. For strong settings, the 6
+// levels of the fine mode are about as far from the converged filter.
+#define E_FAST 1.5f
+
+// the fixed image set: smooth gradients, hard edges with fine texture, and a dark to bright ramp
+#define NUM_IMAGES 3
+
+// sigma, shadows, highlights, clarity: defaults, "HDR local tone-mapping" and "clarity" presets
+static const float params[][4] = { { 0.5f, 0.5f, 0.5f, 0.25f }, { 0.25f, 0.0f, 0.0f, 1.0f }, { 0.5f, 0.0f, 0.0f, 0.33f } };
+#define NUM_PARAMS 3
+
+/*
+ * HELPERS
+ */
+
+// Lab with uniform noise, L in [0; 100]
+static float *gen_image(const int width, const int height, const int kind)
+{
+  float *img = dt_alloc_align_float((size_t)4 * width * height);
+  uint32_t seed = 7;
+  for(int y = 0; y < height; y++)
+    for(int x = 0; x < width; x++)
+    {
+      seed = seed * 1664525u + 1013904223u;
+      const float noise = (seed >> 9) / 8388608.f - 0.5f;
+      float L;
+      if(kind == 0)
+        L = 50.f + 40.f * sinf(x * 0.01f) * cosf(y * 0.013f) + 2.f * noise;
+      else if(kind == 1)
+        L = (((x / 64 + y / 48) & 1) ? 80.f : 15.f) + 3.f * sinf(x * 0.3f) * sinf(y * 0.2f) + noise;
+      else
+        L = 100.f * powf((x + 0.5f) / width, 2.2f) * (0.6f + 0.4f * sinf(y * 0.05f)) + 5.f * noise;
+      float *const pixel = img + 4 * ((size_t)y * width + x);
+      pixel[0] = CLAMPS(L, 0.f, 100.f);
+      pixel[1] = 5.f;
+      pixel[2] = -5.f;
+      pixel[3] = 0.f;
+    }
+  return img;
+}
+
+// the fine mode as it was computed pixel by pixel before the output got assembled by rows, as a reference:
+// replicated padding, 6 brightness levels blended linearly, and each coefficient taken by ll_laplacian()
+#define REF_MAX_LEVELS 30
+#define REF_NUM_GAMMA 6
+
+static inline int ref_dl(int size, const int level)
+{
+  for(int l = 0; l < level; l++) size = (size - 1) / 2 + 1;
+  return size;
+}
+
+// the coarse pixels around the fine pixel (i, j), which needs a 1 or 2 px boundary
+static inline float ll_expand_gaussian(const float *const coarse, const int i, const int j, const int wd, const int ht)
+{
+  const int cw = (wd - 1) / 2 + 1;
+  const int ind = (j / 2) * cw + i / 2;
+  switch((i & 1) + 2 * (j & 1))
+  {
+    case 0: // both are even, 3x3 stencil
+      return 4. / 256. * (6.0f * (coarse[ind - cw] + coarse[ind - 1] + 6.0f * coarse[ind] + coarse[ind + 1] + coarse[ind + cw])
+                          + coarse[ind - cw - 1] + coarse[ind - cw + 1] + coarse[ind + cw - 1] + coarse[ind + cw + 1]);
+    case 1: // i is odd, 2x3 stencil
+      return 4. / 256. * (24.0 * (coarse[ind] + coarse[ind + 1])
+                          + 4.0 * (coarse[ind - cw] + coarse[ind - cw + 1] + coarse[ind + cw] + coarse[ind + cw + 1]));
+    case 2: // j is odd, 3x2 stencil
+      return 4. / 256. * (24.0 * (coarse[ind] + coarse[ind + cw])
+                          + 4.0 * (coarse[ind - 1] + coarse[ind + 1] + coarse[ind + cw - 1] + coarse[ind + cw + 1]));
+    default: // both are odd, 2x2 stencil
+      return .25f * (coarse[ind] + coarse[ind + 1] + coarse[ind + cw] + coarse[ind + cw + 1]);
+  }
+}
+
+static inline float ll_laplacian(const float *const coarse, const float *const fine, const int i, const int j,
+                                 const int wd, const int ht)
+{
+  const float c = ll_expand_gaussian(coarse, CLAMPS(i, 1, ((wd - 1) & ~1) - 1), CLAMPS(j, 1, ((ht - 1) & ~1) - 1), wd, ht);
+  return fine[j * wd + i] - c;
+}
+
+static void ref_fill_boundary1(float *const input, const int wd, const int ht)
+{
+  for(int j = 1; j < ht - 1; j++) input[j * wd] = input[j * wd + 1];
+  for(int j = 1; j < ht - 1; j++) input[j * wd + wd - 1] = input[j * wd + wd - 2];
+  memcpy(input, input + wd, sizeof(float) * wd);
+  memcpy(input + wd * (ht - 1), input + wd * (ht - 2), sizeof(float) * wd);
+}
+
+static void ref_fill_boundary2(float *const input, const int wd, const int ht)
+{
+  for(int j = 1; j < ht - 1; j++) input[j * wd] = input[j * wd + 1];
+  if(wd & 1)
+    for(int j = 1; j < ht - 1; j++) input[j * wd + wd - 1] = input[j * wd + wd - 2];
+  else
+    for(int j = 1; j < ht - 1; j++) input[j * wd + wd - 1] = input[j * wd + wd - 2] = input[j * wd + wd - 3];
+  memcpy(input, input + wd, sizeof(float) * wd);
+  if(!(ht & 1)) memcpy(input + wd * (ht - 2), input + wd * (ht - 3), sizeof(float) * wd);
+  memcpy(input + wd * (ht - 1), input + wd * (ht - 2), sizeof(float) * wd);
+}
+
+static void ref_pad_rows(float *buf, const int w, const int h, const int padding)
+{
+  for(int j = 0; j < padding; j++)
+  {
+    memcpy(buf + (size_t)w * j, buf + (size_t)padding * w, sizeof(float) * w);
+    memcpy(buf + (size_t)w * (h - padding + j), buf + (size_t)w * (h - padding - 1), sizeof(float) * w);
+  }
+}
+
+static void ref_gauss_reduce(const float *const input, float *const coarse, const int wd, const int ht)
+{
+  const int cw = (wd - 1) / 2 + 1, ch = (ht - 1) / 2 + 1;
+  const float w[5] = { 1.f / 16.f, 4.f / 16.f, 6.f / 16.f, 4.f / 16.f, 1.f / 16.f };
+  memset(coarse, 0, sizeof(float) * cw * ch);
+  for(int j = 1; j < ch - 1; j++)
+    for(int i = 1; i < cw - 1; i++)
+      for(int jj = -2; jj <= 2; jj++)
+        for(int ii = -2; ii <= 2; ii++)
+          coarse[j * cw + i] += input[(2 * j + jj) * wd + 2 * i + ii] * w[ii + 2] * w[jj + 2];
+  ref_fill_boundary1(coarse, cw, ch);
+}
+
+static void ref_gauss_expand(const float *const input, float *const fine, const int wd, const int ht)
+{
+  for(int j = 1; j < ((ht - 1) & ~1); j++)
+    for(int i = 1; i < ((wd - 1) & ~1); i++) fine[j * wd + i] = ll_expand_gaussian(input, i, j, wd, ht);
+  ref_fill_boundary2(fine, wd, ht);
+}
+
+static float ref_curve(const float x, const float g, const float sigma, const float shadows, const float highlights,
+                       const float clarity)
+{
+  const float c = x - g;
+  float val;
+  if(c > 2 * sigma)
+    val = g + sigma + shadows * (c - sigma);
+  else if(c < -2 * sigma)
+    val = g - sigma + highlights * (c + sigma);
+  else if(c > 0.0f)
+  {
+    const float t = CLAMPS(c / (2.0f * sigma), 0.0f, 1.0f);
+    val = g + sigma * 2.0f * (1.0f - t) * t + t * t * (sigma + sigma * shadows);
+  }
+  else
+  {
+    const float t = CLAMPS(-c / (2.0f * sigma), 0.0f, 1.0f);
+    val = g - sigma * 2.0f * (1.0f - t) * t + t * t * (-sigma - sigma * highlights);
+  }
+  return val + clarity * c * expf(-c * c / (2.0 * sigma * sigma / 3.0f));
+}
+
+static void ref_apply_curve(float *const out, const float *const in, const int w, const int h, const int padding,
+                            const float g, const float sigma, const float shadows, const float highlights,
+                            const float clarity)
+{
+  for(int j = padding; j < h - padding; j++)
+  {
+    for(int i = padding; i < w - padding; i++)
+      out[j * w + i] = ref_curve(in[j * w + i], g, sigma, shadows, highlights, clarity);
+    for(int i = 0; i < padding; i++) out[j * w + i] = out[j * w + padding];
+    for(int i = w - padding; i < w; i++) out[j * w + i] = out[j * w + w - padding - 1];
+  }
+  ref_pad_rows(out, w, h, padding);
+}
+
+static void ref_local_laplacian(const float *const input, float *const out, const int wd, const int ht,
+                                const float sigma, const float shadows, const float highlights, const float clarity)
+{
+  const int num_levels = MIN(REF_MAX_LEVELS, 31 - __builtin_clz(MIN(wd, ht)));
+  const int last_level = num_levels - 1;
+  const int max_supp = 1 << last_level;
+  const int w = wd + 2 * max_supp, h = ht + 2 * max_supp;
+
+  float *padded[REF_MAX_LEVELS] = { 0 };
+  float *output[REF_MAX_LEVELS] = { 0 };
+  float *buf[REF_NUM_GAMMA][REF_MAX_LEVELS] = { { 0 } };
+  for(int l = 0; l <= last_level; l++)
+  {
+    padded[l] = dt_alloc_align_float((size_t)ref_dl(w, l) * ref_dl(h, l));
+    output[l] = dt_alloc_align_float((size_t)ref_dl(w, l) * ref_dl(h, l));
+    for(int k = 0; k < REF_NUM_GAMMA; k++) buf[k][l] = dt_alloc_align_float((size_t)ref_dl(w, l) * ref_dl(h, l));
+  }
+
+  for(int j = 0; j < ht; j++)
+  {
+    float *const row = padded[0] + (size_t)(j + max_supp) * w;
+    for(int i = 0; i < max_supp; i++) row[i] = input[4 * (size_t)wd * j] * 0.01f;
+    for(int i = 0; i < wd; i++) row[i + max_supp] = input[4 * ((size_t)wd * j + i)] * 0.01f;
+    for(int i = wd + max_supp; i < w; i++) row[i] = input[4 * ((size_t)j * wd + wd - 1)] * 0.01f;
+  }
+  ref_pad_rows(padded[0], w, h, max_supp);
+
+  for(int l = 1; l < last_level; l++) ref_gauss_reduce(padded[l - 1], padded[l], ref_dl(w, l - 1), ref_dl(h, l - 1));
+  ref_gauss_reduce(padded[last_level - 1], output[last_level], ref_dl(w, last_level - 1), ref_dl(h, last_level - 1));
+
+  float gamma[REF_NUM_GAMMA];
+  for(int k = 0; k < REF_NUM_GAMMA; k++) gamma[k] = (k + .5f) / (float)REF_NUM_GAMMA;
+
+  for(int k = 0; k < REF_NUM_GAMMA; k++)
+  {
+    ref_apply_curve(buf[k][0], padded[0], w, h, max_supp, gamma[k], sigma, shadows, highlights, clarity);
+    for(int l = 1; l <= last_level; l++) ref_gauss_reduce(buf[k][l - 1], buf[k][l], ref_dl(w, l - 1), ref_dl(h, l - 1));
+  }
+
+  for(int l = last_level - 1; l >= 0; l--)
+  {
+    const int pw = ref_dl(w, l), ph = ref_dl(h, l);
+    ref_gauss_expand(output[l + 1], output[l], pw, ph);
+    for(int j = 0; j < ph; j++)
+      for(int i = 0; i < pw; i++)
+      {
+        const float v = padded[l][j * pw + i];
+        int hi = 1;
+        for(; hi < REF_NUM_GAMMA - 1 && gamma[hi] <= v; hi++)
+          ;
+        const int lo = hi - 1;
+        const float a = CLAMPS((v - gamma[lo]) / (gamma[hi] - gamma[lo]), 0.0f, 1.0f);
+        const float l0 = ll_laplacian(buf[lo][l + 1], buf[lo][l], i, j, pw, ph);
+        const float l1 = ll_laplacian(buf[hi][l + 1], buf[hi][l], i, j, pw, ph);
+        output[l][j * pw + i] += l0 * (1.0f - a) + l1 * a;
+      }
+  }
+
+  for(int j = 0; j < ht; j++)
+    for(int i = 0; i < wd; i++)
+    {
+      out[4 * ((size_t)j * wd + i) + 0] = 100.0f * output[0][(size_t)(j + max_supp) * w + max_supp + i];
+      out[4 * ((size_t)j * wd + i) + 1] = input[4 * ((size_t)j * wd + i) + 1];
+      out[4 * ((size_t)j * wd + i) + 2] = input[4 * ((size_t)j * wd + i) + 2];
+    }
+
+  for(int l = 0; l <= last_level; l++)
+  {
+    dt_free_align(padded[l]);
+    dt_free_align(output[l]);
+    for(int k = 0; k < REF_NUM_GAMMA; k++) dt_free_align(buf[k][l]);
+  }
+}
+
+static int setup(void **state)
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+// the fine mode stays where the per-pixel evaluation was: this is the default, so existing edits render the same
+static void test_fine_mode(void **state)
+{
+  const size_t npixels = (size_t)SMALL_WIDTH * SMALL_HEIGHT;
+  float *ref = dt_alloc_align_float(4 * npixels);
+  float *fine = dt_alloc_align_float(4 * npixels);
+
+  for(int img = 0; img < NUM_IMAGES; img++)
+  {
+    float *in = gen_image(SMALL_WIDTH, SMALL_HEIGHT, img);
+    for(int p = 0; p < NUM_PARAMS; p++)
+    {
+      const float *const q = params[p];
+      ref_local_laplacian(in, ref, SMALL_WIDTH, SMALL_HEIGHT, q[0], q[1], q[2], q[3]);
+      local_laplacian(in, fine, SMALL_WIDTH, SMALL_HEIGHT, q[0], q[1], q[2], q[3], FALSE, 0, 0);
+
+      float max_err = 0.0f;
+      for(size_t k = 0; k < npixels; k++)
+      {
+        max_err = MAX(max_err, fabsf(fine[4 * k] - ref[4 * k]));
+        assert_float_equal(fine[4 * k + 1], ref[4 * k + 1], 0.0f);
+        assert_float_equal(fine[4 * k + 2], ref[4 * k + 2], 0.0f);
+      }
+      fprintf(stdout, "[locallaplacian] image %i, params %i: fine mode max deviation from reference %.2e\n",
+              img, p, max_err);
+      assert_true(max_err <= E_FINE);
+    }
+    dt_free_align(in);
+  }
+
+  dt_free_align(fine);
+  dt_free_align(ref);
+}
+
+// the fast mode stays close to the fine one, and both keep the colour
+static void test_fast_mode(void **state)
+{
+  const size_t npixels = (size_t)SMALL_WIDTH * SMALL_HEIGHT;
+  float *fine = dt_alloc_align_float(4 * npixels);
+  float *fast = dt_alloc_align_float(4 * npixels);
+
+  for(int img = 0; img < NUM_IMAGES; img++)
+  {
+    float *in = gen_image(SMALL_WIDTH, SMALL_HEIGHT, img);
+    for(int p = 0; p < NUM_PARAMS; p++)
+    {
+      const float *const q = params[p];
+      local_laplacian(in, fine, SMALL_WIDTH, SMALL_HEIGHT, q[0], q[1], q[2], q[3], FALSE, 0, 0);
+      local_laplacian(in, fast, SMALL_WIDTH, SMALL_HEIGHT, q[0], q[1], q[2], q[3], TRUE, 0, 0);
+
+      float max_err = 0.0f;
+      double sum_err = 0.0, sum_change = 0.0;
+      for(size_t k = 0; k < npixels; k++)
+      {
+        const float err = fabsf(fast[4 * k] - fine[4 * k]);
+        max_err = MAX(max_err, err);
+        sum_err += err;
+        sum_change += fabsf(fine[4 * k] - in[4 * k]);
+        assert_float_equal(fast[4 * k + 1], in[4 * k + 1], 0.0f);
+        assert_float_equal(fast[4 * k + 2], in[4 * k + 2], 0.0f);
+      }
+      fprintf(stdout, "[locallaplacian] image %i, params %i: fast mode max error %.2f, mean error %.3f, "
+                      "mean change %.3f\n",
+              img, p, max_err, sum_err / npixels, sum_change / npixels);
+      assert_true(sum_err / npixels < E_FAST);
+      assert_true(sum_change / npixels > 0.1);
+    }
+    dt_free_align(in);
+  }
+
+  dt_free_align(fast);
+  dt_free_align(fine);
+}
+
+// a cached input pyramid gives the same results as a fresh one, and is replaced when the input changes
+static void test_cache(void **state)
+{
+  const size_t npixels = (size_t)SMALL_WIDTH * SMALL_HEIGHT;
+  float *ref = dt_alloc_align_float(4 * npixels);
+  float *out = dt_alloc_align_float(4 * npixels);
+  local_laplacian_cache_t cache = { 0 };
+
+  for(int img = 0; img < NUM_IMAGES; img++)
+  {
+    float *in = gen_image(SMALL_WIDTH, SMALL_HEIGHT, img);
+    for(int p = 0; p < NUM_PARAMS; p++)
+      for(int fast = FALSE; fast <= TRUE; fast++)
+      {
+        const float *const q = params[p];
+        local_laplacian(in, ref, SMALL_WIDTH, SMALL_HEIGHT, q[0], q[1], q[2], q[3], fast, 0, 0);
+        local_laplacian(in, out, SMALL_WIDTH, SMALL_HEIGHT, q[0], q[1], q[2], q[3], fast, 0, &cache);
+        assert_true(cache.hash != 0);
+        assert_true(cache.num_levels > 0);
+        for(size_t k = 0; k < npixels; k++) assert_float_equal(out[4 * k], ref[4 * k], 0.0f);
+      }
+
+    // a change to a single pixel invalidates the cache
+    const uint64_t hash = cache.hash;
+    in[4 * (SMALL_WIDTH * (SMALL_HEIGHT / 2) + SMALL_WIDTH / 2)] += 10.0f;
+    local_laplacian(in, ref, SMALL_WIDTH, SMALL_HEIGHT, 0.5f, 0.5f, 0.5f, 0.25f, FALSE, 0, 0);
+    local_laplacian(in, out, SMALL_WIDTH, SMALL_HEIGHT, 0.5f, 0.5f, 0.5f, 0.25f, FALSE, 0, &cache);
+    assert_true(cache.hash != hash);
+    for(size_t k = 0; k < npixels; k++) assert_float_equal(out[4 * k], ref[4 * k], 0.0f);
+
+    dt_free_align(in);
+  }
+
+  local_laplacian_cache_free(&cache);
+  assert_true(cache.hash == 0);
+  dt_free_align(out);
+  dt_free_align(ref);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_fine_mode),
+    cmocka_unit_test(test_fast_mode),
+    cmocka_unit_test(test_cache)
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,289 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka tests for the pack files of the thumbnail disk cache (common/mipmap_pack.c):
+ * round-trips with both codecs, replacement, removal, compaction on reopen, and detection
+ * of corrupted records.
+ *
+ * Please see ../README.md for more detailed documentation.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <cmocka.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "../util/assert.h"
+#include "../util/tracing.h"
+
+#include "common/darktable.h"
+#include "common/mipmap_pack.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// number of thumbnails in the pack
+#define N 50
+
+// largest thumbnail
+#define MAX_WIDTH 720
+#define MAX_HEIGHT 450
+#define MAX_SIZE (MAX_WIDTH * MAX_HEIGHT * 4)
+
+/*
+ * HELPERS
+ */
+
+// a picture that depends on the image id and on its generation, smooth enough to be compressible
+static void fill(uint8_t *buf, const int32_t imgid, const int width, const int height, const int generation)
+{
+  for(int i = 0; i < width * height; i++)
+  {
+    const int x = i % width;
+    const int y = i / width;
+    for(int c = 0; c < 3; c++) buf[4 * i + c] = (uint8_t)(3 * x + y + 7 * imgid + 13 * generation + c);
+    buf[4 * i + 3] = 255;
+  }
+}
+
+static int width_of(const int32_t imgid)
+{
+  return MAX_WIDTH - 20 + imgid % 20;
+}
+
+static int height_of(const int32_t imgid)
+{
+  return MAX_HEIGHT - 50 + imgid % 50;
+}
+
+// N thumbnails, alternating codecs and color spaces
+static void write_thumbnails(dt_mipmap_pack_t *pack)
+{
+  uint8_t *in = g_malloc(MAX_SIZE);
+  for(int32_t imgid = 1; imgid <= N; imgid++)
+  {
+    fill(in, imgid, width_of(imgid), height_of(imgid), 0);
+    assert_int_equal(dt_mipmap_pack_write(pack, imgid, 1000 + imgid, in, width_of(imgid), height_of(imgid),
+                                          imgid % 3, imgid % 2 ? DT_MIPMAP_PACK_DEFLATE : DT_MIPMAP_PACK_RAW),
+                     0);
+  }
+  g_free(in);
+}
+
+/*
+ * SETUP AND TEARDOWN
+ */
+
+// every test starts from its own empty pack file
+static int setup(void **state)
+{
+  gchar *path = NULL;
+  const gint fd = g_file_open_tmp("ansel_test_mipmap_pack_XXXXXX.pack", &path, NULL);
+  if(fd < 0) return -1;
+  g_close(fd, NULL);
+  g_unlink(path);
+  *state = path;
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  gchar *path = *state;
+  g_unlink(path);
+  g_free(path);
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_roundtrip(void **state)
+{
+  const gchar *path = *state;
+  uint8_t *in = g_malloc(MAX_SIZE);
+  uint8_t *out = g_malloc(MAX_SIZE);
+  uint32_t width, height;
+  int32_t color_space;
+
+  dt_mipmap_pack_t *pack = dt_mipmap_pack_open(path);
+  assert_non_null(pack);
+  write_thumbnails(pack);
+
+  for(int32_t imgid = 1; imgid <= N; imgid++)
+  {
+    assert_int_equal(dt_mipmap_pack_read(pack, imgid, 1000 + imgid, out, MAX_SIZE, &width, &height, &color_space), 0);
+    assert_int_equal(width, width_of(imgid));
+    assert_int_equal(height, height_of(imgid));
+    assert_int_equal(color_space, imgid % 3);
+    fill(in, imgid, width, height, 0);
+    assert_memory_equal(in, out, (size_t)width * height * 4);
+  }
+
+  // the history hash has to match, unless 0 is asked
+  assert_int_equal(dt_mipmap_pack_read(pack, 5, 999, out, MAX_SIZE, &width, &height, &color_space), 1);
+  assert_int_equal(dt_mipmap_pack_read(pack, 5, 0, out, MAX_SIZE, &width, &height, &color_space), 0);
+  assert_false(dt_mipmap_pack_contains(pack, 5, 999));
+  assert_true(dt_mipmap_pack_contains(pack, 5, 1005));
+  assert_false(dt_mipmap_pack_contains(pack, N + 1, 0));
+
+  // the output buffer has to be large enough
+  assert_int_not_equal(dt_mipmap_pack_read(pack, 5, 0, out, 16, &width, &height, &color_space), 0);
+  assert_int_equal(dt_mipmap_pack_get_garbage(pack), 0);
+
+  dt_mipmap_pack_close(pack);
+  g_free(in);
+  g_free(out);
+}
+
+static void test_replace_and_compact(void **state)
+{
+  const gchar *path = *state;
+  uint8_t *in = g_malloc(MAX_SIZE);
+  uint8_t *out = g_malloc(MAX_SIZE);
+  uint32_t width, height;
+  int32_t color_space;
+
+  dt_mipmap_pack_t *pack = dt_mipmap_pack_open(path);
+  assert_non_null(pack);
+  write_thumbnails(pack);
+
+  // replace even ids by smaller thumbnails, remove multiples of 5
+  for(int32_t imgid = 2; imgid <= N; imgid += 2)
+  {
+    fill(in, imgid, 300, 200, 1);
+    assert_int_equal(dt_mipmap_pack_write(pack, imgid, 2000 + imgid, in, 300, 200, 0, DT_MIPMAP_PACK_DEFLATE), 0);
+  }
+  for(int32_t imgid = 5; imgid <= N; imgid += 5) dt_mipmap_pack_remove(pack, imgid);
+  assert_true(dt_mipmap_pack_get_garbage(pack) > 0);
+
+  assert_int_equal(dt_mipmap_pack_compact(pack), 0);
+  assert_int_equal(dt_mipmap_pack_get_garbage(pack), 0);
+  dt_mipmap_pack_close(pack);
+
+  // a torn record at the end, as left by a crash while writing, is dropped on open
+  FILE *f = g_fopen(path, "ab");
+  assert_non_null(f);
+  fwrite("MREC\x01\x00\x00\x00garbage", 1, 15, f);
+  fclose(f);
+
+  pack = dt_mipmap_pack_open(path);
+  assert_non_null(pack);
+  assert_int_equal(dt_mipmap_pack_get_garbage(pack), 0);
+
+  for(int32_t imgid = 1; imgid <= N; imgid++)
+  {
+    const int res = dt_mipmap_pack_read(pack, imgid, 0, out, MAX_SIZE, &width, &height, &color_space);
+    if(imgid % 5 == 0)
+    {
+      assert_int_equal(res, 1);
+      continue;
+    }
+
+    assert_int_equal(res, 0);
+    if(imgid % 2 == 0)
+    {
+      assert_int_equal(width, 300);
+      assert_int_equal(height, 200);
+      assert_true(dt_mipmap_pack_contains(pack, imgid, 2000 + imgid));
+      fill(in, imgid, 300, 200, 1);
+    }
+    else
+    {
+      assert_int_equal(width, width_of(imgid));
+      assert_int_equal(height, height_of(imgid));
+      fill(in, imgid, width, height, 0);
+    }
+    assert_memory_equal(in, out, (size_t)width * height * 4);
+  }
+
+  dt_mipmap_pack_close(pack);
+  g_free(in);
+  g_free(out);
+}
+
+static void test_corruption(void **state)
+{
+  const gchar *path = *state;
+  uint8_t *out = g_malloc(MAX_SIZE);
+  uint32_t width, height;
+  int32_t color_space;
+
+  dt_mipmap_pack_t *pack = dt_mipmap_pack_open(path);
+  assert_non_null(pack);
+  write_thumbnails(pack);
+  dt_mipmap_pack_close(pack);
+
+  // flip one byte in the payload of the first record, after the file and record headers
+  FILE *f = g_fopen(path, "r+b");
+  assert_non_null(f);
+  fseek(f, 64 + 64 + 100, SEEK_SET);
+  const int c = fgetc(f);
+  fseek(f, 64 + 64 + 100, SEEK_SET);
+  fputc(c ^ 0xff, f);
+  fclose(f);
+
+  pack = dt_mipmap_pack_open(path);
+  assert_non_null(pack);
+  int corrupted = 0;
+  for(int32_t imgid = 1; imgid <= N; imgid++)
+    if(dt_mipmap_pack_read(pack, imgid, 0, out, MAX_SIZE, &width, &height, &color_space) == 2) corrupted++;
+  assert_int_equal(corrupted, 1);
+  dt_mipmap_pack_close(pack);
+
+  // a file of another format or version is started over
+  f = g_fopen(path, "r+b");
+  assert_non_null(f);
+  fputc('X', f);
+  fclose(f);
+
+  pack = dt_mipmap_pack_open(path);
+  assert_non_null(pack);
+  for(int32_t imgid = 1; imgid <= N; imgid++) assert_false(dt_mipmap_pack_contains(pack, imgid, 0));
+  dt_mipmap_pack_close(pack);
+
+  g_free(out);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(test_roundtrip, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_replace_and_compact, setup, teardown),
+    cmocka_unit_test_setup_teardown(test_corruption, setup, teardown)
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
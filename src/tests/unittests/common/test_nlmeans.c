@@ -0,0 +1,200 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the banded backend of common/nlmeans_core.c
+ *
+ * Please see ../README.md for more detailed documentation.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/assert.h"
+#include "../util/tracing.h"
+
+#include "common/darktable.h"
+#include "common/nlmeans_core.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// odd size for the accuracy tests, so that the last bands are partial
+#define SMALL_WIDTH 203
+#define SMALL_HEIGHT 101
+
+// max acceptable deviation from the sliding window, relative to the pixel value. Both sum the same
+// weighted pixels, but in a different order and with the distortions read from an integral image.
+#define E_REFERENCE 1e-3f
+
+// the two ways the iops call the core
+typedef enum test_mode_t
+{
+  MODE_NONLOCAL = 0, // denoise (non-local means): Lab, sharpness, luma/chroma blending
+  MODE_PROFILED = 1  // denoise (profiled): variance-stabilized RGB, center pixel weight
+} test_mode_t;
+
+/*
+ * HELPERS
+ */
+
+// Lab-like values: smooth gradients, edges, and uniform noise
+static float *gen_image(const int width, const int height)
+{
+  float *img = dt_alloc_align_float((size_t)4 * width * height);
+  uint32_t seed = 1;
+  for(int y = 0; y < height; y++)
+    for(int x = 0; x < width; x++)
+      for(int c = 0; c < 4; c++)
+      {
+        seed = seed * 1664525u + 1013904223u;
+        const float noise = ((seed >> 9) / 8388608.f - 0.5f) * 8.f;
+        img[4 * ((size_t)y * width + x) + c] = 50.f + 30.f * sinf(x * 0.05f + c) * cosf(y * 0.03f)
+                                               + (((x / 17 + y / 11) & 1) ? 20.f : 0.f) + noise;
+      }
+  return img;
+}
+
+// parameters as set by the iops, with the sharpness scaled by the patch area so that the weights of the
+// large patches don't all vanish on the test image
+static dt_nlmeans_param_t get_params(const test_mode_t mode, const int P, const int K, const float scattering,
+                                     const int decimate, const float *const norm)
+{
+  const float area = (2 * P + 1) * (2 * P + 1);
+  const dt_nlmeans_param_t params = { .scattering = scattering,
+                                      .scale = 1.0f,
+                                      .luma = mode == MODE_PROFILED ? 1.0f : 0.6f,
+                                      .chroma = mode == MODE_PROFILED ? 1.0f : 0.8f,
+                                      .center_weight = mode == MODE_PROFILED ? 0.1f : -1.0f,
+                                      .sharpness = mode == MODE_PROFILED ? 0.03f / area : 1000.0f / area,
+                                      .patch_radius = P,
+                                      .search_radius = K,
+                                      .decimate = decimate,
+                                      .norm = norm,
+                                      .pipe = NULL };
+  return params;
+}
+
+static void get_norm(const test_mode_t mode, dt_aligned_pixel_t norm)
+{
+  if(mode == MODE_PROFILED)
+  {
+    for_four_channels(c) norm[c] = 1.0f;
+  }
+  else
+  {
+    const float nL = 1.0f / 120.0f, nC = 1.0f / 512.0f;
+    norm[0] = nL * nL;
+    norm[1] = norm[2] = nC * nC;
+    norm[3] = 1.0f;
+  }
+}
+
+static int setup(void **state)
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+// the banded backend gives the results of the sliding window, and does denoise
+static void test_matches_reference(void **state)
+{
+  const size_t npixels = (size_t)SMALL_WIDTH * SMALL_HEIGHT;
+  const dt_iop_roi_t roi = { 0, 0, SMALL_WIDTH, SMALL_HEIGHT, 1.0f };
+  float *in = gen_image(SMALL_WIDTH, SMALL_HEIGHT);
+  float *ref = dt_alloc_align_float(4 * npixels);
+  float *out = dt_alloc_align_float(4 * npixels);
+
+  const int radii[][2] = { { 1, 5 }, { 2, 7 }, { 4, 10 }, { 8, 6 } };
+  for(int mode = MODE_NONLOCAL; mode <= MODE_PROFILED; mode++)
+    for(int r = 0; r < 4; r++)
+      for(int variant = 0; variant < 3; variant++)
+      {
+        // plain, decimated, and slightly scattered patches
+        const int P = radii[r][0];
+        const int K = radii[r][1];
+        const int decimate = variant == 1;
+        const float scattering = variant == 2 ? 0.05f : 0.0f;
+        dt_aligned_pixel_t norm;
+        get_norm(mode, norm);
+        const dt_nlmeans_param_t params = get_params(mode, P, K, scattering, decimate, norm);
+
+        nlmeans_denoise(in, ref, &roi, &roi, &params);
+        nlmeans_denoise_banded(in, out, &roi, &roi, &params);
+
+        float max_err = 0.0f;
+        double sum_err = 0.0, sum_change = 0.0;
+        for(size_t k = 0; k < 4 * npixels; k++)
+        {
+          if((k & 3) == 3) continue;
+          const float err = fabsf(out[k] - ref[k]);
+          assert_true(err <= E_REFERENCE * fmaxf(fabsf(ref[k]), 1.0f));
+          max_err = fmaxf(max_err, err);
+          sum_err += err;
+          sum_change += fabsf(ref[k] - in[k]);
+        }
+        fprintf(stdout, "[nlmeans] mode %i, P %i, K %2i, decimate %i, scattering %.2f: max error %.2e, "
+                        "mean error %.2e, mean change %.2e\n",
+                mode, P, K, decimate, scattering, max_err, sum_err / (3 * npixels), sum_change / (3 * npixels));
+        // the noise is +/- 4
+        assert_true(sum_change / (3 * npixels) > 0.1);
+      }
+
+  dt_free_align(out);
+  dt_free_align(ref);
+  dt_free_align(in);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_matches_reference)
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,45 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * iop/hotpixels.c, built into test_raw_fuse. See raw_fuse_prefix.h.
+ */
+#define RAW_FUSE_STAGE hotpixels
+#include "raw_fuse_prefix.h"
+
+#include "iop/hotpixels.c"
+
+#include "raw_fuse_stages.h"
+
+static void _commit(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece,
+                    const raw_fuse_test_params_t *const params)
+{
+  dt_iop_hotpixels_params_t p = { .strength = params->hot_strength,
+                                  .threshold = params->hot_threshold,
+                                  .markfixed = params->hot_markfixed,
+                                  .permissive = params->hot_permissive };
+  init_pipe(self, pipe, piece);
+  commit_params(self, (dt_iop_params_t *)&p, pipe, piece);
+}
+
+const raw_fuse_test_stage_t raw_fuse_test_hotpixels = { _commit, process, fuse_raw, cleanup_pipe };
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
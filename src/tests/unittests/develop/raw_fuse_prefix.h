@@ -0,0 +1,71 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Prefix the functions a module defines with the name of the module.
+ *
+ * Each module of the fused raw stage is compiled into test_raw_fuse by its own raw_fuse_<module>.c,
+ * which defines RAW_FUSE_STAGE to the name of the module and includes this file before the module:
+ * the 4 modules can then be linked in the same executable, and the kernels they call stay their own.
+ */
+#define RAW_FUSE_PREFIX_(stage, symbol) stage##_##symbol
+#define RAW_FUSE_PREFIX(stage, symbol) RAW_FUSE_PREFIX_(stage, symbol)
+#define dt_module_dt_version RAW_FUSE_PREFIX(RAW_FUSE_STAGE, dt_module_dt_version)
+#define dt_module_mod_version RAW_FUSE_PREFIX(RAW_FUSE_STAGE, dt_module_mod_version)
+#define name RAW_FUSE_PREFIX(RAW_FUSE_STAGE, name)
+#define description RAW_FUSE_PREFIX(RAW_FUSE_STAGE, description)
+#define default_group RAW_FUSE_PREFIX(RAW_FUSE_STAGE, default_group)
+#define flags RAW_FUSE_PREFIX(RAW_FUSE_STAGE, flags)
+#define operation_tags RAW_FUSE_PREFIX(RAW_FUSE_STAGE, operation_tags)
+#define default_colorspace RAW_FUSE_PREFIX(RAW_FUSE_STAGE, default_colorspace)
+#define legacy_params RAW_FUSE_PREFIX(RAW_FUSE_STAGE, legacy_params)
+#define init_presets RAW_FUSE_PREFIX(RAW_FUSE_STAGE, init_presets)
+#define init_global RAW_FUSE_PREFIX(RAW_FUSE_STAGE, init_global)
+#define cleanup_global RAW_FUSE_PREFIX(RAW_FUSE_STAGE, cleanup_global)
+#define reload_defaults RAW_FUSE_PREFIX(RAW_FUSE_STAGE, reload_defaults)
+#define distort_transform RAW_FUSE_PREFIX(RAW_FUSE_STAGE, distort_transform)
+#define distort_backtransform RAW_FUSE_PREFIX(RAW_FUSE_STAGE, distort_backtransform)
+#define distort_mask RAW_FUSE_PREFIX(RAW_FUSE_STAGE, distort_mask)
+#define modify_roi_out RAW_FUSE_PREFIX(RAW_FUSE_STAGE, modify_roi_out)
+#define modify_roi_in RAW_FUSE_PREFIX(RAW_FUSE_STAGE, modify_roi_in)
+#define output_format RAW_FUSE_PREFIX(RAW_FUSE_STAGE, output_format)
+#define tiling_callback RAW_FUSE_PREFIX(RAW_FUSE_STAGE, tiling_callback)
+#define process RAW_FUSE_PREFIX(RAW_FUSE_STAGE, process)
+#define process_cl RAW_FUSE_PREFIX(RAW_FUSE_STAGE, process_cl)
+#define fuse_raw RAW_FUSE_PREFIX(RAW_FUSE_STAGE, fuse_raw)
+#define commit_params RAW_FUSE_PREFIX(RAW_FUSE_STAGE, commit_params)
+#define init_pipe RAW_FUSE_PREFIX(RAW_FUSE_STAGE, init_pipe)
+#define cleanup_pipe RAW_FUSE_PREFIX(RAW_FUSE_STAGE, cleanup_pipe)
+#define gui_init RAW_FUSE_PREFIX(RAW_FUSE_STAGE, gui_init)
+#define gui_cleanup RAW_FUSE_PREFIX(RAW_FUSE_STAGE, gui_cleanup)
+#define gui_update RAW_FUSE_PREFIX(RAW_FUSE_STAGE, gui_update)
+#define gui_changed RAW_FUSE_PREFIX(RAW_FUSE_STAGE, gui_changed)
+#define gui_reset RAW_FUSE_PREFIX(RAW_FUSE_STAGE, gui_reset)
+#define gui_focus RAW_FUSE_PREFIX(RAW_FUSE_STAGE, gui_focus)
+#define color_picker_apply RAW_FUSE_PREFIX(RAW_FUSE_STAGE, color_picker_apply)
+// not part of the API, but not static either
+#define check_gain_maps RAW_FUSE_PREFIX(RAW_FUSE_STAGE, check_gain_maps)
+#define generate_preset_combo RAW_FUSE_PREFIX(RAW_FUSE_STAGE, generate_preset_combo)
+#define color_finetuning_slider RAW_FUSE_PREFIX(RAW_FUSE_STAGE, color_finetuning_slider)
+#define color_rgb_sliders RAW_FUSE_PREFIX(RAW_FUSE_STAGE, color_rgb_sliders)
+#define color_temptint_sliders RAW_FUSE_PREFIX(RAW_FUSE_STAGE, color_temptint_sliders)
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,70 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * The modules of the fused raw stage, built into test_raw_fuse by raw_fuse_<module>.c,
+ * as seen by the test.
+ */
+#pragma once
+
+#include "develop/imageop.h"
+#include "develop/pixelpipe_hb.h"
+#include "develop/raw_fuse.h"
+
+// what the test sets in the params of the modules
+typedef struct raw_fuse_test_params_t
+{
+  // rawprepare
+  int crop_left, crop_top, crop_right, crop_bottom;
+  uint16_t black[4];
+  uint16_t white;
+  // temperature
+  float wb[4];
+  // highlights, in clipping mode
+  float clip;
+  // hotpixels
+  float hot_strength;
+  float hot_threshold;
+  gboolean hot_permissive;
+  gboolean hot_markfixed;
+} raw_fuse_test_params_t;
+
+typedef struct raw_fuse_test_stage_t
+{
+  // init_pipe() and commit_params() with the params of the test
+  void (*commit)(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece,
+                 const raw_fuse_test_params_t *const params);
+  // process()
+  void (*run)(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const void *const input, void *const output,
+              const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out);
+  // fuse_raw()
+  gboolean (*fuse)(dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *const roi_in,
+                   const dt_iop_roi_t *const roi_out, dt_dev_raw_fuse_t *fuse);
+  // cleanup_pipe()
+  void (*release)(dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece);
+} raw_fuse_test_stage_t;
+
+extern const raw_fuse_test_stage_t raw_fuse_test_rawprepare;
+extern const raw_fuse_test_stage_t raw_fuse_test_temperature;
+extern const raw_fuse_test_stage_t raw_fuse_test_highlights;
+extern const raw_fuse_test_stage_t raw_fuse_test_hotpixels;
+
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
@@ -0,0 +1,215 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the shaper and the tetrahedral interpolation of the baked colour LUT
+ * in develop/lut_bake.c
+ *
+ * Please see ../README.md for more detailed documentation.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/assert.h"
+#include "../util/tracing.h"
+
+#include "develop/lut_bake.c"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// number of scene-referred pixels to interpolate
+#define NPIXELS 100000
+
+// max acceptable error on functions the tetrahedral interpolation reproduces exactly
+#define E_EXACT 1e-4f
+
+// max acceptable relative error of the identity: the exponential between 2 nodes, 0.28 EV apart,
+// is approximated by a line
+#define E_IDENTITY 1e-2f
+
+/*
+ * HELPERS
+ */
+
+// maps the RGB of a node of the lattice to the output of the LUT
+typedef void (*lut_function_t)(const float rgb[3], float out[3]);
+
+// sample `function` on the lattice, red varying fastest
+static float *clut_alloc(lut_function_t function)
+{
+  const size_t level = DT_LUT_BAKE_LEVEL;
+  float *clut = dt_alloc_align_float(4 * level * level * level);
+  for(size_t b = 0; b < level; b++)
+    for(size_t g = 0; g < level; g++)
+      for(size_t r = 0; r < level; r++)
+      {
+        const float rgb[3] = { _shaper_inverse((float)r / (float)(level - 1)),
+                               _shaper_inverse((float)g / (float)(level - 1)),
+                               _shaper_inverse((float)b / (float)(level - 1)) };
+        float *const node = clut + 4 * (r + level * (g + level * b));
+        function(rgb, node);
+        node[3] = 0.f;
+      }
+  return clut;
+}
+
+// scene-referred RGB from black to +4 EV above white, and random alpha
+static float *pixels_alloc(void)
+{
+  float *pixels = dt_alloc_align_float((size_t)4 * NPIXELS);
+  uint32_t seed = 7;
+  for(size_t k = 0; k < 4 * NPIXELS; k++)
+  {
+    seed = seed * 1664525u + 1013904223u;
+    const float u = (seed >> 8) / 16777216.f;
+    pixels[k] = (k % 4 == 3) ? u : ((k % 12 == 0) ? 0.f : exp2f(18.f * u - 14.f));
+  }
+  return pixels;
+}
+
+// affine in the shaper space, over the whole input range
+static void shaped_affine(const float rgb[3], float out[3])
+{
+  const float r = _shaper(rgb[0]);
+  const float g = _shaper(rgb[1]);
+  const float b = _shaper(rgb[2]);
+  out[0] = 0.2f + 0.5f * r + 0.1f * g;
+  out[1] = 0.3f * g + 0.6f * b - 0.05f;
+  out[2] = 0.25f * r + 0.5f * g + 0.25f * b;
+}
+
+static void identity(const float rgb[3], float out[3])
+{
+  for(int c = 0; c < 3; c++) out[c] = rgb[c];
+}
+
+static int setup(void **state)
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+// the shaper maps 0 to 0 and the top of the range to 1, and its inverse undoes it
+static void test_shaper(void **state)
+{
+  assert_float_equal(_shaper(0.f), 0.f, 1e-6f);
+  assert_float_equal(_shaper(exp2f(DT_LUT_BAKE_MAX_EV)), 1.f, 1e-5f);
+  assert_float_equal(_shaper(-1.f), 0.f, 1e-6f);
+  assert_float_equal(_shaper(1e6f), 1.f, 1e-6f);
+
+  for(int k = 0; k <= 1000; k++)
+  {
+    const float t = k / 1000.f;
+    const float x = _shaper_inverse(t);
+    assert_float_equal(_shaper(x), t, 1e-5f);
+    if(k) assert_true(x > _shaper_inverse((k - 1) / 1000.f));
+  }
+}
+
+// tetrahedral interpolation is exact on functions affine in the lattice coordinates, alpha goes through
+static void test_affine(void **state)
+{
+  float *clut = clut_alloc(shaped_affine);
+  float *in = pixels_alloc();
+  float *out = dt_alloc_align_float((size_t)4 * NPIXELS);
+
+  _apply_clut(in, out, NPIXELS, clut);
+
+  float max_err = 0.f;
+  for(size_t k = 0; k < NPIXELS; k++)
+  {
+    float expected[3];
+    shaped_affine(in + 4 * k, expected);
+    for(int c = 0; c < 3; c++) max_err = fmaxf(max_err, fabsf(out[4 * k + c] - expected[c]));
+    assert_float_equal(out[4 * k + 3], in[4 * k + 3], 0.f);
+  }
+  fprintf(stdout, "[lut_bake] affine function: max error %.2e\n", max_err);
+  assert_true(max_err < E_EXACT);
+
+  dt_free_align(out);
+  dt_free_align(in);
+  dt_free_align(clut);
+}
+
+// the identity is reproduced within the interpolation error, at any exposure of the range
+static void test_identity(void **state)
+{
+  float *clut = clut_alloc(identity);
+  float *in = pixels_alloc();
+  float *out = dt_alloc_align_float((size_t)4 * NPIXELS);
+
+  _apply_clut(in, out, NPIXELS, clut);
+
+  float max_err = 0.f;
+  for(size_t k = 0; k < NPIXELS; k++)
+    for(int c = 0; c < 3; c++)
+    {
+      const float x = in[4 * k + c];
+      const float err = fabsf(out[4 * k + c] - x) / (x + exp2f(DT_LUT_BAKE_MIN_EV));
+      max_err = fmaxf(max_err, err);
+    }
+  fprintf(stdout, "[lut_bake] identity: max relative error %.2e\n", max_err);
+  assert_true(max_err < E_IDENTITY);
+
+  dt_free_align(out);
+  dt_free_align(in);
+  dt_free_align(clut);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_shaper),
+    cmocka_unit_test(test_affine),
+    cmocka_unit_test(test_identity)
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
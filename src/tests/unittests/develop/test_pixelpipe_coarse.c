@@ -0,0 +1,192 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the isolation of the raster masks and processed ROIs
+ * between the full and the coarse passes of progressive rendering in develop/pixelpipe_hb.c
+ *
+ * Please see ../README.md for more detailed documentation.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <cmocka.h>
+
+#include "../util/assert.h"
+#include "../util/tracing.h"
+
+#include "develop/pixelpipe_hb.c"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// full-resolution size of the input of the distorting module, which halves it
+#define FULL_WIDTH 400
+#define FULL_HEIGHT 300
+
+// downscaling factor of the coarse pass
+#define FACTOR 4
+
+/*
+ * HELPERS
+ */
+
+// source of the raster mask, distorting module, consumer of the raster mask
+static dt_iop_module_t modules[3];
+static dt_dev_pixelpipe_iop_t pieces[3];
+static dt_dev_pixelpipe_t pipe;
+
+static const char *_source_name(void)
+{
+  return "source";
+}
+
+static const char *_distort_name(void)
+{
+  return "distort";
+}
+
+static const char *_consumer_name(void)
+{
+  return "consumer";
+}
+
+// Masks carry the width they were made for in their first pixel, so a mask distorted
+// through the ROIs of the other pass is caught.
+static void _distort_mask(struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const float *const in,
+                          float *const out, const struct dt_iop_roi_t *const roi_in,
+                          const struct dt_iop_roi_t *const roi_out)
+{
+  assert_float_equal(in[0], (float)roi_in->width, 0.f);
+  for(size_t k = 0; k < (size_t)roi_out->width * roi_out->height; k++) out[k] = 0.5f;
+  out[0] = (float)roi_out->width;
+}
+
+// What a pass running the source and the distorting module does to their pieces
+static void _run_source_and_distort(const int factor)
+{
+  const dt_iop_roi_t roi_in = { 0, 0, FULL_WIDTH / factor, FULL_HEIGHT / factor, 1.f / factor };
+  const dt_iop_roi_t roi_out = { 0, 0, FULL_WIDTH / (2 * factor), FULL_HEIGHT / (2 * factor), 0.5f / factor };
+
+  float *mask = dt_alloc_align_float((size_t)roi_in.width * roi_in.height);
+  for(size_t k = 0; k < (size_t)roi_in.width * roi_in.height; k++) mask[k] = 1.f;
+  mask[0] = (float)roi_in.width;
+  g_hash_table_replace(pieces[0].raster_masks, GINT_TO_POINTER(0), mask);
+  pieces[0].processed_roi_in = pieces[0].processed_roi_out = roi_in;
+
+  pieces[1].processed_roi_in = roi_in;
+  pieces[1].processed_roi_out = roi_out;
+}
+
+// Fetch the raster mask the way the consumer does, and return the width it has been distorted to
+static float _consumer_mask_width(void)
+{
+  gboolean free_mask = FALSE;
+  int error = 0;
+  float *mask = dt_dev_get_raster_mask(&pipe, &modules[0], 0, &modules[2], &free_mask, &error);
+  assert_int_equal(error, 0);
+  assert_non_null(mask);
+  const float width = mask[0];
+  if(free_mask) dt_free_align(mask);
+  return width;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static int setup(void **state)
+{
+  memset(modules, 0, sizeof(modules));
+  memset(pieces, 0, sizeof(pieces));
+  memset(&pipe, 0, sizeof(pipe));
+
+  modules[0].name = _source_name;
+  modules[1].name = _distort_name;
+  modules[1].distort_mask = _distort_mask;
+  modules[2].name = _consumer_name;
+  g_strlcpy(modules[1].op, "distort", sizeof(modules[1].op));
+
+  for(int k = 0; k < 3; k++)
+  {
+    pieces[k].module = &modules[k];
+    pieces[k].pipe = &pipe;
+    pieces[k].enabled = TRUE;
+    pieces[k].raster_masks = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, dt_free_align_ptr);
+    pieces[k].coarse_raster_masks = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, dt_free_align_ptr);
+    pipe.nodes = g_list_append(pipe.nodes, &pieces[k]);
+  }
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  for(int k = 0; k < 3; k++)
+  {
+    g_hash_table_destroy(pieces[k].raster_masks);
+    g_hash_table_destroy(pieces[k].coarse_raster_masks);
+  }
+  g_list_free(pipe.nodes);
+  return 0;
+}
+
+// The source and the distorting module are served from the caches on the second run of each pass:
+// the consumer has to find the mask and the ROIs their own pass left, not the ones of the other pass.
+static void test_cached_source_keeps_its_pass_state(void **state)
+{
+  TR_DEBUG("full and coarse passes computing everything");
+  _run_source_and_distort(1);
+  assert_float_equal(_consumer_mask_width(), FULL_WIDTH / 2, 0.f);
+
+  _pixelpipe_swap_coarse_state(&pipe);
+  _run_source_and_distort(FACTOR);
+  assert_float_equal(_consumer_mask_width(), FULL_WIDTH / (2 * FACTOR), 0.f);
+  _pixelpipe_swap_coarse_state(&pipe);
+
+  TR_DEBUG("full and coarse passes with the source and the distorting module cached");
+  for(int run = 0; run < 2; run++)
+  {
+    assert_float_equal(_consumer_mask_width(), FULL_WIDTH / 2, 0.f);
+    assert_int_equal(pieces[1].processed_roi_in.width, FULL_WIDTH);
+
+    _pixelpipe_swap_coarse_state(&pipe);
+    assert_float_equal(_consumer_mask_width(), FULL_WIDTH / (2 * FACTOR), 0.f);
+    assert_int_equal(pieces[1].processed_roi_in.width, FULL_WIDTH / FACTOR);
+    _pixelpipe_swap_coarse_state(&pipe);
+  }
+}
+
+/*
+ * MAIN FUNCTION
+ */
+
+int main(int argc, char *argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test_setup_teardown(test_cached_source_keeps_its_pass_state, setup, teardown),
+  };
+
+  return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,300 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the fused raw stage in develop/raw_fuse.c: its output and its side effects
+ * on the pipe are compared bit for bit with the ones of rawprepare, temperature, highlights and
+ * hotpixels run one after the other, as built from raw_fuse_<module>.c
+ *
+ * Please see ../README.md for more detailed documentation.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <cmocka.h>
+
+#include "../util/assert.h"
+#include "../util/tracing.h"
+
+#include "common/image_cache.h"
+#include "develop/develop.h"
+#include "raw_fuse_stages.h"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// size of the mosaic: odd, not a multiple of 4 nor of the rows per thread job of the fused kernel
+#define WIDTH 131
+#define HEIGHT 101
+
+// one sensel in HOT_PERIOD is hot
+#define HOT_PERIOD 37
+
+#define STAGES 4
+
+static const raw_fuse_test_stage_t *const stages[STAGES]
+    = { &raw_fuse_test_rawprepare, &raw_fuse_test_temperature, &raw_fuse_test_highlights,
+        &raw_fuse_test_hotpixels };
+
+static const uint8_t xtrans[6][6] = { { 1, 1, 0, 1, 1, 2 }, { 1, 1, 2, 1, 1, 0 }, { 2, 0, 1, 0, 2, 1 },
+                                      { 1, 1, 2, 1, 1, 0 }, { 1, 1, 0, 1, 1, 2 }, { 0, 2, 1, 2, 0, 1 } };
+
+static dt_dev_pixelpipe_t pipe;
+static dt_develop_t dev;
+static dt_iop_module_t modules[STAGES];
+static dt_dev_pixelpipe_iop_t pieces[STAGES];
+
+/*
+ * MOCKED FUNCTIONS
+ */
+
+// rawprepare records its crop in the image: keep it unchanged so it doesn't raise a signal
+static dt_image_t cached_image;
+
+dt_image_t *__wrap_dt_image_cache_get(dt_image_cache_t *cache, const int32_t imgid, char mode)
+{
+  return &cached_image;
+}
+
+void __wrap_dt_image_cache_read_release(dt_image_cache_t *cache, const dt_image_t *img)
+{
+}
+
+void __wrap_dt_image_cache_write_release(dt_image_cache_t *cache, dt_image_t *img, dt_image_cache_write_mode_t mode)
+{
+}
+
+/*
+ * HELPERS
+ */
+
+// dark raw values around the black level, with hot sensels and a band of blown highlights
+static void *mosaic_alloc(const gboolean is_float, const raw_fuse_test_params_t *const params)
+{
+  void *mosaic = is_float ? (void *)dt_alloc_align_float((size_t)WIDTH * HEIGHT)
+                          : dt_alloc_align(sizeof(uint16_t) * WIDTH * HEIGHT);
+  const float range = params->white - params->black[0];
+  uint32_t seed = 0x2545F491;
+  for(size_t k = 0; k < (size_t)WIDTH * HEIGHT; k++)
+  {
+    seed = seed * 1664525u + 1013904223u;
+    const size_t row = k / WIDTH;
+    float value = params->black[0] - 64 + (float)(seed >> 8) / (float)(1 << 24) * (0.1f * range + 64);
+    if(k % HOT_PERIOD == 0) value = params->white;
+    if(row >= HEIGHT / 2 && row < HEIGHT / 2 + 8) value = params->white + (seed >> 28);
+    if(is_float)
+      ((float *)mosaic)[k] = value;
+    else
+      ((uint16_t *)mosaic)[k] = (uint16_t)CLAMP(value, 0.f, 65535.f);
+  }
+  return mosaic;
+}
+
+static void pipe_init(const uint32_t filters, const gboolean is_float, const raw_fuse_test_params_t *const params)
+{
+  memset(&pipe, 0, sizeof(pipe));
+  memset(&dev, 0, sizeof(dev));
+  memset(modules, 0, sizeof(modules));
+  memset(pieces, 0, sizeof(pieces));
+
+  pipe.type = DT_DEV_PIXELPIPE_FULL;
+  pipe.devid = -1;
+  pipe.iscale = 1.0f;
+  pipe.image.flags = DT_IMAGE_RAW | (is_float ? DT_IMAGE_HDR : 0);
+  pipe.image.raw_white_point = params->white;
+  pipe.image.buf_dsc.channels = 1;
+  pipe.image.buf_dsc.datatype = is_float ? TYPE_FLOAT : TYPE_UINT16;
+  pipe.image.buf_dsc.filters = filters;
+  memcpy(pipe.image.buf_dsc.xtrans, xtrans, sizeof(xtrans));
+  for(int k = 0; k < 4; k++) pipe.image.buf_dsc.processed_maximum[k] = 1.0f;
+  pipe.dsc = pipe.image.buf_dsc;
+  dev.image_storage = pipe.image;
+
+  cached_image.width = WIDTH;
+  cached_image.height = HEIGHT;
+  cached_image.p_width = WIDTH - params->crop_left - params->crop_right;
+  cached_image.p_height = HEIGHT - params->crop_top - params->crop_bottom;
+
+  for(int k = 0; k < STAGES; k++)
+  {
+    modules[k].dev = &dev;
+    pieces[k].module = &modules[k];
+    pieces[k].pipe = &pipe;
+    pieces[k].enabled = TRUE;
+    pieces[k].iscale = 1.0f;
+    pieces[k].colors = 1;
+    stages[k]->commit(&modules[k], &pipe, &pieces[k], params);
+    assert_true(pieces[k].enabled);
+  }
+}
+
+static void pipe_cleanup(void)
+{
+  for(int k = 0; k < STAGES; k++) stages[k]->release(&modules[k], &pipe, &pieces[k]);
+}
+
+// run the first `count` modules one after the other, as the pipe does when they are not fused
+static void run_modules(const int count, const void *const input, float *const output,
+                        const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  pipe.dsc = pipe.image.buf_dsc;
+  float *buf[2] = { dt_alloc_align_float((size_t)roi_out->width * roi_out->height),
+                    dt_alloc_align_float((size_t)roi_out->width * roi_out->height) };
+
+  const void *in = input;
+  for(int k = 0; k < count; k++)
+  {
+    pieces[k].dsc_in = pipe.dsc;
+    stages[k]->run(&modules[k], &pieces[k], in, buf[k & 1], k == 0 ? roi_in : roi_out, roi_out);
+    pipe.dsc.datatype = TYPE_FLOAT;
+    in = buf[k & 1];
+  }
+
+  memcpy(output, in, sizeof(float) * roi_out->width * roi_out->height);
+  dt_free_align(buf[0]);
+  dt_free_align(buf[1]);
+}
+
+// run the first `count` modules as a single pass, as the pipe does when they are fused
+static void run_fused(const int count, const void *const input, float *const output,
+                      const dt_iop_roi_t *const roi_in, const dt_iop_roi_t *const roi_out)
+{
+  pipe.dsc = pipe.image.buf_dsc;
+  dt_dev_raw_fuse_t fuse = { 0 };
+
+  for(int k = 0; k < count; k++)
+  {
+    pieces[k].dsc_in = pipe.dsc;
+    assert_true(stages[k]->fuse(&modules[k], &pieces[k], k == 0 ? roi_in : roi_out, roi_out, &fuse));
+    pipe.dsc.datatype = TYPE_FLOAT;
+  }
+
+  assert_int_equal(dt_dev_raw_fuse_process(&pipe, &fuse, input, output, roi_in, roi_out), 0);
+}
+
+static void check_fused_matches_modules(const uint32_t filters, const gboolean is_float,
+                                        const raw_fuse_test_params_t *const params)
+{
+  pipe_init(filters, is_float, params);
+  void *mosaic = mosaic_alloc(is_float, params);
+
+  const dt_iop_roi_t roi_in = { 0, 0, WIDTH, HEIGHT, 1.0f };
+  const dt_iop_roi_t roi_out = { 0, 0, WIDTH - params->crop_left - params->crop_right,
+                                 HEIGHT - params->crop_top - params->crop_bottom, 1.0f };
+  const size_t size = (size_t)roi_out.width * roi_out.height;
+  float *expected[2] = { dt_alloc_align_float(size), dt_alloc_align_float(size) };
+  float *fused = dt_alloc_align_float(size);
+
+  // without hotpixels, the fused kernel takes a path of its own
+  for(int count = STAGES - 1; count <= STAGES; count++)
+  {
+    TR_DEBUG("%i modules", count);
+    float *const reference = expected[count - STAGES + 1];
+    run_modules(count, mosaic, reference, &roi_in, &roi_out);
+    const dt_iop_buffer_dsc_t dsc = pipe.dsc;
+
+    run_fused(count, mosaic, fused, &roi_in, &roi_out);
+
+    assert_memory_equal(fused, reference, sizeof(float) * size);
+    assert_int_equal(pipe.dsc.filters, dsc.filters);
+    assert_memory_equal(pipe.dsc.xtrans, dsc.xtrans, sizeof(dsc.xtrans));
+    assert_memory_equal(pipe.dsc.processed_maximum, dsc.processed_maximum, sizeof(dsc.processed_maximum));
+  }
+
+  // the mosaic has to go through the clipping and the hot pixels, not around them
+  float clip = 0.0f;
+  for(size_t k = 0; k < size; k++) clip = MAX(clip, expected[0][k]);
+  size_t clipped = 0, fixed = 0;
+  for(size_t k = 0; k < size; k++)
+  {
+    if(expected[0][k] == clip) clipped++;
+    if(expected[0][k] != expected[1][k]) fixed++;
+  }
+  TR_DEBUG("%zu clipped, %zu fixed sensels", clipped, fixed);
+  assert_true(clipped >= (size_t)8 * roi_out.width);
+  assert_true(fixed > 0);
+
+  dt_free_align(expected[0]);
+  dt_free_align(expected[1]);
+  dt_free_align(fused);
+  dt_free_align(mosaic);
+  pipe_cleanup();
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static int setup(void **state)
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  return 0;
+}
+
+// uint16 Bayer mosaic, with a crop shifting the CFA and the black level pattern
+static void test_bayer(void **state)
+{
+  const raw_fuse_test_params_t params = { .crop_left = 1, .crop_top = 1, .crop_right = 2, .crop_bottom = 1,
+                                          .black = { 510, 512, 514, 517 }, .white = 16383,
+                                          .wb = { 2.07f, 1.0f, 1.53f, 1.0f }, .clip = 0.93f,
+                                          .hot_strength = 0.5f, .hot_threshold = 0.05f,
+                                          .hot_permissive = FALSE, .hot_markfixed = TRUE };
+  check_fused_matches_modules(0x94949494u, FALSE, &params);
+}
+
+// float X-Trans mosaic, with a crop shifting the CFA by less than its period
+static void test_xtrans(void **state)
+{
+  const raw_fuse_test_params_t params = { .crop_left = 2, .crop_top = 3, .crop_right = 1, .crop_bottom = 2,
+                                          .black = { 1022, 1024, 1023, 1025 }, .white = 15871,
+                                          .wb = { 1.81f, 1.0f, 1.39f, 1.0f }, .clip = 0.97f,
+                                          .hot_strength = 0.6f, .hot_threshold = 0.1f,
+                                          .hot_permissive = TRUE, .hot_markfixed = TRUE };
+  check_fused_matches_modules(9u, TRUE, &params);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+
+int main(int argc, char *argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_bayer),
+    cmocka_unit_test(test_xtrans),
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
@@ -0,0 +1,165 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the tile sizes of the CPU demosaicing kernels of the module iop/demosaic.c:
+ * the output of RCD, LMMSE and Markesteijn doesn't depend on them.
+ *
+ * Please see README.md for more detailed documentation.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/assert.h"
+#include "../util/tracing.h"
+
+#include "iop/demosaic.c"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// not a multiple of any tile size, so the last tiles of each row and column are partial
+#define WIDTH 610
+#define HEIGHT 418
+
+/*
+ * HELPERS
+ */
+
+typedef struct fixture_t
+{
+  float *bayer;
+  float *xtrans;
+  float *gamma_in;
+  float *gamma_out;
+  dt_dev_pixelpipe_t *pipe;
+} fixture_t;
+
+// demosaic the synthetic raw of the tile size benchmark with tiles of `size` px
+static float *demosaic(fixture_t *f, const dt_iop_demosaic_tiled_t algo, const int size)
+{
+  float *out = dt_alloc_align_float((size_t)4 * WIDTH * HEIGHT);
+  memset(out, 0, sizeof(float) * 4 * WIDTH * HEIGHT);
+  dt_dev_pixelpipe_iop_t piece = { .pipe = f->pipe };
+  dt_iop_roi_t roi = { .x = 0, .y = 0, .width = WIDTH, .height = HEIGHT, .scale = 1.0f };
+  _tilesize_run(algo, size, &piece, out, f->bayer, f->xtrans, &roi, f->gamma_in, f->gamma_out);
+  return out;
+}
+
+// every candidate size of the benchmark against the compiled-in one
+static void check_sizes(fixture_t *f, const dt_iop_demosaic_tiled_t algo)
+{
+  float *ref = demosaic(f, algo, _tilesizes[algo].fallback);
+  int checked = 0;
+  for(const int *size = _tilesizes[algo].candidates; *size; size++)
+  {
+    if(*size == _tilesizes[algo].fallback) continue;
+    assert_true(_tilesize_valid(algo, *size));
+    float *out = demosaic(f, algo, *size);
+    TR_DEBUG("%s: tiles of %i px against %i px", _tilesizes[algo].name, *size, _tilesizes[algo].fallback);
+    assert_memory_equal(out, ref, sizeof(float) * 4 * WIDTH * HEIGHT);
+    dt_free_align(out);
+    checked++;
+  }
+  assert_true(checked >= 2);
+  dt_free_align(ref);
+}
+
+static int setup(void **state)
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+  fixture_t *f = calloc(1, sizeof(fixture_t));
+  f->bayer = dt_alloc_align_float((size_t)WIDTH * HEIGHT);
+  f->xtrans = dt_alloc_align_float((size_t)WIDTH * HEIGHT);
+  f->gamma_in = dt_alloc_align_float(65536);
+  f->gamma_out = dt_alloc_align_float(65536);
+  f->pipe = calloc(1, sizeof(dt_dev_pixelpipe_t));
+  if(!f->bayer || !f->xtrans || !f->gamma_in || !f->gamma_out || !f->pipe) return -1;
+
+  _tilesize_bench_raw(f->bayer, WIDTH, HEIGHT);
+  memcpy(f->xtrans, f->bayer, sizeof(float) * WIDTH * HEIGHT);
+  lmmse_gamma_tables(f->gamma_in, f->gamma_out);
+  for(int c = 0; c < 3; c++) f->pipe->dsc.processed_maximum[c] = 1.0f;
+  *state = f;
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  fixture_t *f = (fixture_t *)*state;
+  free(f->pipe);
+  dt_free_align(f->gamma_out);
+  dt_free_align(f->gamma_in);
+  dt_free_align(f->xtrans);
+  dt_free_align(f->bayer);
+  free(f);
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+static void test_rcd(void **state)
+{
+  check_sizes((fixture_t *)*state, DEMOSAIC_TILED_RCD);
+}
+
+static void test_lmmse(void **state)
+{
+  check_sizes((fixture_t *)*state, DEMOSAIC_TILED_LMMSE);
+}
+
+static void test_markesteijn(void **state)
+{
+  check_sizes((fixture_t *)*state, DEMOSAIC_TILED_MARKESTEIJN);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_rcd),
+    cmocka_unit_test(test_lmmse),
+    cmocka_unit_test(test_markesteijn)
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
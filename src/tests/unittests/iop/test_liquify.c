@@ -0,0 +1,270 @@
+/*
+    This file is part of Ansel,
+    Copyright (C) 2024 Ansel developers.
+
+    Ansel is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ansel is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ansel.  If not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * cmocka unit tests for the distortion map of the module iop/liquify.c
+ *
+ * Please see ../README.md for more detailed documentation.
+ */
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <cmocka.h>
+
+#include "../util/assert.h"
+#include "../util/tracing.h"
+
+#include "iop/liquify.c"
+
+#ifdef _WIN32
+#include "win/main_wrapper.h"
+#endif
+
+/*
+ * DEFINITIONS
+ */
+
+// number of warps
+#define WARPS 200
+
+// size of the image for the accuracy tests
+#define SMALL_WIDTH 1500
+#define SMALL_HEIGHT 1000
+
+// max acceptable deviation from the stamps applied one after another, in pixels
+#define E 1e-4f
+
+/*
+ * HELPERS
+ */
+
+// linear and radial warps of various radii, strengths and controls, some of them interpolated
+static GList *gen_warps(const int n, const int width, const int height)
+{
+  GList *warps = NULL;
+  uint32_t seed = 7;
+  for(int k = 0; k < n; k++)
+  {
+    float r[5];
+    for(int i = 0; i < 5; i++)
+    {
+      seed = seed * 1664525u + 1013904223u;
+      r[i] = (seed >> 8) / 16777216.f;
+    }
+    dt_liquify_warp_t *w = malloc(sizeof(dt_liquify_warp_t));
+    const float complex point = r[0] * width + r[1] * height * I;
+    const float radius = 20.0f + 130.0f * r[2];
+    w->point = point;
+    w->radius = point + radius;
+    w->strength = point + (r[3] - 0.5f) * radius + (r[4] - 0.5f) * radius * I;
+    w->control1 = k % 3 ? 0.5f : r[3];
+    w->control2 = k % 3 ? 0.75f : r[4];
+    w->type = k % 5 == 0 ? DT_LIQUIFY_WARP_TYPE_RADIAL_GROW
+            : k % 7 == 0 ? DT_LIQUIFY_WARP_TYPE_RADIAL_SHRINK
+                         : DT_LIQUIFY_WARP_TYPE_LINEAR;
+    w->status = k % 2 ? DT_LIQUIFY_STATUS_INTERPOLATED : DT_LIQUIFY_STATUS_NONE;
+    warps = g_list_prepend(warps, w);
+  }
+  return g_list_reverse(warps);
+}
+
+static void move_warp(dt_liquify_warp_t *w, const float complex offset)
+{
+  w->point += offset;
+  w->strength += offset;
+  w->radius += offset;
+}
+
+// the stamps of the warps applied one after another to the whole map, as the module did before the
+// stamps were added by tiles, as a reference
+static float complex *reference_map(const cairo_rectangle_int_t *map_extent, const GSList *interpolated)
+{
+  const size_t mapsize = (size_t)map_extent->width * map_extent->height;
+  float complex *map = dt_alloc_align(sizeof(float complex) * mapsize);
+  memset(map, 0, sizeof(float complex) * mapsize);
+
+  for(const GSList *i = interpolated; i; i = g_slist_next(i))
+  {
+    const dt_liquify_warp_t *warp = (const dt_liquify_warp_t *)i->data;
+    const int iradius = round(cabsf(warp->radius - warp->point));
+    const int width = 2 * iradius + 1;
+    float complex strength = 0.5f * (warp->strength - warp->point);
+    strength = (warp->status & DT_LIQUIFY_STATUS_INTERPOLATED) ? (strength * STAMP_RELOCATION) : strength;
+    const float abs_strength = cabsf(strength);
+
+    float complex *stamp = calloc(sizeof(float complex), (size_t)width * width);
+    const int table_size = iradius * LOOKUP_OVERSAMPLE;
+    float *lookup_table = build_lookup_table(table_size, warp->control1, warp->control2);
+    float complex *const center = stamp + 2 * iradius * iradius + 2 * iradius;
+
+    for(int y = 0; y <= iradius; y++)
+      for(int x = 0; x <= iradius; x++)
+      {
+        const int idist = round(sqrtf(x * x + y * y) * LOOKUP_OVERSAMPLE);
+        if(idist >= table_size) break;
+        float complex *const q1 = center - y * width + x;
+        float complex *const q2 = center - y * width - x;
+        float complex *const q3 = center + y * width - x;
+        float complex *const q4 = center + y * width + x;
+        const float abs_lookup = abs_strength * lookup_table[idist] / iradius;
+        switch(warp->type)
+        {
+          case DT_LIQUIFY_WARP_TYPE_RADIAL_GROW:
+            *q1 = abs_lookup * (x - y * I);
+            *q2 = abs_lookup * (-x - y * I);
+            *q3 = abs_lookup * (-x + y * I);
+            *q4 = abs_lookup * (x + y * I);
+            break;
+          case DT_LIQUIFY_WARP_TYPE_RADIAL_SHRINK:
+            *q1 = -abs_lookup * (x - y * I);
+            *q2 = -abs_lookup * (-x - y * I);
+            *q3 = -abs_lookup * (-x + y * I);
+            *q4 = -abs_lookup * (x + y * I);
+            break;
+          default:
+            *q1 = *q2 = *q3 = *q4 = strength * lookup_table[idist];
+            break;
+        }
+      }
+
+    const int x0 = (int)round(crealf(warp->point)) - iradius;
+    const int y0 = (int)round(cimagf(warp->point)) - iradius;
+    for(int y = MAX(y0, map_extent->y); y < MIN(y0 + width, map_extent->y + map_extent->height); y++)
+      for(int x = MAX(x0, map_extent->x); x < MIN(x0 + width, map_extent->x + map_extent->width); x++)
+        map[(size_t)(y - map_extent->y) * map_extent->width + x - map_extent->x]
+            -= stamp[(size_t)(y - y0) * width + x - x0];
+
+    dt_free_align(lookup_table);
+    free(stamp);
+  }
+  return map;
+}
+
+static float max_difference(const float complex *const a, const float complex *const b, const size_t n)
+{
+  float diff = 0.0f;
+  for(size_t k = 0; k < n; k++) diff = MAX(diff, cabsf(a[k] - b[k]));
+  return diff;
+}
+
+static int setup(void **state)
+{
+#ifdef _OPENMP
+  darktable.num_openmp_threads = omp_get_num_procs();
+#else
+  darktable.num_openmp_threads = 1;
+#endif
+  return 0;
+}
+
+static int teardown(void **state)
+{
+  return 0;
+}
+
+/*
+ * TEST FUNCTIONS
+ */
+
+// the stamps added by tiles give the same map as the stamps applied one after another
+static void test_matches_reference(void **state)
+{
+  GList *warps = gen_warps(WARPS, SMALL_WIDTH, SMALL_HEIGHT);
+  const dt_iop_roi_t roi = { 0, 0, SMALL_WIDTH, SMALL_HEIGHT, 1.0f };
+  cairo_rectangle_int_t extent;
+  GSList *in_roi = _get_map_extent(&roi, warps, &extent);
+  const size_t mapsize = (size_t)extent.width * extent.height;
+
+  float complex *ref = reference_map(&extent, in_roi);
+  float complex *map = create_global_distortion_map(&extent, in_roi, FALSE, NULL);
+  assert_non_null(map);
+  const float diff = max_difference(map, ref, mapsize);
+  fprintf(stdout, "[liquify] %i warps: max deviation from the reference %.2e px\n", WARPS, diff);
+  assert_true(diff < E);
+
+  dt_free_align(map);
+  dt_free_align(ref);
+  g_slist_free(in_roi);
+  g_list_free_full(warps, free);
+}
+
+// updating the map of the cache gives the same map as building it from scratch
+static void test_incremental(void **state)
+{
+  GList *warps = gen_warps(WARPS, SMALL_WIDTH, SMALL_HEIGHT);
+  const dt_iop_roi_t roi = { 0, 0, SMALL_WIDTH, SMALL_HEIGHT, 1.0f };
+  dt_liquify_cache_t cache = { 0 };
+
+  for(int step = 0; step < 4; step++)
+  {
+    if(step == 1)
+      // move a warp inside the map
+      move_warp(g_list_nth_data(warps, WARPS / 2), 7.3f + 3.1f * I);
+    else if(step == 2)
+    {
+      // move the leftmost warp further left, which grows the map
+      dt_liquify_warp_t *leftmost = warps->data;
+      for(const GList *l = warps; l; l = g_list_next(l))
+        if(crealf(((dt_liquify_warp_t *)l->data)->point) < crealf(leftmost->point)) leftmost = l->data;
+      move_warp(leftmost, -40.0f);
+    }
+    else if(step == 3)
+    {
+      // delete a warp
+      GList *deleted = g_list_nth(warps, 2);
+      free(deleted->data);
+      warps = g_list_delete_link(warps, deleted);
+    }
+
+    cairo_rectangle_int_t extent;
+    GSList *in_roi = _get_map_extent(&roi, warps, &extent);
+    assert_true(update_global_distortion_map(&cache, &extent, in_roi, NULL));
+    float complex *map = create_global_distortion_map(&extent, in_roi, FALSE, NULL);
+    assert_int_equal(memcmp(cache.map, map, sizeof(float complex) * extent.width * extent.height), 0);
+    assert_int_equal(cache.num_stamps, g_slist_length(in_roi));
+
+    dt_free_align(map);
+    g_slist_free(in_roi);
+  }
+
+  cache_cleanup(&cache);
+  assert_null(cache.map);
+  g_list_free_full(warps, free);
+}
+
+/*
+ * MAIN FUNCTION
+ */
+int main(int argc, char* argv[])
+{
+  const struct CMUnitTest tests[] = {
+    cmocka_unit_test(test_matches_reference),
+    cmocka_unit_test(test_incremental)
+  };
+
+  return cmocka_run_group_tests(tests, setup, teardown);
+}
+// clang-format off
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.py
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-spaces modified;
+// clang-format on
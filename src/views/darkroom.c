@@ -360,6 +360,10 @@ void expose(
   cairo_set_source_rgb(cr, bg_color[0], bg_color[1], bg_color[2]);
   cairo_paint(cr);
 
+  // The main pipe backbuffer is either the full pass, or the downscaled coarse pass
+  // of progressive rendering that we upscale while the full pass is running.
+  const float backbuf_upscale = (float)dev->pipe->backbuf_factor;
+
   if(dev->pipe->output_backbuf && // do we have an image?
     dev->pipe->output_imgid == dev->image_storage.id && // is the right image?
     dev->pipe->backbuf_scale == backbuf_scale && // is this the zoom scale we want to display?
@@ -372,8 +376,8 @@ void expose(
     float ht = dev->pipe->output_backbuf_height;
     stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, wd);
     surface = dt_cairo_image_surface_create_for_data(dev->pipe->output_backbuf, CAIRO_FORMAT_RGB24, wd, ht, stride);
-    wd /= darktable.gui->ppd;
-    ht /= darktable.gui->ppd;
+    wd *= backbuf_upscale / darktable.gui->ppd;
+    ht *= backbuf_upscale / darktable.gui->ppd;
 
     cairo_translate(cr, ceilf(.5f * (width - wd)), ceilf(.5f * (height - ht)));
     if(closeup)
@@ -392,6 +396,7 @@ void expose(
     }
 
     cairo_rectangle(cr, 0, 0, wd, ht);
+    if(backbuf_upscale != 1.f) cairo_scale(cr, backbuf_upscale, backbuf_upscale);
     cairo_set_source_surface(cr, surface, 0, 0);
     cairo_pattern_set_filter(cairo_get_source(cr), _get_filtering_level(dev, zoom, closeup));
     cairo_paint(cr);
@@ -2014,8 +2019,8 @@ void leave(dt_view_t *self)
 
   // Send all pipeline shutdown signals first
   dev->exit = 1;
-  dt_atomic_set_int(&dev->pipe->shutdown, TRUE);
-  dt_atomic_set_int(&dev->preview_pipe->shutdown, TRUE);
+  dt_dev_pixelpipe_cancel(dev->pipe);
+  dt_dev_pixelpipe_cancel(dev->preview_pipe);
 
   // While we wait for possible pipelines to finish,
   // do the GUI cleaning.